@@ -0,0 +1,76 @@
+classdef FrameIterator < handle
+  % FRAMEITERATOR Sequential pass over a range of frames, one chunk at a time
+  %   Created by h265.Reader.frames_iterator.  Each call to next() returns
+  %   the next chunk_frame_count frames (fewer for the last chunk), decoded
+  %   forward from where the previous chunk stopped, so a pass over the
+  %   whole range seeks once and holds only one chunk of frames.
+  %
+  %   Example:
+  %       vid = h265.Reader('movie.mp4');
+  %       iterator = vid.frames_iterator(1, vid.num_frames, 256);
+  %       while iterator.has_next()
+  %         [frames, first_frame_index] = iterator.next();
+  %       end
+
+  properties (SetAccess = private)
+    start_frame  % first frame of the range, 1-based
+    end_frame  % last frame of the range, 1-based
+    chunk_frame_count  % frames per chunk
+    next_frame  % first frame of the chunk next() returns
+  end
+
+  properties (Access = private)
+    reader  % the h265.Reader read from
+  end
+
+  methods
+    function obj = FrameIterator(reader, start_frame, end_frame, chunk_frame_count)
+      % FRAMEITERATOR Iterate over frames start_frame to end_frame of reader
+      %   iterator = h265.FrameIterator(reader, start_frame, end_frame, chunk_frame_count)
+      %
+      %   Use reader.frames_iterator instead of calling this directly.
+
+      is_range_valid = isscalar(start_frame) && isscalar(end_frame) && ...
+        start_frame == round(start_frame) && end_frame == round(end_frame) && ...
+        start_frame >= 1 && end_frame <= reader.num_frames && start_frame <= end_frame;
+      if ~is_range_valid
+        error('FrameIterator:badRange', 'Frame range must be integers with 1 <= start_frame <= end_frame <= %d', ...
+          reader.num_frames);
+      end
+      if ~isscalar(chunk_frame_count) || chunk_frame_count < 1 || chunk_frame_count ~= round(chunk_frame_count)
+        error('FrameIterator:badChunkSize', 'chunk_frame_count must be a positive integer');
+      end
+      obj.reader = reader;
+      obj.start_frame = double(start_frame);
+      obj.end_frame = double(end_frame);
+      obj.chunk_frame_count = double(chunk_frame_count);
+      obj.next_frame = obj.start_frame;
+    end
+
+    function result = has_next(obj)
+      % HAS_NEXT True while there are frames left in the range
+      result = obj.next_frame <= obj.end_frame;
+    end
+
+    function [frames, first_frame_index] = next(obj)
+      % NEXT Read the next chunk
+      %   [frames, first_frame_index] = iterator.next()
+      %
+      %   frames is height x width x n (or height x width x 3 x n for RGB),
+      %   and frame k of it is frame first_frame_index + k - 1 of the video.
+
+      if ~obj.has_next()
+        error('FrameIterator:done', 'No frames left: the iterator reached frame %d', obj.end_frame);
+      end
+      first_frame_index = obj.next_frame;
+      frame_count = min(obj.chunk_frame_count, obj.end_frame - first_frame_index + 1);
+      frames = obj.reader.read_chunk(first_frame_index, frame_count);
+      obj.next_frame = first_frame_index + frame_count;
+    end
+
+    function reset(obj)
+      % RESET Start over at start_frame
+      obj.next_frame = obj.start_frame;
+    end
+  end % methods
+end % classdef
@@ -6,22 +6,68 @@ classdef Reader < handle
   %       vid = h265.Reader('movie.mp4');
   %       frame = vid.read(1);
   %       frames = vid.read(1, 100);  % batch read
+  %       frames = vid.read_frames(1:10:vid.num_frames);  % every 10th frame
   %       % vid closes automatically when it goes out of scope
   %
   %   Example (grayscale):
   %       vid = h265.Reader('gray_movie.mp4', 'is_gray', true);
+  %
+  %   Example (256x256 views of the left half of each frame):
+  %       vid = h265.Reader('movie.mp4', 'crop_rect', [1 1 960 1080], 'output_size', [256 256]);
+  %
+  %   Example (multithreaded decoding, one thread per core):
+  %       vid = h265.Reader('movie.mp4', 'thread_count', 0);
+  %
+  %   Example (decode on the GPU if there is one, else in software):
+  %       vid = h265.Reader('movie.mp4', 'hwaccel', 'auto');
+  %
+  %   Example (file on NFS/Lustre: 4 MiB reads through a shared block cache):
+  %       vid = h265.Reader('/nfs/movie.mp4', 'io_mode', 'cached', 'io_block_kb', 4096);
+  %
+  %   Example (many Readers of one file, e.g. one per parfor iteration):
+  %       vid = h265.Reader('movie.mp4', 'do_share', true);  % index built once per process
+  %
+  %   Example (whole GOPs, indexed directly):
+  %       [frames, first_frame_index] = vid.read_gop(vid.gop_for_frame(500));
+  %
+  %   Example (a full pass in constant memory, 256 frames at a time):
+  %       iterator = vid.frames_iterator(1, vid.num_frames, 256);
+  %       while iterator.has_next()
+  %         frames = iterator.next();
+  %       end
+  %
+  %   Example (where the time of a read goes):
+  %       vid = h265.Reader('movie.mp4', 'do_collect_stats', true);
+  %       frames = vid.read(1, 100);
+  %       stats = vid.stats();  % seeks, decode and conversion times, cache hits, ...
 
   properties (SetAccess = private)
     filename
     num_frames
-    width
-    height
+    width  % width of the video in the file (see output_size for the frames returned)
+    height  % height of the video in the file
     frame_rate_num
     frame_rate_den
     time_base_num
     time_base_den
     pts_increment
     is_gray  % true to return grayscale frames (2D), false for RGB (3D)
+    thread_count  % decoder threads (0 means one per core)
+    thread_type  % decoder threading mode: 'frame', 'slice', or 'both'
+    worker_count  % parallel decoder contexts used for large batch reads
+    cache_mb  % byte budget of the decoded-GOP cache, in MiB
+    forward_frame_limit  % furthest a read may start ahead of the decoder and still decode on without a seek
+    do_prefetch  % true to decode the next GOP in the background during single-frame reads
+    prefetch_direction  % which GOP do_prefetch decodes: 'auto', 'forward', or 'backward'
+    crop_rect  % [x y width height] of the region decoded, 1-based x and y
+    output_size  % [height width] of the frames returned
+    bit_depth  % bits per sample in the file; frames are uint8 for 8, else uint16
+    hwaccel  % device the decoder runs on ('cuda', 'vaapi', 'videotoolbox'), or 'none'
+    io_mode  % how the file is read: 'default', 'mmap', or 'cached'
+    keyframes  % 1-based frame numbers of the keyframes (GOP starts)
+    index_source  % where the frame index came from: 'shared', 'index_file', 'sample_table', or 'scan'
+    do_share  % true to share the index and pool the decoder with other Readers of the file
+    do_collect_stats  % true to time and count the stages of every read, for stats
   end
 
   properties (Dependent)
@@ -37,15 +83,138 @@ classdef Reader < handle
       % READER Open a video file for reading
       %   vid = h265.Reader(filename)
       %   vid = h265.Reader(filename, 'is_gray', true)
+      %   vid = h265.Reader(filename, 'thread_count', 8, 'thread_type', 'frame')
       %
       %   Optional parameters:
-      %     is_gray - boolean (default: auto-detect from file metadata,
-      %               or false if no metadata). If true, return grayscale
-      %               frames (height x width) instead of RGB (height x width x 3)
+      %     is_gray      - boolean (default: auto-detect from file metadata,
+      %                    or false if no metadata). If true, return grayscale
+      %                    frames (height x width) instead of RGB (height x width x 3)
+      %     thread_count - number of decoder threads, 0 for one per core (default 1)
+      %     thread_type  - 'frame', 'slice', or 'both' (default 'both').  Frame
+      %                    threading gives the biggest speedup for GOP and batch
+      %                    reads, at the cost of a few frames of decoder latency.
+      %     worker_count - number of independent decoders used for batch reads
+      %                    (default 1).  Ranges spanning several GOPs are split
+      %                    at keyframes and the pieces are decoded in parallel.
+      %     do_read_index  - boolean (default true).  If true and <filename>.h265idx
+      %                      exists and is current, load the frame index from it
+      %                      instead of scanning every packet of the file.
+      %     do_write_index - boolean (default false).  If true and the index was
+      %                      not loaded from <filename>.h265idx, save it there so
+      %                      later opens are fast.
+      %     do_use_sample_table - boolean (default true).  If true, build the index
+      %                      from the MP4 sample table, reading only keyframe
+      %                      packets.  If false (or the table is unusable), scan
+      %                      every packet, which also validates every frame's PTS.
+      %     cache_mb     - memory for decoded GOPs kept by single-frame reads, in
+      %                    MiB (default 256).  The least recently used GOPs are
+      %                    dropped beyond this, but the GOP of the last frame
+      %                    read is always kept.  Raise it for access patterns
+      %                    that revisit several GOPs, e.g. scrubbing back and forth.
+      %     forward_frame_limit - integer (default 16).  A read that has to
+      %                    decode, and starts at most this many frames after
+      %                    where the previous one stopped, keeps decoding
+      %                    from there instead of seeking back to a keyframe
+      %                    and restarting the decoder.  Chunked sequential
+      %                    reads then decode every frame once.  -1 makes
+      %                    every read seek.
+      %     do_prefetch  - boolean (default false).  If true, each single-frame
+      %                    read starts decoding the following GOP on a background
+      %                    thread with its own decoder, so sequential playback
+      %                    gets a cache hit at GOP boundaries instead of a stall.
+      %                    Uses memory for one extra GOP beyond cache_mb.
+      %     prefetch_direction - 'auto' (default), 'forward', or 'backward'.
+      %                    Which GOP do_prefetch decodes: the next one, the
+      %                    previous one (for reverse playback), or, with
+      %                    'auto', whichever way the reads are stepping.
+      %     crop_rect    - [x y width height] (default: whole frame).  Only
+      %                    this region of each frame is returned, with x and y
+      %                    the 1-based column and row of its top-left pixel.
+      %     output_size  - [height width] to scale the (cropped) frames to
+      %                    (default: no scaling).
+      %     scale        - scale factor for the (cropped) frames, as an
+      %                    alternative to output_size (default 1).
+      %                    Cropping and scaling happen during color conversion,
+      %                    so the cache, prefetch, and returned arrays hold
+      %                    only the smaller frames.
+      %     hwaccel      - 'none' (default), 'auto', 'cuda', 'vaapi', or
+      %                    'videotoolbox'.  Decode on that device (or, for
+      %                    'auto', the first one found) and download each
+      %                    frame that is returned.  Frames come back exactly
+      %                    as from the software decoder, up to rounding.
+      %                    Without the device, decoding stays in software,
+      %                    with a warning unless hwaccel is 'auto'; the
+      %                    hwaccel property says which happened.
+      %     io_mode      - 'default', 'mmap', or 'cached' (default 'default').
+      %                    'default' reads the file through FFmpeg, which makes
+      %                    many small reads after every seek.  'mmap' maps the
+      %                    file into memory.  'cached' reads it in large
+      %                    aligned blocks through a block cache; meant for
+      %                    network and parallel file systems, where each read
+      %                    is slow to start.  Readers of the same file (and
+      %                    their prefetch and batch-read workers) share the
+      %                    mapping or the block cache.
+      %     io_block_kb  - size of each read for io_mode 'cached', in KiB, a
+      %                    multiple of 4 (default 1024).
+      %     io_cache_mb  - memory for the blocks kept by io_mode 'cached', in
+      %                    MiB (default 64).  Set by the first Reader of the file.
+      %     do_share     - boolean (default false).  If true, Readers of the
+      %                    same file in this MATLAB process share one frame
+      %                    index (index_source 'shared' for all but the
+      %                    first), and a closed Reader's decoder is kept for
+      %                    the next Reader of the file with the same
+      %                    thread_count, thread_type, hwaccel, and io_mode,
+      %                    so reopening the file costs almost nothing.  Under
+      %                    parfor each worker process shares separately; add
+      %                    do_write_index so that each worker loads the
+      %                    index instead of scanning.
+      %     do_collect_stats - boolean (default false).  If true, count and time
+      %                    the stages of every read (seeking, demuxing,
+      %                    decoding, conversion, cache lookups) for stats.
+      %                    Off, the read path never reads the clock.
+
+      [is_gray, thread_count, thread_type, worker_count, do_read_index, do_write_index, do_use_sample_table, cache_mb, forward_frame_limit, ...
+       do_prefetch, prefetch_direction, crop_rect, output_size, scale, hwaccel, io_mode, io_block_kb, io_cache_mb, do_share, ...
+       do_collect_stats] = ...
+        myparse(varargin, ...
+                'is_gray', [], 'thread_count', 1, 'thread_type', 'both', 'worker_count', 1, ...
+                'do_read_index', true, 'do_write_index', false, 'do_use_sample_table', true, ...
+                'cache_mb', 256, 'forward_frame_limit', 16, 'do_prefetch', false, ...
+                'prefetch_direction', 'auto', 'crop_rect', [], 'output_size', [], 'scale', [], 'hwaccel', 'none', ...
+                'io_mode', 'default', 'io_block_kb', 1024, 'io_cache_mb', 64, 'do_share', false, ...
+                'do_collect_stats', false);
 
-      is_gray = myparse(varargin, 'is_gray', []);
+      if ~isscalar(worker_count) || worker_count < 1 || worker_count ~= round(worker_count)
+        error('Reader:badWorkerCount', 'worker_count must be a positive integer');
+      end
+      if ~isscalar(cache_mb) || ~(cache_mb >= 0)
+        error('Reader:badCacheSize', 'cache_mb must be a non-negative number');
+      end
+      if ~isscalar(forward_frame_limit) || ~(forward_frame_limit >= -1) || forward_frame_limit ~= round(forward_frame_limit)
+        error('Reader:badForwardFrameLimit', 'forward_frame_limit must be an integer of at least -1');
+      end
+      if ~any(strcmp(prefetch_direction, {'auto', 'forward', 'backward'}))
+        error('Reader:badPrefetchDirection', 'prefetch_direction must be ''auto'', ''forward'', or ''backward''');
+      end
+      if ~isempty(output_size) && ~isempty(scale)
+        error('Reader:badOutputSize', 'Only one of output_size and scale may be given');
+      end
+      if ~isempty(output_size) && ...
+          (numel(output_size) ~= 2 || ~all(output_size >= 1) || any(output_size ~= round(output_size)))
+        error('Reader:badOutputSize', 'output_size must be [height width], positive integers');
+      end
+      if ~isempty(scale) && (~isscalar(scale) || ~(scale > 0))
+        error('Reader:badOutputSize', 'scale must be a positive number');
+      end
 
-      obj.video_info = h265.open_h265_video(filename);
+      open_options = struct('thread_count', thread_count, 'thread_type', thread_type, ...
+                            'do_read_index', do_read_index, 'do_write_index', do_write_index, ...
+                            'do_use_sample_table', do_use_sample_table, 'cache_mb', cache_mb, ...
+                            'forward_frame_limit', forward_frame_limit, ...
+                            'hwaccel', hwaccel, 'io_mode', io_mode, ...
+                            'io_block_kb', io_block_kb, 'io_cache_mb', io_cache_mb, ...
+                            'do_share', do_share, 'do_collect_stats', do_collect_stats);
+      obj.video_info = h265.open_h265_video(filename, open_options);
 
       % If is_gray not explicitly set, use metadata from file (if available)
       if isempty(is_gray)
@@ -60,6 +229,38 @@ classdef Reader < handle
       obj.video_info.is_gray = is_gray;
       obj.is_gray = is_gray;
 
+      % Add worker_count to video_info for read_h265_frames
+      obj.video_info.worker_count = worker_count;
+      obj.worker_count = worker_count;
+      obj.cache_mb = cache_mb;
+      obj.forward_frame_limit = forward_frame_limit;
+
+      % Add do_prefetch and prefetch_direction to video_info for read_h265_frame
+      obj.video_info.do_prefetch = logical(do_prefetch);
+      obj.do_prefetch = logical(do_prefetch);
+      obj.video_info.prefetch_direction = char(prefetch_direction);
+      obj.prefetch_direction = char(prefetch_direction);
+
+      % Add crop_rect and output_size to video_info for the read MEX functions
+      if isempty(crop_rect)
+        crop_rect = [1, 1, obj.video_info.width, obj.video_info.height];
+      end
+      if numel(crop_rect) ~= 4 || any(crop_rect ~= round(crop_rect)) || ~all(crop_rect >= 1) || ...
+          crop_rect(1) + crop_rect(3) - 1 > obj.video_info.width || ...
+          crop_rect(2) + crop_rect(4) - 1 > obj.video_info.height
+        error('Reader:badCropRect', 'crop_rect must be [x y width height] within the %dx%d frame', ...
+              obj.video_info.width, obj.video_info.height);
+      end
+      if ~isempty(scale)
+        output_size = max(1, round(scale * [crop_rect(4), crop_rect(3)]));
+      elseif isempty(output_size)
+        output_size = [crop_rect(4), crop_rect(3)];
+      end
+      obj.video_info.crop_rect = double(crop_rect(:)');
+      obj.video_info.output_size = double(output_size(:)');
+      obj.crop_rect = obj.video_info.crop_rect;
+      obj.output_size = obj.video_info.output_size;
+
       % Copy properties for easy access
       obj.filename = obj.video_info.filename;
       obj.num_frames = obj.video_info.num_frames;
@@ -70,6 +271,15 @@ classdef Reader < handle
       obj.time_base_num = obj.video_info.time_base_num;
       obj.time_base_den = obj.video_info.time_base_den;
       obj.pts_increment = obj.video_info.pts_increment;
+      obj.thread_count = obj.video_info.thread_count;
+      obj.thread_type = obj.video_info.thread_type;
+      obj.bit_depth = obj.video_info.bit_depth;
+      obj.hwaccel = obj.video_info.hwaccel;
+      obj.io_mode = obj.video_info.io_mode;
+      obj.keyframes = double(obj.video_info.keyframes);
+      obj.index_source = obj.video_info.index_source;
+      obj.do_share = logical(do_share);
+      obj.do_collect_stats = logical(do_collect_stats);
     end
 
     function frame = read(obj, start_frame, end_frame)
@@ -88,6 +298,185 @@ classdef Reader < handle
       end
     end
 
+    function read_into(obj, buffer, start_frame, end_frame)
+      % READ_INTO Read one or more frames into an existing array, in place
+      %   vid.read_into(buffer, frame_idx)
+      %   vid.read_into(buffer, start_idx, end_idx)
+      %
+      %   Decodes the frames into the leading frames of buffer, which must
+      %   have the class and frame size vid.read returns (uint8 or uint16,
+      %   height x width, or height x width x 3 for RGB) and room for the
+      %   range.  A loop that reads into one buffer then allocates no frame
+      %   memory per call.  The write happens in place, so every variable
+      %   sharing buffer's data sees it: create the buffer with zeros() and
+      %   do not copy it to another variable while it is in use.
+
+      if nargin < 4
+        end_frame = start_frame;
+      end
+      h265.read_h265_frames(obj.video_info, start_frame, end_frame, buffer);
+    end
+
+    function frames = read_frames(obj, frame_indices)
+      % READ_FRAMES Read an arbitrary list of frames
+      %   frames = vid.read_frames(frame_indices)
+      %
+      %   frame_indices is a vector of 1-based frame indices, in any order and
+      %   possibly with repeats, e.g. 1:10:vid.num_frames.  frames(:,:,k) (or
+      %   frames(:,:,:,k) for RGB) is frame frame_indices(k).  The requests
+      %   are grouped by GOP, so each GOP is decoded at most once, and only as
+      %   far as the last frame needed from it.
+
+      if ~isvector(frame_indices) && ~isempty(frame_indices)
+        error('Reader:badFrameIndex', 'frame_indices must be a vector');
+      end
+      frames = h265.read_h265_frames(obj.video_info, double(frame_indices(:)));
+    end
+
+    function [frames, first_frame_index] = read_gop(obj, gop_index)
+      % READ_GOP Read every frame of one GOP in a single call
+      %   [frames, first_frame_index] = vid.read_gop(gop_index)
+      %
+      %   gop_index is 1-based, from 1 to numel(vid.keyframes).  frames holds
+      %   the whole GOP (height x width x n, or height x width x 3 x n for
+      %   RGB), and frame k of it is frame first_frame_index + k - 1 of the
+      %   video.  Indexing into the block avoids a MEX call and a frame copy
+      %   per frame; use gop_for_frame to map frame indices to GOPs.
+
+      if ~isscalar(gop_index) || gop_index < 1 || gop_index > numel(obj.keyframes) || ...
+          gop_index ~= round(gop_index)
+        error('Reader:badGopIndex', 'gop_index must be an integer from 1 to %d', numel(obj.keyframes));
+      end
+      [frames, first_frame_index] = h265.read_h265_frame(obj.video_info, obj.keyframes(gop_index), true);
+    end
+
+    function frames = read_chunk(obj, first_frame, frame_count)
+      % READ_CHUNK Read frame_count frames starting at first_frame, for sequential passes
+      %   frames = vid.read_chunk(first_frame, frame_count)
+      %
+      %   Same as vid.read(first_frame, first_frame + frame_count - 1).  The
+      %   decoder is left where the chunk ends, so a chunk that starts right
+      %   after the previous read (or up to forward_frame_limit frames after
+      %   it) continues decoding from there, without seeking or flushing the
+      %   decoder.  Chunks bypass the frame cache, and are decoded on the
+      %   Reader's own decoder even with worker_count > 1.  Other reads in
+      %   between that leave the decoder elsewhere make the next chunk seek
+      %   again.  Usually called through frames_iterator.
+
+      % The worker_count decoders would leave the Reader's own where it was
+      video_info = obj.video_info;
+      video_info.worker_count = 1;
+      frames = h265.read_h265_frames(video_info, first_frame, first_frame + frame_count - 1);
+    end
+
+    function [frames, frame_indices] = read_keyframes(obj, stride, varargin)
+      % READ_KEYFRAMES Read every stride-th keyframe, for thumbnails and overviews
+      %   [frames, frame_indices] = vid.read_keyframes()
+      %   [frames, frame_indices] = vid.read_keyframes(stride)
+      %   [frames, frame_indices] = vid.read_keyframes(stride, 'output_size', [height width])
+      %   [frames, frame_indices] = vid.read_keyframes(stride, 'scale', 0.25)
+      %
+      %   Reads keyframes vid.keyframes(1:stride:end) (stride default 1, one
+      %   frame per GOP), and frame_indices are their 1-based frame numbers.
+      %   Only the keyframes are decoded, each from its own packet after a
+      %   seek, so the cost does not grow with the GOP size.  output_size or
+      %   scale (of the cropped frames, as for the constructor) shrinks the
+      %   thumbnails in the color conversion; by default they have the size
+      %   of vid.read's frames.  Bypasses the frame cache.
+
+      if nargin < 2
+        stride = 1;
+      end
+      if ~isscalar(stride) || stride < 1 || stride ~= round(stride)
+        error('Reader:badStride', 'stride must be a positive integer');
+      end
+      [output_size, scale] = myparse(varargin, 'output_size', [], 'scale', []);
+      if ~isempty(output_size) && ~isempty(scale)
+        error('Reader:badOutputSize', 'Only one of output_size and scale may be given');
+      end
+      if ~isempty(output_size) && ...
+          (numel(output_size) ~= 2 || ~all(output_size >= 1) || any(output_size ~= round(output_size)))
+        error('Reader:badOutputSize', 'output_size must be [height width], positive integers');
+      end
+      if ~isempty(scale) && (~isscalar(scale) || ~(scale > 0))
+        error('Reader:badOutputSize', 'scale must be a positive number');
+      end
+
+      video_info = obj.video_info;
+      if ~isempty(scale)
+        video_info.output_size = max(1, round(scale * [obj.crop_rect(4), obj.crop_rect(3)]));
+      elseif ~isempty(output_size)
+        video_info.output_size = double(output_size(:)');
+      end
+      frame_indices = obj.keyframes(1:stride:end);
+      frames = h265.read_h265_keyframes(video_info, frame_indices);
+    end
+
+    function iterator = frames_iterator(obj, start_frame, end_frame, chunk_frame_count)
+      % FRAMES_ITERATOR Step through a range of frames in fixed-size chunks
+      %   iterator = vid.frames_iterator()
+      %   iterator = vid.frames_iterator(start_frame, end_frame)
+      %   iterator = vid.frames_iterator(start_frame, end_frame, chunk_frame_count)
+      %
+      %   Returns an h265.FrameIterator over frames start_frame to end_frame
+      %   (default: the whole video) in chunks of chunk_frame_count frames
+      %   (default: 100; the last chunk may be shorter).  Only one chunk is
+      %   in memory at a time, and the decoder seeks once, at the first chunk:
+      %       iterator = vid.frames_iterator(1, vid.num_frames, 256);
+      %       while iterator.has_next()
+      %         [frames, first_frame_index] = iterator.next();
+      %       end
+
+      if nargin < 2
+        start_frame = 1;
+      end
+      if nargin < 3
+        end_frame = obj.num_frames;
+      end
+      if nargin < 4
+        chunk_frame_count = 100;
+      end
+      iterator = h265.FrameIterator(obj, start_frame, end_frame, chunk_frame_count);
+    end
+
+    function [gop_index, frame_offset] = gop_for_frame(obj, frame_index)
+      % GOP_FOR_FRAME Map frame indices to the GOPs that contain them
+      %   [gop_index, frame_offset] = vid.gop_for_frame(frame_index)
+      %
+      %   frame_index may be an array of 1-based frame indices.  gop_index is
+      %   the 1-based GOP for read_gop, and frame_offset the 1-based position
+      %   of the frame within that GOP's block.
+
+      gop_index = discretize(frame_index, [obj.keyframes(:); obj.num_frames + 1]);
+      if any(isnan(gop_index(:)))
+        error('Reader:badFrameIndex', 'Frame indices must be from 1 to %d', obj.num_frames);
+      end
+      frame_offset = frame_index - reshape(obj.keyframes(gop_index), size(frame_index)) + 1;
+    end
+
+    function result = stats(obj)
+      % STATS Timing and counters of every read so far
+      %   stats = vid.stats()
+      %
+      %   Returns a struct of counts (_count fields) and times in seconds
+      %   (_time fields) since the Reader was opened or reset_stats was
+      %   called: seeks and reads that decoded on without one, packets
+      %   demuxed, time in av_read_frame, in the decoder, downloading from
+      %   a GPU, in sws_scale, and transposing into MATLAB layout; frames
+      %   decoded, converted, discarded (decoded only to reach a later
+      %   frame), and returned; and GOP cache hits, prefetch hits, misses,
+      %   and evictions.  Decoding by the prefetch thread and the
+      %   worker_count decoders counts too.  All zero unless the Reader was
+      %   opened with do_collect_stats.
+
+      result = h265.get_h265_read_stats(obj.video_info);
+    end
+
+    function reset_stats(obj)
+      % RESET_STATS Zero the timing and counters returned by stats
+      h265.get_h265_read_stats(obj.video_info, true);
+    end
+
     function delete(obj)
       % DELETE Destructor - ensures resources are freed
       h265.close_h265_video(obj.video_info);
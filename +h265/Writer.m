@@ -11,6 +11,23 @@ classdef Writer < handle
   %       vid = h265.Writer('output.mp4', 640, 480, 30, 'is_gray', true);
   %       vid.write(gray_frame);  % height x width uint8
   %       % vid flushes and closes automatically when it goes out of scope
+  %
+  %   Example (pipelined, write returns while earlier frames are still encoding):
+  %       vid = h265.Writer('output.mp4', 640, 480, 30, 'do_pipeline', true);
+  %       vid.write(block);  % returns once the frames are queued
+  %       vid.wait();        % block until everything queued so far is encoded
+  %
+  %   Example (encode on the GPU if there is one, else with libx265):
+  %       vid = h265.Writer('output.mp4', 640, 480, 30, 'hwaccel', 'auto');
+  %
+  %   Example (12-bit grayscale, Main12):
+  %       vid = h265.Writer('output.mp4', 640, 480, 30, 'is_gray', true, 'bit_depth', 12);
+  %       vid.write(gray_frame);  % height x width uint16, values 0 to 4095
+  %
+  %   Example (where the time of a write goes):
+  %       vid = h265.Writer('output.mp4', 640, 480, 30, 'do_collect_stats', true);
+  %       vid.write(block);
+  %       stats = vid.stats();  % conversion, encoder, and muxing times
 
   properties (SetAccess = private)
     filename
@@ -20,6 +37,18 @@ classdef Writer < handle
     is_gray
     gop_size
     crf
+    do_write_index
+    do_pipeline
+    queue_frame_count
+    conversion_thread_count
+    segment_encoder_count
+    segment_gop_count
+    preset
+    tune
+    bit_depth  % bits per sample: 8 (uint8 frames), or 10 or 12 (uint16 frames)
+    hwaccel  % device the encoder runs on ('cuda', 'videotoolbox'), or 'none' for libx265
+    x265_params  % the x265-params string passed to the encoder
+    do_collect_stats  % true to time and count conversion, encoding, and muxing, for stats
     frames_written = 0
   end
 
@@ -40,13 +69,104 @@ classdef Writer < handle
       %     is_gray  - boolean (default false): false for RGB color, true for grayscale
       %     gop_size - keyframe interval in frames (default 50)
       %     crf      - quality setting, 0-51 where lower is better quality (default 18)
+      %     do_write_index - boolean (default false).  If true, index the finished
+      %                      file on close and save <filename>.h265idx, so that
+      %                      h265.Reader can open it without scanning.
+      %     do_pipeline - boolean (default false).  If true, write() copies the
+      %                   frames into a queue and returns; conversion runs on a
+      %                   pool of threads and encoding and muxing on another.
+      %                   write() blocks only while the queue is full.  Use
+      %                   wait() to block until every queued frame is encoded.
+      %     queue_frame_count - frames the pipeline buffers (default 16)
+      %     conversion_thread_count - pipeline conversion threads (default 2)
+      %     segment_encoder_count - if greater than 1, split the frames into
+      %                             segments of whole GOPs, encode up to this many
+      %                             segments at once on separate x265 instances,
+      %                             and mux them in order (default 1).  Buffers up
+      %                             to segment_encoder_count segments of raw frames.
+      %                             Cannot be combined with do_pipeline.
+      %     segment_gop_count - GOPs per segment (default 1)
+      %     bit_depth - bits per sample, 8 (default), 10 (Main10), or 12 (Main12).
+      %                 Above 8, write() takes uint16 frames holding values
+      %                 0 to 2^bit_depth - 1.  Needs a libx265 built with high
+      %                 bit depth support.
+      %     hwaccel - 'none' (default), 'auto', 'cuda' (NVENC), or 'videotoolbox'.
+      %               Encode on that device's h.265 encoder (or, for 'auto',
+      %               the first one that opens), with closed GOPs every
+      %               gop_size frames and crf as its constant-quality level.
+      %               Of the x265 options below only b_frame_count applies
+      %               to it.  If the device or its encoder is missing, cannot
+      %               take the frame format (e.g. grayscale), or has no free
+      %               session, encode with libx265 instead, with a warning
+      %               unless hwaccel is 'auto'; the hwaccel property says
+      %               which happened.
+      %     do_collect_stats - boolean (default false).  If true, count and
+      %                        time frame conversion, the encoder, and muxing
+      %                        on every thread, for stats.
+      %
+      %   x265 performance options (each defaults to x265's own choice; none of
+      %   them can change the closed GOP, gop_size, or crf):
+      %     preset - 'ultrafast', 'superfast', 'veryfast', 'faster', 'fast',
+      %              'medium', 'slow', 'slower', 'veryslow', or 'placebo'
+      %     tune   - 'fastdecode' (default), 'zerolatency', 'psnr', 'ssim',
+      %              'grain', 'animation', or 'none'
+      %     pools  - x265 thread pool list, e.g. '8' (8 threads), '+' (all
+      %              cores), '-' (no pool), or '4,4' (per NUMA node)
+      %     frame_thread_count    - frames encoded concurrently, 0 for auto (0-16)
+      %     do_wpp                - boolean, wavefront parallel processing
+      %     lookahead_slice_count - slices per lookahead frame (0-16)
+      %     b_frame_count         - maximum consecutive B-frames (0-16)
+      %
+      %   Example (live capture):
+      %       vid = h265.Writer('out.mp4', 640, 480, 30, 'preset', 'ultrafast', 'tune', 'zerolatency');
 
-      [is_gray, gop_size, crf] = myparse(varargin, ...
-        'is_gray', false, 'gop_size', 50, 'crf', 18);
+      [is_gray, gop_size, crf, do_write_index, do_pipeline, queue_frame_count, conversion_thread_count, ...
+       segment_encoder_count, segment_gop_count, preset, tune, pools, frame_thread_count, do_wpp, ...
+       lookahead_slice_count, b_frame_count, bit_depth, hwaccel, do_collect_stats] = myparse(varargin, ...
+        'is_gray', false, 'gop_size', 50, 'crf', 18, 'do_write_index', false, ...
+        'do_pipeline', false, 'queue_frame_count', 16, 'conversion_thread_count', 2, ...
+        'segment_encoder_count', 1, 'segment_gop_count', 1, ...
+        'preset', '', 'tune', 'fastdecode', 'pools', '', 'frame_thread_count', [], 'do_wpp', [], ...
+        'lookahead_slice_count', [], 'b_frame_count', [], 'bit_depth', 8, 'hwaccel', 'none', ...
+        'do_collect_stats', false);
+
+      if ~isscalar(queue_frame_count) || queue_frame_count < 1 || queue_frame_count ~= round(queue_frame_count)
+        error('Writer:badQueueFrameCount', 'queue_frame_count must be a positive integer');
+      end
+      if ~isscalar(conversion_thread_count) || conversion_thread_count < 1 || conversion_thread_count ~= round(conversion_thread_count)
+        error('Writer:badConversionThreadCount', 'conversion_thread_count must be a positive integer');
+      end
+      if ~isscalar(segment_encoder_count) || segment_encoder_count < 1 || segment_encoder_count ~= round(segment_encoder_count)
+        error('Writer:badSegmentEncoderCount', 'segment_encoder_count must be a positive integer');
+      end
+      if ~isscalar(segment_gop_count) || segment_gop_count < 1 || segment_gop_count ~= round(segment_gop_count)
+        error('Writer:badSegmentGopCount', 'segment_gop_count must be a positive integer');
+      end
+      if do_pipeline && segment_encoder_count > 1
+        error('Writer:badOption', 'do_pipeline cannot be combined with segment_encoder_count > 1');
+      end
+      if ~isscalar(bit_depth) || ~ismember(bit_depth, [8 10 12])
+        error('Writer:badBitDepth', 'bit_depth must be 8, 10, or 12');
+      end
 
       is_color = ~is_gray;
+      write_options = struct('do_pipeline', logical(do_pipeline), ...
+                             'queue_frame_count', queue_frame_count, ...
+                             'conversion_thread_count', conversion_thread_count, ...
+                             'segment_encoder_count', segment_encoder_count, ...
+                             'segment_gop_count', segment_gop_count, ...
+                             'preset', preset, ...
+                             'tune', tune, ...
+                             'pools', pools, ...
+                             'frame_thread_count', frame_thread_count, ...
+                             'do_wpp', do_wpp, ...
+                             'lookahead_slice_count', lookahead_slice_count, ...
+                             'b_frame_count', b_frame_count, ...
+                             'bit_depth', bit_depth, ...
+                             'hwaccel', hwaccel, ...
+                             'do_collect_stats', logical(do_collect_stats));
       obj.writer_info = h265.open_h265_write(filename, width, height, frame_rate, ...
-        is_color, gop_size, crf);
+        is_color, gop_size, crf, write_options);
 
       obj.filename = filename;
       obj.width = width;
@@ -54,6 +174,18 @@ classdef Writer < handle
       obj.is_gray = is_gray;
       obj.gop_size = gop_size;
       obj.crf = crf;
+      obj.do_write_index = do_write_index;
+      obj.do_pipeline = logical(do_pipeline);
+      obj.queue_frame_count = queue_frame_count;
+      obj.conversion_thread_count = conversion_thread_count;
+      obj.segment_encoder_count = segment_encoder_count;
+      obj.segment_gop_count = segment_gop_count;
+      obj.preset = preset;
+      obj.tune = tune;
+      obj.bit_depth = bit_depth;
+      obj.hwaccel = obj.writer_info.hwaccel;
+      obj.x265_params = obj.writer_info.x265_params;
+      obj.do_collect_stats = logical(do_collect_stats);
       if isscalar(frame_rate)
         obj.frame_rate = frame_rate;
       else
@@ -66,12 +198,21 @@ classdef Writer < handle
       %   vid.write(frame)
       %   vid.write(frames)
       %
-      %   For grayscale: frames must be uint8 array of size height x width x num_frames
+      %   For grayscale: frames must be an array of size height x width x num_frames
       %                  (single frame can be height x width)
-      %   For RGB color: frames must be uint8 array of size height x width x 3 x num_frames
+      %   For RGB color: frames must be an array of size height x width x 3 x num_frames
       %                  (single frame can be height x width x 3)
+      %   Frames are uint8, or uint16 if the writer has a bit_depth above 8.
+      %
+      %   With do_pipeline or segment_encoder_count > 1, this returns once the
+      %   frames are queued, and an encoding error from an earlier write may be
+      %   raised here.
 
-      if ~isa(frames, 'uint8')
+      if obj.bit_depth > 8
+        if ~isa(frames, 'uint16')
+          error('Writer:badType', 'Frames must be uint16 for a %d-bit writer', obj.bit_depth);
+        end
+      elseif ~isa(frames, 'uint8')
         error('Writer:badType', 'Frames must be uint8');
       end
 
@@ -127,9 +268,76 @@ classdef Writer < handle
       obj.frames_written = obj.frames_written + num_frames;
     end
 
+    function write_ufmf(obj, ufmf, first_frame, last_frame)
+      % WRITE_UFMF Transcode frames of a UFMF file into the video
+      %   vid.write_ufmf(ufmf, first_frame, last_frame)
+      %
+      %   ufmf is the struct returned by h265.open_ufmf.  Frames first_frame
+      %   to last_frame (1-based, inclusive) are decoded natively and passed
+      %   straight to the encoder, without building MATLAB arrays.  The writer
+      %   must be 8-bit, grayscale for a MONO8 file and RGB for an RGB24 one,
+      %   and ufmf.width x ufmf.height.  Queues like write() with do_pipeline
+      %   or segment_encoder_count > 1.
+
+      if obj.bit_depth > 8
+        error('Writer:badType', 'UFMF frames are 8-bit, but the writer is %d-bit', obj.bit_depth);
+      end
+      if ufmf.is_color == obj.is_gray
+        error('Writer:badColor', 'UFMF file has is_color %d, so the writer needs is_gray %d', ...
+          ufmf.is_color, ~ufmf.is_color);
+      end
+      if ufmf.height ~= obj.height || ufmf.width ~= obj.width
+        error('Writer:badSize', 'UFMF frame size %dx%d does not match video %dx%d', ...
+          ufmf.height, ufmf.width, obj.height, obj.width);
+      end
+
+      h265.write_ufmf_frames(obj.writer_info, ufmf, first_frame, last_frame);
+      obj.frames_written = obj.frames_written + (last_frame - first_frame + 1);
+    end
+
+    function wait(obj)
+      % WAIT Block until every frame passed to write() has been encoded
+      %   vid.wait()
+      %
+      %   Raises any error from the pipeline or the segment encoders.  With
+      %   segment_encoder_count > 1, the partial segment is encoded now, which
+      %   ends the current GOP early.  Returns immediately unless the writer
+      %   was opened with do_pipeline or segment_encoder_count > 1.
+      h265.wait_h265_write(obj.writer_info);
+    end
+
+    function result = stats(obj)
+      % STATS Timing and counters of every frame encoded so far
+      %   stats = vid.stats()
+      %
+      %   Returns a struct of counts (_count fields) and times in seconds
+      %   (_time fields) since the Writer was opened or reset_stats was
+      %   called: frames converted and the time taken, time in
+      %   avcodec_send_frame and avcodec_receive_packet, packets muxed, their
+      %   bytes, and time in av_interleaved_write_frame.  Summed over every
+      %   thread, so with do_pipeline or segment_encoder_count > 1 the times
+      %   can exceed the wall-clock time, and frames still in flight are not
+      %   counted yet (call wait() first).  All zero unless the Writer was
+      %   opened with do_collect_stats.
+
+      result = h265.get_h265_write_stats(obj.writer_info);
+    end
+
+    function reset_stats(obj)
+      % RESET_STATS Zero the timing and counters returned by stats
+      h265.get_h265_write_stats(obj.writer_info, true);
+    end
+
     function delete(obj)
       % DELETE Destructor - ensures encoder is flushed and file is closed
       h265.close_h265_write(obj.writer_info);
+      if obj.do_write_index && obj.frames_written > 0
+        % Index the finished file with the same scan the Reader would do, so
+        % the sidecar matches exactly what the demuxer reports
+        open_options = struct('do_read_index', false, 'do_write_index', true);
+        video_info = h265.open_h265_video(obj.filename, open_options);
+        h265.close_h265_video(video_info);
+      end
     end
 
     function d = duration(obj)
@@ -0,0 +1,290 @@
+function results = benchmark_suite(varargin)
+% BENCHMARK_SUITE Time opening, reading, and writing synthetic videos, and save the results
+%   results = h265.benchmark_suite()
+%   results = h265.benchmark_suite('label', 'v1.2', 'output_dir', 'benchmarks')
+%
+%   Writes a synthetic video for every combination of frame size, gray vs RGB,
+%   and GOP size, timing the Writer at each preset, then times opening it
+%   (sample table and full scan) and each read pattern at every cache size
+%   and decoder thread count:
+%     batch       - one read(1, n)
+%     sequential  - read(k) for k = 1 to n
+%     strided     - read(k) for every stride-th frame
+%     random      - read(k) in a random order (the same order in every run)
+%     reverse     - read(k) for k = n down to 1
+%     sparse_list - one read_frames call for every stride-th frame
+%     chunked     - a frames_iterator pass in chunks of chunk_frame_count
+%   Each measurement is repeated, on a fresh Reader or Writer each time, and
+%   the median and minimum are kept.  Read rows also carry the Reader's stats
+%   (seeks, frames decoded, cache hits) from the last repetition.
+%
+%   The results are returned as a table and saved to output_dir as
+%   benchmark_<label>_<time>.csv, one row per measurement, and a .json file
+%   that also records the machine, the MATLAB version, and the git commit, so
+%   runs of different releases can be compared.
+%
+%   Optional parameters:
+%     label             - name of this run, e.g. a release (default 'run')
+%     output_dir        - where the results are saved (default: current folder)
+%     frame_sizes       - [height width] rows (default [240 320; 720 1280])
+%     is_gray_values    - gray and/or RGB (default [true false])
+%     gop_sizes         - writer GOP sizes (default [10 50])
+%     frame_count       - frames per video (default 200)
+%     presets           - x265 presets timed for writing; the video read is
+%                         written with the first (default {'ultrafast', 'medium'})
+%     cache_mb_values   - Reader cache_mb values (default [0 256])
+%     thread_counts     - Reader thread_count values (default [1 0])
+%     stride            - frame step of the strided and sparse_list patterns (default 7)
+%     chunk_frame_count - chunk size of the chunked pattern (default 64)
+%     repeat_count      - repetitions of each measurement (default 3)
+
+[label, output_dir, frame_sizes, is_gray_values, gop_sizes, frame_count, presets, cache_mb_values, thread_counts, ...
+ stride, chunk_frame_count, repeat_count] = ...
+  myparse(varargin, ...
+          'label', 'run', 'output_dir', pwd(), 'frame_sizes', [240 320; 720 1280], 'is_gray_values', [true false], ...
+          'gop_sizes', [10 50], 'frame_count', 200, 'presets', {'ultrafast', 'medium'}, ...
+          'cache_mb_values', [0 256], 'thread_counts', [1 0], 'stride', 7, 'chunk_frame_count', 64, 'repeat_count', 3);
+
+read_patterns = {'batch', 'sequential', 'strided', 'random', 'reverse', 'sparse_list', 'chunked'};
+frame_rate = 30;  % Hz
+block_frame_count = 50;  % frames generated once and written repeatedly
+
+% Create temp directory for the videos and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% The same random order for every video and every run
+random_stream = RandStream('mt19937ar', 'Seed', 0);
+random_order = randperm(random_stream, frame_count);
+
+rows = struct([]);
+for size_index = 1:size(frame_sizes, 1)
+  height = frame_sizes(size_index, 1);
+  width = frame_sizes(size_index, 2);
+  for is_gray = is_gray_values
+    block = synthetic_frames(height, width, is_gray, min(block_frame_count, frame_count));
+    for gop_size = gop_sizes
+      config = struct('height', height, 'width', width, 'is_gray', is_gray, 'gop_size', gop_size);
+      fprintf('%dx%d %s, gop_size %d\n', height, width, color_name(is_gray), gop_size);
+
+      % Writing, at each preset
+      for preset_index = 1:length(presets)
+        preset = presets{preset_index};
+        video_file_name = fullfile(temp_dir, sprintf('benchmark_%s.mp4', preset));
+        seconds = zeros(1, repeat_count);
+        for repeat_index = 1:repeat_count
+          start_time = tic();
+          writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, ...
+                               'gop_size', gop_size, 'preset', preset);
+          write_blocks(writer, block, frame_count);
+          delete(writer);  % includes flushing the encoder
+          seconds(repeat_index) = toc(start_time);
+        end
+        rows = add_row(rows, label, 'write', 'write', config, preset, NaN, NaN, frame_count, seconds, []);
+      end
+      video_file_name = fullfile(temp_dir, sprintf('benchmark_%s.mp4', presets{1}));
+
+      % Opening, from the sample table and with a full packet scan
+      open_patterns = {'open', 'open_scan'};
+      for pattern_index = 1:length(open_patterns)
+        do_use_sample_table = pattern_index == 1;
+        seconds = zeros(1, repeat_count);
+        for repeat_index = 1:repeat_count
+          start_time = tic();
+          reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_read_index', false, ...
+                               'do_use_sample_table', do_use_sample_table);
+          seconds(repeat_index) = toc(start_time);
+          delete(reader);
+        end
+        rows = add_row(rows, label, 'open', open_patterns{pattern_index}, config, presets{1}, NaN, NaN, 0, seconds, []);
+      end
+
+      % Reading, in each pattern, at each cache size and thread count
+      for cache_mb = cache_mb_values
+        for thread_count = thread_counts
+          for pattern_index = 1:length(read_patterns)
+            pattern = read_patterns{pattern_index};
+            seconds = zeros(1, repeat_count);
+            for repeat_index = 1:repeat_count
+              reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'cache_mb', cache_mb, ...
+                                   'thread_count', thread_count, 'do_collect_stats', true);
+              start_time = tic();
+              read_frame_count = read_in_pattern(reader, pattern, random_order, stride, chunk_frame_count);
+              seconds(repeat_index) = toc(start_time);
+              stats = reader.stats();
+              delete(reader);
+            end
+            rows = add_row(rows, label, 'read', pattern, config, presets{1}, cache_mb, thread_count, ...
+                           read_frame_count, seconds, stats);
+          end
+        end
+      end
+    end
+  end
+end
+
+results = struct2table(rows, 'AsArray', true);
+print_summary(results);
+
+% Save the rows, and the rows with the run's environment
+if ~exist(output_dir, 'dir')
+  mkdir(output_dir);
+end
+time_stamp = char(datetime('now', 'Format', 'yyyyMMdd''T''HHmmss'));
+base_name = fullfile(output_dir, sprintf('benchmark_%s_%s', label, time_stamp));
+writetable(results, [base_name '.csv']);
+run_info = struct('label', label, 'time', time_stamp, 'computer', computer(), 'matlab_version', version(), ...
+                  'core_count', feature('numcores'), 'git_commit', git_commit(), 'results', rows);
+file_id = fopen([base_name '.json'], 'w');
+fprintf(file_id, '%s\n', jsonencode(run_info));
+fclose(file_id);
+fprintf('Results saved to %s.csv and %s.json\n', base_name, base_name);
+end % function
+
+
+
+function frames = synthetic_frames(height, width, is_gray, frame_count)
+% Smooth noise drifting one pixel per frame, so the encoder sees motion
+channel_count = 3 - 2 * is_gray;
+random_stream = RandStream('mt19937ar', 'Seed', 1);
+base_image = uint8(imgaussfilt(255 * rand(random_stream, height, width + frame_count, channel_count), 3));
+frames = zeros(height, width, channel_count, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,:,frame_index) = base_image(:, frame_index:frame_index+width-1, :);
+end
+if is_gray
+  frames = reshape(frames, height, width, frame_count);
+end
+end % function
+
+
+
+function write_blocks(writer, block, frame_count)
+% Write frame_count frames, repeating the frames of block
+block_frame_count = size(block, ndims(block));
+written_frame_count = 0;
+while written_frame_count < frame_count
+  block_count = min(block_frame_count, frame_count - written_frame_count);
+  if writer.is_gray
+    writer.write(block(:,:,1:block_count));
+  else
+    writer.write(block(:,:,:,1:block_count));
+  end
+  written_frame_count = written_frame_count + block_count;
+end
+end % function
+
+
+
+function read_frame_count = read_in_pattern(reader, pattern, random_order, stride, chunk_frame_count)
+% Read frames of reader in pattern, returning how many were read
+frame_count = min(reader.num_frames, length(random_order));
+switch pattern
+  case 'batch'
+    reader.read(1, frame_count);
+    read_frame_count = frame_count;
+  case 'sequential'
+    for frame_index = 1:frame_count
+      reader.read(frame_index);
+    end
+    read_frame_count = frame_count;
+  case 'strided'
+    frame_indices = 1:stride:frame_count;
+    for frame_index = frame_indices
+      reader.read(frame_index);
+    end
+    read_frame_count = length(frame_indices);
+  case 'random'
+    for frame_index = random_order(random_order <= frame_count)
+      reader.read(frame_index);
+    end
+    read_frame_count = frame_count;
+  case 'reverse'
+    for frame_index = frame_count:-1:1
+      reader.read(frame_index);
+    end
+    read_frame_count = frame_count;
+  case 'sparse_list'
+    frame_indices = 1:stride:frame_count;
+    reader.read_frames(frame_indices);
+    read_frame_count = length(frame_indices);
+  case 'chunked'
+    iterator = reader.frames_iterator(1, frame_count, chunk_frame_count);
+    while iterator.has_next()
+      iterator.next();
+    end
+    read_frame_count = frame_count;
+  otherwise
+    error('benchmark_suite:badPattern', 'Unknown read pattern %s', pattern);
+end
+end % function
+
+
+
+function rows = add_row(rows, label, benchmark, pattern, config, preset, cache_mb, thread_count, frame_count, seconds, stats)
+% Append one measurement; stats is a Reader stats struct, or empty
+median_seconds = median(seconds);
+row = struct('label', label, 'benchmark', benchmark, 'pattern', pattern, ...
+             'height', config.height, 'width', config.width, 'is_gray', config.is_gray, 'gop_size', config.gop_size, ...
+             'preset', preset, 'cache_mb', cache_mb, 'thread_count', thread_count, ...
+             'frame_count', frame_count, 'repeat_count', length(seconds), ...
+             'median_seconds', median_seconds, 'min_seconds', min(seconds), ...
+             'ms_per_frame', 1000 * median_seconds / frame_count, 'frames_per_second', frame_count / median_seconds, ...
+             'seek_count', NaN, 'decoded_frame_count', NaN, 'discarded_frame_count', NaN, ...
+             'cache_hit_count', NaN, 'cache_miss_count', NaN);
+if frame_count == 0
+  row.ms_per_frame = NaN;
+  row.frames_per_second = NaN;
+end
+if ~isempty(stats)
+  row.seek_count = stats.seek_count;
+  row.decoded_frame_count = stats.decoded_frame_count;
+  row.discarded_frame_count = stats.discarded_frame_count;
+  row.cache_hit_count = stats.cache_hit_count;
+  row.cache_miss_count = stats.cache_miss_count;
+end
+if isempty(rows)
+  rows = row;
+else
+  rows(end+1) = row;
+end
+end % function
+
+
+
+function print_summary(results)
+% Print one line per measurement
+fprintf('\n%-6s %-12s %-11s %-5s %-4s %-10s %-6s %-4s %12s %10s\n', ...
+        'kind', 'pattern', 'size', 'color', 'gop', 'preset', 'cache', 'thr', 'median (ms)', 'ms/frame');
+for row_index = 1:height(results)
+  row = results(row_index, :);
+  fprintf('%-6s %-12s %-11s %-5s %-4d %-10s %-6g %-4g %12.1f %10.2f\n', ...
+          row.benchmark{1}, row.pattern{1}, sprintf('%dx%d', row.height, row.width), color_name(row.is_gray), ...
+          row.gop_size, row.preset{1}, row.cache_mb, row.thread_count, 1000 * row.median_seconds, row.ms_per_frame);
+end
+end % function
+
+
+
+function name = color_name(is_gray)
+% 'gray' or 'rgb'
+if is_gray
+  name = 'gray';
+else
+  name = 'rgb';
+end
+end % function
+
+
+
+function commit = git_commit()
+% Commit of the working copy this file is in, or '' outside git
+this_dir = fileparts(mfilename('fullpath'));
+[status, output] = system(sprintf('git -C "%s" rev-parse HEAD', this_dir));
+if status == 0
+  commit = strtrim(output);
+else
+  commit = '';
+end
+end % function
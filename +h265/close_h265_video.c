@@ -5,11 +5,16 @@
  * Usage: close_h265_video(video_info)
  *   video_info - struct returned by open_h265_video
  *
+ * Any read-ahead job started by read_h265_frame is waited for and freed.
+ * For a reader opened with do_share, the demuxer and decoder go to the
+ * registry's pool of idle decoders instead (see h265_registry.h). Once
+ * everything is freed, the MEX files locked for the reader are unlocked
+ * (see h265_mex_lock.h).
  * After calling this function, the video_info struct should not be used
  * with read_h265_frame.
  *
  * Compile with:
- *   mex close_h265_video.c -lavformat -lavcodec -lavutil
+ *   mex close_h265_video.c h265_frame_cache.c h265_prefetch.c h265_decode_common.c h265_transpose.c h265_hwaccel.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
@@ -17,20 +22,11 @@
 #include <libavcodec/avcodec.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "h265_frame_cache.h"
-
-/*
- * Free frame cache memory.
- */
-static void free_frame_cache(H265FrameCache *cache)
-{
-    if (!cache) return;
-
-    if (cache->frames) {
-        mxDestroyArray(cache->frames);
-    }
-    mxFree(cache);
-}
+#include "h265_io.h"
+#include "h265_registry.h"
+#include "h265_prefetch.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
@@ -49,6 +45,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     mxArray *fmt_ctx_field = mxGetField(prhs[0], 0, "fmt_ctx_ptr");
     mxArray *codec_ctx_field = mxGetField(prhs[0], 0, "codec_ctx_ptr");
     mxArray *cache_ptr_field = mxGetField(prhs[0], 0, "cache_ptr");
+    mxArray *registry_ptr_field = mxGetField(prhs[0], 0, "registry_ptr");
 
     if (!fmt_ctx_field || !codec_ctx_field) {
         mexErrMsgIdAndTxt("close_h265_video:badStruct",
@@ -59,20 +56,38 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     fmt_ctx = (AVFormatContext *)(uintptr_t)(*(uint64_t *)mxGetData(fmt_ctx_field));
     codec_ctx = (AVCodecContext *)(uintptr_t)(*(uint64_t *)mxGetData(codec_ctx_field));
 
-    /* Extract and free cache if present */
+    /* Extract and free cache if present, keeping its locks until the end */
+    H265MexLocks mex_locks;
+    memset(&mex_locks, 0, sizeof(mex_locks));
     if (cache_ptr_field) {
         H265FrameCache *cache = (H265FrameCache *)(uintptr_t)(*(uint64_t *)mxGetData(cache_ptr_field));
-        free_frame_cache(cache);
+        if (cache) {
+            h265_prefetch_free(cache->prefetch);
+            free_decode_state(&cache->decode_state);
+            mex_locks = cache->mex_locks;
+        }
+        h265_cache_free(cache);
     }
 
-    /* Free FFmpeg resources if not already freed */
-    if (codec_ctx) {
-        avcodec_free_context(&codec_ctx);
-    }
-    if (fmt_ctx) {
-        avformat_close_input(&fmt_ctx);
+    /* A do_share Reader hands its demuxer and decoder back to the registry */
+    H265VideoLease *lease = registry_ptr_field
+        ? (H265VideoLease *)(uintptr_t)(*(uint64_t *)mxGetData(registry_ptr_field))
+        : NULL;
+    if (lease) {
+        lease->release(lease, fmt_ctx, codec_ctx);
+    } else {
+        /* Free FFmpeg resources if not already freed */
+        if (codec_ctx) {
+            avcodec_free_context(&codec_ctx);
+        }
+        if (fmt_ctx) {
+            h265_io_close_input(&fmt_ctx);
+        }
     }
 
+    /* Nothing of the reader runs code from the locked MEX files any more */
+    h265_mex_unlock_all(&mex_locks);
+
     /* Note: We can't modify the input struct to set pointers to 0,
      * so the caller should discard video_info after calling this function.
      * Calling read_h265_frame after close will result in undefined behavior. */
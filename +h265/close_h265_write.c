@@ -5,11 +5,13 @@
  * Usage: close_h265_write(writer)
  *   writer - struct returned by open_h265_write
  *
- * This flushes any remaining frames from the encoder, writes the file
- * trailer, and frees all resources.
+ * This drains and stops the writer pipeline or segment encoder (if any),
+ * flushes any remaining frames from the encoder, writes the file trailer, and
+ * frees all resources. The MEX files locked for the writer's threads are then
+ * unlocked (see h265_mex_lock.h).
  *
  * Compile with:
- *   mex close_h265_write.c -lavformat -lavcodec -lavutil -lswscale
+ *   mex close_h265_write.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
@@ -18,6 +20,10 @@
 #include <libswscale/swscale.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include "h265_write_common.h"
+#include "h265_write_pipeline.h"
+#include "h265_segment_encoder.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
@@ -25,7 +31,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     AVCodecContext *codec_ctx = NULL;
     AVFrame *frame = NULL;
     AVPacket *pkt = NULL;
-    void *state = NULL;
+    WriterState *state = NULL;
     struct SwsContext *sws_ctx = NULL;
     int ret;
     int stream_idx;
@@ -56,7 +62,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     fmt_ctx = (AVFormatContext *)(uintptr_t)(*(uint64_t *)mxGetData(fmt_ctx_field));
     codec_ctx = (AVCodecContext *)(uintptr_t)(*(uint64_t *)mxGetData(codec_ctx_field));
     frame = (AVFrame *)(uintptr_t)(*(uint64_t *)mxGetData(frame_field));
-    state = (void *)(uintptr_t)(*(uint64_t *)mxGetData(state_field));
+    state = (WriterState *)(uintptr_t)(*(uint64_t *)mxGetData(state_field));
     stream_idx = (int)mxGetScalar(stream_idx_field);
     if (sws_ctx_field) {
         sws_ctx = (struct SwsContext *)(uintptr_t)(*(uint64_t *)mxGetData(sws_ctx_field));
@@ -69,6 +75,27 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         return;
     }
 
+    /* Finish every queued frame and stop the pipeline threads, which hand
+     * the encoder back to this thread */
+    if (state && state->pipeline) {
+        if (h265_write_pipeline_wait(state->pipeline) != 0) {
+            mexWarnMsgIdAndTxt("close_h265_write:pipelineError",
+                "Writer pipeline failed: %s", state->pipeline->error_message);
+        }
+        h265_write_pipeline_free(state->pipeline);
+        state->pipeline = NULL;
+    }
+
+    /* Encode the last partial segment and mux every outstanding one */
+    if (state && state->segments) {
+        if (h265_segment_encoder_flush(state->segments) != 0) {
+            mexWarnMsgIdAndTxt("close_h265_write:segmentError",
+                "Segment encoding failed: %s", state->segments->error_message);
+        }
+        h265_segment_encoder_free(state->segments);
+        state->segments = NULL;
+    }
+
     /* Allocate packet for flushing */
     pkt = av_packet_alloc();
     if (!pkt) {
@@ -76,37 +103,27 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Could not allocate packet");
     }
 
-    /* Flush encoder by sending NULL frame */
-    ret = avcodec_send_frame(codec_ctx, NULL);
-    if (ret < 0 && ret != AVERROR_EOF) {
-        av_packet_free(&pkt);
-        mexWarnMsgIdAndTxt("close_h265_write:flushError",
-            "Error flushing encoder");
-    }
-
-    /* Receive and write remaining packets */
-    while (1) {
-        ret = avcodec_receive_packet(codec_ctx, pkt);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+    /* Flush encoder by sending NULL frame, then write remaining packets */
+    ret = h265_encode_frame(fmt_ctx, codec_ctx, stream_idx, NULL, pkt, NULL);
+    switch (ret) {
+        case 0:
             break;
-        } else if (ret < 0) {
-            av_packet_free(&pkt);
+        case H265_ENCODE_SEND_ERROR:
+            mexWarnMsgIdAndTxt("close_h265_write:flushError",
+                "Error flushing encoder");
+            break;
+        case H265_ENCODE_RECEIVE_ERROR:
             mexWarnMsgIdAndTxt("close_h265_write:receiveError",
                 "Error receiving packet during flush");
             break;
-        }
-
-        /* Rescale timestamps */
-        av_packet_rescale_ts(pkt, codec_ctx->time_base,
-                             fmt_ctx->streams[stream_idx]->time_base);
-        pkt->stream_index = stream_idx;
-
-        /* Write packet */
-        ret = av_interleaved_write_frame(fmt_ctx, pkt);
-        if (ret < 0) {
+        case H265_ENCODE_WRITE_ERROR:
             mexWarnMsgIdAndTxt("close_h265_write:writeError",
                 "Error writing packet during flush");
-        }
+            break;
+        default:
+            mexWarnMsgIdAndTxt("close_h265_write:flushError",
+                "Unexpected encoder error during flush");
+            break;
     }
 
     av_packet_free(&pkt);
@@ -118,11 +135,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Error writing file trailer");
     }
 
-    /* Free resources */
+    /* Free resources, keeping the writer's locks until the end */
+    H265MexLocks mex_locks;
+    memset(&mex_locks, 0, sizeof(mex_locks));
     if (sws_ctx) {
         sws_freeContext(sws_ctx);
     }
     if (state) {
+        mex_locks = state->mex_locks;
         mxFree(state);
     }
     if (frame) {
@@ -137,4 +157,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         }
         avformat_free_context(fmt_ctx);
     }
+
+    /* Every thread of the writer has been joined */
+    h265_mex_unlock_all(&mex_locks);
 }
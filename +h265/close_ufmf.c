@@ -0,0 +1,35 @@
+/*
+ * close_ufmf.c
+ * MEX function to close a UFMF file opened with open_ufmf.
+ *
+ * Usage: close_ufmf(ufmf)
+ *   ufmf - struct returned by open_ufmf
+ *
+ * After calling this function, the ufmf struct should not be used.
+ *
+ * Compile with:
+ *   mex close_ufmf.c h265_ufmf.c
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include "h265_ufmf.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    /* Check arguments */
+    if (nrhs != 1) {
+        mexErrMsgIdAndTxt("close_ufmf:nrhs", "One input required: ufmf");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("close_ufmf:notStruct", "Argument must be ufmf struct from open_ufmf");
+    }
+
+    mxArray *ufmf_field = mxGetField(prhs[0], 0, "ufmf_ptr");
+    if (!ufmf_field) {
+        mexErrMsgIdAndTxt("close_ufmf:badStruct", "ufmf struct must have a ufmf_ptr field");
+    }
+
+    H265Ufmf *ufmf = (H265Ufmf *)(uintptr_t)(*(uint64_t *)mxGetData(ufmf_field));
+    h265_ufmf_close(ufmf);
+}
@@ -4,41 +4,48 @@ function h265_from_ufmf(h265_file, ufmf_file, varargin)
 %   h265_from_ufmf(h265_file, ufmf_file)
 %   h265_from_ufmf(h265_file, ufmf_file, 'block_size', 1000)
 %
-%   Reads frames from a UFMF file in blocks and writes them to an h.265
-%   encoded MP4 file.
+%   Decodes the UFMF file natively (h265.open_ufmf) and streams its frames
+%   straight into an h.265 encoded MP4 file with Writer.write_ufmf, so no
+%   frames pass through MATLAB arrays.  Progress is printed after every
+%   block of frames.
 %
 %   Arguments:
 %     h265_file  - path to output .mp4 file (will be overwritten if exists)
 %     ufmf_file  - path to input .ufmf file
 %
 %   Optional parameters:
-%     block_size  - number of frames to read/write at once (default: 1000)
+%     block_size  - number of frames to convert between progress reports (default: 1000)
 %     frame_rate  - output frame rate in fps (default: computed from timestamps)
 %     frame_count - number of frames to convert (default: all frames)
+%     segment_encoder_count - encode this many GOP-aligned segments in
+%                             parallel (default: 1, a single encoder)
+%     do_pipeline - decode the next frames while earlier ones are encoded on
+%                   the writer's pipeline threads (default: true unless
+%                   segment_encoder_count > 1, which it cannot be combined with)
 %
 %   Example:
 %     h265_from_ufmf('movie.mp4', 'movie.ufmf');
 %     h265_from_ufmf('movie.mp4', 'movie.ufmf', 'block_size', 500);
 %     h265_from_ufmf('movie.mp4', 'movie.ufmf', 'frame_rate', 30);
 %     h265_from_ufmf('movie.mp4', 'movie.ufmf', 'frame_count', 10000);
+%     h265_from_ufmf('movie.mp4', 'movie.ufmf', 'segment_encoder_count', 4);
 
-[block_size, frame_rate, frame_count] = myparse(varargin, ...
-  'block_size', 1000, 'frame_rate', [], 'frame_count', []);
+[block_size, frame_rate, frame_count, segment_encoder_count, do_pipeline] = myparse(varargin, ...
+  'block_size', 1000, 'frame_rate', [], 'frame_count', [], 'segment_encoder_count', 1, 'do_pipeline', []);
 
-% Read UFMF header
-header = ufmf_read_header(ufmf_file);
-header_cleanup = onCleanup(@() fclose(header.fid));
+if isempty(do_pipeline)
+  do_pipeline = (segment_encoder_count <= 1);
+end
 
-% Get video properties
-height = header.nr;
-width = header.nc;
-is_color = header.ncolors == 3;
+% Open the UFMF file: header, index, and first mean
+ufmf = h265.open_ufmf(ufmf_file);
+ufmf_cleanup = onCleanup(@() h265.close_ufmf(ufmf));
 
 % Determine frame rate
 if isempty(frame_rate)
-  if header.nframes > 1
-    timestamps = header.timestamps;
-    avg_dt = (timestamps(end) - timestamps(1)) / (header.nframes - 1);
+  if ufmf.frame_count > 1
+    timestamps = ufmf.timestamps;
+    avg_dt = (timestamps(end) - timestamps(1)) / (ufmf.frame_count - 1);
     frame_rate = 1 / avg_dt;
   else
     error('h265_from_ufmf:noFrameRate', ...
@@ -48,52 +55,29 @@ end
 
 % Determine number of frames to convert
 if isempty(frame_count)
-  num_frames = header.nframes;
+  num_frames = ufmf.frame_count;
 else
-  num_frames = min(frame_count, header.nframes);
+  num_frames = min(frame_count, ufmf.frame_count);
 end
 
 % Create h.265 writer
-writer = h265.Writer(h265_file, width, height, frame_rate, 'is_gray', ~is_color);
+writer = h265.Writer(h265_file, ufmf.width, ufmf.height, frame_rate, 'is_gray', ~ufmf.is_color, ...
+  'segment_encoder_count', segment_encoder_count, 'do_pipeline', do_pipeline);
 
-% Process frames in blocks
+% Transcode in blocks, reporting progress after each
 num_blocks = ceil(num_frames / block_size);
-frames_written = 0;
 
 for block = 1:num_blocks
-  % Compute frame range for this block
   start_frame = (block - 1) * block_size + 1;
   end_frame = min(block * block_size, num_frames);
-  frames_in_block = end_frame - start_frame + 1;
-
-  % Pre-allocate block array
-  if is_color
-    block_data = zeros(height, width, 3, frames_in_block, 'uint8');
-  else
-    block_data = zeros(height, width, frames_in_block, 'uint8');
-  end
-
-  % Read frames in this block
-  for i = 1:frames_in_block
-    frame_idx = start_frame + i - 1;
-    im = ufmf_read_frame(header, frame_idx);
+  writer.write_ufmf(ufmf, start_frame, end_frame);
 
-    if is_color
-      block_data(:, :, :, i) = im;
-    else
-      block_data(:, :, i) = im;
-    end
-  end
-
-  % Write block to h.265
-  writer.write(block_data);
-
-  frames_written = frames_written + frames_in_block;
-  fprintf('Converted %d/%d frames (%.1f%%)\n', frames_written, num_frames, ...
-    100 * frames_written / num_frames);
+  fprintf('Converted %d/%d frames (%.1f%%)\n', end_frame, num_frames, ...
+    100 * end_frame / num_frames);
 end
 
-% writer and header_cleanup close automatically when function returns
+% Flush the encoder and close the output before reporting it done
+clear writer;
 
 fprintf('Done. Output: %s\n', h265_file);
-end
+end % function
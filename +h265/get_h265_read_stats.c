@@ -0,0 +1,107 @@
+/*
+ * get_h265_read_stats.c
+ * MEX function to return the read path timing and counters of a reader
+ * opened with do_collect_stats (see h265_stats.h).
+ *
+ * Usage: stats = get_h265_read_stats(video_info)
+ *        stats = get_h265_read_stats(video_info, do_reset)
+ *   video_info - struct returned by open_h265_video
+ *   do_reset   - zero the counters after reading them (default 0)
+ *
+ * Returns a struct whose _count fields are counts and whose _time fields are
+ * seconds, summed over every read since open_h265_video or the last reset:
+ *   seek_count, forward_count, seek_time - seeks (each with a decoder flush),
+ *                          reads that decoded on instead, and time seeking
+ *   packet_count, demux_time  - video packets read, time in av_read_frame
+ *   send_packet_time, receive_frame_time - time in the decoder
+ *   decoded_frame_count    - frames out of the decoder
+ *   converted_frame_count  - of those, frames converted for output
+ *   discarded_frame_count  - the rest: decoded only to reach a later frame
+ *   download_time          - copying frames off a hardware decoder
+ *   scale_time, copy_time  - sws_scale, and the transpose into MATLAB layout
+ *   returned_frame_count   - frames handed back to MATLAB
+ *   cache_hit_count, prefetch_hit_count, cache_miss_count - single-frame and
+ *                          GOP reads served by the GOP cache, by the
+ *                          prefetched GOP, and by decoding the GOP
+ *   cache_evict_count      - GOPs evicted from the cache
+ * All are 0 for a reader opened without do_collect_stats.
+ *
+ * Compile with:
+ *   mex get_h265_read_stats.c -lavformat -lavcodec -lavutil
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include <string.h>
+#include "h265_frame_cache.h"
+
+static const char *stat_field_names[] = {
+    "seek_count", "forward_count", "seek_time",
+    "packet_count", "demux_time", "send_packet_time", "receive_frame_time",
+    "decoded_frame_count", "converted_frame_count", "discarded_frame_count",
+    "download_time", "scale_time", "copy_time",
+    "returned_frame_count",
+    "cache_hit_count", "prefetch_hit_count", "cache_miss_count", "cache_evict_count"
+};
+
+static void set_count(mxArray *result, const char *name, int64_t count)
+{
+    mxSetField(result, 0, name, mxCreateDoubleScalar((double)count));
+}
+
+static void set_time(mxArray *result, const char *name, int64_t microseconds)
+{
+    mxSetField(result, 0, name, mxCreateDoubleScalar((double)microseconds / 1e6));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    /* Check arguments */
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgIdAndTxt("get_h265_read_stats:nrhs",
+            "Inputs must be video_info and optional do_reset");
+    }
+    if (nlhs > 1) {
+        mexErrMsgIdAndTxt("get_h265_read_stats:nlhs", "One output allowed");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("get_h265_read_stats:notStruct", "First argument must be video_info struct");
+    }
+    int do_reset = nrhs == 2 && mxGetNumberOfElements(prhs[1]) == 1 && mxGetScalar(prhs[1]) != 0;
+
+    mxArray *cache_ptr_field = mxGetField(prhs[0], 0, "cache_ptr");
+    if (!cache_ptr_field) {
+        mexErrMsgIdAndTxt("get_h265_read_stats:badStruct", "video_info missing required fields");
+    }
+    H265FrameCache *cache = (H265FrameCache *)(uintptr_t)(*(uint64_t *)mxGetData(cache_ptr_field));
+    if (!cache) {
+        mexErrMsgIdAndTxt("get_h265_read_stats:nullPtr", "Invalid video_info: null pointers");
+    }
+
+    const H265ReadStats *stats = &cache->stats;
+    mxArray *result = mxCreateStructMatrix(1, 1, sizeof(stat_field_names) / sizeof(stat_field_names[0]),
+                                           stat_field_names);
+    set_count(result, "seek_count", stats->seek_count);
+    set_count(result, "forward_count", stats->forward_count);
+    set_time(result, "seek_time", stats->seek_us);
+    set_count(result, "packet_count", stats->packet_count);
+    set_time(result, "demux_time", stats->demux_us);
+    set_time(result, "send_packet_time", stats->send_packet_us);
+    set_time(result, "receive_frame_time", stats->receive_frame_us);
+    set_count(result, "decoded_frame_count", stats->decoded_frame_count);
+    set_count(result, "converted_frame_count", stats->converted_frame_count);
+    set_count(result, "discarded_frame_count", stats->decoded_frame_count - stats->converted_frame_count);
+    set_time(result, "download_time", stats->download_us);
+    set_time(result, "scale_time", stats->scale_us);
+    set_time(result, "copy_time", stats->copy_us);
+    set_count(result, "returned_frame_count", stats->returned_frame_count);
+    set_count(result, "cache_hit_count", stats->cache_hit_count);
+    set_count(result, "prefetch_hit_count", stats->prefetch_hit_count);
+    set_count(result, "cache_miss_count", stats->cache_miss_count);
+    set_count(result, "cache_evict_count", stats->cache_evict_count);
+
+    if (do_reset) {
+        memset(&cache->stats, 0, sizeof(cache->stats));
+    }
+    plhs[0] = result;
+}
@@ -0,0 +1,103 @@
+/*
+ * get_h265_write_stats.c
+ * MEX function to return the write path timing and counters of a writer
+ * opened with do_collect_stats (see h265_stats.h).
+ *
+ * Usage: stats = get_h265_write_stats(writer)
+ *        stats = get_h265_write_stats(writer, do_reset)
+ *   writer   - struct returned by open_h265_write
+ *   do_reset - zero the counters after reading them (default 0)
+ *
+ * Returns a struct whose _count fields are counts and whose _time fields are
+ * seconds, summed over every thread that converted or encoded frames since
+ * open_h265_write or the last reset:
+ *   frame_count        - frames converted for the encoder
+ *   convert_time       - transpose and color conversion into encoder frames
+ *   send_frame_time    - avcodec_send_frame
+ *   receive_packet_time - avcodec_receive_packet, draining the encoder
+ *   packet_count, packet_bytes - packets muxed, and their total size
+ *   write_packet_time  - av_interleaved_write_frame
+ * Frames still queued on a pipelined writer's threads, or in a segment not
+ * yet muxed, are not counted until they are done (after wait_h265_write, all
+ * are). Threads are timed separately, so times can add up to more than the
+ * wall-clock time. All are 0 for a writer opened without do_collect_stats.
+ *
+ * Compile with:
+ *   mex get_h265_write_stats.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c -lavformat -lavcodec -lavutil -lswscale -lpthread
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include <string.h>
+#include "h265_write_common.h"
+#include "h265_write_pipeline.h"
+#include "h265_segment_encoder.h"
+
+static const char *stat_field_names[] = {
+    "frame_count", "convert_time", "send_frame_time", "receive_packet_time",
+    "packet_count", "packet_bytes", "write_packet_time"
+};
+
+static void set_count(mxArray *result, const char *name, int64_t count)
+{
+    mxSetField(result, 0, name, mxCreateDoubleScalar((double)count));
+}
+
+static void set_time(mxArray *result, const char *name, int64_t microseconds)
+{
+    mxSetField(result, 0, name, mxCreateDoubleScalar((double)microseconds / 1e6));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    /* Check arguments */
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgIdAndTxt("get_h265_write_stats:nrhs",
+            "Inputs must be writer struct and optional do_reset");
+    }
+    if (nlhs > 1) {
+        mexErrMsgIdAndTxt("get_h265_write_stats:nlhs", "One output allowed");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("get_h265_write_stats:notStruct",
+            "First argument must be writer struct from open_h265_write");
+    }
+    int do_reset = nrhs == 2 && mxGetNumberOfElements(prhs[1]) == 1 && mxGetScalar(prhs[1]) != 0;
+
+    mxArray *state_field = mxGetField(prhs[0], 0, "state_ptr");
+    if (!state_field) {
+        mexErrMsgIdAndTxt("get_h265_write_stats:badStruct",
+            "Writer struct is missing required fields");
+    }
+    WriterState *state = (WriterState *)(uintptr_t)(*(uint64_t *)mxGetData(state_field));
+    if (!state) {
+        mexErrMsgIdAndTxt("get_h265_write_stats:nullPtr",
+            "Invalid writer: null pointers. Was close_h265_write already called?");
+    }
+
+    /* The MATLAB thread's own counts, plus those of the worker threads */
+    H265WriteStats stats = state->stats;
+    if (state->pipeline) {
+        h265_write_pipeline_add_stats(state->pipeline, &stats, do_reset);
+    }
+    if (state->segments) {
+        h265_write_stats_add(&stats, &state->segments->stats);
+    }
+    if (do_reset) {
+        memset(&state->stats, 0, sizeof(state->stats));
+        if (state->segments) {
+            memset(&state->segments->stats, 0, sizeof(state->segments->stats));
+        }
+    }
+
+    mxArray *result = mxCreateStructMatrix(1, 1, sizeof(stat_field_names) / sizeof(stat_field_names[0]),
+                                           stat_field_names);
+    set_count(result, "frame_count", stats.frame_count);
+    set_time(result, "convert_time", stats.convert_us);
+    set_time(result, "send_frame_time", stats.send_frame_us);
+    set_time(result, "receive_packet_time", stats.receive_packet_us);
+    set_count(result, "packet_count", stats.packet_count);
+    set_count(result, "packet_bytes", stats.packet_bytes);
+    set_time(result, "write_packet_time", stats.write_packet_us);
+    plhs[0] = result;
+}
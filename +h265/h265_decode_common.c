@@ -4,82 +4,328 @@
  */
 
 #include "h265_decode_common.h"
+#include "h265_hwaccel.h"
 
 /*
- * Copy an FFmpeg frame in row-major order (fast sequential memcpy).
- * Caller should use MATLAB permute() to convert to column-major:
- *   grayscale: permute(data, [2 1 3])
- *   RGB: permute(data, [3 2 1 4])
+ * Transpose one row-major plane of 1- or 2-byte samples into a column-major
+ * height x width matrix at out_data.
  */
-void copy_frame_rowmajor(AVFrame *out_frame, int width, int height,
-                         int is_grayscale, uint8_t *out_data)
+static void transpose_plane(const uint8_t *plane, int linesize, int width, int height,
+                            int bytes_per_sample, uint8_t *out_data)
+{
+  if (bytes_per_sample == 2) {
+    h265_transpose_u16((const uint16_t *)plane, linesize / 2, (uint16_t *)out_data,
+                       height, height, width);
+  } else {
+    h265_transpose_u8(plane, linesize, out_data, height, height, width);
+  }
+}
+
+/*
+ * Copy a converted frame (GRAY or GBRP, at any bit depth) into MATLAB
+ * column-major layout. GBRP stores planes in G, B, R order; MATLAB wants R, G, B.
+ */
+void copy_frame_colmajor(const AVFrame *out_frame, int width, int height,
+                         int is_grayscale, int bytes_per_sample, uint8_t *out_data)
 {
   if (is_grayscale) {
-    /* Copy row by row (handles linesize padding) */
-    for (int y = 0; y < height; y++) {
-      memcpy(out_data + y * width,
-             out_frame->data[0] + y * out_frame->linesize[0],
-             width);
+    transpose_plane(out_frame->data[0], out_frame->linesize[0], width, height,
+                    bytes_per_sample, out_data);
+  } else {
+    static const int gbrp_plane_for_channel[3] = {2, 0, 1};
+    size_t plane_size = (size_t)width * height * bytes_per_sample;
+    for (int c = 0; c < 3; c++) {
+      int plane = gbrp_plane_for_channel[c];
+      transpose_plane(out_frame->data[plane], out_frame->linesize[plane], width, height,
+                      bytes_per_sample, out_data + c * plane_size);
     }
+  }
+}
+
+static int setup_converter(H265DecodeState *state, enum AVPixelFormat src_pix_fmt);
+
+/*
+ * Crop, scale, and color convert state->frame, and store it column-major at
+ * out_data. For unscaled grayscale output from a YUV stream (what the Writer
+ * produces with is_gray), the Y plane already is the image and is transposed
+ * straight into out_data. Frames downloaded from a hardware decoder may come
+ * in another format than the stream's, so the converter follows the frames.
+ */
+int convert_frame_colmajor(H265DecodeState *state, uint8_t *out_data)
+{
+  if (state->frame->format != state->src_pix_fmt &&
+      !setup_converter(state, (enum AVPixelFormat)state->frame->format)) {
+    return -1;
+  }
+  if (state->is_cropped) {
+    /* Only moves the plane pointers; the crop is validated against the
+     * stream size, which every decoded frame has */
+    const H265OutputGeometry *geometry = &state->geometry;
+    state->frame->crop_left = geometry->crop_x;
+    state->frame->crop_top = geometry->crop_y;
+    state->frame->crop_right = state->frame->width - geometry->crop_x - geometry->crop_width;
+    state->frame->crop_bottom = state->frame->height - geometry->crop_y - geometry->crop_height;
+    av_frame_apply_cropping(state->frame, AV_FRAME_CROP_UNALIGNED);
+  }
+  int bytes_per_sample = output_bytes_per_sample(&state->geometry);
+  int64_t start = h265_stats_start(state->stats);
+  if (state->is_luma_direct) {
+    transpose_plane(state->frame->data[0], state->frame->linesize[0], state->width,
+                    state->height, bytes_per_sample, out_data);
+    if (state->stats) state->stats->copy_us += h265_stats_elapsed_us(start);
+    return 0;
+  }
+  sws_scale(state->sws_ctx,
+            (const uint8_t * const*)state->frame->data,
+            state->frame->linesize, 0, state->geometry.crop_height,
+            state->out_frame->data, state->out_frame->linesize);
+  if (state->stats) {
+    int64_t scaled = av_gettime_relative();
+    state->stats->scale_us += scaled - start;
+    start = scaled;
+  }
+  copy_frame_colmajor(state->out_frame, state->width, state->height,
+                      state->is_grayscale, bytes_per_sample, out_data);
+  if (state->stats) state->stats->copy_us += h265_stats_elapsed_us(start);
+  return 0;
+}
+
+/*
+ * Bit depth of plane 0 of pix_fmt if it is plain luma in native byte order
+ * (one byte per sample up to 8 bits, two above), or 0 if it is not.
+ */
+static int luma_plane_depth(enum AVPixelFormat pix_fmt)
+{
+  switch (pix_fmt) {
+    case AV_PIX_FMT_GRAY8:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+      return 8;
+    case AV_PIX_FMT_GRAY10:
+    case AV_PIX_FMT_YUV420P10:
+    case AV_PIX_FMT_YUV422P10:
+    case AV_PIX_FMT_YUV444P10:
+      return 10;
+    case AV_PIX_FMT_GRAY12:
+    case AV_PIX_FMT_YUV420P12:
+    case AV_PIX_FMT_YUV422P12:
+    case AV_PIX_FMT_YUV444P12:
+      return 12;
+    default:
+      return 0;
+  }
+}
+
+enum AVPixelFormat decoder_pix_fmt(const AVCodecContext *codec_ctx)
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(codec_ctx->pix_fmt);
+  if (desc && (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) && codec_ctx->sw_pix_fmt != AV_PIX_FMT_NONE) {
+    return codec_ctx->sw_pix_fmt;
+  }
+  return codec_ctx->pix_fmt;
+}
+
+int output_bit_depth(enum AVPixelFormat pix_fmt)
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+  int depth = desc ? desc->comp[0].depth : 8;
+  if (depth <= 8) return 8;
+  if (depth == 10 || depth == 12) return depth;
+  return 16;
+}
+
+size_t output_frame_size(const H265OutputGeometry *geometry, int is_grayscale)
+{
+  size_t sample_count = (size_t)geometry->width * geometry->height * (is_grayscale ? 1 : 3);
+  return sample_count * output_bytes_per_sample(geometry);
+}
+
+mxArray *create_frame_array(const H265OutputGeometry *geometry, int is_grayscale, int frame_count)
+{
+  mxClassID class_id = output_bytes_per_sample(geometry) == 2 ? mxUINT16_CLASS : mxUINT8_CLASS;
+  if (is_grayscale) {
+    mwSize dims[3] = {geometry->height, geometry->width, frame_count};
+    return mxCreateUninitNumericArray(3, dims, class_id, mxREAL);
   } else {
-    /* RGB: copy row by row (handles linesize padding) */
-    int row_bytes = width * 3;
-    for (int y = 0; y < height; y++) {
-      memcpy(out_data + y * row_bytes,
-             out_frame->data[0] + y * out_frame->linesize[0],
-             row_bytes);
+    mwSize dims[4] = {geometry->height, geometry->width, 3, frame_count};
+    return mxCreateUninitNumericArray(4, dims, class_id, mxREAL);
+  }
+}
+
+/*
+ * Read a real double field of video_info with element_count elements into
+ * values. Returns 1 if it was read, 0 if it is missing or empty, -1 if it is
+ * malformed.
+ */
+static int get_geometry_field(const mxArray *video_info, const char *name,
+                              int element_count, int *values)
+{
+  const mxArray *field = mxGetField(video_info, 0, name);
+  if (!field || mxIsEmpty(field)) return 0;
+  if (!mxIsDouble(field) || mxIsComplex(field) ||
+      (int)mxGetNumberOfElements(field) != element_count) {
+    return -1;
+  }
+  const double *data = mxGetPr(field);
+  for (int i = 0; i < element_count; i++) {
+    if (!(data[i] >= 0 && data[i] <= INT32_MAX) || data[i] != (int)data[i]) return -1;
+    values[i] = (int)data[i];
+  }
+  return 1;
+}
+
+int get_output_geometry(const mxArray *video_info, const AVCodecContext *codec_ctx,
+                        H265OutputGeometry *geometry)
+{
+  int source_width = codec_ctx->width;
+  int source_height = codec_ctx->height;
+  int crop_rect[4];
+  int output_size[2];
+
+  int has_crop = get_geometry_field(video_info, "crop_rect", 4, crop_rect);
+  int has_output_size = get_geometry_field(video_info, "output_size", 2, output_size);
+  if (has_crop < 0 || has_output_size < 0) return 0;
+
+  if (has_crop) {
+    geometry->crop_x = crop_rect[0] - 1;
+    geometry->crop_y = crop_rect[1] - 1;
+    geometry->crop_width = crop_rect[2];
+    geometry->crop_height = crop_rect[3];
+    if (geometry->crop_x < 0 || geometry->crop_y < 0 ||
+        geometry->crop_width < 1 || geometry->crop_height < 1 ||
+        geometry->crop_width > source_width - geometry->crop_x ||
+        geometry->crop_height > source_height - geometry->crop_y) {
+      return 0;
     }
+  } else {
+    geometry->crop_x = 0;
+    geometry->crop_y = 0;
+    geometry->crop_width = source_width;
+    geometry->crop_height = source_height;
+  }
+
+  if (has_output_size) {
+    geometry->height = output_size[0];
+    geometry->width = output_size[1];
+    if (geometry->width < 1 || geometry->height < 1) return 0;
+  } else {
+    geometry->width = geometry->crop_width;
+    geometry->height = geometry->crop_height;
   }
+  geometry->bit_depth = output_bit_depth(decoder_pix_fmt(codec_ctx));
+  return 1;
 }
 
 /*
- * Initialize decode state. Returns 1 on success, 0 on failure.
+ * (Re)create the converter from frames of src_pix_fmt to the output: nothing
+ * for the direct luma path, else a swscale context and its output frame.
+ * Returns 1 on success, 0 on failure.
  */
-int init_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
-                      int width, int height, int is_grayscale)
+static int setup_converter(H265DecodeState *state, enum AVPixelFormat src_pix_fmt)
 {
-  memset(state, 0, sizeof(H265DecodeState));
+  const H265OutputGeometry *geometry = &state->geometry;
+  int width = geometry->width;
+  int height = geometry->height;
+  int is_grayscale = state->is_grayscale;
 
-  state->width = width;
-  state->height = height;
-  state->is_grayscale = is_grayscale;
-  state->frame_size = is_grayscale ? (size_t)width * height : (size_t)width * height * 3;
+  sws_freeContext(state->sws_ctx);
+  state->sws_ctx = NULL;
+  av_frame_free(&state->out_frame);
+  state->src_pix_fmt = src_pix_fmt;
+  state->is_luma_direct = is_grayscale && luma_plane_depth(src_pix_fmt) == geometry->bit_depth &&
+                          width == geometry->crop_width && height == geometry->crop_height;
+  if (state->is_luma_direct) return 1;
 
-  state->frame = av_frame_alloc();
   state->out_frame = av_frame_alloc();
-  state->pkt = av_packet_alloc();
+  if (!state->out_frame) return 0;
 
-  if (!state->frame || !state->out_frame || !state->pkt) {
-    av_frame_free(&state->frame);
-    av_frame_free(&state->out_frame);
-    av_packet_free(&state->pkt);
-    return 0;
+  /* Planar output, so each plane can be transposed straight into MATLAB order.
+   * High-bit-depth output keeps the stream's sample values (0-1023 for 10-bit). */
+  enum AVPixelFormat out_pix_fmt;
+  switch (geometry->bit_depth) {
+    case 10:
+      out_pix_fmt = is_grayscale ? AV_PIX_FMT_GRAY10 : AV_PIX_FMT_GBRP10;
+      break;
+    case 12:
+      out_pix_fmt = is_grayscale ? AV_PIX_FMT_GRAY12 : AV_PIX_FMT_GBRP12;
+      break;
+    case 16:
+      out_pix_fmt = is_grayscale ? AV_PIX_FMT_GRAY16 : AV_PIX_FMT_GBRP16;
+      break;
+    default:
+      out_pix_fmt = is_grayscale ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_GBRP;
+      break;
   }
-
-  enum AVPixelFormat out_pix_fmt = is_grayscale ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_RGB24;
   state->out_frame->format = out_pix_fmt;
   state->out_frame->width = width;
   state->out_frame->height = height;
-  if (av_frame_get_buffer(state->out_frame, 0) < 0) {
-    av_frame_free(&state->frame);
-    av_frame_free(&state->out_frame);
-    av_packet_free(&state->pkt);
-    return 0;
-  }
+  if (av_frame_get_buffer(state->out_frame, 0) < 0) return 0;
 
-  state->sws_ctx = sws_getContext(width, height, codec_ctx->pix_fmt,
+  state->sws_ctx = sws_getContext(geometry->crop_width, geometry->crop_height, src_pix_fmt,
                                   width, height, out_pix_fmt,
                                   SWS_BILINEAR, NULL, NULL, NULL);
-  if (!state->sws_ctx) {
-    av_frame_free(&state->frame);
-    av_frame_free(&state->out_frame);
-    av_packet_free(&state->pkt);
-    return 0;
+  if (!state->sws_ctx) return 0;
+
+  /* Keep grayscale output in the stream's own range, so scaled frames have
+   * the same levels as ones taken straight from the Y plane */
+  if (is_grayscale) {
+    int *inv_table, *table;
+    int src_range, dst_range, brightness, contrast, saturation;
+    if (sws_getColorspaceDetails(state->sws_ctx, &inv_table, &src_range, &table, &dst_range,
+                                 &brightness, &contrast, &saturation) >= 0) {
+      sws_setColorspaceDetails(state->sws_ctx, inv_table, src_range, table, src_range,
+                               brightness, contrast, saturation);
+    }
   }
 
   return 1;
 }
 
+/*
+ * Initialize decode state. Returns 1 on success, 0 on failure.
+ */
+int init_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
+                      const H265OutputGeometry *geometry, int is_grayscale)
+{
+  memset(state, 0, sizeof(H265DecodeState));
+
+  state->geometry = *geometry;
+  state->is_cropped = geometry->crop_x != 0 || geometry->crop_y != 0 ||
+                      geometry->crop_width != codec_ctx->width ||
+                      geometry->crop_height != codec_ctx->height;
+  state->width = geometry->width;
+  state->height = geometry->height;
+  state->is_grayscale = is_grayscale;
+  state->frame_size = output_frame_size(geometry, is_grayscale);
+
+  state->frame = av_frame_alloc();
+  state->pkt = av_packet_alloc();
+  if (!state->frame || !state->pkt ||
+      (codec_ctx->hw_device_ctx && !(state->sw_frame = av_frame_alloc())) ||
+      !setup_converter(state, decoder_pix_fmt(codec_ctx))) {
+    free_decode_state(state);
+    return 0;
+  }
+  return 1;
+}
+
+int prepare_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
+                         const H265OutputGeometry *geometry, int is_grayscale)
+{
+  if (state->frame && state->is_grayscale == is_grayscale &&
+      memcmp(&state->geometry, geometry, sizeof(H265OutputGeometry)) == 0) {
+    return 1;
+  }
+  free_decode_state(state);
+  return init_decode_state(state, codec_ctx, geometry, is_grayscale);
+}
+
 /*
  * Free decode state resources.
  */
@@ -89,111 +335,284 @@ void free_decode_state(H265DecodeState *state)
   if (state->pkt) av_packet_free(&state->pkt);
   if (state->frame) av_frame_free(&state->frame);
   if (state->out_frame) av_frame_free(&state->out_frame);
+  if (state->sw_frame) av_frame_free(&state->sw_frame);
+  av_freep(&state->captured);
   memset(state, 0, sizeof(H265DecodeState));
 }
 
 /*
- * Decode frames in [target_start, target_end] into frame_buffer using row-major copy.
+ * Store state->frame, frame frame_idx, if it is in [target_start, target_end],
+ * wanted, and not captured yet. slot_for_frame maps frames of the range to
+ * output slots (-1 for frames that are not wanted); NULL means slot =
+ * position in range. Frames decoded on a device are downloaded only when they
+ * are stored.
+ * Returns 0 on success, -1 if the frame could not be downloaded or converted.
+ */
+static int capture_frame(H265DecodeState *state, int frame_idx,
+                          int target_start, int target_end, const int *slot_for_frame,
+                          int *captured, int *frames_captured,
+                          uint8_t *frame_buffer, size_t frame_size)
+{
+  if (frame_idx >= target_start && frame_idx <= target_end) {
+    int local_idx = frame_idx - target_start;
+    int slot = slot_for_frame ? slot_for_frame[local_idx] : local_idx;
+    if (slot >= 0 && !captured[local_idx]) {
+      int64_t start = h265_stats_start(state->stats);
+      if (h265_hwaccel_download(state->frame, state->sw_frame) < 0) return -1;
+      if (state->stats && state->sw_frame) state->stats->download_us += h265_stats_elapsed_us(start);
+      if (convert_frame_colmajor(state, frame_buffer + slot * frame_size) < 0) return -1;
+      if (state->stats) state->stats->converted_frame_count++;
+      captured[local_idx] = 1;
+      (*frames_captured)++;
+    }
+  }
+  return 0;
+}
+
+void seek_decoder(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+                  int64_t *dts_array, int target_start, H265DecodePosition *position,
+                  H265ReadStats *stats)
+{
+  int is_ahead = position && position->forward_frame_limit >= 0 &&
+                 position->next_frame >= 0 && target_start >= position->next_frame &&
+                 target_start - position->next_frame <= position->forward_frame_limit;
+  if (position) position->next_frame = -1;
+  if (is_ahead) {
+    if (stats) stats->forward_count++;
+    return;
+  }
+
+  int64_t start = h265_stats_start(stats);
+  int ret = av_seek_frame(fmt_ctx, video_stream_idx, dts_array[target_start], AVSEEK_FLAG_BACKWARD);
+  if (ret < 0) {
+    avformat_seek_file(fmt_ctx, video_stream_idx, INT64_MIN, 0, 0, 0);
+  }
+  avcodec_flush_buffers(codec_ctx);
+  if (stats) {
+    stats->seek_count++;
+    stats->seek_us += h265_stats_elapsed_us(start);
+  }
+}
+
+/*
+ * Decode frames in [target_start, target_end] into frame_buffer, column-major.
+ * Frames are matched to their index by PTS, so decoder output delay (B-frame
+ * reordering, frame threading) only means more packets are read before the
+ * range is complete.
  * Returns: number of frames captured, or -1 on error
  */
-int decode_frame_range_rowmajor(
+int decode_frame_range_colmajor(
     AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
     int64_t *dts_array, int64_t pts_increment,
     int target_start, int target_end,
-    H265DecodeState *state,
+    H265DecodeState *state, H265DecodePosition *position,
+    uint8_t *frame_buffer, size_t frame_size)
+{
+  return decode_frame_list_colmajor(fmt_ctx, codec_ctx, video_stream_idx,
+                                    dts_array, pts_increment, target_start, target_end,
+                                    NULL, state, position, frame_buffer, frame_size);
+}
+
+/*
+ * Decode the wanted frames of [target_start, target_end] into their slots of
+ * frame_buffer. Decoding starts at the keyframe before target_start, or where
+ * the decoder stands if that is close enough ahead, and stops as soon as the
+ * last wanted frame has been captured, so unwanted frames are decoded only as
+ * far as references require and are never color converted.
+ *
+ * GOPs are closed, so without a position to keep, once the keyframe of a GOP
+ * after the range is read no later packet is needed: the decoder is drained
+ * instead, which also catches the tail at end of stream. Draining ends the
+ * stream for the decoder, though, so with a position the decoder is fed
+ * packets until the range is out, and is left holding the frames after it.
+ * Returns: number of frames captured, or -1 on error
+ */
+int decode_frame_list_colmajor(
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    int target_start, int target_end, const int *slot_for_frame,
+    H265DecodeState *state, H265DecodePosition *position,
     uint8_t *frame_buffer, size_t frame_size)
 {
   int ret;
-  int num_frames = target_end - target_start + 1;
+  int range_frame_count = target_end - target_start + 1;
+  int num_frames = range_frame_count;
   int frames_captured = 0;
+  int is_keeping_position = position && position->forward_frame_limit >= 0;
+  int last_frame = -1;      /* Index of the last frame out of the decoder */
+  int is_drained = 0;
 
-  /* Track which frames we've captured */
-  int *captured = (int *)mxCalloc(num_frames, sizeof(int));
-  if (!captured) return -1;
-
-  /* Seek to target start position */
-  ret = av_seek_frame(fmt_ctx, video_stream_idx, dts_array[target_start], AVSEEK_FLAG_BACKWARD);
-  if (ret < 0) {
-    avformat_seek_file(fmt_ctx, video_stream_idx, INT64_MIN, 0, 0, 0);
+  if (slot_for_frame) {
+    num_frames = 0;
+    for (int i = 0; i < range_frame_count; i++) {
+      if (slot_for_frame[i] >= 0) num_frames++;
+    }
   }
-  avcodec_flush_buffers(codec_ctx);
 
-  /* Decode until we have all frames */
-  while (frames_captured < num_frames && av_read_frame(fmt_ctx, state->pkt) >= 0) {
-    if (state->pkt->stream_index == video_stream_idx) {
-      ret = avcodec_send_packet(codec_ctx, state->pkt);
-      if (ret < 0) {
-        av_packet_unref(state->pkt);
-        continue;
-      }
-
-      while (frames_captured < num_frames) {
-        ret = avcodec_receive_frame(codec_ctx, state->frame);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
-        if (ret < 0) {
-          mxFree(captured);
-          return -1;
-        }
-
-        int frame_idx = (int)(state->frame->pts / pts_increment);
+  /* Track which frames we've captured, in scratch kept with the state.
+   * Allocated with av_realloc rather than mxRealloc because this function
+   * also runs on worker threads. */
+  if (range_frame_count > state->captured_capacity) {
+    int *grown = (int *)av_realloc_array(state->captured, range_frame_count, sizeof(int));
+    if (!grown) return -1;
+    state->captured = grown;
+    state->captured_capacity = range_frame_count;
+  }
+  int *captured = state->captured;
+  memset(captured, 0, (size_t)range_frame_count * sizeof(int));
 
-        /* Check if this frame is in our target range and not yet captured */
-        if (frame_idx >= target_start && frame_idx <= target_end) {
-          int local_idx = frame_idx - target_start;
-          if (!captured[local_idx]) {
-            sws_scale(state->sws_ctx,
-                      (const uint8_t * const*)state->frame->data,
-                      state->frame->linesize, 0, state->height,
-                      state->out_frame->data, state->out_frame->linesize);
+  H265ReadStats *stats = state->stats;
+  seek_decoder(fmt_ctx, codec_ctx, video_stream_idx, dts_array, target_start, position, stats);
 
-            uint8_t *dest = frame_buffer + local_idx * frame_size;
-            copy_frame_rowmajor(state->out_frame, state->width,
-                                state->height, state->is_grayscale, dest);
+  /* Decode until we have all frames, a frame past the range comes out (one
+   * is missing), or we reach the GOP after the range. Frames the decoder has
+   * ready are taken before the next packet is sent: a decoder left holding
+   * frames by the previous read would not accept it. */
+  while (frames_captured < num_frames && last_frame <= target_end) {
+    int64_t start = h265_stats_start(stats);
+    ret = avcodec_receive_frame(codec_ctx, state->frame);
+    if (stats) stats->receive_frame_us += h265_stats_elapsed_us(start);
+    if (ret == 0) {
+      if (stats) stats->decoded_frame_count++;
+      last_frame = (int)(state->frame->pts / pts_increment);
+      ret = capture_frame(state, last_frame, target_start, target_end, slot_for_frame,
+                          captured, &frames_captured, frame_buffer, frame_size);
 
-            captured[local_idx] = 1;
-            frames_captured++;
-          }
-        }
+      /* Release decoder's internal buffer reference */
+      av_frame_unref(state->frame);
+      if (ret < 0) return -1;
+      continue;
+    }
+    if (ret == AVERROR_EOF) break;
+    if (ret != AVERROR(EAGAIN)) return -1;
 
-        /* Release decoder's internal buffer reference */
-        av_frame_unref(state->frame);
-      }
+    /* The decoder wants the next video packet */
+    start = h265_stats_start(stats);
+    while ((ret = av_read_frame(fmt_ctx, state->pkt)) >= 0 &&
+           state->pkt->stream_index != video_stream_idx) {
+      av_packet_unref(state->pkt);
+    }
+    if (stats) stats->demux_us += h265_stats_elapsed_us(start);
+    if (ret < 0) break;
+    if (!is_keeping_position &&
+        (state->pkt->flags & AV_PKT_FLAG_KEY) &&
+        state->pkt->pts != AV_NOPTS_VALUE &&
+        state->pkt->pts / pts_increment > target_end) {
+      av_packet_unref(state->pkt);
+      break;
+    }
+    start = h265_stats_start(stats);
+    avcodec_send_packet(codec_ctx, state->pkt);
+    if (stats) {
+      stats->send_packet_us += h265_stats_elapsed_us(start);
+      stats->packet_count++;
     }
     av_packet_unref(state->pkt);
   }
 
-  /* Flush decoder for remaining frames */
-  if (frames_captured < num_frames) {
+  /* Drain decoder for frames still held back */
+  if (frames_captured < num_frames && last_frame <= target_end) {
+    is_drained = 1;
     avcodec_send_packet(codec_ctx, NULL);
     while (frames_captured < num_frames) {
+      int64_t start = h265_stats_start(stats);
       ret = avcodec_receive_frame(codec_ctx, state->frame);
+      if (stats) stats->receive_frame_us += h265_stats_elapsed_us(start);
       if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
       if (ret < 0) break;
+      if (stats) stats->decoded_frame_count++;
+
+      ret = capture_frame(state, (int)(state->frame->pts / pts_increment),
+                          target_start, target_end, slot_for_frame,
+                          captured, &frames_captured, frame_buffer, frame_size);
 
-      int frame_idx = (int)(state->frame->pts / pts_increment);
+      /* Release decoder's internal buffer reference */
+      av_frame_unref(state->frame);
+      if (ret < 0) return -1;
+    }
+  }
 
-      if (frame_idx >= target_start && frame_idx <= target_end) {
-        int local_idx = frame_idx - target_start;
-        if (!captured[local_idx]) {
-          sws_scale(state->sws_ctx,
-                    (const uint8_t * const*)state->frame->data,
-                    state->frame->linesize, 0, state->height,
-                    state->out_frame->data, state->out_frame->linesize);
+  /* Frames come out in order, so the decoder outputs the one after the last */
+  if (is_keeping_position && !is_drained && frames_captured == num_frames) {
+    position->next_frame = last_frame + 1;
+  }
 
-          uint8_t *dest = frame_buffer + local_idx * frame_size;
-          copy_frame_rowmajor(state->out_frame, state->width,
-                              state->height, state->is_grayscale, dest);
+  return frames_captured;
+}
 
-          captured[local_idx] = 1;
-          frames_captured++;
+/*
+ * Decode each keyframe from its packet alone: after the seek, packets are
+ * read up to the keyframe's own, which is sent, and the decoder is drained
+ * to get the frame out of any frame-threading delay. skip_frame keeps the
+ * decoder from decoding anything else it might be sent.
+ * Returns: number of frames captured, or -1 on error
+ */
+int decode_keyframes_colmajor(
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    const int *keyframes, int keyframe_count,
+    H265DecodeState *state, uint8_t *frame_buffer, size_t frame_size)
+{
+  int ret;
+  int frames_captured = 0;
+  enum AVDiscard skip_frame = codec_ctx->skip_frame;
+  H265ReadStats *stats = state->stats;
+
+  codec_ctx->skip_frame = AVDISCARD_NONKEY;
+  for (int i = 0; i < keyframe_count; i++) {
+    int keyframe = keyframes[i];
+    int is_sent = 0;
+    int captured = 0;
+    int frame_captured = 0;
+    seek_decoder(fmt_ctx, codec_ctx, video_stream_idx, dts_array, keyframe, NULL, stats);
+
+    /* Read up to the keyframe's packet; a later keyframe means it is missing */
+    for (;;) {
+      int64_t start = h265_stats_start(stats);
+      while ((ret = av_read_frame(fmt_ctx, state->pkt)) >= 0 &&
+             state->pkt->stream_index != video_stream_idx) {
+        av_packet_unref(state->pkt);
+      }
+      if (stats) stats->demux_us += h265_stats_elapsed_us(start);
+      if (ret < 0) break;
+      int is_key = (state->pkt->flags & AV_PKT_FLAG_KEY) && state->pkt->pts != AV_NOPTS_VALUE;
+      int64_t packet_frame = is_key ? state->pkt->pts / pts_increment : -1;
+      if (is_key && packet_frame == keyframe) {
+        start = h265_stats_start(stats);
+        is_sent = avcodec_send_packet(codec_ctx, state->pkt) >= 0;
+        if (stats) {
+          stats->send_packet_us += h265_stats_elapsed_us(start);
+          stats->packet_count++;
         }
       }
+      av_packet_unref(state->pkt);
+      if (is_sent || (is_key && packet_frame > keyframe)) break;
+    }
+    if (!is_sent) break;
+
+    /* Drain the decoder for the frame */
+    avcodec_send_packet(codec_ctx, NULL);
+    for (;;) {
+      int64_t start = h265_stats_start(stats);
+      ret = avcodec_receive_frame(codec_ctx, state->frame);
+      if (stats) stats->receive_frame_us += h265_stats_elapsed_us(start);
+      if (ret < 0) break;
+      if (stats) stats->decoded_frame_count++;
+
+      ret = capture_frame(state, (int)(state->frame->pts / pts_increment), keyframe, keyframe, NULL,
+                          &captured, &frame_captured, frame_buffer + i * frame_size, frame_size);
 
       /* Release decoder's internal buffer reference */
       av_frame_unref(state->frame);
+      if (ret < 0) {
+        codec_ctx->skip_frame = skip_frame;
+        return -1;
+      }
     }
+    if (!frame_captured) break;
+    frames_captured++;
   }
+  codec_ctx->skip_frame = skip_frame;
 
-  mxFree(captured);
   return frames_captured;
 }
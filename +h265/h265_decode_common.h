@@ -4,7 +4,10 @@
  *
  * Provides:
  * - Decode state management (allocation/cleanup of AVFrame, AVPacket, SwsContext)
- * - Frame range decoding with row-major output
+ * - Output geometry (crop rectangle and output size) from video_info
+ * - Frame range decoding straight into MATLAB column-major layout
+ * - Continuing forward on the reader's own decoder instead of seeking
+ * - Keyframe-only decoding for thumbnails
  */
 
 #ifndef H265_DECODE_COMMON_H
@@ -15,22 +18,66 @@
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
 #include <stdint.h>
 #include <string.h>
+#include "h265_stats.h"
+#include "h265_transpose.h"
 
 /* ============================================================================
  * Decode State Structure
  * ============================================================================ */
 
+/* Source rectangle, output size, and sample depth of decoded frames. The
+ * crop and the resize both happen in the swscale pass, so nothing larger than
+ * the output is ever converted, cached, or returned. */
+typedef struct {
+  int crop_x;               /* Left edge of the source rectangle, 0-based */
+  int crop_y;               /* Top edge of the source rectangle, 0-based */
+  int crop_width;
+  int crop_height;
+  int width;                /* Output frame size */
+  int height;
+  int bit_depth;            /* 8 for uint8 output; 10, 12, or 16 for uint16 */
+} H265OutputGeometry;
+
+/* Bytes in one output sample: 1 for uint8, 2 for uint16 */
+static inline int output_bytes_per_sample(const H265OutputGeometry *geometry)
+{
+  return geometry->bit_depth > 8 ? 2 : 1;
+}
+
+/* Default of the open_h265_video option forward_frame_limit */
+#define H265_DEFAULT_FORWARD_FRAME_LIMIT 16
+
+/* Where the reader's own decoder stands between reads, kept in its frame
+ * cache. A read whose first frame lies at most forward_frame_limit frames
+ * after next_frame decodes on from there, skipping the frames in between,
+ * rather than seeking and flushing the decoder and refilling its pipeline. */
+typedef struct {
+  int next_frame;           /* Frame the decoder outputs next, or -1 if it must seek */
+  int forward_frame_limit;  /* Furthest skip decoded through; negative to always seek */
+} H265DecodePosition;
+
 typedef struct {
   AVFrame *frame;           /* Decoded frame from codec */
-  AVFrame *out_frame;       /* Converted output frame */
+  AVFrame *sw_frame;        /* Download target for frames decoded on a device; NULL in software */
+  AVFrame *out_frame;       /* Converted output frame (GRAY8 or planar GBRP); NULL if is_luma_direct */
   AVPacket *pkt;            /* Packet for reading */
-  struct SwsContext *sws_ctx;  /* Color space converter */
-  int width;
+  struct SwsContext *sws_ctx;  /* Color space converter, crop size -> output size; NULL if is_luma_direct */
+  enum AVPixelFormat src_pix_fmt;  /* Frame format the converter was set up for */
+  H265OutputGeometry geometry;
+  int is_cropped;           /* Crop rectangle is smaller than the decoded frame */
+  int is_luma_direct;       /* Grayscale output transposed straight from the Y plane */
+  int width;                /* Output frame size */
   int height;
   int is_grayscale;
   size_t frame_size;        /* Size of one frame in bytes */
+  int *captured;            /* Scratch of decode_frame_list_colmajor, kept with the state */
+  int captured_capacity;
+  H265ReadStats *stats;     /* Where decoding is counted, or NULL; set by the owner after
+                             * prepare_decode_state */
 } H265DecodeState;
 
 /* ============================================================================
@@ -38,19 +85,74 @@ typedef struct {
  * ============================================================================ */
 
 /*
- * Copy an FFmpeg frame in row-major order (fast sequential memcpy).
- * Caller should use MATLAB permute() to convert to column-major.
- * For grayscale: output is width x height (use permute([2 1]))
- * For RGB: output is stored as height rows of width*3 bytes
+ * Copy a converted frame (GRAY, or GBRP for RGB) into column-major layout:
+ * height x width for grayscale, height x width x 3 for RGB, with
+ * bytes_per_sample bytes per sample.
+ */
+void copy_frame_colmajor(const AVFrame *out_frame, int width, int height,
+                         int is_grayscale, int bytes_per_sample, uint8_t *out_data);
+
+/*
+ * Color convert state->frame into state->out_frame, then copy it
+ * column-major to out_data (state->frame_size bytes). state->frame must be
+ * in system memory.
+ * Returns 0 on success, -1 if the converter could not be set up for the
+ * frame's format.
+ */
+int convert_frame_colmajor(H265DecodeState *state, uint8_t *out_data);
+
+/*
+ * Software pixel format of codec_ctx's frames: the stream's format, also
+ * while the decoder runs on a hardware device.
+ */
+enum AVPixelFormat decoder_pix_fmt(const AVCodecContext *codec_ctx);
+
+/*
+ * Output bit depth for a stream of pix_fmt: 8 up to 8-bit streams, 10 or 12
+ * for those depths, and 16 for anything else.
+ */
+int output_bit_depth(enum AVPixelFormat pix_fmt);
+
+/*
+ * Size in bytes of one output frame.
+ */
+size_t output_frame_size(const H265OutputGeometry *geometry, int is_grayscale);
+
+/*
+ * Create an uninitialized column-major array for frame_count output frames:
+ * uint8 or uint16, height x width x frame_count for grayscale and
+ * height x width x 3 x frame_count for RGB. Runs on the MATLAB thread only.
+ */
+mxArray *create_frame_array(const H265OutputGeometry *geometry, int is_grayscale, int frame_count);
+
+/*
+ * Read the output geometry from video_info's optional crop_rect
+ * ([x y width height], 1-based x and y) and output_size ([height width])
+ * fields. A missing or empty crop_rect means the whole frame of
+ * codec_ctx; a missing or empty output_size means the crop size. The
+ * bit depth follows the stream (see output_bit_depth).
+ * Runs on the MATLAB thread only.
+ * Returns 1 on success, 0 if the fields are malformed or out of range.
  */
-void copy_frame_rowmajor(AVFrame *out_frame, int width, int height,
-                         int is_grayscale, uint8_t *out_data);
+int get_output_geometry(const mxArray *video_info, const AVCodecContext *codec_ctx,
+                        H265OutputGeometry *geometry);
 
 /*
- * Initialize decode state. Returns 1 on success, 0 on failure.
+ * Initialize decode state for frames cropped and scaled to geometry.
+ * Returns 1 on success, 0 on failure.
  */
 int init_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
-                      int width, int height, int is_grayscale);
+                      const H265OutputGeometry *geometry, int is_grayscale);
+
+/*
+ * Make state, either zeroed or set up by an earlier call, ready for frames
+ * cropped and scaled to geometry. A state already set up for the same output
+ * is kept as it is, so a reader that keeps its state between reads (see
+ * H265FrameCache) allocates the frames, packet, and converter only once.
+ * Returns 1 on success, 0 on failure.
+ */
+int prepare_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
+                         const H265OutputGeometry *geometry, int is_grayscale);
 
 /*
  * Free decode state resources.
@@ -58,15 +160,63 @@ int init_decode_state(H265DecodeState *state, AVCodecContext *codec_ctx,
 void free_decode_state(H265DecodeState *state);
 
 /*
- * Decode frames in [target_start, target_end] into frame_buffer using row-major copy.
- * Same as decode_frame_range but uses fast row-major copy instead of column-major transpose.
- * Caller must use MATLAB permute() on the result.
+ * Get the decoder ready to output target_start: leave it where it is if
+ * position allows continuing forward to target_start (see
+ * H265DecodePosition), otherwise seek to the keyframe at or before
+ * target_start and flush it. position may be NULL, meaning always seek.
+ * Either way position->next_frame is -1 afterwards, until the caller records
+ * where decoding stopped. stats, if not NULL, counts the seek or the
+ * continuation.
  */
-int decode_frame_range_rowmajor(
+void seek_decoder(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+                  int64_t *dts_array, int target_start, H265DecodePosition *position,
+                  H265ReadStats *stats);
+
+/*
+ * Decode frames in [target_start, target_end] into frame_buffer, which holds
+ * frame_size bytes per frame in MATLAB column-major layout, so it can be the
+ * data of the final output array.
+ * position is the decoder's position (see H265DecodePosition), read before
+ * decoding and updated after it, or NULL for a decoder that always seeks.
+ * Makes no MATLAB API calls, so it is safe to call from a worker thread.
+ * Returns: number of frames captured, or -1 on error
+ */
+int decode_frame_range_colmajor(
     AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
     int64_t *dts_array, int64_t pts_increment,
     int target_start, int target_end,
-    H265DecodeState *state,
+    H265DecodeState *state, H265DecodePosition *position,
     uint8_t *frame_buffer, size_t frame_size);
 
+/*
+ * Like decode_frame_range_colmajor, but only the frames of the range with
+ * slot_for_frame[frame - target_start] >= 0 are stored, each at that slot of
+ * frame_buffer, and decoding stops once all of them are captured.
+ * slot_for_frame may be NULL, meaning every frame at its position in the range.
+ * Makes no MATLAB API calls, so it is safe to call from a worker thread.
+ * Returns: number of frames captured, or -1 on error
+ */
+int decode_frame_list_colmajor(
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    int target_start, int target_end, const int *slot_for_frame,
+    H265DecodeState *state, H265DecodePosition *position,
+    uint8_t *frame_buffer, size_t frame_size);
+
+/*
+ * Decode the keyframes keyframes[0..keyframe_count), 0-based frame indices of
+ * GOP starts, into consecutive frames of frame_buffer. Each is reached with a
+ * seek and decoded from its own packet alone, with skip_frame set to
+ * AVDISCARD_NONKEY meanwhile, so no other frame is decoded or converted. The
+ * decoder is left drained: the caller must mark the reader's position lost.
+ * Makes no MATLAB API calls, so it is safe to call from a worker thread.
+ * Returns: number of frames captured before the first missing keyframe, or
+ * -1 on error
+ */
+int decode_keyframes_colmajor(
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    const int *keyframes, int keyframe_count,
+    H265DecodeState *state, uint8_t *frame_buffer, size_t frame_size);
+
 #endif /* H265_DECODE_COMMON_H */
@@ -0,0 +1,155 @@
+/*
+ * h265_frame_cache.c
+ * GOP frame cache for h.265 video reading (see h265_frame_cache.h).
+ */
+
+#include "h265_frame_cache.h"
+#include <string.h>
+
+H265FrameCache *h265_cache_alloc(size_t byte_budget)
+{
+    H265FrameCache *cache = (H265FrameCache *)mxMalloc(sizeof(H265FrameCache));
+    if (!cache) return NULL;
+    mexMakeMemoryPersistent(cache);
+
+    cache->gops = NULL;            /* entry array allocated on first insert */
+    cache->gop_count = 0;
+    cache->gop_capacity = 0;
+    cache->byte_budget = byte_budget;
+    cache->bytes_used = 0;
+    cache->use_counter = 0;
+    cache->width = 0;
+    cache->height = 0;
+    cache->is_grayscale = 0;
+    cache->bytes_per_sample = 0;
+    cache->frame_size = 0;
+    cache->prefetch = NULL;
+    cache->position.next_frame = -1;
+    cache->position.forward_frame_limit = H265_DEFAULT_FORWARD_FRAME_LIMIT;
+    memset(&cache->decode_state, 0, sizeof(cache->decode_state));
+    cache->do_collect_stats = 0;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    memset(&cache->mex_locks, 0, sizeof(cache->mex_locks));
+
+    return cache;
+}
+
+void h265_cache_clear(H265FrameCache *cache)
+{
+    if (!cache) return;
+    for (int i = 0; i < cache->gop_count; i++) {
+        if (cache->gops[i].frames) {
+            mxDestroyArray(cache->gops[i].frames);
+        }
+    }
+    cache->gop_count = 0;
+    cache->bytes_used = 0;
+}
+
+void h265_cache_free(H265FrameCache *cache)
+{
+    if (!cache) return;
+    h265_cache_clear(cache);
+    if (cache->gops) {
+        mxFree(cache->gops);
+    }
+    mxFree(cache);
+}
+
+void h265_cache_set_format(H265FrameCache *cache, int width, int height, int is_grayscale,
+                           int bytes_per_sample)
+{
+    if (cache->width == width && cache->height == height &&
+        cache->is_grayscale == is_grayscale && cache->bytes_per_sample == bytes_per_sample &&
+        cache->frame_size != 0) {
+        return;
+    }
+    h265_cache_clear(cache);
+    cache->width = width;
+    cache->height = height;
+    cache->is_grayscale = is_grayscale;
+    cache->bytes_per_sample = bytes_per_sample;
+    cache->frame_size = (size_t)width * height * (is_grayscale ? 1 : 3) * bytes_per_sample;
+}
+
+H265CachedGop *h265_cache_find(H265FrameCache *cache, int frame_index)
+{
+    if (!cache) return NULL;
+    for (int i = 0; i < cache->gop_count; i++) {
+        H265CachedGop *gop = &cache->gops[i];
+        if (frame_index >= gop->start_frame &&
+            frame_index < gop->start_frame + gop->num_frames) {
+            gop->last_used = ++cache->use_counter;
+            return gop;
+        }
+    }
+    return NULL;
+}
+
+int h265_cache_has_frame(const H265FrameCache *cache, int frame_index)
+{
+    if (!cache) return 0;
+    for (int i = 0; i < cache->gop_count; i++) {
+        const H265CachedGop *gop = &cache->gops[i];
+        if (frame_index >= gop->start_frame &&
+            frame_index < gop->start_frame + gop->num_frames) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Remove the entry at position i, freeing its frames.
+ */
+static void remove_gop(H265FrameCache *cache, int i)
+{
+    H265CachedGop *gop = &cache->gops[i];
+    cache->bytes_used -= (size_t)gop->num_frames * cache->frame_size;
+    mxDestroyArray(gop->frames);
+    cache->gops[i] = cache->gops[cache->gop_count - 1];
+    cache->gop_count--;
+}
+
+H265CachedGop *h265_cache_insert(H265FrameCache *cache, mxArray *frames,
+                                 int start_frame, int num_frames)
+{
+    size_t gop_bytes = (size_t)num_frames * cache->frame_size;
+
+    /* Evict least recently used GOPs until the new one fits */
+    while (cache->gop_count > 0 && cache->bytes_used + gop_bytes > cache->byte_budget) {
+        int oldest = 0;
+        for (int i = 1; i < cache->gop_count; i++) {
+            if (cache->gops[i].last_used < cache->gops[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        remove_gop(cache, oldest);
+        if (cache->do_collect_stats) cache->stats.cache_evict_count++;
+    }
+
+    /* Grow the entry array if needed (persistent memory, so copy by hand) */
+    if (cache->gop_count >= cache->gop_capacity) {
+        int new_capacity = cache->gop_capacity ? cache->gop_capacity * 2 : 8;
+        H265CachedGop *new_gops = (H265CachedGop *)mxMalloc(new_capacity * sizeof(H265CachedGop));
+        if (!new_gops) {
+            mxDestroyArray(frames);
+            return NULL;
+        }
+        mexMakeMemoryPersistent(new_gops);
+        if (cache->gops) {
+            memcpy(new_gops, cache->gops, cache->gop_count * sizeof(H265CachedGop));
+            mxFree(cache->gops);
+        }
+        cache->gops = new_gops;
+        cache->gop_capacity = new_capacity;
+    }
+
+    H265CachedGop *gop = &cache->gops[cache->gop_count++];
+    gop->frames = frames;
+    gop->start_frame = start_frame;
+    gop->num_frames = num_frames;
+    gop->last_used = ++cache->use_counter;
+    cache->bytes_used += gop_bytes;
+    return gop;
+}
@@ -2,10 +2,14 @@
  * h265_frame_cache.h
  * GOP frame cache structure for h.265 video reading.
  *
- * The cache stores decoded frames from a GOP (Group of Pictures) to avoid
- * re-decoding when reading sequential frames within the same GOP.
+ * The cache stores decoded GOPs (Groups of Pictures) to avoid re-decoding when
+ * reading frames that were decoded recently. It holds as many GOPs as fit in
+ * its byte budget and evicts the least recently used GOP when a new one is
+ * added, so access patterns that go back and forth across a GOP boundary stay
+ * in cache. The most recently decoded GOP is always kept, even if it alone
+ * exceeds the budget.
  *
- * Frames are stored in a MATLAB array (column-major, already transposed)
+ * Frames are stored in MATLAB arrays (column-major, already transposed)
  * so returning a frame is just a memcpy with no per-frame transpose needed.
  *
  * Each H265Reader instance has its own cache, stored as a pointer in the
@@ -18,15 +22,93 @@
 #include "mex.h"
 #include <stdint.h>
 #include <stddef.h>
+#include "h265_decode_common.h"
+#include "h265_mex_lock.h"
+
+/* Default byte budget (h265.Reader option cache_mb) */
+#define H265_CACHE_DEFAULT_MB 256
+
+typedef struct {
+    mxArray *frames;         /* MATLAB array holding the GOP's frames (column-major) */
+    int start_frame;         /* First frame index of the GOP */
+    int num_frames;          /* Number of frames in the GOP */
+    uint64_t last_used;      /* Value of use_counter at last access */
+} H265CachedGop;
 
 typedef struct {
-    mxArray *frames;         /* MATLAB array holding cached frames (column-major) */
-    int num_frames;          /* Number of frames currently in cache */
-    int start_frame;         /* First frame index in cache */
+    H265CachedGop *gops;     /* Cached GOPs, in no particular order */
+    int gop_count;           /* Number of GOPs currently in cache */
+    int gop_capacity;        /* Allocated length of gops */
+    size_t byte_budget;      /* Evict once cached frames exceed this many bytes */
+    size_t bytes_used;       /* Bytes of frame data currently cached */
+    uint64_t use_counter;    /* Incremented on every access, for LRU ordering */
     int width;
     int height;
     int is_grayscale;        /* Output format: 1 for grayscale, 0 for RGB */
+    int bytes_per_sample;    /* 1 for uint8 frames, 2 for uint16 */
     size_t frame_size;       /* Size of each frame in bytes */
+    struct H265Prefetch *prefetch;  /* Read-ahead state, or NULL (see h265_prefetch.h) */
+    H265DecodePosition position;  /* Where the reader's own decoder stands */
+    H265DecodeState decode_state;  /* Kept between reads on the reader's own decoder
+                                    * (see prepare_decode_state); zeroed until the first */
+    int do_collect_stats;    /* Count into stats (open_h265_video option do_collect_stats) */
+    H265ReadStats stats;     /* Read path timing and counters (see h265_stats.h) */
+    H265MexLocks mex_locks;  /* MEX files kept loaded for this reader, unlocked by
+                              * close_h265_video (see h265_mex_lock.h) */
 } H265FrameCache;
 
+/*
+ * Where reads through cache are counted: &cache->stats if it collects stats,
+ * else NULL. Also NULL for a NULL cache.
+ */
+static inline H265ReadStats *h265_cache_stats(H265FrameCache *cache)
+{
+    return cache && cache->do_collect_stats ? &cache->stats : NULL;
+}
+
+/*
+ * Allocate an empty frame cache with the given byte budget. Frame data will be
+ * allocated on first read. Uses mxMalloc + mexMakeMemoryPersistent.
+ * Returns NULL on allocation failure.
+ */
+H265FrameCache *h265_cache_alloc(size_t byte_budget);
+
+/*
+ * Free all cached GOPs and the cache itself. The owner must free
+ * cache->prefetch and cache->decode_state first.
+ */
+void h265_cache_free(H265FrameCache *cache);
+
+/*
+ * Drop all cached GOPs, keeping the cache itself.
+ */
+void h265_cache_clear(H265FrameCache *cache);
+
+/*
+ * Set the output format. If it differs from the format of the frames already
+ * cached, the cache is cleared first.
+ */
+void h265_cache_set_format(H265FrameCache *cache, int width, int height, int is_grayscale,
+                           int bytes_per_sample);
+
+/*
+ * Find the cached GOP containing frame_index and mark it most recently used.
+ * Returns NULL on a miss.
+ */
+H265CachedGop *h265_cache_find(H265FrameCache *cache, int frame_index);
+
+/*
+ * Return 1 if frame_index is in a cached GOP, without changing LRU order.
+ */
+int h265_cache_has_frame(const H265FrameCache *cache, int frame_index);
+
+/*
+ * Add a decoded GOP to the cache, taking ownership of frames (which must
+ * already be persistent). Evicts least recently used GOPs to stay within the
+ * byte budget, counting them in cache->stats. Returns the new entry, or NULL
+ * on allocation failure (in which case frames has been destroyed).
+ */
+H265CachedGop *h265_cache_insert(H265FrameCache *cache, mxArray *frames,
+                                 int start_frame, int num_frames);
+
 #endif /* H265_FRAME_CACHE_H */
@@ -0,0 +1,111 @@
+/*
+ * h265_hwaccel.c
+ * Opt-in hardware decoding and encoding (see h265_hwaccel.h).
+ */
+
+#include "h265_hwaccel.h"
+#include <string.h>
+
+const char *const h265_hwaccel_names[] = {
+    "none", "auto", "cuda", "vaapi", "videotoolbox", NULL
+};
+
+/* Order tried by "auto": the platform's native API first, then NVIDIA */
+static const enum AVHWDeviceType auto_device_types[] = {
+#ifdef __APPLE__
+    AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+#endif
+    AV_HWDEVICE_TYPE_CUDA,
+#ifdef __linux__
+    AV_HWDEVICE_TYPE_VAAPI,
+#endif
+    AV_HWDEVICE_TYPE_NONE
+};
+
+enum AVHWDeviceType h265_hwaccel_device_type(const char *hwaccel, int attempt)
+{
+    if (strcmp(hwaccel, "none") == 0) return AV_HWDEVICE_TYPE_NONE;
+    if (strcmp(hwaccel, "auto") == 0) {
+        int type_count = sizeof(auto_device_types) / sizeof(auto_device_types[0]) - 1;
+        return attempt < type_count ? auto_device_types[attempt] : AV_HWDEVICE_TYPE_NONE;
+    }
+    return attempt == 0 ? av_hwdevice_find_type_by_name(hwaccel) : AV_HWDEVICE_TYPE_NONE;
+}
+
+/* 1 if decoder can decode on a device of type given as hw_device_ctx */
+static int decoder_supports_device(const AVCodec *codec, enum AVHWDeviceType type)
+{
+    for (int i = 0;; i++) {
+        const AVCodecHWConfig *config = avcodec_get_hw_config(codec, i);
+        if (!config) return 0;
+        if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) &&
+            config->device_type == type) {
+            return 1;
+        }
+    }
+}
+
+int h265_hwaccel_attach_decoder(AVCodecContext *codec_ctx, enum AVHWDeviceType type)
+{
+    if (type == AV_HWDEVICE_TYPE_NONE || !decoder_supports_device(codec_ctx->codec, type)) {
+        return 0;
+    }
+
+    /* The default get_format picks the device's format when the stream can
+     * be decoded there and a software format otherwise */
+    AVBufferRef *device = NULL;
+    if (av_hwdevice_ctx_create(&device, type, NULL, NULL, 0) < 0) return 0;
+    codec_ctx->hw_device_ctx = device;
+    return 1;
+}
+
+int h265_hwaccel_share_device(AVCodecContext *codec_ctx, AVBufferRef *device)
+{
+    if (!device) return 1;
+    codec_ctx->hw_device_ctx = av_buffer_ref(device);
+    return codec_ctx->hw_device_ctx != NULL;
+}
+
+const char *h265_hwaccel_device_name(const AVCodecContext *codec_ctx)
+{
+    if (!codec_ctx->hw_device_ctx) return "none";
+    const AVHWDeviceContext *device = (const AVHWDeviceContext *)codec_ctx->hw_device_ctx->data;
+    return av_hwdevice_get_type_name(device->type);
+}
+
+int h265_hwaccel_download(AVFrame *frame, AVFrame *sw_frame)
+{
+    if (!frame->hw_frames_ctx) return 0;
+
+    /* sw_frame->format is unset, so the device's preferred download format
+     * (NV12, P010, ...) is used; the converter adapts to it */
+    int ret = av_hwframe_transfer_data(sw_frame, frame, 0);
+    if (ret >= 0) ret = av_frame_copy_props(sw_frame, frame);
+    if (ret < 0) {
+        av_frame_unref(sw_frame);
+        return ret;
+    }
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, sw_frame);
+    return 0;
+}
+
+const char *h265_hwaccel_encoder_name(enum AVHWDeviceType type)
+{
+    /* hevc_vaapi only takes frames already on the device, which none of the
+     * writer's conversion paths produce */
+    switch (type) {
+        case AV_HWDEVICE_TYPE_CUDA: return "hevc_nvenc";
+        case AV_HWDEVICE_TYPE_VIDEOTOOLBOX: return "hevc_videotoolbox";
+        default: return NULL;
+    }
+}
+
+int h265_hwaccel_has_pix_fmt(const AVCodec *codec, enum AVPixelFormat pix_fmt)
+{
+    if (!codec->pix_fmts) return 0;
+    for (const enum AVPixelFormat *p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+        if (*p == pix_fmt) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * h265_hwaccel.h
+ * Opt-in hardware decoding and encoding (NVDEC/NVENC through CUDA, VAAPI,
+ * VideoToolbox), shared by the read and write MEX files.
+ *
+ * Hardware is only used when the reader or writer asks for it with the
+ * hwaccel option, and everything falls back to the software path when no
+ * device is available:
+ * - A decoder gets an AVHWDeviceContext before it is opened. FFmpeg then
+ *   decodes on the device and, for streams the device cannot handle (profile,
+ *   chroma format, size), negotiates software decoding instead. Decoded
+ *   frames are downloaded to system memory before the usual crop, scale, and
+ *   transpose, and keep their PTS, so frames are still matched to the index
+ *   exactly as in software.
+ * - An encoder is the device's h.265 encoder (hevc_nvenc, hevc_videotoolbox)
+ *   fed the writer's system-memory frames; the writer falls back to libx265
+ *   when it cannot be opened.
+ *
+ * None of these functions make MATLAB API calls, so they may be used from
+ * worker threads.
+ */
+
+#ifndef H265_HWACCEL_H
+#define H265_HWACCEL_H
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+
+/* Values accepted by the hwaccel option of the reader and the writer */
+extern const char *const h265_hwaccel_names[];
+
+/*
+ * The attempt-th device type (0-based) to try for the hwaccel option value
+ * hwaccel, or AV_HWDEVICE_TYPE_NONE when there are no more: none for "none",
+ * just the named type for a device name, and every supported type in turn
+ * for "auto".
+ */
+enum AVHWDeviceType h265_hwaccel_device_type(const char *hwaccel, int attempt);
+
+/*
+ * Set codec_ctx (allocated but not opened) up to decode on a new device of
+ * type. Returns 1 on success, or 0 if the decoder has no hwaccel for type or
+ * the device cannot be opened, leaving codec_ctx unchanged.
+ */
+int h265_hwaccel_attach_decoder(AVCodecContext *codec_ctx, enum AVHWDeviceType type);
+
+/*
+ * Set codec_ctx (allocated but not opened) up to decode on device, the
+ * hw_device_ctx of another decoder of the same stream; does nothing if device
+ * is NULL. Used for the prefetch and parallel decode workers.
+ * Returns 1 on success, 0 if out of memory.
+ */
+int h265_hwaccel_share_device(AVCodecContext *codec_ctx, AVBufferRef *device);
+
+/*
+ * Name of the device codec_ctx was set up on ("cuda", "vaapi", ...), or
+ * "none" for software.
+ */
+const char *h265_hwaccel_device_name(const AVCodecContext *codec_ctx);
+
+/*
+ * If frame is in device memory, download it into sw_frame and move the copy
+ * (with frame's PTS and other properties) back into frame. Frames already in
+ * system memory are left alone.
+ * Returns 0 on success or a negative AVERROR.
+ */
+int h265_hwaccel_download(AVFrame *frame, AVFrame *sw_frame);
+
+/*
+ * Name of the h.265 encoder for type that takes system-memory frames, or NULL
+ * if there is none.
+ */
+const char *h265_hwaccel_encoder_name(enum AVHWDeviceType type);
+
+/*
+ * 1 if codec lists pix_fmt among its input formats, else 0.
+ */
+int h265_hwaccel_has_pix_fmt(const AVCodec *codec, enum AVPixelFormat pix_fmt);
+
+#endif /* H265_HWACCEL_H */
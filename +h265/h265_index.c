@@ -0,0 +1,169 @@
+/*
+ * h265_index.c
+ * Frame index for h.265 video reading, and its sidecar file.
+ */
+
+#include "h265_index.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define h265_stat_t struct _stat64
+#define h265_stat _stat64
+#else
+#define h265_stat_t struct stat
+#define h265_stat stat
+#endif
+
+void h265_index_init(H265Index *index)
+{
+    memset(index, 0, sizeof(H265Index));
+}
+
+void h265_index_free(H265Index *index)
+{
+    if (index->dts) mxFree(index->dts);
+    if (index->keyframes) mxFree(index->keyframes);
+    h265_index_init(index);
+}
+
+char *h265_index_file_name(const char *video_file_name)
+{
+    size_t length = strlen(video_file_name) + strlen(H265_INDEX_FILE_SUFFIX) + 1;
+    char *name = (char *)mxMalloc(length);
+    snprintf(name, length, "%s%s", video_file_name, H265_INDEX_FILE_SUFFIX);
+    return name;
+}
+
+int h265_file_stamp(const char *file_name, int64_t *size, int64_t *mtime)
+{
+    h265_stat_t info;
+    if (h265_stat(file_name, &info) != 0) return 0;
+    *size = (int64_t)info.st_size;
+    *mtime = (int64_t)info.st_mtime;
+    return 1;
+}
+
+int h265_index_read(const char *video_file_name, int64_t expected_pts_increment,
+                    H265Index *index)
+{
+    int64_t video_size, video_mtime;
+    if (!h265_file_stamp(video_file_name, &video_size, &video_mtime)) return 0;
+
+    char *index_file_name = h265_index_file_name(video_file_name);
+    FILE *file = fopen(index_file_name, "rb");
+    mxFree(index_file_name);
+    if (!file) return 0;
+
+    /* Read the whole sidecar in one go */
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+    if (file_size < (long)sizeof(H265IndexFileHeader)) {
+        fclose(file);
+        return 0;
+    }
+
+    uint8_t *contents = (uint8_t *)mxMalloc((size_t)file_size);
+    size_t bytes_read = fread(contents, 1, (size_t)file_size, file);
+    fclose(file);
+    if (bytes_read != (size_t)file_size) {
+        mxFree(contents);
+        return 0;
+    }
+
+    /* Validate header against the video it claims to describe */
+    H265IndexFileHeader header;
+    memcpy(&header, contents, sizeof(header));
+    int is_valid =
+        strncmp(header.magic, H265_INDEX_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == H265_INDEX_FILE_VERSION &&
+        header.byte_order_mark == H265_INDEX_BYTE_ORDER_MARK &&
+        header.video_file_size == video_size &&
+        header.video_mtime == video_mtime &&
+        header.pts_increment == expected_pts_increment &&
+        header.is_closed_gop == 1 &&
+        header.num_frames > 0 &&
+        header.keyframe_count > 0 &&
+        header.keyframe_count <= header.num_frames &&
+        (size_t)file_size == sizeof(header) +
+                             (size_t)header.num_frames * sizeof(int64_t) +
+                             (size_t)header.keyframe_count * sizeof(int32_t);
+    if (!is_valid) {
+        mxFree(contents);
+        return 0;
+    }
+
+    index->num_frames = header.num_frames;
+    index->keyframe_count = header.keyframe_count;
+    index->pts_increment = header.pts_increment;
+    index->dts = (int64_t *)mxMalloc((size_t)header.num_frames * sizeof(int64_t));
+    index->keyframes = (int32_t *)mxMalloc((size_t)header.keyframe_count * sizeof(int32_t));
+
+    const uint8_t *position = contents + sizeof(header);
+    memcpy(index->dts, position, (size_t)header.num_frames * sizeof(int64_t));
+    position += (size_t)header.num_frames * sizeof(int64_t);
+    memcpy(index->keyframes, position, (size_t)header.keyframe_count * sizeof(int32_t));
+    mxFree(contents);
+
+    /* Keyframes must start the video and be strictly increasing */
+    is_valid = (index->keyframes[0] == 0);
+    for (int i = 1; i < index->keyframe_count && is_valid; i++) {
+        is_valid = index->keyframes[i] > index->keyframes[i - 1] &&
+                   index->keyframes[i] < index->num_frames;
+    }
+    if (!is_valid) {
+        h265_index_free(index);
+        return 0;
+    }
+
+    return 1;
+}
+
+int h265_index_write(const char *video_file_name, const H265Index *index)
+{
+    H265IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, H265_INDEX_FILE_MAGIC, strlen(H265_INDEX_FILE_MAGIC));
+    header.version = H265_INDEX_FILE_VERSION;
+    header.byte_order_mark = H265_INDEX_BYTE_ORDER_MARK;
+    if (!h265_file_stamp(video_file_name, &header.video_file_size, &header.video_mtime)) return 0;
+    header.pts_increment = index->pts_increment;
+    header.num_frames = index->num_frames;
+    header.keyframe_count = index->keyframe_count;
+    header.is_closed_gop = 1;  /* Either way of building an index rejects open GOPs */
+
+    /* Write to a temporary name, then rename, so readers never see a partial file */
+    char *index_file_name = h265_index_file_name(video_file_name);
+    size_t temp_length = strlen(index_file_name) + 5;
+    char *temp_file_name = (char *)mxMalloc(temp_length);
+    snprintf(temp_file_name, temp_length, "%s.tmp", index_file_name);
+
+    FILE *file = fopen(temp_file_name, "wb");
+    if (!file) {
+        mxFree(temp_file_name);
+        mxFree(index_file_name);
+        return 0;
+    }
+    int is_ok =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(index->dts, sizeof(int64_t), (size_t)index->num_frames, file) == (size_t)index->num_frames &&
+        fwrite(index->keyframes, sizeof(int32_t), (size_t)index->keyframe_count, file) == (size_t)index->keyframe_count;
+    is_ok = (fclose(file) == 0) && is_ok;
+
+    if (is_ok) {
+        remove(index_file_name);  /* rename() does not overwrite on Windows */
+        is_ok = (rename(temp_file_name, index_file_name) == 0);
+    }
+    if (!is_ok) {
+        remove(temp_file_name);
+    }
+
+    mxFree(temp_file_name);
+    mxFree(index_file_name);
+    return is_ok;
+}
@@ -0,0 +1,130 @@
+/*
+ * h265_index.h
+ * Frame index for h.265 video reading: a seek DTS per frame plus the keyframe
+ * list.
+ *
+ * open_h265_video builds the index from the container's sample table, reading
+ * only the keyframe packets, or else by scanning every packet of the file.
+ * A scan stores each frame's own DTS and checks every packet for open-GOP NAL
+ * units. The sample table stores, for each frame, the DTS of its GOP's
+ * keyframe (a backward seek from either lands on that keyframe) and checks
+ * only the keyframe packets, which is where the CRA and BLA pictures that
+ * start an open GOP sit.
+ *
+ * The result can be saved to a sidecar file next to the video
+ * (<video file name>.h265idx) and loaded on later opens with a single small
+ * read, as long as the video's size and modification time still match.
+ *
+ * Sidecar layout (native byte order, checked with byte_order_mark):
+ *   H265IndexFileHeader
+ *   int64_t dts[num_frames]          - seek DTS of each frame, by frame number:
+ *                                      its own DTS, or its keyframe's (see above)
+ *   int32_t keyframes[keyframe_count] - 0-based frame numbers of keyframes
+ *
+ * Index arrays are allocated with mxMalloc, so this module may only be used
+ * from the MATLAB thread.
+ */
+
+#ifndef H265_INDEX_H
+#define H265_INDEX_H
+
+#include "mex.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define H265_INDEX_FILE_SUFFIX ".h265idx"
+#define H265_INDEX_FILE_MAGIC "H265IDX"
+#define H265_INDEX_FILE_VERSION 1
+#define H265_INDEX_BYTE_ORDER_MARK 0x01020304u
+
+typedef struct {
+    int num_frames;
+    int keyframe_count;
+    int64_t pts_increment;
+    int64_t *dts;            /* Seek DTS by frame number (num_frames entries) */
+    int32_t *keyframes;      /* 0-based keyframe frame numbers, ascending */
+} H265Index;
+
+typedef struct {
+    char magic[8];               /* H265_INDEX_FILE_MAGIC, NUL-padded */
+    uint32_t version;
+    uint32_t byte_order_mark;
+    int64_t video_file_size;     /* Size of the video when indexed */
+    int64_t video_mtime;         /* Modification time of the video (seconds) */
+    int64_t pts_increment;
+    int32_t num_frames;
+    int32_t keyframe_count;
+    int32_t is_closed_gop;       /* 1 if the packets checked when indexing (every one,
+                                  * or every keyframe; see above) had no open-GOP NAL units */
+    int32_t reserved;
+} H265IndexFileHeader;
+
+/*
+ * GOP lookup on the keyframe list stored in video_info.keyframes, which holds
+ * 1-based frame numbers. frame and the returned frame numbers are 0-based.
+ */
+
+/* Index into keyframes of the GOP containing frame (binary search) */
+static inline int h265_gop_for_frame(const int32_t *keyframes, int keyframe_count, int frame)
+{
+    int low = 0;
+    int high = keyframe_count - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (keyframes[middle] - 1 <= frame) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+/* First frame of GOP gop_index */
+static inline int h265_gop_start(const int32_t *keyframes, int gop_index)
+{
+    return keyframes[gop_index] - 1;
+}
+
+/* One past the last frame of GOP gop_index */
+static inline int h265_gop_end(const int32_t *keyframes, int keyframe_count,
+                               int num_frames, int gop_index)
+{
+    return (gop_index + 1 < keyframe_count) ? keyframes[gop_index + 1] - 1 : num_frames;
+}
+
+/*
+ * Initialize an empty index.
+ */
+void h265_index_init(H265Index *index);
+
+/*
+ * Free the arrays of an index and reset it to empty.
+ */
+void h265_index_free(H265Index *index);
+
+/*
+ * Get size and modification time (seconds) of a file. Returns 1 on success.
+ */
+int h265_file_stamp(const char *file_name, int64_t *size, int64_t *mtime);
+
+/*
+ * Build the sidecar file name for a video. Returned string is mxMalloc'd.
+ */
+char *h265_index_file_name(const char *video_file_name);
+
+/*
+ * Load the sidecar for video_file_name into index.
+ * Returns 1 on success, 0 if there is no sidecar or it is stale, malformed,
+ * or does not match expected_pts_increment.
+ */
+int h265_index_read(const char *video_file_name, int64_t expected_pts_increment,
+                    H265Index *index);
+
+/*
+ * Save index to the sidecar for video_file_name.
+ * Returns 1 on success, 0 on failure.
+ */
+int h265_index_write(const char *video_file_name, const H265Index *index);
+
+#endif /* H265_INDEX_H */
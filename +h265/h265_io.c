@@ -0,0 +1,422 @@
+/*
+ * h265_io.c
+ * Custom AVIOContext input with mmap and block-cached modes (see h265_io.h).
+ */
+
+#include "h265_io.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char *const h265_io_mode_names[] = {"default", "mmap", "cached", NULL};
+
+/* AVIOContext buffer. Reads are served from memory (the mapping or the block
+ * cache), so this only sets the size of the copies into libavformat. */
+#define CONTEXT_BUFFER_SIZE (64 * 1024)
+
+#ifndef _WIN32
+
+/* ============================================================================
+ * Open Files
+ * ============================================================================ */
+
+typedef struct CachedBlock {
+    int64_t block_index;
+    uint8_t *data;
+    size_t size;                     /* block_size, or less for the last block */
+    struct CachedBlock *hash_next;   /* Next block in the same bucket */
+    struct CachedBlock *lru_prev;    /* Neighbours in LRU order, most recent first */
+    struct CachedBlock *lru_next;
+} CachedBlock;
+
+typedef struct IoFile {
+    H265IoFile base;                 /* Entry points; must be first */
+    struct IoFile *next;             /* Registry list */
+    int reference_count;             /* Open contexts (plus holds); under registry_mutex */
+
+    /* Identity, fixed at open */
+    dev_t dev;
+    ino_t ino;
+    int64_t file_size;
+    time_t mtime;
+    H265IoMode mode;
+    size_t block_size;
+
+    /* H265_IO_MMAP */
+    const uint8_t *map;
+
+    /* H265_IO_CACHED; everything below fd is guarded by mutex */
+    int fd;
+    pthread_mutex_t mutex;
+    size_t byte_budget;
+    CachedBlock **buckets;
+    size_t bucket_count;             /* Power of two */
+    CachedBlock *lru_head;
+    CachedBlock *lru_tail;
+    size_t bytes_used;
+} IoFile;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IoFile *registry = NULL;
+
+static AVIOContext *open_context(H265IoFile *base);
+static void close_context(AVIOContext **pb);
+
+static void free_file(IoFile *file)
+{
+    if (file->map) munmap((void *)file->map, (size_t)file->file_size);
+    if (file->mode == H265_IO_CACHED) {
+        for (CachedBlock *block = file->lru_head; block;) {
+            CachedBlock *next = block->lru_next;
+            av_free(block->data);
+            av_free(block);
+            block = next;
+        }
+        av_free(file->buckets);
+        pthread_mutex_destroy(&file->mutex);
+    }
+    if (file->fd >= 0) close(file->fd);
+    av_free(file);
+}
+
+/* Drop one reference, freeing the file with the last */
+static void release_file(IoFile *file)
+{
+    pthread_mutex_lock(&registry_mutex);
+    int is_last = --file->reference_count == 0;
+    if (is_last) {
+        for (IoFile **link = &registry; *link; link = &(*link)->next) {
+            if (*link == file) {
+                *link = file->next;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (is_last) free_file(file);
+}
+
+static IoFile *open_file(const char *filename, const struct stat *st, H265IoMode mode,
+                         size_t block_size, size_t byte_budget)
+{
+    if (st->st_size <= 0) return NULL;
+
+    IoFile *file = (IoFile *)av_mallocz(sizeof(IoFile));
+    if (!file) return NULL;
+    file->base.open_context = open_context;
+    file->base.close_context = close_context;
+    file->dev = st->st_dev;
+    file->ino = st->st_ino;
+    file->file_size = (int64_t)st->st_size;
+    file->mtime = st->st_mtime;
+    file->mode = mode;
+    file->block_size = mode == H265_IO_CACHED ? block_size : 0;
+
+    file->fd = open(filename, O_RDONLY);
+    if (file->fd < 0) {
+        av_free(file);
+        return NULL;
+    }
+
+    if (mode == H265_IO_MMAP) {
+        void *map = mmap(NULL, (size_t)file->file_size, PROT_READ, MAP_SHARED, file->fd, 0);
+        close(file->fd);
+        file->fd = -1;
+        if (map == MAP_FAILED) {
+            av_free(file);
+            return NULL;
+        }
+        file->map = (const uint8_t *)map;
+        return file;
+    }
+
+    /* Two buckets per block that fits in the budget keeps chains short */
+    size_t max_block_count = byte_budget / block_size + 1;
+    file->bucket_count = 16;
+    while (file->bucket_count < 2 * max_block_count) file->bucket_count *= 2;
+    file->buckets = (CachedBlock **)av_calloc(file->bucket_count, sizeof(CachedBlock *));
+    if (!file->buckets || pthread_mutex_init(&file->mutex, NULL) != 0) {
+        av_free(file->buckets);
+        close(file->fd);
+        av_free(file);
+        return NULL;
+    }
+    file->byte_budget = byte_budget;
+
+#ifdef POSIX_FADV_RANDOM
+    /* Every read is already a large block; kernel read-ahead would only add
+     * I/O for blocks that may never be used */
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    return file;
+}
+
+/* ============================================================================
+ * Block Cache
+ * ============================================================================ */
+
+static void lru_unlink(IoFile *file, CachedBlock *block)
+{
+    if (block->lru_prev) block->lru_prev->lru_next = block->lru_next;
+    else file->lru_head = block->lru_next;
+    if (block->lru_next) block->lru_next->lru_prev = block->lru_prev;
+    else file->lru_tail = block->lru_prev;
+    block->lru_prev = block->lru_next = NULL;
+}
+
+static void lru_push_front(IoFile *file, CachedBlock *block)
+{
+    block->lru_next = file->lru_head;
+    if (file->lru_head) file->lru_head->lru_prev = block;
+    file->lru_head = block;
+    if (!file->lru_tail) file->lru_tail = block;
+}
+
+static CachedBlock **bucket_for(IoFile *file, int64_t block_index)
+{
+    return &file->buckets[(size_t)block_index & (file->bucket_count - 1)];
+}
+
+/* Cached block, marked most recently used, or NULL. Caller holds mutex. */
+static CachedBlock *find_block(IoFile *file, int64_t block_index)
+{
+    for (CachedBlock *block = *bucket_for(file, block_index); block; block = block->hash_next) {
+        if (block->block_index == block_index) {
+            lru_unlink(file, block);
+            lru_push_front(file, block);
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void remove_block(IoFile *file, CachedBlock *block)
+{
+    for (CachedBlock **link = bucket_for(file, block->block_index); *link; link = &(*link)->hash_next) {
+        if (*link == block) {
+            *link = block->hash_next;
+            break;
+        }
+    }
+    lru_unlink(file, block);
+    file->bytes_used -= block->size;
+    av_free(block->data);
+    av_free(block);
+}
+
+/* Add block as most recently used and evict beyond the budget, always keeping
+ * block itself. Caller holds mutex. */
+static void insert_block(IoFile *file, CachedBlock *block)
+{
+    CachedBlock **bucket = bucket_for(file, block->block_index);
+    block->hash_next = *bucket;
+    *bucket = block;
+    lru_push_front(file, block);
+    file->bytes_used += block->size;
+
+    while (file->bytes_used > file->byte_budget && file->lru_tail != block) {
+        remove_block(file, file->lru_tail);
+    }
+}
+
+/* Read one whole block from the file. Called without mutex held, so other
+ * threads keep hitting the cache during the I/O. */
+static CachedBlock *load_block(IoFile *file, int64_t block_index)
+{
+    int64_t offset = block_index * (int64_t)file->block_size;
+    size_t size = file->block_size;
+    if (offset + (int64_t)size > file->file_size) size = (size_t)(file->file_size - offset);
+
+    CachedBlock *block = (CachedBlock *)av_mallocz(sizeof(CachedBlock));
+    uint8_t *data = block ? (uint8_t *)av_malloc(size) : NULL;
+    if (!data) {
+        av_free(block);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(file->fd, data + done, size - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            av_free(data);
+            av_free(block);
+            return NULL;
+        }
+        done += (size_t)n;
+    }
+
+    block->block_index = block_index;
+    block->data = data;
+    block->size = size;
+    return block;
+}
+
+/* Copy size bytes at pos (all within the file) out of the block cache.
+ * Returns the number of bytes copied, or a negative AVERROR. */
+static int read_through_cache(IoFile *file, int64_t pos, uint8_t *buf, int size)
+{
+    int copied = 0;
+    while (copied < size) {
+        int64_t block_index = (pos + copied) / (int64_t)file->block_size;
+        size_t offset = (size_t)(pos + copied - block_index * (int64_t)file->block_size);
+
+        pthread_mutex_lock(&file->mutex);
+        CachedBlock *block = find_block(file, block_index);
+        if (!block) {
+            pthread_mutex_unlock(&file->mutex);
+            CachedBlock *loaded = load_block(file, block_index);
+            if (!loaded) return copied > 0 ? copied : AVERROR(EIO);
+            pthread_mutex_lock(&file->mutex);
+
+            /* Another context may have loaded it in the meantime */
+            block = find_block(file, block_index);
+            if (block) {
+                av_free(loaded->data);
+                av_free(loaded);
+            } else {
+                insert_block(file, loaded);
+                block = loaded;
+            }
+        }
+
+        size_t n = block->size - offset;
+        if (n > (size_t)(size - copied)) n = (size_t)(size - copied);
+        memcpy(buf + copied, block->data + offset, n);
+        pthread_mutex_unlock(&file->mutex);
+        copied += (int)n;
+    }
+    return copied;
+}
+
+/* ============================================================================
+ * AVIOContext Callbacks
+ * ============================================================================ */
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    H265IoStream *stream = (H265IoStream *)opaque;
+    IoFile *file = (IoFile *)stream->file;
+
+    if (stream->pos >= file->file_size) return AVERROR_EOF;
+    if (buf_size > file->file_size - stream->pos) buf_size = (int)(file->file_size - stream->pos);
+
+    int n;
+    if (file->mode == H265_IO_MMAP) {
+        memcpy(buf, file->map + stream->pos, buf_size);
+        n = buf_size;
+    } else {
+        n = read_through_cache(file, stream->pos, buf, buf_size);
+    }
+    if (n > 0) stream->pos += n;
+    return n;
+}
+
+static int64_t seek_stream(void *opaque, int64_t offset, int whence)
+{
+    H265IoStream *stream = (H265IoStream *)opaque;
+    int64_t file_size = ((IoFile *)stream->file)->file_size;
+
+    int64_t pos;
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE: return file_size;
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = stream->pos + offset; break;
+        case SEEK_END: pos = file_size + offset; break;
+        default: return AVERROR(EINVAL);
+    }
+    if (pos < 0) return AVERROR(EINVAL);
+    stream->pos = pos;
+    return pos;
+}
+
+static AVIOContext *open_context(H265IoFile *base)
+{
+    IoFile *file = (IoFile *)base;
+
+    H265IoStream *stream = (H265IoStream *)av_mallocz(sizeof(H265IoStream));
+    uint8_t *buffer = (uint8_t *)av_malloc(CONTEXT_BUFFER_SIZE);
+    AVIOContext *pb = (stream && buffer)
+        ? avio_alloc_context(buffer, CONTEXT_BUFFER_SIZE, 0, stream, read_packet, NULL, seek_stream)
+        : NULL;
+    if (!pb) {
+        av_free(buffer);
+        av_free(stream);
+        return NULL;
+    }
+    stream->file = base;
+
+    pthread_mutex_lock(&registry_mutex);
+    file->reference_count++;
+    pthread_mutex_unlock(&registry_mutex);
+    return pb;
+}
+
+static void close_context(AVIOContext **pb)
+{
+    if (!*pb) return;
+    H265IoStream *stream = (H265IoStream *)(*pb)->opaque;
+    IoFile *file = (IoFile *)stream->file;
+
+    /* libavformat may have replaced the buffer, so free the current one */
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+    av_free(stream);
+    release_file(file);
+}
+
+/* ============================================================================
+ * Public Entry Point
+ * ============================================================================ */
+
+AVIOContext *h265_io_open(const char *filename, H265IoMode mode, size_t block_size,
+                          size_t byte_budget)
+{
+    struct stat st;
+    if (mode == H265_IO_DEFAULT || stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    if (mode != H265_IO_CACHED) block_size = 0;
+
+    /* Share a file already open with the same identity and layout; hold a
+     * reference so it cannot be freed before the new context is open */
+    pthread_mutex_lock(&registry_mutex);
+    IoFile *file = registry;
+    while (file && !(file->dev == st.st_dev && file->ino == st.st_ino &&
+                     file->file_size == (int64_t)st.st_size && file->mtime == st.st_mtime &&
+                     file->mode == mode && file->block_size == block_size)) {
+        file = file->next;
+    }
+    if (file) file->reference_count++;
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (!file) {
+        file = open_file(filename, &st, mode, block_size, byte_budget);
+        if (!file) return NULL;
+        file->reference_count = 1;
+        pthread_mutex_lock(&registry_mutex);
+        file->next = registry;
+        registry = file;
+        pthread_mutex_unlock(&registry_mutex);
+    }
+
+    AVIOContext *pb = open_context(&file->base);
+    release_file(file);
+    return pb;
+}
+
+#else /* _WIN32 */
+
+AVIOContext *h265_io_open(const char *filename, H265IoMode mode, size_t block_size,
+                          size_t byte_budget)
+{
+    return NULL;
+}
+
+#endif
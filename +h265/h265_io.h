@@ -0,0 +1,127 @@
+/*
+ * h265_io.h
+ * Custom AVIOContext input for the reader, for files on network and parallel
+ * file systems (NFS, Lustre) where FFmpeg's small buffered reads after every
+ * seek turn into many high-latency I/Os.
+ *
+ * Selected with open_h265_video's io_mode option:
+ *   "default" - FFmpeg's own file protocol (no custom I/O)
+ *   "mmap"    - map the whole file read-only and copy from the mapping
+ *   "cached"  - read the file in large aligned blocks (io_block_kb) through a
+ *               block cache of io_cache_mb; least recently used blocks are
+ *               evicted beyond it, but the last block read is always kept
+ *
+ * The mapping or block cache belongs to the opened file, not to the reader:
+ * every AVIOContext opened on the same file (same device, inode, size, and
+ * mtime) with the same mode and block size shares it. That includes other
+ * Readers of the file and the prefetch and parallel decode workers, which
+ * open their contexts with h265_io_open_input. The file is unmapped or its
+ * cache freed when the last context is closed.
+ *
+ * Only open_h265_video compiles h265_io.c. Contexts hold function pointers
+ * into it, and the other MEX files reach it only through the H265IoFile
+ * entry points below, so the registry of open files exists once per process.
+ * open_h265_video locks itself in memory for every Reader that reads through
+ * one, until close_h265_video closes it (see h265_mex_lock.h).
+ *
+ * The read and seek callbacks make no MATLAB API calls and are thread-safe,
+ * so contexts may be used from worker threads.
+ */
+
+#ifndef H265_IO_H
+#define H265_IO_H
+
+#include <libavformat/avformat.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    H265_IO_DEFAULT = 0,
+    H265_IO_MMAP,
+    H265_IO_CACHED
+} H265IoMode;
+
+/* Defaults for open_h265_video options io_block_kb and io_cache_mb */
+#define H265_IO_DEFAULT_BLOCK_KB 1024
+#define H265_IO_DEFAULT_CACHE_MB 64
+
+/*
+ * A file opened for custom I/O. Only the entry points are public; they point
+ * into the MEX file that opened it.
+ */
+typedef struct H265IoFile {
+    /* Open another context on the file, or NULL on failure */
+    AVIOContext *(*open_context)(struct H265IoFile *file);
+    /* Close a context returned by open_context or h265_io_open; sets *pb to NULL */
+    void (*close_context)(AVIOContext **pb);
+} H265IoFile;
+
+/* AVIOContext.opaque of every custom context */
+typedef struct {
+    H265IoFile *file;
+    int64_t pos;
+} H265IoStream;
+
+/* Values accepted by the io_mode option, indexed by H265IoMode */
+extern const char *const h265_io_mode_names[];
+
+/*
+ * Open a context reading filename in mode (not H265_IO_DEFAULT), sharing the
+ * mapping or block cache of any context already open on the file. block_size
+ * and byte_budget only matter for H265_IO_CACHED, and only for the first
+ * context on the file. Returns NULL if the file cannot be opened (or mapped),
+ * or the platform has no custom I/O.
+ */
+AVIOContext *h265_io_open(const char *filename, H265IoMode mode, size_t block_size,
+                          size_t byte_budget);
+
+/*
+ * The file fmt_ctx reads through, or NULL if it uses FFmpeg's own I/O.
+ */
+static inline H265IoFile *h265_io_file_of(const AVFormatContext *fmt_ctx)
+{
+    if (!fmt_ctx || !(fmt_ctx->flags & AVFMT_FLAG_CUSTOM_IO) || !fmt_ctx->pb) return NULL;
+    return ((H265IoStream *)fmt_ctx->pb->opaque)->file;
+}
+
+/*
+ * avformat_open_input on filename, reading through a new context on file
+ * when it is not NULL (the file of the reader's fmt_ctx, see h265_io_file_of).
+ * Returns 0 or a negative AVERROR; on failure *fmt_ctx is left NULL.
+ */
+static inline int h265_io_open_input(AVFormatContext **fmt_ctx, const char *filename,
+                                     H265IoFile *file)
+{
+    if (!file) return avformat_open_input(fmt_ctx, filename, NULL, NULL);
+
+    AVIOContext *pb = file->open_context(file);
+    AVFormatContext *ctx = pb ? avformat_alloc_context() : NULL;
+    if (!ctx) {
+        if (pb) file->close_context(&pb);
+        return AVERROR(ENOMEM);
+    }
+    ctx->pb = pb;
+
+    /* On failure avformat_open_input frees ctx but leaves a custom pb open */
+    int ret = avformat_open_input(&ctx, filename, NULL, NULL);
+    if (ret < 0) {
+        file->close_context(&pb);
+        return ret;
+    }
+    *fmt_ctx = ctx;
+    return 0;
+}
+
+/*
+ * avformat_close_input that also closes a custom context. Use in place of
+ * avformat_close_input on any fmt_ctx that may read through h265_io.
+ */
+static inline void h265_io_close_input(AVFormatContext **fmt_ctx)
+{
+    H265IoFile *file = h265_io_file_of(*fmt_ctx);
+    AVIOContext *pb = file ? (*fmt_ctx)->pb : NULL;
+    avformat_close_input(fmt_ctx);
+    if (pb) file->close_context(&pb);
+}
+
+#endif /* H265_IO_H */
@@ -0,0 +1,89 @@
+/*
+ * h265_mex_lock.h
+ * Keeping a MEX file loaded exactly as long as threads or callbacks may run
+ * its code.
+ *
+ * Worker threads (prefetch, the write pipeline, segment encoders) and
+ * function pointers kept in long-lived objects (custom I/O callbacks,
+ * registry leases) run code from the MEX file that set them up, which must
+ * not be cleared until the object is freed. That MEX file calls
+ * h265_mex_lock_for when it sets them up, recording itself in the object's
+ * H265MexLocks, and whichever MEX file frees the object calls
+ * h265_mex_unlock_all afterwards, so the module can be cleared (and a
+ * rebuilt one loaded) once the last Reader or Writer using it is closed.
+ *
+ * mexLock and mexUnlock act on the MEX file whose mexFunction is running,
+ * so a lock is dropped by calling its owner from MATLAB with the single
+ * argument H265_MEX_UNLOCK_REQUEST. Every MEX file that takes locks hands
+ * its arguments to h265_mex_handle_unlock first thing in mexFunction.
+ *
+ * Everything here runs on the MATLAB thread.
+ */
+
+#ifndef H265_MEX_LOCK_H
+#define H265_MEX_LOCK_H
+
+#include "mex.h"
+#include <stdint.h>
+#include <string.h>
+
+/* The one argument of an unlock request: uint32, so it cannot be mistaken
+ * for the filename or struct every locking MEX file otherwise takes first */
+#define H265_MEX_UNLOCK_REQUEST 0x48324C4Bu
+
+/* Distinct MEX files that may lock on behalf of one object */
+#define H265_MEX_LOCK_MAX 4
+
+/* The MEX files (package-qualified names, e.g. "h265.read_h265_frame") an
+ * object holds a lock on; zero-initialized means none */
+typedef struct {
+    const char *mex_names[H265_MEX_LOCK_MAX];
+    int count;
+} H265MexLocks;
+
+/*
+ * Lock the running MEX file, named mex_name, for the object owning locks,
+ * unless it already holds a lock on it.
+ */
+static inline void h265_mex_lock_for(H265MexLocks *locks, const char *mex_name)
+{
+    for (int i = 0; i < locks->count; i++) {
+        if (strcmp(locks->mex_names[i], mex_name) == 0) return;
+    }
+    if (locks->count == H265_MEX_LOCK_MAX) {
+        mexErrMsgIdAndTxt("h265:mexLock", "Too many MEX files locked for one object");
+    }
+    mexLock();
+    locks->mex_names[locks->count++] = mex_name;
+}
+
+/*
+ * Drop every lock in locks, once nothing of the object runs any more.
+ */
+static inline void h265_mex_unlock_all(H265MexLocks *locks)
+{
+    mxArray *request = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL);
+    *(uint32_t *)mxGetData(request) = H265_MEX_UNLOCK_REQUEST;
+    for (int i = 0; i < locks->count; i++) {
+        mxArray *exception = mexCallMATLABWithTrap(0, NULL, 1, &request, locks->mex_names[i]);
+        if (exception) mxDestroyArray(exception);
+    }
+    mxDestroyArray(request);
+    locks->count = 0;
+}
+
+/*
+ * If the arguments are an unlock request, drop one lock on the running MEX
+ * file and return 1; mexFunction then returns at once. Otherwise return 0.
+ */
+static inline int h265_mex_handle_unlock(int nrhs, const mxArray *prhs[])
+{
+    if (nrhs != 1 || !mxIsUint32(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1 ||
+        *(const uint32_t *)mxGetData(prhs[0]) != H265_MEX_UNLOCK_REQUEST) {
+        return 0;
+    }
+    if (mexIsLocked()) mexUnlock();
+    return 1;
+}
+
+#endif /* H265_MEX_LOCK_H */
@@ -0,0 +1,195 @@
+/*
+ * h265_parallel_decode.c
+ * GOP-parallel decoding of a frame range, used by read_h265_frames.c.
+ */
+
+#include "h265_parallel_decode.h"
+#include "h265_hwaccel.h"
+#include "h265_index.h"
+#include "h265_io.h"
+#include <pthread.h>
+
+/* ============================================================================
+ * Worker Job
+ * ============================================================================ */
+
+typedef struct {
+  /* Inputs (read-only while the worker runs) */
+  const char *filename;
+  H265IoFile *io_file;      /* Reader's custom I/O (see h265_io.h), or NULL */
+  const AVCodecParameters *codecpar;
+  AVBufferRef *hw_device_ctx;  /* Reader's decode device, NULL in software */
+  int video_stream_idx;
+  int64_t *dts_array;
+  int64_t pts_increment;
+  int segment_start;
+  int segment_end;
+  const H265OutputGeometry *geometry;
+  int is_grayscale;
+  uint8_t *frame_buffer;    /* Start of this segment's slice of the output */
+  size_t frame_size;
+  int do_collect_stats;
+
+  /* Output */
+  int frames_captured;      /* -1 on error */
+  H265ReadStats stats;      /* Added into the reader's after the join */
+} SegmentJob;
+
+/*
+ * Decode one segment on a private demuxer and decoder.
+ * Runs on a worker thread, so it must not make any MATLAB API calls.
+ */
+static void *decode_segment(void *arg)
+{
+  SegmentJob *job = (SegmentJob *)arg;
+  AVFormatContext *fmt_ctx = NULL;
+  AVCodecContext *codec_ctx = NULL;
+  H265DecodeState state;
+
+  job->frames_captured = -1;
+
+  if (h265_io_open_input(&fmt_ctx, job->filename, job->io_file) < 0) {
+    return NULL;
+  }
+
+  const AVCodec *codec = avcodec_find_decoder(job->codecpar->codec_id);
+  codec_ctx = codec ? avcodec_alloc_context3(codec) : NULL;
+  if (!codec_ctx ||
+      avcodec_parameters_to_context(codec_ctx, job->codecpar) < 0 ||
+      !h265_hwaccel_share_device(codec_ctx, job->hw_device_ctx)) {
+    avcodec_free_context(&codec_ctx);
+    h265_io_close_input(&fmt_ctx);
+    return NULL;
+  }
+
+  /* Parallelism comes from the segments, so each decoder is single-threaded */
+  codec_ctx->thread_count = 1;
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    avcodec_free_context(&codec_ctx);
+    h265_io_close_input(&fmt_ctx);
+    return NULL;
+  }
+
+  if (init_decode_state(&state, codec_ctx, job->geometry, job->is_grayscale)) {
+    state.stats = job->do_collect_stats ? &job->stats : NULL;
+    job->frames_captured = decode_frame_range_colmajor(
+        fmt_ctx, codec_ctx, job->video_stream_idx,
+        job->dts_array, job->pts_increment,
+        job->segment_start, job->segment_end,
+        &state, NULL, job->frame_buffer, job->frame_size);
+    free_decode_state(&state);
+  }
+
+  avcodec_free_context(&codec_ctx);
+  h265_io_close_input(&fmt_ctx);
+  return NULL;
+}
+
+/* ============================================================================
+ * Public Entry Point
+ * ============================================================================ */
+
+int decode_frame_range_parallel(
+    const char *filename,
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    const int32_t *keyframes, int keyframe_count,
+    int target_start, int target_end,
+    int worker_count, H265DecodeState *state, H265DecodePosition *position,
+    uint8_t *frame_buffer, size_t frame_size)
+{
+  int num_frames = target_end - target_start + 1;
+
+  /* Limit workers so each gets a worthwhile share of the range */
+  int max_workers = num_frames / H265_MIN_FRAMES_PER_WORKER;
+  if (worker_count > max_workers) worker_count = max_workers;
+
+  /* Split evenly, then move each boundary back to the start of its GOP so no
+   * worker decodes frames that belong to its neighbour */
+  int *boundaries = (int *)av_malloc_array(worker_count + 1, sizeof(int));
+  if (!boundaries) return -1;
+
+  int segment_count = 0;
+  if (worker_count > 1) {
+    boundaries[0] = target_start;
+    segment_count = 1;
+    for (int i = 1; i < worker_count; i++) {
+      int split = target_start + (int)((int64_t)num_frames * i / worker_count);
+      int gop_index = h265_gop_for_frame(keyframes, keyframe_count, split);
+      int gop_start = h265_gop_start(keyframes, gop_index);
+      if (gop_start > boundaries[segment_count - 1]) {
+        boundaries[segment_count++] = gop_start;
+      }
+    }
+    boundaries[segment_count] = target_end + 1;
+  }
+
+  /* Too small to split: decode on the reader's own contexts and state */
+  if (segment_count < 2) {
+    av_free(boundaries);
+    return decode_frame_range_colmajor(
+        fmt_ctx, codec_ctx, video_stream_idx,
+        dts_array, pts_increment,
+        target_start, target_end,
+        state, position, frame_buffer, frame_size);
+  }
+
+  SegmentJob *jobs = (SegmentJob *)av_calloc(segment_count, sizeof(SegmentJob));
+  pthread_t *threads = (pthread_t *)av_calloc(segment_count, sizeof(pthread_t));
+  int *is_thread_started = (int *)av_calloc(segment_count, sizeof(int));
+  if (!jobs || !threads || !is_thread_started) {
+    av_free(jobs);
+    av_free(threads);
+    av_free(is_thread_started);
+    av_free(boundaries);
+    return -1;
+  }
+
+  for (int i = 0; i < segment_count; i++) {
+    SegmentJob *job = &jobs[i];
+    job->filename = filename;
+    job->io_file = h265_io_file_of(fmt_ctx);
+    job->codecpar = fmt_ctx->streams[video_stream_idx]->codecpar;
+    job->hw_device_ctx = codec_ctx->hw_device_ctx;
+    job->video_stream_idx = video_stream_idx;
+    job->dts_array = dts_array;
+    job->pts_increment = pts_increment;
+    job->segment_start = boundaries[i];
+    job->segment_end = boundaries[i + 1] - 1;
+    job->geometry = &state->geometry;
+    job->is_grayscale = state->is_grayscale;
+    job->frame_buffer = frame_buffer + (size_t)(boundaries[i] - target_start) * frame_size;
+    job->frame_size = frame_size;
+    job->do_collect_stats = (state->stats != NULL);
+    job->frames_captured = -1;
+  }
+
+  /* Keep the last segment for this thread; if a thread cannot be started,
+   * its segment is decoded here as well */
+  for (int i = 0; i < segment_count - 1; i++) {
+    is_thread_started[i] = (pthread_create(&threads[i], NULL, decode_segment, &jobs[i]) == 0);
+  }
+  decode_segment(&jobs[segment_count - 1]);
+  for (int i = 0; i < segment_count - 1; i++) {
+    if (!is_thread_started[i]) {
+      decode_segment(&jobs[i]);
+    }
+  }
+
+  int frames_captured = 0;
+  for (int i = 0; i < segment_count; i++) {
+    if (is_thread_started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+    if (state->stats) h265_read_stats_add(state->stats, &jobs[i].stats);
+    if (frames_captured >= 0) {
+      frames_captured = (jobs[i].frames_captured < 0) ? -1 : frames_captured + jobs[i].frames_captured;
+    }
+  }
+
+  av_free(jobs);
+  av_free(threads);
+  av_free(is_thread_started);
+  av_free(boundaries);
+  return frames_captured;
+}
@@ -0,0 +1,44 @@
+/*
+ * h265_parallel_decode.h
+ * GOP-parallel decoding of a frame range, used by read_h265_frames.c.
+ *
+ * Videos written by h265.Writer have closed GOPs, so every GOP can be decoded
+ * independently of the others. A large range is split at keyframes into
+ * segments, and each segment is decoded on a worker thread with its own
+ * AVFormatContext and AVCodecContext, writing into its own slice of the
+ * column-major output array.
+ */
+
+#ifndef H265_PARALLEL_DECODE_H
+#define H265_PARALLEL_DECODE_H
+
+#include "h265_decode_common.h"
+
+/* Do not give a worker fewer frames than this; below it the cost of opening
+ * another demuxer and decoder outweighs the decode time saved. */
+#define H265_MIN_FRAMES_PER_WORKER 50
+
+/*
+ * Decode frames in [target_start, target_end] into frame_buffer (column-major,
+ * same layout as decode_frame_range_colmajor) using up to worker_count
+ * threads. keyframes is video_info.keyframes (1-based frame numbers) and is
+ * used to put segment boundaries on GOP starts.
+ * filename must name the file fmt_ctx was opened on; fmt_ctx and
+ * codec_ctx supply the stream parameters and are used directly when the range
+ * is too small to split, with state and from and then at position (see
+ * decode_frame_range_colmajor). state must be set up for the output (see
+ * prepare_decode_state); the workers decode to its geometry on states of
+ * their own and leave position alone, counting into state->stats (if set)
+ * once they are joined.
+ * Returns: number of frames captured, or -1 on error
+ */
+int decode_frame_range_parallel(
+    const char *filename,
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    const int32_t *keyframes, int keyframe_count,
+    int target_start, int target_end,
+    int worker_count, H265DecodeState *state, H265DecodePosition *position,
+    uint8_t *frame_buffer, size_t frame_size);
+
+#endif /* H265_PARALLEL_DECODE_H */
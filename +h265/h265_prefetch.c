@@ -0,0 +1,219 @@
+/*
+ * h265_prefetch.c
+ * Read-ahead decoding of the next GOP on a background thread (see h265_prefetch.h).
+ */
+
+#include "h265_prefetch.h"
+#include "h265_hwaccel.h"
+#include "h265_io.h"
+
+/* ============================================================================
+ * Worker Thread
+ * ============================================================================ */
+
+/*
+ * Open the worker's own demuxer and decoder if this is the first job.
+ * Returns 1 on success, 0 on failure.
+ */
+static int open_worker_decoder(H265Prefetch *prefetch)
+{
+  if (prefetch->codec_ctx) return 1;
+
+  if (!prefetch->fmt_ctx &&
+      h265_io_open_input(&prefetch->fmt_ctx, prefetch->filename, prefetch->io_file) < 0) {
+    return 0;
+  }
+
+  const AVCodec *codec = avcodec_find_decoder(prefetch->codecpar->codec_id);
+  AVCodecContext *codec_ctx = codec ? avcodec_alloc_context3(codec) : NULL;
+  if (!codec_ctx ||
+      avcodec_parameters_to_context(codec_ctx, prefetch->codecpar) < 0 ||
+      !h265_hwaccel_share_device(codec_ctx, prefetch->hw_device_ctx)) {
+    avcodec_free_context(&codec_ctx);
+    return 0;
+  }
+
+  codec_ctx->thread_count = prefetch->thread_count;
+  codec_ctx->thread_type = prefetch->thread_type;
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    avcodec_free_context(&codec_ctx);
+    return 0;
+  }
+
+  prefetch->codec_ctx = codec_ctx;
+  return 1;
+}
+
+/*
+ * Decode the current job's GOP into prefetch->frames_data.
+ * Runs on the worker thread, so it must not make any MATLAB API calls.
+ */
+static void *prefetch_worker(void *arg)
+{
+  H265Prefetch *prefetch = (H265Prefetch *)arg;
+  int frames_captured = -1;
+
+  if (open_worker_decoder(prefetch) &&
+      prepare_decode_state(&prefetch->state, prefetch->codec_ctx, &prefetch->geometry,
+                           prefetch->is_grayscale)) {
+    prefetch->state.stats = prefetch->do_collect_stats ? &prefetch->stats : NULL;
+    frames_captured = decode_frame_range_colmajor(
+        prefetch->fmt_ctx, prefetch->codec_ctx, prefetch->video_stream_idx,
+        prefetch->dts, prefetch->pts_increment,
+        prefetch->gop_start, prefetch->gop_start + prefetch->gop_frame_count - 1,
+        &prefetch->state, NULL, prefetch->frames_data, prefetch->frame_size);
+  }
+
+  pthread_mutex_lock(&prefetch->mutex);
+  prefetch->frames_captured = frames_captured;
+  prefetch->is_done = 1;
+  pthread_mutex_unlock(&prefetch->mutex);
+  return NULL;
+}
+
+/* ============================================================================
+ * MATLAB Thread
+ * ============================================================================ */
+
+/*
+ * Wait for the current job, if any, and drop its frames.
+ */
+static void discard_job(H265Prefetch *prefetch)
+{
+  if (prefetch->is_thread_started) {
+    pthread_join(prefetch->thread, NULL);
+    prefetch->is_thread_started = 0;
+  }
+  if (prefetch->frames) {
+    mxDestroyArray(prefetch->frames);
+    prefetch->frames = NULL;
+  }
+  prefetch->frames_data = NULL;
+  prefetch->gop_start = -1;
+}
+
+H265Prefetch *h265_prefetch_alloc(const char *filename,
+                                  AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                  int video_stream_idx, const int64_t *dts, int num_frames,
+                                  int64_t pts_increment, const H265OutputGeometry *geometry,
+                                  int is_grayscale, int do_collect_stats)
+{
+  H265Prefetch *prefetch = (H265Prefetch *)av_mallocz(sizeof(H265Prefetch));
+  if (!prefetch) return NULL;
+
+  prefetch->filename = av_strdup(filename);
+  prefetch->codecpar = avcodec_parameters_alloc();
+  prefetch->dts = (int64_t *)av_malloc_array(num_frames, sizeof(int64_t));
+  if (codec_ctx->hw_device_ctx) {
+    prefetch->hw_device_ctx = av_buffer_ref(codec_ctx->hw_device_ctx);
+  }
+  if (!prefetch->filename || !prefetch->codecpar || !prefetch->dts ||
+      (codec_ctx->hw_device_ctx && !prefetch->hw_device_ctx) ||
+      avcodec_parameters_copy(prefetch->codecpar, fmt_ctx->streams[video_stream_idx]->codecpar) < 0 ||
+      pthread_mutex_init(&prefetch->mutex, NULL) != 0) {
+    av_buffer_unref(&prefetch->hw_device_ctx);
+    av_free(prefetch->filename);
+    avcodec_parameters_free(&prefetch->codecpar);
+    av_free(prefetch->dts);
+    av_free(prefetch);
+    return NULL;
+  }
+  memcpy(prefetch->dts, dts, num_frames * sizeof(int64_t));
+
+  prefetch->io_file = h265_io_file_of(fmt_ctx);
+  prefetch->video_stream_idx = video_stream_idx;
+  prefetch->thread_count = codec_ctx->thread_count;
+  prefetch->thread_type = codec_ctx->thread_type;
+  prefetch->num_frames = num_frames;
+  prefetch->pts_increment = pts_increment;
+  prefetch->geometry = *geometry;
+  prefetch->is_grayscale = is_grayscale;
+  prefetch->frame_size = output_frame_size(geometry, is_grayscale);
+  prefetch->do_collect_stats = do_collect_stats;
+  prefetch->gop_start = -1;
+  prefetch->last_frame = -1;
+  prefetch->step = 1;
+
+  return prefetch;
+}
+
+void h265_prefetch_free(H265Prefetch *prefetch)
+{
+  if (!prefetch) return;
+
+  discard_job(prefetch);
+  free_decode_state(&prefetch->state);
+  avcodec_free_context(&prefetch->codec_ctx);
+  h265_io_close_input(&prefetch->fmt_ctx);
+  avcodec_parameters_free(&prefetch->codecpar);
+  av_buffer_unref(&prefetch->hw_device_ctx);
+  pthread_mutex_destroy(&prefetch->mutex);
+  av_free(prefetch->dts);
+  av_free(prefetch->filename);
+  av_free(prefetch);
+}
+
+void h265_prefetch_start(H265Prefetch *prefetch, int gop_start, int gop_end)
+{
+  if (prefetch->gop_start == gop_start) return;
+
+  /* Never block the caller on a job it no longer needs */
+  if (prefetch->is_thread_started) {
+    pthread_mutex_lock(&prefetch->mutex);
+    int is_done = prefetch->is_done;
+    pthread_mutex_unlock(&prefetch->mutex);
+    if (!is_done) return;
+  }
+  discard_job(prefetch);
+
+  int frame_count = gop_end - gop_start;
+  if (frame_count <= 0) return;
+
+  /* Uninitialized: the worker overwrites every byte */
+  mxArray *frames = create_frame_array(&prefetch->geometry, prefetch->is_grayscale, frame_count);
+  if (!frames) return;
+  mexMakeArrayPersistent(frames);
+
+  prefetch->frames = frames;
+  prefetch->frames_data = (uint8_t *)mxGetData(frames);
+  prefetch->gop_start = gop_start;
+  prefetch->gop_frame_count = frame_count;
+  prefetch->frames_captured = -1;
+  memset(&prefetch->stats, 0, sizeof(prefetch->stats));
+  prefetch->is_done = 0;
+
+  if (pthread_create(&prefetch->thread, NULL, prefetch_worker, prefetch) == 0) {
+    prefetch->is_thread_started = 1;
+  } else {
+    discard_job(prefetch);
+  }
+}
+
+H265CachedGop *h265_prefetch_take(H265Prefetch *prefetch, H265FrameCache *cache,
+                                  int frame_index)
+{
+  if (prefetch->gop_start < 0 ||
+      frame_index < prefetch->gop_start ||
+      frame_index >= prefetch->gop_start + prefetch->gop_frame_count) {
+    return NULL;
+  }
+
+  if (prefetch->is_thread_started) {
+    pthread_join(prefetch->thread, NULL);
+    prefetch->is_thread_started = 0;
+  }
+  H265ReadStats *stats = h265_cache_stats(cache);
+  if (stats) h265_read_stats_add(stats, &prefetch->stats);
+
+  if (prefetch->frames_captured != prefetch->gop_frame_count) {
+    discard_job(prefetch);
+    return NULL;
+  }
+
+  H265CachedGop *gop = h265_cache_insert(cache, prefetch->frames,
+                                         prefetch->gop_start, prefetch->gop_frame_count);
+  prefetch->frames = NULL;
+  prefetch->frames_data = NULL;
+  prefetch->gop_start = -1;
+  return gop;
+}
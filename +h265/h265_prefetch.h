@@ -0,0 +1,99 @@
+/*
+ * h265_prefetch.h
+ * Read-ahead decoding of an adjacent GOP on a background thread, used by
+ * read_h265_frame.c when video_info.do_prefetch is true.
+ *
+ * After read_h265_frame serves a frame from GOP k, it starts decoding GOP k+1
+ * (or k-1, when reads are stepping backward) on a worker thread with its own
+ * AVFormatContext and AVCodecContext. The worker decodes column-major frames
+ * straight into a MATLAB array that was created on the MATLAB thread, so no
+ * MATLAB API calls happen off that thread.
+ * When the caller reaches that GOP the finished array is moved into the frame
+ * cache, turning the stall at each GOP boundary into a cache hit.
+ *
+ * The GOP being prefetched is held outside the cache's byte budget until the
+ * caller asks for it, so read-ahead never evicts the GOP being read.
+ *
+ * The prefetcher hangs off H265FrameCache.prefetch and is freed (after
+ * joining the worker) by close_h265_video.
+ */
+
+#ifndef H265_PREFETCH_H
+#define H265_PREFETCH_H
+
+#include "h265_decode_common.h"
+#include "h265_frame_cache.h"
+#include <pthread.h>
+
+typedef struct H265Prefetch {
+  /* Fixed at allocation; read-only while the worker runs */
+  char *filename;
+  struct H265IoFile *io_file;  /* Reader's custom I/O (see h265_io.h), or NULL */
+  AVCodecParameters *codecpar;
+  int video_stream_idx;
+  int thread_count;         /* Decoder threading copied from the reader */
+  int thread_type;
+  AVBufferRef *hw_device_ctx;  /* Reader's decode device, NULL in software */
+  int64_t *dts;             /* Private copy of video_info.dts */
+  int num_frames;
+  int64_t pts_increment;
+  H265OutputGeometry geometry;
+  int is_grayscale;
+  size_t frame_size;
+  int do_collect_stats;     /* Count the worker's decoding (the Reader's do_collect_stats) */
+
+  /* Worker's demuxer, decoder, and decode state, set up by the first job */
+  AVFormatContext *fmt_ctx;
+  AVCodecContext *codec_ctx;
+  H265DecodeState state;
+
+  /* Current job. gop_start is -1 when there is none. */
+  pthread_t thread;
+  int is_thread_started;    /* thread must be joined before the job is reused */
+  pthread_mutex_t mutex;
+  int is_done;              /* Set by the worker under mutex */
+  int gop_start;
+  int gop_frame_count;
+  mxArray *frames;          /* Persistent, column-major; filled by the worker */
+  uint8_t *frames_data;     /* mxGetData(frames), taken on the MATLAB thread */
+  int frames_captured;      /* -1 on error */
+  H265ReadStats stats;      /* The job's decoding, added into the cache's when taken */
+
+  /* Direction of travel, kept by read_h265_frame on the MATLAB thread */
+  int last_frame;           /* Frame of the last read, -1 before the first */
+  int step;                 /* GOPs from the one read to the one to prefetch: 1 or -1 */
+} H265Prefetch;
+
+/*
+ * Create a prefetcher for the video fmt_ctx/codec_ctx were opened on.
+ * dts is copied, so video_info need not outlive the prefetcher.
+ * Returns NULL on failure.
+ */
+H265Prefetch *h265_prefetch_alloc(const char *filename,
+                                  AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                  int video_stream_idx, const int64_t *dts, int num_frames,
+                                  int64_t pts_increment, const H265OutputGeometry *geometry,
+                                  int is_grayscale, int do_collect_stats);
+
+/*
+ * Wait for any running job, then free the prefetcher and everything it holds.
+ */
+void h265_prefetch_free(H265Prefetch *prefetch);
+
+/*
+ * Start decoding frames [gop_start, gop_end) in the background. Does nothing
+ * if that GOP is already being prefetched or a job for another GOP is still
+ * running (the caller does not wait); a finished job for another GOP is
+ * discarded.
+ */
+void h265_prefetch_start(H265Prefetch *prefetch, int gop_start, int gop_end);
+
+/*
+ * If the current job covers frame_index, wait for it to finish, add its
+ * decoding into cache->stats, and move its frames into cache. Returns the new cache entry, or NULL if the job does not
+ * cover frame_index or failed.
+ */
+H265CachedGop *h265_prefetch_take(H265Prefetch *prefetch, H265FrameCache *cache,
+                                  int frame_index);
+
+#endif /* H265_PREFETCH_H */
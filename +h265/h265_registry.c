@@ -0,0 +1,238 @@
+/*
+ * h265_registry.c
+ * Process-wide registry of shared frame indexes and idle decoders
+ * (see h265_registry.h).
+ */
+
+#include "h265_registry.h"
+#include <string.h>
+
+typedef struct SharedVideo {
+    struct SharedVideo *next;
+    int reference_count;       /* Leases plus idle decoders */
+    char *filename;
+    int64_t file_size;
+    int64_t mtime;
+    H265Index index;           /* Persistent copies of the arrays */
+} SharedVideo;
+
+typedef struct IdleDecoder {
+    struct IdleDecoder *next;  /* Most recently returned first */
+    SharedVideo *video;
+    H265DecoderConfig config;
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;
+} IdleDecoder;
+
+typedef struct {
+    H265VideoLease base;       /* Entry point; must be first */
+    SharedVideo *video;
+    H265DecoderConfig config;
+} Lease;
+
+static SharedVideo *videos = NULL;
+static IdleDecoder *idle_decoders = NULL;
+static int idle_count = 0;
+
+/* ============================================================================
+ * Videos
+ * ============================================================================ */
+
+static void *persistent_copy(const void *data, size_t size)
+{
+    void *copy = mxMalloc(size > 0 ? size : 1);
+    mexMakeMemoryPersistent(copy);
+    if (size > 0) memcpy(copy, data, size);
+    return copy;
+}
+
+static void release_video(SharedVideo *video)
+{
+    if (--video->reference_count > 0) return;
+    for (SharedVideo **link = &videos; *link; link = &(*link)->next) {
+        if (*link == video) {
+            *link = video->next;
+            break;
+        }
+    }
+    h265_index_free(&video->index);
+    mxFree(video->filename);
+    mxFree(video);
+}
+
+static void free_idle_decoder(IdleDecoder *idle)
+{
+    avcodec_free_context(&idle->codec_ctx);
+    h265_io_close_input(&idle->fmt_ctx);
+    release_video(idle->video);
+    mxFree(idle);
+}
+
+/* Unlink and free every idle decoder of video */
+static void drop_idle_decoders(SharedVideo *video)
+{
+    IdleDecoder **link = &idle_decoders;
+    while (*link) {
+        IdleDecoder *idle = *link;
+        if (idle->video == video) {
+            *link = idle->next;
+            idle_count--;
+            free_idle_decoder(idle);
+        } else {
+            link = &idle->next;
+        }
+    }
+}
+
+/*
+ * The registered video at filename, or NULL. A video whose file has changed
+ * since it was registered is never returned, and its idle decoders are freed.
+ */
+static SharedVideo *find_video(const char *filename)
+{
+    int64_t file_size, mtime;
+    int has_stamp = h265_file_stamp(filename, &file_size, &mtime);
+
+    for (SharedVideo *video = videos; video; video = video->next) {
+        if (strcmp(video->filename, filename) != 0) continue;
+        if (has_stamp && video->file_size == file_size && video->mtime == mtime) return video;
+        drop_idle_decoders(video);
+        return NULL;
+    }
+    return NULL;
+}
+
+/* Same settings, for reusing a pooled decoder */
+static int is_same_config(const H265DecoderConfig *a, const H265DecoderConfig *b)
+{
+    return a->thread_count == b->thread_count &&
+           a->thread_type == b->thread_type &&
+           strcmp(a->hwaccel, b->hwaccel) == 0 &&
+           a->io_mode == b->io_mode &&
+           (a->io_mode != H265_IO_CACHED || a->io_block_size == b->io_block_size);
+}
+
+/* ============================================================================
+ * Leases
+ * ============================================================================ */
+
+static void release_lease(H265VideoLease *base, AVFormatContext *fmt_ctx,
+                          AVCodecContext *codec_ctx)
+{
+    Lease *lease = (Lease *)base;
+
+    if (fmt_ctx && codec_ctx) {
+        /* The idle decoder takes over the lease's reference */
+        IdleDecoder *idle = (IdleDecoder *)mxMalloc(sizeof(IdleDecoder));
+        mexMakeMemoryPersistent(idle);
+        idle->video = lease->video;
+        idle->config = lease->config;
+        idle->fmt_ctx = fmt_ctx;
+        idle->codec_ctx = codec_ctx;
+        idle->next = idle_decoders;
+        idle_decoders = idle;
+        idle_count++;
+
+        /* Evict the decoder returned longest ago */
+        if (idle_count > H265_REGISTRY_MAX_IDLE) {
+            IdleDecoder **link = &idle_decoders;
+            while ((*link)->next) link = &(*link)->next;
+            IdleDecoder *oldest = *link;
+            *link = NULL;
+            idle_count--;
+            free_idle_decoder(oldest);
+        }
+    } else {
+        avcodec_free_context(&codec_ctx);
+        h265_io_close_input(&fmt_ctx);
+        release_video(lease->video);
+    }
+    mxFree(lease);
+}
+
+/* ============================================================================
+ * Public Entry Points
+ * ============================================================================ */
+
+int h265_registry_take_decoder(const char *filename, const H265DecoderConfig *config,
+                               AVFormatContext **fmt_ctx, AVCodecContext **codec_ctx)
+{
+    SharedVideo *video = find_video(filename);
+    if (!video) return 0;
+
+    for (IdleDecoder **link = &idle_decoders; *link; link = &(*link)->next) {
+        IdleDecoder *idle = *link;
+        if (idle->video != video || !is_same_config(&idle->config, config)) continue;
+
+        *link = idle->next;
+        idle_count--;
+        *fmt_ctx = idle->fmt_ctx;
+        *codec_ctx = idle->codec_ctx;
+        release_video(video);
+        mxFree(idle);
+
+        /* The previous Reader left the demuxer wherever it last read */
+        avformat_seek_file(*fmt_ctx, -1, INT64_MIN, 0, 0, 0);
+        avcodec_flush_buffers(*codec_ctx);
+        return 1;
+    }
+    return 0;
+}
+
+int h265_registry_read_index(const char *filename, H265Index *index)
+{
+    SharedVideo *video = find_video(filename);
+    if (!video) return 0;
+
+    const H265Index *shared = &video->index;
+    index->num_frames = shared->num_frames;
+    index->keyframe_count = shared->keyframe_count;
+    index->pts_increment = shared->pts_increment;
+    index->dts = (int64_t *)mxMalloc(shared->num_frames * sizeof(int64_t));
+    index->keyframes = (int32_t *)mxMalloc(shared->keyframe_count * sizeof(int32_t));
+    memcpy(index->dts, shared->dts, shared->num_frames * sizeof(int64_t));
+    memcpy(index->keyframes, shared->keyframes, shared->keyframe_count * sizeof(int32_t));
+    return 1;
+}
+
+H265VideoLease *h265_registry_register(const char *filename, const H265Index *index,
+                                       const H265DecoderConfig *config)
+{
+    SharedVideo *video = find_video(filename);
+    if (!video) {
+        int64_t file_size, mtime;
+        if (!h265_file_stamp(filename, &file_size, &mtime)) return NULL;
+
+        video = (SharedVideo *)mxCalloc(1, sizeof(SharedVideo));
+        mexMakeMemoryPersistent(video);
+        video->filename = (char *)persistent_copy(filename, strlen(filename) + 1);
+        video->file_size = file_size;
+        video->mtime = mtime;
+        video->index.num_frames = index->num_frames;
+        video->index.keyframe_count = index->keyframe_count;
+        video->index.pts_increment = index->pts_increment;
+        video->index.dts = (int64_t *)persistent_copy(index->dts, index->num_frames * sizeof(int64_t));
+        video->index.keyframes = (int32_t *)persistent_copy(index->keyframes,
+                                                            index->keyframe_count * sizeof(int32_t));
+        video->next = videos;
+        videos = video;
+    }
+
+    Lease *lease = (Lease *)mxMalloc(sizeof(Lease));
+    mexMakeMemoryPersistent(lease);
+    lease->base.release = release_lease;
+    lease->video = video;
+    lease->config = *config;
+    video->reference_count++;
+    return &lease->base;
+}
+
+void h265_registry_free_idle(void)
+{
+    while (idle_decoders) {
+        IdleDecoder *idle = idle_decoders;
+        idle_decoders = idle->next;
+        idle_count--;
+        free_idle_decoder(idle);
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * h265_registry.h
+ * Process-wide registry of videos opened with do_share, used by
+ * open_h265_video and close_h265_video.
+ *
+ * Readers of the same file (same path, size, and mtime) opened with do_share
+ * share one copy of its frame index, so only the first of them builds it;
+ * later opens report index_source 'shared'. When such a Reader is closed, its
+ * demuxer and decoder go into a small pool of idle decoders instead of being
+ * freed, and the next do_share Reader of the file with the same decoder
+ * settings takes them over, skipping the file open, stream probing, and
+ * decoder setup. At most H265_REGISTRY_MAX_IDLE decoders are kept, the one
+ * returned longest ago being freed first. A video's entry is freed once no
+ * Reader or idle decoder refers to it.
+ *
+ * Under parfor each worker process has its own registry: workers share the
+ * index across processes through the .h265idx sidecar (do_write_index), and
+ * the registry makes reopening the video free within each worker.
+ *
+ * Only open_h265_video compiles h265_registry.c; close_h265_video hands a
+ * Reader back through the release entry point of its lease, so the registry
+ * exists once per process (see h265_io.h). open_h265_video stays locked in
+ * memory while any Reader holds a lease (see h265_mex_lock.h); once the last
+ * one is closed it may be cleared, and then frees the idle decoders.
+ *
+ * Everything here runs on the MATLAB thread, so there is no locking.
+ */
+
+#ifndef H265_REGISTRY_H
+#define H265_REGISTRY_H
+
+#include "h265_index.h"
+#include "h265_io.h"
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+/* Idle decoders kept across all videos */
+#define H265_REGISTRY_MAX_IDLE 4
+
+/* Settings a pooled decoder must match to be reused */
+typedef struct {
+    int thread_count;
+    int thread_type;           /* FF_THREAD_* flags */
+    const char *hwaccel;       /* hwaccel option, not the device it got */
+    H265IoMode io_mode;
+    size_t io_block_size;
+} H265DecoderConfig;
+
+/*
+ * A do_share Reader's hold on its registry entry, stored in
+ * video_info.registry_ptr.
+ */
+typedef struct H265VideoLease {
+    /* Pool or free the Reader's fmt_ctx and codec_ctx (either may be NULL),
+     * drop its reference to the video, and free the lease */
+    void (*release)(struct H265VideoLease *lease, AVFormatContext *fmt_ctx,
+                    AVCodecContext *codec_ctx);
+} H265VideoLease;
+
+/*
+ * Take an idle decoder of filename opened with config, if there is one and
+ * the file has not changed since. The demuxer is rewound and the decoder
+ * flushed. Returns 1 and sets *fmt_ctx and *codec_ctx, or returns 0.
+ */
+int h265_registry_take_decoder(const char *filename, const H265DecoderConfig *config,
+                               AVFormatContext **fmt_ctx, AVCodecContext **codec_ctx);
+
+/*
+ * Copy the registered index of filename into index (mxMalloc'd, free with
+ * h265_index_free). Returns 1 on success, 0 if filename is not registered or
+ * has changed since.
+ */
+int h265_registry_read_index(const char *filename, H265Index *index);
+
+/*
+ * Register a Reader of filename with the given index and decoder settings,
+ * adding the video if it is not registered yet. Returns the Reader's lease,
+ * or NULL if out of memory (the Reader then just does not share).
+ */
+H265VideoLease *h265_registry_register(const char *filename, const H265Index *index,
+                                       const H265DecoderConfig *config);
+
+/*
+ * Free every idle decoder, and with them every video no Reader holds a lease
+ * on. Run when open_h265_video is cleared.
+ */
+void h265_registry_free_idle(void);
+
+#endif /* H265_REGISTRY_H */
@@ -0,0 +1,332 @@
+/*
+ * h265_segment_encoder.c
+ * Segment-parallel encoding on worker threads (see h265_segment_encoder.h).
+ */
+
+#include "h265_segment_encoder.h"
+#include <libavutil/opt.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ============================================================================
+ * Worker Thread
+ * ============================================================================ */
+
+/*
+ * Open an encoder with the same settings as the writer's. The private options
+ * (tune, x265-params, ...) are copied wholesale so the two cannot drift apart;
+ * a hardware encoder shares the writer's device.
+ * Returns NULL on failure.
+ */
+static AVCodecContext *open_segment_codec(const AVCodecContext *template_ctx)
+{
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(template_ctx->codec);
+    if (!codec_ctx) return NULL;
+
+    codec_ctx->width = template_ctx->width;
+    codec_ctx->height = template_ctx->height;
+    codec_ctx->time_base = template_ctx->time_base;
+    codec_ctx->framerate = template_ctx->framerate;
+    codec_ctx->pix_fmt = template_ctx->pix_fmt;
+    codec_ctx->gop_size = template_ctx->gop_size;
+    codec_ctx->max_b_frames = template_ctx->max_b_frames;
+    codec_ctx->global_quality = template_ctx->global_quality;
+    codec_ctx->bit_rate = template_ctx->bit_rate;
+    codec_ctx->flags = template_ctx->flags;
+    codec_ctx->thread_count = template_ctx->thread_count;
+    if (template_ctx->hw_device_ctx) {
+        codec_ctx->hw_device_ctx = av_buffer_ref(template_ctx->hw_device_ctx);
+    }
+    if ((template_ctx->hw_device_ctx && !codec_ctx->hw_device_ctx) ||
+        av_opt_copy(codec_ctx->priv_data, template_ctx->priv_data) < 0 ||
+        avcodec_open2(codec_ctx, template_ctx->codec, NULL) < 0) {
+        avcodec_free_context(&codec_ctx);
+        return NULL;
+    }
+    return codec_ctx;
+}
+
+/*
+ * Append the encoder's pending packets to the job. Returns 0 on success or a
+ * negative AVERROR.
+ */
+static int collect_packets(H265SegmentJob *job, AVCodecContext *codec_ctx, AVPacket *pkt,
+                           H265WriteStats *stats)
+{
+    while (1) {
+        int64_t start = h265_stats_start(stats);
+        int ret = avcodec_receive_packet(codec_ctx, pkt);
+        if (stats) stats->receive_packet_us += h265_stats_elapsed_us(start);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0;
+        if (ret < 0) return ret;
+
+        if (job->packet_count == job->packet_capacity) {
+            int new_capacity = job->packet_capacity ? 2 * job->packet_capacity : 64;
+            AVPacket **packets = (AVPacket **)av_realloc_array(job->packets, new_capacity,
+                                                               sizeof(AVPacket *));
+            if (!packets) return AVERROR(ENOMEM);
+            job->packets = packets;
+            job->packet_capacity = new_capacity;
+        }
+        AVPacket *stored = av_packet_alloc();
+        if (!stored) return AVERROR(ENOMEM);
+        av_packet_move_ref(stored, pkt);
+        job->packets[job->packet_count++] = stored;
+    }
+}
+
+/*
+ * Encode one segment into job->packets.
+ * Runs on a worker thread, so it must not make any MATLAB API calls.
+ */
+static void *segment_worker(void *arg)
+{
+    H265SegmentJob *job = (H265SegmentJob *)arg;
+    H265SegmentEncoder *encoder = job->encoder;
+    AVCodecContext *codec_ctx = open_segment_codec(encoder->codec_ctx);
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *gbrp_frame = NULL;
+    struct SwsContext *sws_ctx = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    H265WriteStats *stats = encoder->do_collect_stats ? &job->stats : NULL;
+    int ret;
+
+    if (!codec_ctx || !frame || !pkt) {
+        snprintf(job->error_message, sizeof(job->error_message), "Could not open segment encoder");
+        job->error = AVERROR(ENOMEM);
+        goto done;
+    }
+    if (codec_ctx->extradata_size != encoder->codec_ctx->extradata_size ||
+        memcmp(codec_ctx->extradata, encoder->codec_ctx->extradata, codec_ctx->extradata_size) != 0) {
+        snprintf(job->error_message, sizeof(job->error_message),
+                 "Segment encoder produced different stream headers than the writer's encoder");
+        job->error = AVERROR(EINVAL);
+        goto done;
+    }
+
+    frame->format = codec_ctx->pix_fmt;
+    frame->width = encoder->width;
+    frame->height = encoder->height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        snprintf(job->error_message, sizeof(job->error_message), "Could not allocate frame buffer");
+        job->error = AVERROR(ENOMEM);
+        goto done;
+    }
+    if (encoder->is_color) {
+        sws_ctx = h265_alloc_rgb_sws(encoder->width, encoder->height, encoder->bit_depth, 1);
+        gbrp_frame = h265_alloc_gbrp_frame(encoder->width, encoder->height, encoder->bit_depth);
+        if (!sws_ctx || !gbrp_frame) {
+            snprintf(job->error_message, sizeof(job->error_message),
+                     "Could not allocate conversion buffer");
+            job->error = AVERROR(ENOMEM);
+            goto done;
+        }
+    }
+
+    for (int f = 0; f < job->frame_count; f++) {
+        ret = h265_convert_frame(job->frames + f * encoder->frame_size, encoder->width,
+                                 encoder->height, encoder->is_color, encoder->bit_depth,
+                                 gbrp_frame, sws_ctx, frame, stats);
+        if (ret < 0) {
+            snprintf(job->error_message, sizeof(job->error_message),
+                     "Could not convert frame %lld", (long long)job->pts[f] + 1);
+            job->error = ret;
+            goto done;
+        }
+        frame->pts = job->pts[f];
+        int64_t start = h265_stats_start(stats);
+        ret = avcodec_send_frame(codec_ctx, frame);
+        if (stats) stats->send_frame_us += h265_stats_elapsed_us(start);
+        if (ret >= 0) ret = collect_packets(job, codec_ctx, pkt, stats);
+        if (ret < 0) {
+            snprintf(job->error_message, sizeof(job->error_message),
+                     "Error encoding frame %lld", (long long)job->pts[f] + 1);
+            job->error = ret;
+            goto done;
+        }
+    }
+
+    /* Flush this segment's encoder */
+    ret = avcodec_send_frame(codec_ctx, NULL);
+    if (ret >= 0) ret = collect_packets(job, codec_ctx, pkt, stats);
+    if (ret < 0) {
+        snprintf(job->error_message, sizeof(job->error_message), "Error flushing segment encoder");
+        job->error = ret;
+    }
+
+done:
+    av_packet_free(&pkt);
+    sws_freeContext(sws_ctx);
+    av_frame_free(&gbrp_frame);
+    av_frame_free(&frame);
+    avcodec_free_context(&codec_ctx);
+    return NULL;
+}
+
+/* ============================================================================
+ * MATLAB Thread
+ * ============================================================================ */
+
+static void free_job_packets(H265SegmentJob *job)
+{
+    for (int i = 0; i < job->packet_count; i++) {
+        av_packet_free(&job->packets[i]);
+    }
+    job->packet_count = 0;
+}
+
+/*
+ * Wait for the oldest submitted segment and mux its packets (unless an error
+ * has already occurred), then make its job reusable.
+ */
+static void mux_oldest_segment(H265SegmentEncoder *encoder)
+{
+    H265SegmentJob *job = &encoder->jobs[encoder->muxed_count % encoder->job_count];
+    if (job->is_thread_started) {
+        pthread_join(job->thread, NULL);
+        job->is_thread_started = 0;
+    }
+    h265_write_stats_add(&encoder->stats, &job->stats);
+    memset(&job->stats, 0, sizeof(job->stats));
+
+    if (!encoder->error && job->error) {
+        encoder->error = job->error;
+        snprintf(encoder->error_message, sizeof(encoder->error_message), "%s", job->error_message);
+    }
+    AVRational stream_time_base = encoder->fmt_ctx->streams[encoder->stream_idx]->time_base;
+    for (int i = 0; i < job->packet_count && !encoder->error; i++) {
+        AVPacket *pkt = job->packets[i];
+        av_packet_rescale_ts(pkt, encoder->codec_ctx->time_base, stream_time_base);
+        pkt->stream_index = encoder->stream_idx;
+        int64_t start = 0;
+        if (encoder->do_collect_stats) {
+            encoder->stats.packet_count++;
+            encoder->stats.packet_bytes += pkt->size;
+            start = av_gettime_relative();
+        }
+        int ret = av_interleaved_write_frame(encoder->fmt_ctx, pkt);
+        if (encoder->do_collect_stats) encoder->stats.write_packet_us += h265_stats_elapsed_us(start);
+        if (ret < 0) {
+            encoder->error = ret;
+            snprintf(encoder->error_message, sizeof(encoder->error_message),
+                     "Error writing packet to file in segment %lld",
+                     (long long)encoder->muxed_count + 1);
+        }
+    }
+
+    free_job_packets(job);
+    job->frame_count = 0;
+    job->error = 0;
+    encoder->muxed_count++;
+}
+
+/*
+ * Hand the current segment to a worker thread.
+ */
+static void submit_current_segment(H265SegmentEncoder *encoder)
+{
+    H265SegmentJob *job = &encoder->jobs[encoder->submitted_count % encoder->job_count];
+    encoder->submitted_count++;
+    if (pthread_create(&job->thread, NULL, segment_worker, job) == 0) {
+        job->is_thread_started = 1;
+    } else {
+        job->error = AVERROR(EAGAIN);
+        snprintf(job->error_message, sizeof(job->error_message),
+                 "Could not start segment encoder thread");
+    }
+}
+
+H265SegmentEncoder *h265_segment_encoder_alloc(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                               int stream_idx, int width, int height, int is_color,
+                                               int bit_depth, int segment_frame_count, int encoder_count)
+{
+    if (segment_frame_count < 1 || encoder_count < 1) return NULL;
+
+    H265SegmentEncoder *encoder = (H265SegmentEncoder *)av_mallocz(sizeof(H265SegmentEncoder));
+    if (!encoder) return NULL;
+
+    encoder->jobs = (H265SegmentJob *)av_calloc(encoder_count, sizeof(H265SegmentJob));
+    if (!encoder->jobs) {
+        av_free(encoder);
+        return NULL;
+    }
+
+    encoder->fmt_ctx = fmt_ctx;
+    encoder->codec_ctx = codec_ctx;
+    encoder->stream_idx = stream_idx;
+    encoder->width = width;
+    encoder->height = height;
+    encoder->is_color = is_color;
+    encoder->bit_depth = bit_depth;
+    encoder->frame_size = (is_color ? (size_t)width * height * 3 : (size_t)width * height) *
+        h265_bytes_per_sample(bit_depth);
+    encoder->segment_frame_count = segment_frame_count;
+    encoder->job_count = encoder_count;
+    for (int i = 0; i < encoder_count; i++) {
+        encoder->jobs[i].encoder = encoder;
+    }
+
+    return encoder;
+}
+
+int h265_segment_encoder_free(H265SegmentEncoder *encoder)
+{
+    if (!encoder) return 0;
+
+    int error = h265_segment_encoder_flush(encoder);
+    for (int i = 0; i < encoder->job_count; i++) {
+        av_free(encoder->jobs[i].packets);
+        av_free(encoder->jobs[i].frames);
+        av_free(encoder->jobs[i].pts);
+    }
+    av_free(encoder->jobs);
+    av_free(encoder);
+    return error;
+}
+
+int h265_segment_encoder_add_frame(H265SegmentEncoder *encoder, const uint8_t *frame_data,
+                                   int64_t pts)
+{
+    if (encoder->error) return encoder->error;
+
+    /* With every job busy, the next one still holds segment
+     * submitted_count - job_count until that has been muxed */
+    while (encoder->submitted_count - encoder->muxed_count >= encoder->job_count) {
+        mux_oldest_segment(encoder);
+    }
+    if (encoder->error) return encoder->error;
+
+    H265SegmentJob *job = &encoder->jobs[encoder->submitted_count % encoder->job_count];
+    if (!job->frames) {
+        job->frames = (uint8_t *)av_malloc_array(encoder->segment_frame_count, encoder->frame_size);
+        job->pts = (int64_t *)av_malloc_array(encoder->segment_frame_count, sizeof(int64_t));
+        if (!job->frames || !job->pts) {
+            av_freep(&job->frames);
+            av_freep(&job->pts);
+            encoder->error = AVERROR(ENOMEM);
+            snprintf(encoder->error_message, sizeof(encoder->error_message),
+                     "Could not allocate segment buffer");
+            return encoder->error;
+        }
+    }
+
+    memcpy(job->frames + job->frame_count * encoder->frame_size, frame_data, encoder->frame_size);
+    job->pts[job->frame_count] = pts;
+    job->frame_count++;
+    if (job->frame_count == encoder->segment_frame_count) {
+        submit_current_segment(encoder);
+    }
+    return 0;
+}
+
+int h265_segment_encoder_flush(H265SegmentEncoder *encoder)
+{
+    H265SegmentJob *job = &encoder->jobs[encoder->submitted_count % encoder->job_count];
+    if (job->frame_count > 0 && !encoder->error) {
+        submit_current_segment(encoder);
+    }
+    while (encoder->muxed_count < encoder->submitted_count) {
+        mux_oldest_segment(encoder);
+    }
+    return encoder->error;
+}
@@ -0,0 +1,102 @@
+/*
+ * h265_segment_encoder.h
+ * Segment-parallel encoding, used by write_h265_frames.c when the writer was
+ * opened with segment_encoder_count > 1.
+ *
+ * The writer's GOPs are closed and start every gop_size frames, so a run of
+ * whole GOPs can be encoded without reference to its neighbours. Frames are
+ * collected into segments of segment_frame_count frames (a multiple of
+ * gop_size); each full segment is encoded on its own thread by a fresh x265
+ * instance configured exactly like the writer's encoder, and the finished
+ * segments' packets are muxed in order on the MATLAB thread. Timestamps are
+ * the writer's global ones, so the segments join into one continuous stream.
+ * Every segment encoder must produce the same parameter sets as the writer's
+ * encoder (which are in the MP4 header); a mismatch is reported as an error.
+ *
+ * At most encoder_count segments are buffered or in flight; once all of them
+ * are busy, starting a new segment waits for the oldest to finish and muxes
+ * it, which bounds memory and applies backpressure to the caller.
+ *
+ * The segment encoder hangs off WriterState.segments and is freed (after
+ * encoding and muxing the last partial segment) by close_h265_write.
+ */
+
+#ifndef H265_SEGMENT_ENCODER_H
+#define H265_SEGMENT_ENCODER_H
+
+#include "h265_write_common.h"
+#include <pthread.h>
+
+#define H265_SEGMENT_DEFAULT_GOP_COUNT 1
+
+typedef struct H265SegmentJob {
+    struct H265SegmentEncoder *encoder;
+    uint8_t *frames;            /* segment_frame_count column-major frames, allocated on first use */
+    int64_t *pts;
+    int frame_count;            /* Frames collected so far */
+    pthread_t thread;
+    int is_thread_started;      /* thread must be joined before the job is reused */
+
+    /* Written by the worker, read after the join */
+    AVPacket **packets;
+    int packet_count;
+    int packet_capacity;
+    int error;
+    char error_message[256];
+    H265WriteStats stats;       /* If the encoder's do_collect_stats */
+} H265SegmentJob;
+
+typedef struct H265SegmentEncoder {
+    /* Fixed at allocation; read-only while workers run */
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;  /* Template for the segment encoders; never fed frames */
+    int stream_idx;
+    int width;
+    int height;
+    int is_color;
+    int bit_depth;
+    size_t frame_size;
+    int segment_frame_count;
+    H265SegmentJob *jobs;       /* Segment n uses jobs[n % job_count] */
+    int job_count;
+
+    /* MATLAB thread only */
+    int64_t submitted_count;    /* Segments handed to a worker */
+    int64_t muxed_count;        /* Segments joined and muxed */
+    int error;                  /* First error, 0 if none */
+    char error_message[256];
+    int do_collect_stats;       /* Set before the first frame */
+    H265WriteStats stats;       /* Muxing, plus the stats of every joined job */
+} H265SegmentEncoder;
+
+/*
+ * Create a segment encoder for an opened writer. codec_ctx is the writer's
+ * encoder, whose settings every segment encoder copies.
+ * Returns NULL on failure.
+ */
+H265SegmentEncoder *h265_segment_encoder_alloc(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                               int stream_idx, int width, int height, int is_color,
+                                               int bit_depth, int segment_frame_count, int encoder_count);
+
+/*
+ * Encode and mux everything still buffered, then free the segment encoder.
+ * Returns its error, 0 if none.
+ */
+int h265_segment_encoder_free(H265SegmentEncoder *encoder);
+
+/*
+ * Copy one column-major frame into the current segment, starting a worker
+ * when the segment is full. Waits for (and muxes) the oldest segment when
+ * every job is busy.
+ * Returns the segment encoder's error, 0 if none.
+ */
+int h265_segment_encoder_add_frame(H265SegmentEncoder *encoder, const uint8_t *frame_data,
+                                   int64_t pts);
+
+/*
+ * Encode the current partial segment (which ends that GOP early) and wait
+ * until every segment has been muxed. Returns the error, 0 if none.
+ */
+int h265_segment_encoder_flush(H265SegmentEncoder *encoder);
+
+#endif /* H265_SEGMENT_ENCODER_H */
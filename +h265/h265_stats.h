@@ -0,0 +1,101 @@
+/*
+ * h265_stats.h
+ * Opt-in per-stage timing and counters of the read and write paths, returned
+ * by get_h265_read_stats and get_h265_write_stats (h265.Reader/stats and
+ * h265.Writer/stats).
+ *
+ * Times are microseconds of FFmpeg's monotonic clock (av_gettime_relative).
+ * Instrumented functions take a stats pointer that is NULL when collection is
+ * off, and then never read the clock. Each stats struct is updated by one
+ * thread at a time: worker threads count into structs of their own, which are
+ * added into the shared totals under the lock (or after the join) that
+ * already hands their results back.
+ *
+ * Header only; the structs are plain counters, so there is nothing to free.
+ */
+
+#ifndef H265_STATS_H
+#define H265_STATS_H
+
+#include <libavutil/time.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Read path of one Reader, kept in its frame cache, summed over its own
+ * decoder, the prefetch thread, and the worker decoders of parallel reads */
+typedef struct {
+  int64_t seek_count;              /* Seeks, each with a decoder flush */
+  int64_t forward_count;           /* Reads that decoded on instead of seeking */
+  int64_t seek_us;
+  int64_t packet_count;            /* Video packets read */
+  int64_t demux_us;                /* av_read_frame */
+  int64_t send_packet_us;          /* avcodec_send_packet */
+  int64_t receive_frame_us;        /* avcodec_receive_frame */
+  int64_t decoded_frame_count;     /* Frames out of the decoder */
+  int64_t converted_frame_count;   /* Of those, frames converted; the rest were thrown away */
+  int64_t download_us;             /* Copying frames off a hardware decoder */
+  int64_t scale_us;                /* sws_scale: crop, resize, and color conversion */
+  int64_t copy_us;                 /* Transposing into MATLAB column-major layout */
+  int64_t returned_frame_count;    /* Frames handed back to MATLAB */
+  int64_t cache_hit_count;         /* Single-frame and GOP reads served by the GOP cache */
+  int64_t prefetch_hit_count;      /* ... by the prefetched GOP */
+  int64_t cache_miss_count;        /* ... that decoded their GOP */
+  int64_t cache_evict_count;       /* GOPs evicted from the cache */
+} H265ReadStats;
+
+/* Write path of one Writer, summed over its encoder threads */
+typedef struct {
+  int64_t frame_count;             /* Frames converted for the encoder */
+  int64_t convert_us;              /* Transpose and color conversion into encoder frames */
+  int64_t send_frame_us;           /* avcodec_send_frame */
+  int64_t receive_packet_us;       /* avcodec_receive_packet, draining the encoder */
+  int64_t packet_count;            /* Packets muxed */
+  int64_t packet_bytes;
+  int64_t write_packet_us;         /* av_interleaved_write_frame */
+} H265WriteStats;
+
+/* Start time for h265_stats_elapsed_us, or 0 without stats */
+static inline int64_t h265_stats_start(const void *stats)
+{
+  return stats ? av_gettime_relative() : 0;
+}
+
+/* Microseconds since start */
+static inline int64_t h265_stats_elapsed_us(int64_t start)
+{
+  return av_gettime_relative() - start;
+}
+
+static inline void h265_read_stats_add(H265ReadStats *total, const H265ReadStats *stats)
+{
+  total->seek_count += stats->seek_count;
+  total->forward_count += stats->forward_count;
+  total->seek_us += stats->seek_us;
+  total->packet_count += stats->packet_count;
+  total->demux_us += stats->demux_us;
+  total->send_packet_us += stats->send_packet_us;
+  total->receive_frame_us += stats->receive_frame_us;
+  total->decoded_frame_count += stats->decoded_frame_count;
+  total->converted_frame_count += stats->converted_frame_count;
+  total->download_us += stats->download_us;
+  total->scale_us += stats->scale_us;
+  total->copy_us += stats->copy_us;
+  total->returned_frame_count += stats->returned_frame_count;
+  total->cache_hit_count += stats->cache_hit_count;
+  total->prefetch_hit_count += stats->prefetch_hit_count;
+  total->cache_miss_count += stats->cache_miss_count;
+  total->cache_evict_count += stats->cache_evict_count;
+}
+
+static inline void h265_write_stats_add(H265WriteStats *total, const H265WriteStats *stats)
+{
+  total->frame_count += stats->frame_count;
+  total->convert_us += stats->convert_us;
+  total->send_frame_us += stats->send_frame_us;
+  total->receive_packet_us += stats->receive_packet_us;
+  total->packet_count += stats->packet_count;
+  total->packet_bytes += stats->packet_bytes;
+  total->write_packet_us += stats->write_packet_us;
+}
+
+#endif /* H265_STATS_H */
@@ -0,0 +1,277 @@
+/*
+ * h265_transpose.c
+ * Tiled SIMD transpose kernels with run-time CPU dispatch (see h265_transpose.h).
+ *
+ * Every SIMD kernel transposes 16 x 16 byte tiles with the same network: four
+ * rounds of interleaving register i with register i + 8 (unpacklo/unpackhi on
+ * x86, vzipq on NEON). Each round rotates the 8-bit (row, column) index of
+ * every byte by one bit, so after four rounds row and column are swapped.
+ * AVX2 interleaves within 128-bit lanes, so loading 32-byte rows transposes
+ * two side-by-side tiles at once.
+ *
+ * 16-bit samples use the same network on 8 x 8 tiles of 16-bit lanes: three
+ * rounds of interleaving register i with register i + 4.
+ */
+
+#include "h265_transpose.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define H265_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define H265_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define H265_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define TILE 16
+#define TILE_U16 8
+
+typedef void (*TileKernel)(const uint8_t *src, ptrdiff_t src_stride,
+                           uint8_t *dst, ptrdiff_t dst_stride);
+
+/* ============================================================================
+ * Kernels
+ * ============================================================================ */
+
+static void transpose_scalar(const uint8_t *src, ptrdiff_t src_stride,
+                             uint8_t *dst, ptrdiff_t dst_stride,
+                             int row_count, int col_count)
+{
+  for (int c = 0; c < col_count; c++) {
+    uint8_t *dst_row = dst + c * dst_stride;
+    for (int r = 0; r < row_count; r++) {
+      dst_row[r] = src[r * src_stride + c];
+    }
+  }
+}
+
+static void transpose_scalar_u16(const uint16_t *src, ptrdiff_t src_stride,
+                                 uint16_t *dst, ptrdiff_t dst_stride,
+                                 int row_count, int col_count)
+{
+  for (int c = 0; c < col_count; c++) {
+    uint16_t *dst_row = dst + c * dst_stride;
+    for (int r = 0; r < row_count; r++) {
+      dst_row[r] = src[r * src_stride + c];
+    }
+  }
+}
+
+#ifdef H265_HAVE_SSE2
+static void tile_sse2(const uint8_t *src, ptrdiff_t src_stride,
+                      uint8_t *dst, ptrdiff_t dst_stride)
+{
+  __m128i x[TILE], y[TILE];
+  for (int i = 0; i < TILE; i++) {
+    x[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+  }
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < TILE / 2; i++) {
+      y[2 * i] = _mm_unpacklo_epi8(x[i], x[i + TILE / 2]);
+      y[2 * i + 1] = _mm_unpackhi_epi8(x[i], x[i + TILE / 2]);
+    }
+    for (int i = 0; i < TILE; i++) x[i] = y[i];
+  }
+  for (int i = 0; i < TILE; i++) {
+    _mm_storeu_si128((__m128i *)(dst + i * dst_stride), x[i]);
+  }
+}
+#endif
+
+#ifdef H265_HAVE_SSE2
+static void tile_u16_sse2(const uint16_t *src, ptrdiff_t src_stride,
+                          uint16_t *dst, ptrdiff_t dst_stride)
+{
+  __m128i x[TILE_U16], y[TILE_U16];
+  for (int i = 0; i < TILE_U16; i++) {
+    x[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+  }
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < TILE_U16 / 2; i++) {
+      y[2 * i] = _mm_unpacklo_epi16(x[i], x[i + TILE_U16 / 2]);
+      y[2 * i + 1] = _mm_unpackhi_epi16(x[i], x[i + TILE_U16 / 2]);
+    }
+    for (int i = 0; i < TILE_U16; i++) x[i] = y[i];
+  }
+  for (int i = 0; i < TILE_U16; i++) {
+    _mm_storeu_si128((__m128i *)(dst + i * dst_stride), x[i]);
+  }
+}
+#endif
+
+#ifdef H265_HAVE_AVX2
+/* 16 rows x 32 columns: the tiles in the low and high lanes come out as
+ * destination rows 0-15 and 16-31 */
+__attribute__((target("avx2")))
+static void tile_pair_avx2(const uint8_t *src, ptrdiff_t src_stride,
+                           uint8_t *dst, ptrdiff_t dst_stride)
+{
+  __m256i x[TILE], y[TILE];
+  for (int i = 0; i < TILE; i++) {
+    x[i] = _mm256_loadu_si256((const __m256i *)(src + i * src_stride));
+  }
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < TILE / 2; i++) {
+      y[2 * i] = _mm256_unpacklo_epi8(x[i], x[i + TILE / 2]);
+      y[2 * i + 1] = _mm256_unpackhi_epi8(x[i], x[i + TILE / 2]);
+    }
+    for (int i = 0; i < TILE; i++) x[i] = y[i];
+  }
+  for (int i = 0; i < TILE; i++) {
+    _mm_storeu_si128((__m128i *)(dst + i * dst_stride), _mm256_castsi256_si128(x[i]));
+    _mm_storeu_si128((__m128i *)(dst + (i + TILE) * dst_stride), _mm256_extracti128_si256(x[i], 1));
+  }
+}
+#endif
+
+#ifdef H265_HAVE_NEON
+static void tile_neon(const uint8_t *src, ptrdiff_t src_stride,
+                      uint8_t *dst, ptrdiff_t dst_stride)
+{
+  uint8x16_t x[TILE], y[TILE];
+  for (int i = 0; i < TILE; i++) {
+    x[i] = vld1q_u8(src + i * src_stride);
+  }
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < TILE / 2; i++) {
+      uint8x16x2_t zipped = vzipq_u8(x[i], x[i + TILE / 2]);
+      y[2 * i] = zipped.val[0];
+      y[2 * i + 1] = zipped.val[1];
+    }
+    for (int i = 0; i < TILE; i++) x[i] = y[i];
+  }
+  for (int i = 0; i < TILE; i++) {
+    vst1q_u8(dst + i * dst_stride, x[i]);
+  }
+}
+#endif
+
+#ifdef H265_HAVE_NEON
+static void tile_u16_neon(const uint16_t *src, ptrdiff_t src_stride,
+                          uint16_t *dst, ptrdiff_t dst_stride)
+{
+  uint16x8_t x[TILE_U16], y[TILE_U16];
+  for (int i = 0; i < TILE_U16; i++) {
+    x[i] = vld1q_u16(src + i * src_stride);
+  }
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < TILE_U16 / 2; i++) {
+      uint16x8x2_t zipped = vzipq_u16(x[i], x[i + TILE_U16 / 2]);
+      y[2 * i] = zipped.val[0];
+      y[2 * i + 1] = zipped.val[1];
+    }
+    for (int i = 0; i < TILE_U16; i++) x[i] = y[i];
+  }
+  for (int i = 0; i < TILE_U16; i++) {
+    vst1q_u16(dst + i * dst_stride, x[i]);
+  }
+}
+#endif
+
+/* ============================================================================
+ * Dispatch
+ * ============================================================================ */
+
+#ifdef H265_HAVE_AVX2
+static int cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* Kernel for one 16 x 16 tile, or NULL if there is no SIMD support */
+static TileKernel select_tile_kernel(void)
+{
+#if defined(H265_HAVE_SSE2)
+  return tile_sse2;
+#elif defined(H265_HAVE_NEON)
+  return tile_neon;
+#else
+  return NULL;
+#endif
+}
+
+/* Kernel for 16 rows x 32 columns, or NULL if the CPU has none */
+static TileKernel select_tile_pair_kernel(void)
+{
+#ifdef H265_HAVE_AVX2
+  if (cpu_has_avx2()) return tile_pair_avx2;
+#endif
+  return NULL;
+}
+
+void h265_transpose_u8(const uint8_t *src, ptrdiff_t src_stride,
+                       uint8_t *dst, ptrdiff_t dst_stride,
+                       int row_count, int col_count)
+{
+  TileKernel tile = select_tile_kernel();
+  TileKernel tile_pair = select_tile_pair_kernel();
+  if (!tile) {
+    transpose_scalar(src, src_stride, dst, dst_stride, row_count, col_count);
+    return;
+  }
+
+  int full_rows = row_count - row_count % TILE;
+  int full_cols = col_count - col_count % TILE;
+
+  for (int r0 = 0; r0 < full_rows; r0 += TILE) {
+    const uint8_t *src_rows = src + r0 * src_stride;
+    int c0 = 0;
+    if (tile_pair) {
+      for (; c0 + 2 * TILE <= full_cols; c0 += 2 * TILE) {
+        tile_pair(src_rows + c0, src_stride, dst + c0 * dst_stride + r0, dst_stride);
+      }
+    }
+    for (; c0 < full_cols; c0 += TILE) {
+      tile(src_rows + c0, src_stride, dst + c0 * dst_stride + r0, dst_stride);
+    }
+  }
+
+  /* Right edge (columns past the last full tile), then bottom edge */
+  if (full_cols < col_count) {
+    transpose_scalar(src + full_cols, src_stride, dst + full_cols * dst_stride, dst_stride,
+                     full_rows, col_count - full_cols);
+  }
+  if (full_rows < row_count) {
+    transpose_scalar(src + full_rows * src_stride, src_stride, dst + full_rows, dst_stride,
+                     row_count - full_rows, col_count);
+  }
+}
+
+void h265_transpose_u16(const uint16_t *src, ptrdiff_t src_stride,
+                        uint16_t *dst, ptrdiff_t dst_stride,
+                        int row_count, int col_count)
+{
+#if defined(H265_HAVE_SSE2) || defined(H265_HAVE_NEON)
+  int full_rows = row_count - row_count % TILE_U16;
+  int full_cols = col_count - col_count % TILE_U16;
+
+  for (int r0 = 0; r0 < full_rows; r0 += TILE_U16) {
+    const uint16_t *src_rows = src + r0 * src_stride;
+    for (int c0 = 0; c0 < full_cols; c0 += TILE_U16) {
+#ifdef H265_HAVE_SSE2
+      tile_u16_sse2(src_rows + c0, src_stride, dst + c0 * dst_stride + r0, dst_stride);
+#else
+      tile_u16_neon(src_rows + c0, src_stride, dst + c0 * dst_stride + r0, dst_stride);
+#endif
+    }
+  }
+
+  /* Right edge (columns past the last full tile), then bottom edge */
+  if (full_cols < col_count) {
+    transpose_scalar_u16(src + full_cols, src_stride, dst + full_cols * dst_stride, dst_stride,
+                         full_rows, col_count - full_cols);
+  }
+  if (full_rows < row_count) {
+    transpose_scalar_u16(src + full_rows * src_stride, src_stride, dst + full_rows, dst_stride,
+                         row_count - full_rows, col_count);
+  }
+#else
+  transpose_scalar_u16(src, src_stride, dst, dst_stride, row_count, col_count);
+#endif
+}
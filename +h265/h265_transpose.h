@@ -0,0 +1,45 @@
+/*
+ * h265_transpose.h
+ * Matrix transpose kernels shared by the read and write MEX files, for 8-bit
+ * samples and for the 16-bit samples of high-bit-depth video.
+ *
+ * MATLAB stores images column-major while FFmpeg frames are row-major, so
+ * every frame crosses a transpose on its way in or out. Doing that with a
+ * per-pixel strided loop touches a new cache line for almost every byte. These
+ * kernels work on 16 x 16 tiles that stay in registers: SSE2 on x86-64
+ * (always available), AVX2 when the CPU supports it (two tiles at once), and
+ * NEON on ARM. The choice is made at run time on each call, so the same MEX
+ * binary runs on any CPU of its architecture. Edges that do not fill a tile
+ * use a scalar loop. 16-bit samples use 8 x 8 tiles (SSE2 or NEON).
+ *
+ * All functions are pure computation with no MATLAB API calls, so they may
+ * be used from worker threads.
+ */
+
+#ifndef H265_TRANSPOSE_H
+#define H265_TRANSPOSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Transpose a matrix of row_count rows by col_count bytes.
+ * Element (r, c) is read from src[r * src_stride + c] and written to
+ * dst[c * dst_stride + r].
+ *
+ * A MATLAB height x width matrix is width rows of height bytes in this
+ * terminology, and an FFmpeg plane is height rows of width bytes.
+ */
+void h265_transpose_u8(const uint8_t *src, ptrdiff_t src_stride,
+                       uint8_t *dst, ptrdiff_t dst_stride,
+                       int row_count, int col_count);
+
+/*
+ * Transpose a matrix of row_count rows by col_count 16-bit samples.
+ * As h265_transpose_u8, but strides are in samples, not bytes.
+ */
+void h265_transpose_u16(const uint16_t *src, ptrdiff_t src_stride,
+                        uint16_t *dst, ptrdiff_t dst_stride,
+                        int row_count, int col_count);
+
+#endif /* H265_TRANSPOSE_H */
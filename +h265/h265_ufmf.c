@@ -0,0 +1,562 @@
+/*
+ * h265_ufmf.c
+ * Native UFMF reader (see h265_ufmf.h).
+ */
+
+#include "h265_ufmf.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define h265_fseek _fseeki64
+#define h265_ftell _ftelli64
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#define h265_fseek fseeko
+#define h265_ftell ftello
+#endif
+
+#define FRAME_CHUNK 1
+#define KEYFRAME_CHUNK 0
+#define DICT_START_CHAR 'd'
+#define ARRAY_START_CHAR 'a'
+#define MAX_DICT_DEPTH 8
+
+/* ============================================================================
+ * Byte Decoding
+ * ============================================================================ */
+
+/* UFMF is little-endian throughout */
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static double get_double(const uint8_t *p)
+{
+    uint64_t bits = get_u64(p);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static float get_float(const uint8_t *p)
+{
+    uint32_t bits = get_u32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Bytes per element of a dtype character (dtypechar2matlabclass.m), or 0 */
+static int dtype_size(char dtype)
+{
+    switch (dtype) {
+        case 'c': case 's': case 'p': case 'b': case 'B': return 1;
+        case 'h': case 'H': return 2;
+        case 'i': case 'l': case 'I': case 'L': case 'f': return 4;
+        case 'q': case 'Q': case 'd': return 8;
+        default: return 0;
+    }
+}
+
+/* Element i of an array of dtype as a double */
+static double get_element(char dtype, const uint8_t *data, size_t i)
+{
+    const uint8_t *p = data + i * dtype_size(dtype);
+    switch (dtype) {
+        case 'b': return (double)(int8_t)p[0];
+        case 'h': return (double)(int16_t)get_u16(p);
+        case 'H': return (double)get_u16(p);
+        case 'i': case 'l': return (double)(int32_t)get_u32(p);
+        case 'I': case 'L': return (double)get_u32(p);
+        case 'q': return (double)(int64_t)get_u64(p);
+        case 'Q': return (double)get_u64(p);
+        case 'f': return (double)get_float(p);
+        case 'd': return get_double(p);
+        default: return (double)p[0];
+    }
+}
+
+/* Element i of an integer array of dtype as an int64 (exact beyond 2^53) */
+static int64_t get_location(char dtype, const uint8_t *data, size_t i)
+{
+    const uint8_t *p = data + i * dtype_size(dtype);
+    switch (dtype) {
+        case 'q': case 'Q': return (int64_t)get_u64(p);
+        default: return (int64_t)get_element(dtype, data, i);
+    }
+}
+
+/* A mean value cast to uint8 the way MATLAB does: round, then saturate */
+static uint8_t to_uint8(double value)
+{
+    if (!(value > 0)) return 0;
+    if (value >= 255) return 255;
+    return (uint8_t)floor(value + 0.5);
+}
+
+/* ============================================================================
+ * Memory and File Helpers
+ * ============================================================================ */
+
+static void *persistent_alloc(size_t size)
+{
+    void *data = mxMalloc(size > 0 ? size : 1);
+    mexMakeMemoryPersistent(data);
+    return data;
+}
+
+/* Make chunk hold at least size bytes */
+static void reserve_chunk(H265Ufmf *ufmf, size_t size)
+{
+    if (size <= ufmf->chunk_capacity) return;
+    size_t capacity = ufmf->chunk_capacity > 0 ? ufmf->chunk_capacity : 4096;
+    while (capacity < size) capacity *= 2;
+    if (ufmf->chunk) mxFree(ufmf->chunk);
+    ufmf->chunk = (uint8_t *)persistent_alloc(capacity);
+    ufmf->chunk_capacity = capacity;
+}
+
+/* Read size bytes at location into chunk; returns 1 on success */
+static int read_chunk(H265Ufmf *ufmf, int64_t location, size_t size)
+{
+    reserve_chunk(ufmf, size);
+    if (h265_fseek(ufmf->file, location, SEEK_SET) != 0) return 0;
+    return fread(ufmf->chunk, 1, size, ufmf->file) == size;
+}
+
+/* ============================================================================
+ * Index
+ * ============================================================================ */
+
+/* One array of the index dictionary, pointing into the index bytes */
+typedef struct {
+    char dtype;
+    const uint8_t *data;
+    size_t count;
+} IndexArray;
+
+typedef struct {
+    IndexArray frame_locations;      /* frame.loc */
+    IndexArray frame_timestamps;     /* frame.timestamp */
+    IndexArray mean_locations;       /* keyframe.mean.loc */
+    IndexArray mean_timestamps;      /* keyframe.mean.timestamp */
+} IndexArrays;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} Cursor;
+
+static int has_bytes(const Cursor *cursor, size_t count)
+{
+    return cursor->size - cursor->pos >= count;
+}
+
+/*
+ * Parse the dictionary at the cursor, keeping the arrays that IndexArrays
+ * names. path is the dotted key path of the dictionary ("" at the top).
+ * Returns 1 on success, 0 if the dictionary is malformed.
+ */
+static int parse_dict(Cursor *cursor, const char *path, int depth, IndexArrays *arrays)
+{
+    if (depth > MAX_DICT_DEPTH || !has_bytes(cursor, 2)) return 0;
+    if (cursor->data[cursor->pos] != DICT_START_CHAR) return 0;
+    int key_count = cursor->data[cursor->pos + 1];
+    cursor->pos += 2;
+
+    for (int k = 0; k < key_count; k++) {
+        if (!has_bytes(cursor, 2)) return 0;
+        size_t key_length = get_u16(cursor->data + cursor->pos);
+        cursor->pos += 2;
+        if (!has_bytes(cursor, key_length + 1)) return 0;
+
+        char key_path[256];
+        int path_length = snprintf(key_path, sizeof(key_path), "%s%s%.*s", path, path[0] ? "." : "",
+                                   (int)key_length, (const char *)cursor->data + cursor->pos);
+        if (path_length < 0 || path_length >= (int)sizeof(key_path)) return 0;
+        cursor->pos += key_length;
+
+        char chunk_type = (char)cursor->data[cursor->pos];
+        if (chunk_type == DICT_START_CHAR) {
+            if (!parse_dict(cursor, key_path, depth + 1, arrays)) return 0;
+        } else if (chunk_type == ARRAY_START_CHAR) {
+            if (!has_bytes(cursor, 6)) return 0;
+            char dtype = (char)cursor->data[cursor->pos + 1];
+            size_t byte_count = get_u32(cursor->data + cursor->pos + 2);
+            int element_size = dtype_size(dtype);
+            cursor->pos += 6;
+            if (element_size == 0 || byte_count % element_size != 0 || !has_bytes(cursor, byte_count)) return 0;
+
+            IndexArray array = {dtype, cursor->data + cursor->pos, byte_count / element_size};
+            if (strcmp(key_path, "frame.loc") == 0) arrays->frame_locations = array;
+            else if (strcmp(key_path, "frame.timestamp") == 0) arrays->frame_timestamps = array;
+            else if (strcmp(key_path, "keyframe.mean.loc") == 0) arrays->mean_locations = array;
+            else if (strcmp(key_path, "keyframe.mean.timestamp") == 0) arrays->mean_timestamps = array;
+            cursor->pos += byte_count;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_integer_dtype(char dtype)
+{
+    return dtype != 'f' && dtype != 'd' && dtype_size(dtype) > 1;
+}
+
+/*
+ * Assign each frame its mean: the last mean by default, else mean i for
+ * timestamps in [mean i, mean i + 1), later means winning, as in
+ * ufmf_read_header.m. With sorted mean timestamps that is a binary search.
+ */
+static void assign_frame_means(H265Ufmf *ufmf)
+{
+    int is_sorted = 1;
+    for (int m = 1; m < ufmf->mean_count; m++) {
+        if (!(ufmf->mean_timestamps[m] >= ufmf->mean_timestamps[m - 1])) is_sorted = 0;
+    }
+
+    for (int f = 0; f < ufmf->frame_count; f++) {
+        double timestamp = ufmf->timestamps[f];
+        int mean = ufmf->mean_count - 1;
+        if (is_sorted) {
+            /* Last interval start <= timestamp whose end is > timestamp */
+            int low = 0, high = ufmf->mean_count - 1;
+            while (low < high) {
+                int middle = low + (high - low) / 2;
+                if (ufmf->mean_timestamps[middle + 1] <= timestamp) low = middle + 1;
+                else high = middle;
+            }
+            if (low < ufmf->mean_count - 1 && ufmf->mean_timestamps[low] <= timestamp) mean = low;
+        } else {
+            for (int m = 0; m + 1 < ufmf->mean_count; m++) {
+                if (timestamp >= ufmf->mean_timestamps[m] && timestamp < ufmf->mean_timestamps[m + 1]) {
+                    mean = m;
+                }
+            }
+        }
+        ufmf->frame_means[f] = mean;
+    }
+}
+
+/* ============================================================================
+ * Means
+ * ============================================================================ */
+
+/*
+ * Read mean mean_index into mean_frame. The first mean read sets the frame
+ * size; every other mean must match it.
+ */
+static int load_mean(H265Ufmf *ufmf, int mean_index, const char **error_id,
+                     char *error_message, size_t error_message_size)
+{
+    int64_t location = ufmf->mean_locations[mean_index];
+
+    /* chunk type, keyframe type length, "mean", dtype, width, height, timestamp */
+    const size_t header_size = 1 + 1 + 4 + 1 + 2 + 2 + 8;
+    if (!read_chunk(ufmf, location, header_size)) {
+        *error_id = "h265_ufmf:readError";
+        snprintf(error_message, error_message_size, "Could not read mean %d", mean_index + 1);
+        return 0;
+    }
+    const uint8_t *p = ufmf->chunk;
+    if (p[0] != KEYFRAME_CHUNK || p[1] != 4 || memcmp(p + 2, "mean", 4) != 0) {
+        *error_id = "h265_ufmf:badMean";
+        snprintf(error_message, error_message_size, "Mean %d is not a mean keyframe", mean_index + 1);
+        return 0;
+    }
+    char dtype = (char)p[6];
+    int element_size = dtype_size(dtype);
+    int width = get_u16(p + 7);
+    int height = get_u16(p + 9);
+    if (element_size == 0 || dtype == 'c' || dtype == 's' || dtype == 'p' || width == 0 || height == 0) {
+        *error_id = "h265_ufmf:badMean";
+        snprintf(error_message, error_message_size, "Mean %d has unsupported type '%c' or no pixels",
+                 mean_index + 1, dtype);
+        return 0;
+    }
+
+    if (!ufmf->mean_frame) {
+        ufmf->width = width;
+        ufmf->height = height;
+        ufmf->mean_frame = (uint8_t *)persistent_alloc(h265_ufmf_frame_size(ufmf));
+    } else if (width != ufmf->width || height != ufmf->height) {
+        *error_id = "h265_ufmf:badMean";
+        snprintf(error_message, error_message_size, "Mean %d is %d x %d, but mean 1 is %d x %d",
+                 mean_index + 1, height, width, ufmf->height, ufmf->width);
+        return 0;
+    }
+
+    int color_count = ufmf->color_count;
+    size_t element_count = (size_t)width * height * color_count;
+    if (!read_chunk(ufmf, location + header_size, element_count * element_size)) {
+        *error_id = "h265_ufmf:readError";
+        snprintf(error_message, error_message_size, "Could not read mean %d", mean_index + 1);
+        return 0;
+    }
+
+    /* Stored color fastest, then x, then y; MATLAB wants y fastest, then x,
+     * then color */
+    const uint8_t *data = ufmf->chunk;
+    uint8_t *mean = ufmf->mean_frame;
+    size_t plane_size = (size_t)width * height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t source = ((size_t)y * width + x) * color_count;
+            size_t destination = (size_t)x * height + y;
+            for (int c = 0; c < color_count; c++) {
+                mean[c * plane_size + destination] =
+                    dtype == 'B' ? data[source + c] : to_uint8(get_element(dtype, data, source + c));
+            }
+        }
+    }
+    ufmf->cached_mean_index = mean_index;
+    return 1;
+}
+
+/* ============================================================================
+ * Public Entry Points
+ * ============================================================================ */
+
+void h265_ufmf_close(H265Ufmf *ufmf)
+{
+    if (!ufmf) return;
+    if (ufmf->file) fclose(ufmf->file);
+    if (ufmf->frame_locations) mxFree(ufmf->frame_locations);
+    if (ufmf->timestamps) mxFree(ufmf->timestamps);
+    if (ufmf->mean_locations) mxFree(ufmf->mean_locations);
+    if (ufmf->mean_timestamps) mxFree(ufmf->mean_timestamps);
+    if (ufmf->frame_means) mxFree(ufmf->frame_means);
+    if (ufmf->mean_frame) mxFree(ufmf->mean_frame);
+    if (ufmf->chunk) mxFree(ufmf->chunk);
+    mxFree(ufmf);
+}
+
+H265Ufmf *h265_ufmf_open(const char *filename, const char **error_id,
+                         char *error_message, size_t error_message_size)
+{
+    H265Ufmf *ufmf = (H265Ufmf *)mxCalloc(1, sizeof(H265Ufmf));
+    mexMakeMemoryPersistent(ufmf);
+    ufmf->cached_mean_index = -1;
+
+    ufmf->file = fopen(filename, "rb");
+    if (!ufmf->file) {
+        mxFree(ufmf);
+        *error_id = "h265_ufmf:fileOpen";
+        snprintf(error_message, error_message_size, "Could not open file: %s", filename);
+        return NULL;
+    }
+    if (h265_fseek(ufmf->file, 0, SEEK_END) == 0) ufmf->file_size = h265_ftell(ufmf->file);
+
+    /* Header: "ufmf", version, index location, box size, [is_fixed_size],
+     * coding length, coding */
+    const size_t header_size = 4 + 4 + 8 + 2 + 2;
+    if (!read_chunk(ufmf, 0, header_size + 2) || memcmp(ufmf->chunk, "ufmf", 4) != 0) {
+        h265_ufmf_close(ufmf);
+        *error_id = "h265_ufmf:badHeader";
+        snprintf(error_message, error_message_size, "Not a UFMF file: %s", filename);
+        return NULL;
+    }
+    const uint8_t *p = ufmf->chunk;
+    ufmf->version = (int)get_u32(p + 4);
+    ufmf->index_location = (int64_t)get_u64(p + 8);
+    ufmf->box_width = get_u16(p + 16);
+    ufmf->box_height = get_u16(p + 18);
+    size_t coding_pos = header_size;
+    if (ufmf->version >= 4) ufmf->is_fixed_size = p[coding_pos++] != 0;
+    int coding_length = p[coding_pos++];
+    if (ufmf->version < 2 || ufmf->version > 4) {
+        h265_ufmf_close(ufmf);
+        *error_id = "h265_ufmf:badHeader";
+        snprintf(error_message, error_message_size,
+                 "Only UFMF versions 2-4 are supported, but %s is version %d", filename, (int)get_u32(p + 4));
+        return NULL;
+    }
+
+    char coding[256];
+    if (!read_chunk(ufmf, coding_pos, coding_length)) coding_length = 0;
+    memcpy(coding, ufmf->chunk, coding_length);
+    coding[coding_length] = '\0';
+    if (strcasecmp(coding, "mono8") == 0) {
+        ufmf->color_count = 1;
+    } else if (strcasecmp(coding, "rgb24") == 0) {
+        ufmf->color_count = 3;
+    } else {
+        h265_ufmf_close(ufmf);
+        *error_id = "h265_ufmf:badCoding";
+        snprintf(error_message, error_message_size,
+                 "Unsupported UFMF coding '%s' (only MONO8 and RGB24 are supported)", coding);
+        return NULL;
+    }
+
+    /* Index: read everything from its start to the end of the file */
+    if (ufmf->index_location <= 0 || ufmf->index_location >= ufmf->file_size ||
+        !read_chunk(ufmf, ufmf->index_location, (size_t)(ufmf->file_size - ufmf->index_location))) {
+        h265_ufmf_close(ufmf);
+        *error_id = "h265_ufmf:badIndex";
+        snprintf(error_message, error_message_size, "Could not read the index of %s", filename);
+        return NULL;
+    }
+    Cursor cursor = {ufmf->chunk, (size_t)(ufmf->file_size - ufmf->index_location), 0};
+    IndexArrays arrays;
+    memset(&arrays, 0, sizeof(arrays));
+    int is_index_valid = parse_dict(&cursor, "", 0, &arrays) &&
+        arrays.frame_locations.count > 0 && is_integer_dtype(arrays.frame_locations.dtype) &&
+        arrays.frame_timestamps.count == arrays.frame_locations.count &&
+        arrays.mean_locations.count > 0 && is_integer_dtype(arrays.mean_locations.dtype) &&
+        arrays.mean_timestamps.count == arrays.mean_locations.count &&
+        arrays.frame_locations.count <= INT32_MAX && arrays.mean_locations.count <= INT32_MAX;
+    if (!is_index_valid) {
+        h265_ufmf_close(ufmf);
+        *error_id = "h265_ufmf:badIndex";
+        snprintf(error_message, error_message_size,
+                 "The index of %s lacks frame or mean locations and timestamps, or is malformed", filename);
+        return NULL;
+    }
+
+    /* The arrays point into chunk, so copy them out before reading anything else */
+    ufmf->frame_count = (int)arrays.frame_locations.count;
+    ufmf->frame_locations = (int64_t *)persistent_alloc(ufmf->frame_count * sizeof(int64_t));
+    ufmf->timestamps = (double *)persistent_alloc(ufmf->frame_count * sizeof(double));
+    ufmf->frame_means = (int *)persistent_alloc(ufmf->frame_count * sizeof(int));
+    for (int f = 0; f < ufmf->frame_count; f++) {
+        ufmf->frame_locations[f] = get_location(arrays.frame_locations.dtype, arrays.frame_locations.data, f);
+        ufmf->timestamps[f] = get_element(arrays.frame_timestamps.dtype, arrays.frame_timestamps.data, f);
+    }
+    ufmf->mean_count = (int)arrays.mean_locations.count;
+    ufmf->mean_locations = (int64_t *)persistent_alloc(ufmf->mean_count * sizeof(int64_t));
+    ufmf->mean_timestamps = (double *)persistent_alloc(ufmf->mean_count * sizeof(double));
+    for (int m = 0; m < ufmf->mean_count; m++) {
+        ufmf->mean_locations[m] = get_location(arrays.mean_locations.dtype, arrays.mean_locations.data, m);
+        ufmf->mean_timestamps[m] = get_element(arrays.mean_timestamps.dtype, arrays.mean_timestamps.data, m);
+    }
+    assign_frame_means(ufmf);
+
+    /* The first mean gives the frame size */
+    if (!load_mean(ufmf, 0, error_id, error_message, error_message_size)) {
+        h265_ufmf_close(ufmf);
+        return NULL;
+    }
+    return ufmf;
+}
+
+int h265_ufmf_read_frame(H265Ufmf *ufmf, int frame_index, uint8_t *frame,
+                         const char **error_id, char *error_message,
+                         size_t error_message_size)
+{
+    int mean_index = ufmf->frame_means[frame_index];
+    if (mean_index != ufmf->cached_mean_index &&
+        !load_mean(ufmf, mean_index, error_id, error_message, error_message_size)) {
+        return 0;
+    }
+    size_t frame_size = h265_ufmf_frame_size(ufmf);
+    memcpy(frame, ufmf->mean_frame, frame_size);
+
+    /* The chunk runs to the next frame, or to the index after the last one */
+    int64_t location = ufmf->frame_locations[frame_index];
+    int64_t end = ufmf->index_location > location ? ufmf->index_location : ufmf->file_size;
+    if (frame_index + 1 < ufmf->frame_count && ufmf->frame_locations[frame_index + 1] > location &&
+        ufmf->frame_locations[frame_index + 1] < end) {
+        end = ufmf->frame_locations[frame_index + 1];
+    }
+    if (end > ufmf->file_size) end = ufmf->file_size;
+    if (location < 0 || end <= location || !read_chunk(ufmf, location, (size_t)(end - location))) {
+        *error_id = "h265_ufmf:readError";
+        snprintf(error_message, error_message_size, "Could not read frame %d", frame_index + 1);
+        return 0;
+    }
+
+    /* chunk type, timestamp, box count */
+    const uint8_t *chunk = ufmf->chunk;
+    size_t chunk_size = (size_t)(end - location);
+    size_t count_size = ufmf->version == 4 ? 4 : 2;
+    if (chunk_size < 9 + count_size || chunk[0] != FRAME_CHUNK) {
+        *error_id = "h265_ufmf:badFrame";
+        snprintf(error_message, error_message_size, "Frame %d does not start with a frame chunk", frame_index + 1);
+        return 0;
+    }
+    size_t box_count = count_size == 4 ? get_u32(chunk + 9) : get_u16(chunk + 9);
+    size_t pos = 9 + count_size;
+
+    int width = ufmf->width;
+    int height = ufmf->height;
+    int color_count = ufmf->color_count;
+    size_t plane_size = (size_t)width * height;
+
+    if (ufmf->is_fixed_size) {
+        /* All x0, then all y0, then the pixels color fastest, then box, then
+         * x within the box, then y within the box */
+        int box_width = ufmf->box_width;
+        int box_height = ufmf->box_height;
+        size_t data_size = box_count * box_width * box_height * color_count;
+        if (chunk_size - pos < box_count * 4 + data_size) goto truncated;
+        const uint8_t *x0s = chunk + pos;
+        const uint8_t *y0s = x0s + box_count * 2;
+        const uint8_t *data = y0s + box_count * 2;
+        for (size_t b = 0; b < box_count; b++) {
+            int x0 = get_u16(x0s + 2 * b);
+            int y0 = get_u16(y0s + 2 * b);
+            for (int i = 0; i < box_width && x0 + i < width; i++) {
+                for (int j = 0; j < box_height && y0 + j < height; j++) {
+                    size_t source = (((size_t)j * box_width + i) * box_count + b) * color_count;
+                    size_t destination = (size_t)(x0 + i) * height + (y0 + j);
+                    for (int c = 0; c < color_count; c++) {
+                        frame[c * plane_size + destination] = data[source + c];
+                    }
+                }
+            }
+        }
+    } else {
+        /* Each box: x0, y0, box width, box height, then its pixels color
+         * fastest, then x, then y */
+        for (size_t b = 0; b < box_count; b++) {
+            if (chunk_size - pos < 8) goto truncated;
+            int x0 = get_u16(chunk + pos);
+            int y0 = get_u16(chunk + pos + 2);
+            int box_width = get_u16(chunk + pos + 4);
+            int box_height = get_u16(chunk + pos + 6);
+            pos += 8;
+            size_t data_size = (size_t)box_width * box_height * color_count;
+            if (chunk_size - pos < data_size) goto truncated;
+            const uint8_t *data = chunk + pos;
+            pos += data_size;
+
+            for (int i = 0; i < box_width && x0 + i < width; i++) {
+                uint8_t *column = frame + (size_t)(x0 + i) * height;
+                if (color_count == 1) {
+                    for (int j = 0; j < box_height && y0 + j < height; j++) {
+                        column[y0 + j] = data[(size_t)j * box_width + i];
+                    }
+                } else {
+                    for (int j = 0; j < box_height && y0 + j < height; j++) {
+                        size_t source = ((size_t)j * box_width + i) * color_count;
+                        for (int c = 0; c < color_count; c++) {
+                            column[c * plane_size + y0 + j] = data[source + c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+
+truncated:
+    *error_id = "h265_ufmf:badFrame";
+    snprintf(error_message, error_message_size, "Frame %d is truncated", frame_index + 1);
+    return 0;
+}
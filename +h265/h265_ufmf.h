@@ -0,0 +1,91 @@
+/*
+ * h265_ufmf.h
+ * Native reader for UFMF (micro fly movie format) files, used by open_ufmf,
+ * read_ufmf_frame, and write_ufmf_frames to convert UFMF to h.265 without
+ * going through toolbox/ufmf_read_frame.m.
+ *
+ * A UFMF file holds background "mean" keyframes plus, for every frame, the
+ * foreground boxes that differ from the background. The index at the end of
+ * the file (a nested dictionary of arrays) gives the file location of every
+ * frame and mean, and their timestamps. Each frame uses the mean whose
+ * timestamp interval [mean k, mean k + 1) contains the frame's timestamp,
+ * and the last mean otherwise, exactly as ufmf_read_header.m assigns them.
+ *
+ * Frames are decoded with one read per frame chunk, onto a copy of the
+ * current mean, straight into the layout of a MATLAB uint8 array:
+ * height x width (MONO8) or height x width x 3 (RGB24), column-major. That
+ * is the layout the writer's conversion paths take, so write_ufmf_frames
+ * hands frames to the encoder without building MATLAB arrays.
+ *
+ * Note that the header field names of ufmf_read_header.m are "sideways":
+ * its nr is the frame width and nc the frame height.
+ *
+ * Memory is allocated with mxMalloc, so this module may only be used from
+ * the MATLAB thread.
+ */
+
+#ifndef H265_UFMF_H
+#define H265_UFMF_H
+
+#include "mex.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct {
+    FILE *file;
+    int64_t file_size;
+    int version;                 /* 2 to 4 */
+    int is_fixed_size;           /* Version 4: every box is box_width x box_height */
+    int box_width;               /* Fixed box size (max_height and max_width in */
+    int box_height;              /* ufmf_read_header.m, which are sideways) */
+    int color_count;             /* 1 for MONO8, 3 for RGB24 */
+    int width;
+    int height;
+    int64_t index_location;
+
+    int frame_count;
+    int64_t *frame_locations;
+    double *timestamps;
+    int mean_count;
+    int64_t *mean_locations;
+    double *mean_timestamps;
+    int *frame_means;            /* 0-based mean of each frame */
+
+    /* Decoding buffers, grown as needed */
+    int cached_mean_index;       /* Mean held in mean_frame, or -1 */
+    uint8_t *mean_frame;         /* Column-major, like the frames */
+    uint8_t *chunk;              /* Raw bytes of the chunk being decoded */
+    size_t chunk_capacity;
+} H265Ufmf;
+
+/*
+ * Open filename and read its header, index, and first mean.
+ * Returns NULL on failure, with error_id and error_message set.
+ */
+H265Ufmf *h265_ufmf_open(const char *filename, const char **error_id,
+                         char *error_message, size_t error_message_size);
+
+/*
+ * Close the file and free everything.
+ */
+void h265_ufmf_close(H265Ufmf *ufmf);
+
+/*
+ * Bytes of one decoded frame: height * width * color_count.
+ */
+static inline size_t h265_ufmf_frame_size(const H265Ufmf *ufmf)
+{
+    return (size_t)ufmf->height * ufmf->width * ufmf->color_count;
+}
+
+/*
+ * Decode frame_index (0-based) into frame, h265_ufmf_frame_size bytes in
+ * MATLAB layout. Boxes that reach past the frame edge are clipped.
+ * Returns 1 on success, or 0 with error_id and error_message set.
+ */
+int h265_ufmf_read_frame(H265Ufmf *ufmf, int frame_index, uint8_t *frame,
+                         const char **error_id, char *error_message,
+                         size_t error_message_size);
+
+#endif /* H265_UFMF_H */
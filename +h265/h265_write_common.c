@@ -0,0 +1,303 @@
+/*
+ * h265_write_common.c
+ * Writer helpers shared by the write MEX files (see h265_write_common.h).
+ */
+
+#include "h265_write_common.h"
+#include "h265_transpose.h"
+#include "h265_write_pipeline.h"
+#include "h265_segment_encoder.h"
+#include <libswscale/version.h>
+#include <libavutil/opt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+enum AVPixelFormat h265_encoder_pix_fmt(int is_color, int bit_depth)
+{
+    switch (bit_depth) {
+        case 10: return is_color ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_GRAY10;
+        case 12: return is_color ? AV_PIX_FMT_YUV420P12 : AV_PIX_FMT_GRAY12;
+        default: return is_color ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_GRAY8;
+    }
+}
+
+/* Planar RGB staging format for bit_depth */
+static enum AVPixelFormat gbrp_pix_fmt(int bit_depth)
+{
+    switch (bit_depth) {
+        case 10: return AV_PIX_FMT_GBRP10;
+        case 12: return AV_PIX_FMT_GBRP12;
+        default: return AV_PIX_FMT_GBRP;
+    }
+}
+
+struct SwsContext *h265_alloc_rgb_sws(int width, int height, int bit_depth, int thread_count)
+{
+    struct SwsContext *sws_ctx = sws_alloc_context();
+    if (!sws_ctx) return NULL;
+
+    av_opt_set_int(sws_ctx, "srcw", width, 0);
+    av_opt_set_int(sws_ctx, "srch", height, 0);
+    av_opt_set_int(sws_ctx, "src_format", gbrp_pix_fmt(bit_depth), 0);
+    av_opt_set_int(sws_ctx, "dstw", width, 0);
+    av_opt_set_int(sws_ctx, "dsth", height, 0);
+    av_opt_set_int(sws_ctx, "dst_format", h265_encoder_pix_fmt(1, bit_depth), 0);
+    av_opt_set_int(sws_ctx, "sws_flags", SWS_BILINEAR, 0);
+    av_opt_set_int(sws_ctx, "threads", thread_count, 0);
+    if (sws_init_context(sws_ctx, NULL, NULL) < 0) {
+        sws_freeContext(sws_ctx);
+        return NULL;
+    }
+    return sws_ctx;
+}
+
+AVFrame *h265_alloc_gbrp_frame(int width, int height, int bit_depth)
+{
+    AVFrame *gbrp_frame = av_frame_alloc();
+    if (!gbrp_frame) return NULL;
+
+    gbrp_frame->format = gbrp_pix_fmt(bit_depth);
+    gbrp_frame->width = width;
+    gbrp_frame->height = height;
+    if (av_frame_get_buffer(gbrp_frame, 0) < 0) {
+        av_frame_free(&gbrp_frame);
+        return NULL;
+    }
+    return gbrp_frame;
+}
+
+/* Transpose one column-major MATLAB plane (width columns of height samples)
+ * into height rows of plane */
+static void transpose_plane(const uint8_t *plane_data, int width, int height, int bit_depth,
+                            uint8_t *plane, int linesize)
+{
+    if (bit_depth > 8) {
+        h265_transpose_u16((const uint16_t *)plane_data, height, (uint16_t *)plane,
+                           linesize / 2, width, height);
+    } else {
+        h265_transpose_u8(plane_data, height, plane, linesize, width, height);
+    }
+}
+
+/*
+ * Transpose the color frame_data into gbrp_frame and convert it into frame.
+ */
+static int convert_color_frame(const uint8_t *frame_data, int width, int height, int bit_depth,
+                               AVFrame *gbrp_frame, struct SwsContext *sws_ctx, AVFrame *frame)
+{
+    int ret;
+
+    /* Transpose the R, G, B planes of the MATLAB array (height x width x 3,
+     * column-major) into the GBRP frame, whose planes are stored in G, B, R
+     * order */
+    static const int gbrp_plane_for_channel[3] = {2, 0, 1};
+    size_t plane_size = (size_t)height * width * h265_bytes_per_sample(bit_depth);
+    for (int c = 0; c < 3; c++) {
+        int plane = gbrp_plane_for_channel[c];
+        transpose_plane(frame_data + c * plane_size, width, height, bit_depth,
+                        gbrp_frame->data[plane], gbrp_frame->linesize[plane]);
+    }
+
+    /* Convert GBRP to YUV420P (at bit_depth), in slices on swscale's threads */
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+    ret = sws_scale_frame(sws_ctx, frame, gbrp_frame);
+#else
+    ret = sws_scale(sws_ctx, (const uint8_t * const*)gbrp_frame->data, gbrp_frame->linesize,
+                    0, height, frame->data, frame->linesize);
+#endif
+    return ret < 0 ? ret : 0;
+}
+
+int h265_convert_frame(const uint8_t *frame_data, int width, int height, int is_color,
+                       int bit_depth, AVFrame *gbrp_frame, struct SwsContext *sws_ctx,
+                       AVFrame *frame, H265WriteStats *stats)
+{
+    int64_t start = h265_stats_start(stats);
+
+    /* The encoder may still hold a reference to the last buffer */
+    int ret = av_frame_make_writable(frame);
+    if (ret < 0) return ret;
+
+    if (!is_color) {
+        /* Transpose MATLAB column-major straight into the frame buffer */
+        transpose_plane(frame_data, width, height, bit_depth,
+                        frame->data[0], frame->linesize[0]);
+    } else {
+        ret = convert_color_frame(frame_data, width, height, bit_depth, gbrp_frame, sws_ctx, frame);
+        if (ret < 0) return ret;
+    }
+    if (stats) {
+        stats->frame_count++;
+        stats->convert_us += h265_stats_elapsed_us(start);
+    }
+    return 0;
+}
+
+int h265_encode_frame(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int stream_idx,
+                      const AVFrame *frame, AVPacket *pkt, H265WriteStats *stats)
+{
+    /* A second flush reports EOF, which is not an error */
+    int64_t start = h265_stats_start(stats);
+    int ret = avcodec_send_frame(codec_ctx, frame);
+    if (stats) stats->send_frame_us += h265_stats_elapsed_us(start);
+    if (ret < 0 && !(frame == NULL && ret == AVERROR_EOF)) {
+        return H265_ENCODE_SEND_ERROR;
+    }
+
+    /* Receive and write encoded packets */
+    while (1) {
+        start = h265_stats_start(stats);
+        ret = avcodec_receive_packet(codec_ctx, pkt);
+        if (stats) stats->receive_packet_us += h265_stats_elapsed_us(start);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        } else if (ret < 0) {
+            return H265_ENCODE_RECEIVE_ERROR;
+        }
+
+        /* Rescale timestamps */
+        av_packet_rescale_ts(pkt, codec_ctx->time_base,
+                             fmt_ctx->streams[stream_idx]->time_base);
+        pkt->stream_index = stream_idx;
+
+        /* Write packet (which takes it, so count it first) */
+        if (stats) {
+            stats->packet_count++;
+            stats->packet_bytes += pkt->size;
+            start = av_gettime_relative();
+        }
+        ret = av_interleaved_write_frame(fmt_ctx, pkt);
+        if (stats) stats->write_packet_us += h265_stats_elapsed_us(start);
+        if (ret < 0) {
+            return H265_ENCODE_WRITE_ERROR;
+        }
+    }
+}
+
+/*
+ * Free the staging frame and packet of h265_writer_add_frames, then raise the
+ * error <mex_name after its package>:<id_suffix>.
+ */
+static void raise_add_error(const char *mex_name, const char *id_suffix,
+                            AVFrame **gbrp_frame, AVPacket **pkt, const char *format, ...)
+{
+    av_frame_free(gbrp_frame);
+    av_packet_free(pkt);
+
+    const char *dot = strrchr(mex_name, '.');
+    char error_id[64];
+    snprintf(error_id, sizeof(error_id), "%s:%s", dot ? dot + 1 : mex_name, id_suffix);
+
+    char error_message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_message, sizeof(error_message), format, args);
+    va_end(args);
+    mexErrMsgIdAndTxt(error_id, "%s", error_message);
+}
+
+void h265_writer_add_frames(WriterState *state, AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                            int stream_idx, AVFrame *frame, struct SwsContext *sws_ctx,
+                            int width, int height, int frame_count,
+                            H265WriterFrameFn next_frame, void *source, const char *mex_name)
+{
+    AVFrame *gbrp_frame = NULL;
+    AVPacket *pkt = NULL;
+    const uint8_t *frame_data;
+    const char *error_id = NULL;
+    char error_message[256];
+    int ret;
+
+    /* Pipelined mode: queue copies of the frames and return */
+    if (state->pipeline) {
+        for (int f = 0; f < frame_count; f++) {
+            frame_data = next_frame(source, f, &error_id, error_message, sizeof(error_message));
+            if (!frame_data) mexErrMsgIdAndTxt(error_id, "%s", error_message);
+            if (h265_write_pipeline_enqueue(state->pipeline, frame_data, state->next_pts) != 0) {
+                raise_add_error(mex_name, "pipeline", &gbrp_frame, &pkt,
+                                "%s", state->pipeline->error_message);
+            }
+            state->next_pts += state->pts_increment;
+        }
+        return;
+    }
+
+    /* Segment-parallel mode: collect frames into segments for the workers */
+    if (state->segments) {
+        h265_mex_lock_for(&state->mex_locks, mex_name);
+        for (int f = 0; f < frame_count; f++) {
+            frame_data = next_frame(source, f, &error_id, error_message, sizeof(error_message));
+            if (!frame_data) mexErrMsgIdAndTxt(error_id, "%s", error_message);
+            if (h265_segment_encoder_add_frame(state->segments, frame_data, state->next_pts) != 0) {
+                raise_add_error(mex_name, "segment", &gbrp_frame, &pkt,
+                                "%s", state->segments->error_message);
+            }
+            state->next_pts += state->pts_increment;
+        }
+        return;
+    }
+
+    /* Allocate packet once for all frames */
+    pkt = av_packet_alloc();
+    if (!pkt) {
+        raise_add_error(mex_name, "allocPacket", &gbrp_frame, &pkt, "Could not allocate packet");
+    }
+
+    /* For color, allocate a planar GBRP staging frame once: each MATLAB plane
+     * is transposed into it and swscale converts it to YUV420P */
+    if (state->is_color) {
+        gbrp_frame = h265_alloc_gbrp_frame(width, height, state->bit_depth);
+        if (!gbrp_frame) {
+            raise_add_error(mex_name, "allocBuffer", &gbrp_frame, &pkt,
+                            "Could not allocate conversion buffer");
+        }
+    }
+
+    /* Process each frame */
+    for (int f = 0; f < frame_count; f++) {
+        frame_data = next_frame(source, f, &error_id, error_message, sizeof(error_message));
+        if (!frame_data) {
+            av_frame_free(&gbrp_frame);
+            av_packet_free(&pkt);
+            mexErrMsgIdAndTxt(error_id, "%s", error_message);
+        }
+
+        ret = h265_convert_frame(frame_data, width, height, state->is_color, state->bit_depth,
+                                 gbrp_frame, sws_ctx, frame, h265_writer_stats(state));
+        if (ret < 0) {
+            raise_add_error(mex_name, "convert", &gbrp_frame, &pkt,
+                            "Could not convert frame %d", f + 1);
+        }
+
+        /* Set PTS and increment for next frame */
+        frame->pts = state->next_pts;
+        state->next_pts += state->pts_increment;
+
+        /* Send frame to encoder, then receive and write encoded packets */
+        ret = h265_encode_frame(fmt_ctx, codec_ctx, stream_idx, frame, pkt, h265_writer_stats(state));
+        switch (ret) {
+            case 0:
+                break;
+            case H265_ENCODE_SEND_ERROR:
+                raise_add_error(mex_name, "sendFrame", &gbrp_frame, &pkt,
+                                "Error sending frame %d to encoder", f + 1);
+                break;
+            case H265_ENCODE_RECEIVE_ERROR:
+                raise_add_error(mex_name, "receivePacket", &gbrp_frame, &pkt,
+                                "Error receiving packet from encoder at frame %d", f + 1);
+                break;
+            case H265_ENCODE_WRITE_ERROR:
+                raise_add_error(mex_name, "writeFrame", &gbrp_frame, &pkt,
+                                "Error writing packet to file at frame %d", f + 1);
+                break;
+            default:
+                raise_add_error(mex_name, "encode", &gbrp_frame, &pkt,
+                                "Unexpected encoder error at frame %d", f + 1);
+                break;
+        }
+    }
+
+    av_frame_free(&gbrp_frame);
+    av_packet_free(&pkt);
+}
@@ -0,0 +1,129 @@
+/*
+ * h265_write_common.h
+ * Writer state, frame conversion, and encoding helpers shared by the write
+ * MEX files, the pipelined writer (h265_write_pipeline.c), and the segment
+ * encoder (h265_segment_encoder.c).
+ *
+ * The conversion and encoding functions make no MATLAB API calls, so they may
+ * be used from worker threads. h265_writer_add_frames, which the write MEX
+ * files feed their frames through, runs on the MATLAB thread.
+ */
+
+#ifndef H265_WRITE_COMMON_H
+#define H265_WRITE_COMMON_H
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <stdint.h>
+#include "h265_mex_lock.h"
+#include "h265_stats.h"
+
+struct H265WritePipeline;
+struct H265SegmentEncoder;
+
+/* Mutable state that is updated by write_h265_frames */
+typedef struct {
+    int64_t next_pts;
+    int64_t pts_increment;
+    int is_color;  /* 0 for grayscale, 1 for RGB */
+    int bit_depth; /* 8 for uint8 input; 10 or 12 for uint16 */
+    struct H265WritePipeline *pipeline;  /* NULL unless opened with do_pipeline */
+    struct H265SegmentEncoder *segments; /* NULL unless opened with segment_encoder_count > 1 */
+    int do_collect_stats;  /* open_h265_write option do_collect_stats */
+    H265WriteStats stats;  /* Frames encoded on the MATLAB thread */
+    H265MexLocks mex_locks;  /* MEX files whose code the writer's threads run,
+                              * unlocked by close_h265_write (see h265_mex_lock.h) */
+} WriterState;
+
+/*
+ * Where the MATLAB thread counts its encoding: &state->stats if the writer
+ * collects stats, else NULL.
+ */
+static inline H265WriteStats *h265_writer_stats(WriterState *state)
+{
+    return state->do_collect_stats ? &state->stats : NULL;
+}
+
+/* Failure points of h265_encode_frame */
+#define H265_ENCODE_SEND_ERROR -1
+#define H265_ENCODE_RECEIVE_ERROR -2
+#define H265_ENCODE_WRITE_ERROR -3
+
+/*
+ * Bytes per input sample for bit_depth: 1 for 8-bit, 2 (uint16) otherwise.
+ */
+static inline int h265_bytes_per_sample(int bit_depth)
+{
+    return bit_depth > 8 ? 2 : 1;
+}
+
+/*
+ * Encoder pixel format for is_color and bit_depth (8, 10, or 12).
+ */
+enum AVPixelFormat h265_encoder_pix_fmt(int is_color, int bit_depth);
+
+/*
+ * Create a swscale context for planar GBRP -> YUV420P at width x height, both
+ * at bit_depth bits per sample (GBRP10 -> YUV420P10 and so on).
+ * thread_count = 0 lets swscale convert slices on one thread per core; that
+ * takes effect with sws_scale_frame (libswscale >= 6.1).
+ * Returns NULL on failure.
+ */
+struct SwsContext *h265_alloc_rgb_sws(int width, int height, int bit_depth, int thread_count);
+
+/*
+ * Allocate the planar GBRP staging frame (at bit_depth) used by
+ * h265_convert_frame for color.
+ * Returns NULL on failure.
+ */
+AVFrame *h265_alloc_gbrp_frame(int width, int height, int bit_depth);
+
+/*
+ * Convert one MATLAB column-major frame into the encoder frame.
+ * Grayscale planes are transposed straight into frame; RGB planes are
+ * transposed into gbrp_frame, which sws_ctx converts to YUV420P.
+ * frame_data holds uint8 samples for bit_depth 8 and uint16 samples otherwise.
+ * gbrp_frame and sws_ctx are unused for grayscale and may be NULL.
+ * stats, if not NULL, counts the frame and the time taken.
+ * Returns 0 on success or a negative AVERROR.
+ */
+int h265_convert_frame(const uint8_t *frame_data, int width, int height, int is_color,
+                       int bit_depth, AVFrame *gbrp_frame, struct SwsContext *sws_ctx,
+                       AVFrame *frame, H265WriteStats *stats);
+
+/*
+ * Send frame (or NULL to flush) to the encoder and write every packet it
+ * returns, timing each step in stats if not NULL.
+ * Returns 0 on success, or one of the H265_ENCODE_* codes.
+ */
+int h265_encode_frame(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int stream_idx,
+                      const AVFrame *frame, AVPacket *pkt, H265WriteStats *stats);
+
+/*
+ * Source of the frames passed to h265_writer_add_frames: return frame
+ * frame_index (0-based, counted from the first frame added) in MATLAB
+ * column-major layout, valid until the next call, or return NULL with
+ * error_id and error_message set.
+ */
+typedef const uint8_t *(*H265WriterFrameFn)(void *source, int frame_index, const char **error_id,
+                                             char *error_message, size_t error_message_size);
+
+/*
+ * Add frame_count frames from next_frame to the writer, numbering them from
+ * state->next_pts: with do_pipeline they are queued for the worker threads,
+ * with segment_encoder_count > 1 they are collected into segments, and
+ * otherwise they are converted and encoded here with frame and sws_ctx.
+ * mex_name is the package-qualified name of the calling MEX file (a string
+ * literal, e.g. "h265.write_h265_frames"). A segment writer locks it (see
+ * h265_mex_lock.h), because a segment submitted here may still be encoding
+ * after the call returns. The part after the package names the errors
+ * raised here, e.g. write_h265_frames:sendFrame. Errors from next_frame are
+ * raised as given.
+ */
+void h265_writer_add_frames(WriterState *state, AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                            int stream_idx, AVFrame *frame, struct SwsContext *sws_ctx,
+                            int width, int height, int frame_count,
+                            H265WriterFrameFn next_frame, void *source, const char *mex_name);
+
+#endif /* H265_WRITE_COMMON_H */
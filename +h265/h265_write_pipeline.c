@@ -0,0 +1,311 @@
+/*
+ * h265_write_pipeline.c
+ * Pipelined conversion, encoding, and muxing on worker threads
+ * (see h265_write_pipeline.h).
+ */
+
+#include "h265_write_pipeline.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Record the first error. Called with the mutex held.
+ */
+static void set_error(H265WritePipeline *pipeline, int error, const char *format, ...)
+{
+    if (pipeline->error) return;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(pipeline->error_message, sizeof(pipeline->error_message), format, args);
+    va_end(args);
+    pipeline->error = error;
+}
+
+/* ============================================================================
+ * Worker Threads
+ * ============================================================================ */
+
+/*
+ * Convert queued frames in the order they were queued, until the pipeline is
+ * stopping and every queued frame has been claimed.
+ * Worker threads must not make any MATLAB API calls.
+ */
+static void *converter_worker(void *arg)
+{
+    H265PipelineConverter *converter = (H265PipelineConverter *)arg;
+    H265WritePipeline *pipeline = converter->pipeline;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    while (1) {
+        while (pipeline->claimed_count == pipeline->enqueued_count && !pipeline->is_stopping) {
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+        }
+        if (pipeline->claimed_count == pipeline->enqueued_count) break;
+
+        int64_t frame_number = pipeline->claimed_count++;
+        H265PipelineSlot *slot = &pipeline->slots[frame_number % pipeline->slot_count];
+        int is_failed = pipeline->error != 0;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        /* After an error, frames are only retired so the queue drains */
+        int ret = 0;
+        H265WriteStats frame_stats;
+        memset(&frame_stats, 0, sizeof(frame_stats));
+        if (!is_failed) {
+            ret = h265_convert_frame(slot->input, pipeline->width, pipeline->height,
+                                     pipeline->is_color, pipeline->bit_depth,
+                                     converter->gbrp_frame, converter->sws_ctx, slot->frame,
+                                     pipeline->do_collect_stats ? &frame_stats : NULL);
+        }
+
+        pthread_mutex_lock(&pipeline->mutex);
+        h265_write_stats_add(&pipeline->stats, &frame_stats);
+        if (ret < 0) {
+            set_error(pipeline, ret, "Could not convert frame %lld", (long long)frame_number + 1);
+        }
+        slot->status = H265_SLOT_CONVERTED;
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+}
+
+/*
+ * Send converted frames to the encoder in order and mux the packets, until
+ * the pipeline is stopping and every queued frame has been retired.
+ */
+static void *encoder_worker(void *arg)
+{
+    H265WritePipeline *pipeline = (H265WritePipeline *)arg;
+    AVPacket *pkt = av_packet_alloc();
+
+    pthread_mutex_lock(&pipeline->mutex);
+    if (!pkt) {
+        set_error(pipeline, AVERROR(ENOMEM), "Could not allocate packet");
+    }
+    while (1) {
+        H265PipelineSlot *slot = &pipeline->slots[pipeline->encoded_count % pipeline->slot_count];
+        while (!(pipeline->encoded_count < pipeline->enqueued_count &&
+                 slot->status == H265_SLOT_CONVERTED) &&
+               !(pipeline->is_stopping && pipeline->encoded_count == pipeline->enqueued_count)) {
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+        }
+        if (pipeline->encoded_count == pipeline->enqueued_count) break;
+
+        int64_t frame_number = pipeline->encoded_count;
+        int is_failed = pipeline->error != 0;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        int ret = 0;
+        H265WriteStats frame_stats;
+        memset(&frame_stats, 0, sizeof(frame_stats));
+        if (!is_failed) {
+            slot->frame->pts = slot->pts;
+            ret = h265_encode_frame(pipeline->fmt_ctx, pipeline->codec_ctx, pipeline->stream_idx,
+                                    slot->frame, pkt, pipeline->do_collect_stats ? &frame_stats : NULL);
+        }
+
+        pthread_mutex_lock(&pipeline->mutex);
+        h265_write_stats_add(&pipeline->stats, &frame_stats);
+        switch (ret) {
+            case 0:
+                break;
+            case H265_ENCODE_SEND_ERROR:
+                set_error(pipeline, ret, "Error sending frame %lld to encoder",
+                          (long long)frame_number + 1);
+                break;
+            case H265_ENCODE_RECEIVE_ERROR:
+                set_error(pipeline, ret, "Error receiving packet from encoder at frame %lld",
+                          (long long)frame_number + 1);
+                break;
+            case H265_ENCODE_WRITE_ERROR:
+                set_error(pipeline, ret, "Error writing packet to file at frame %lld",
+                          (long long)frame_number + 1);
+                break;
+            default:
+                set_error(pipeline, ret, "Unexpected encoder error at frame %lld",
+                          (long long)frame_number + 1);
+                break;
+        }
+        slot->status = H265_SLOT_EMPTY;
+        pipeline->encoded_count++;
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+/* ============================================================================
+ * MATLAB Thread
+ * ============================================================================ */
+
+H265WritePipeline *h265_write_pipeline_alloc(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                             int stream_idx, int width, int height, int is_color,
+                                             int bit_depth, int slot_count, int converter_count)
+{
+    if (slot_count < 1 || converter_count < 1) return NULL;
+
+    H265WritePipeline *pipeline = (H265WritePipeline *)av_mallocz(sizeof(H265WritePipeline));
+    if (!pipeline) return NULL;
+    if (pthread_mutex_init(&pipeline->mutex, NULL) != 0) {
+        av_free(pipeline);
+        return NULL;
+    }
+    if (pthread_cond_init(&pipeline->cond, NULL) != 0) {
+        pthread_mutex_destroy(&pipeline->mutex);
+        av_free(pipeline);
+        return NULL;
+    }
+
+    pipeline->fmt_ctx = fmt_ctx;
+    pipeline->codec_ctx = codec_ctx;
+    pipeline->stream_idx = stream_idx;
+    pipeline->width = width;
+    pipeline->height = height;
+    pipeline->is_color = is_color;
+    pipeline->bit_depth = bit_depth;
+    pipeline->frame_size = (is_color ? (size_t)width * height * 3 : (size_t)width * height) *
+        h265_bytes_per_sample(bit_depth);
+
+    /* From here on, h265_write_pipeline_free copes with a partial pipeline */
+    pipeline->slots = (H265PipelineSlot *)av_calloc(slot_count, sizeof(H265PipelineSlot));
+    pipeline->converters = (H265PipelineConverter *)av_calloc(converter_count,
+                                                              sizeof(H265PipelineConverter));
+    if (!pipeline->slots || !pipeline->converters) {
+        h265_write_pipeline_free(pipeline);
+        return NULL;
+    }
+    pipeline->slot_count = slot_count;
+    pipeline->converter_count = converter_count;
+
+    for (int i = 0; i < slot_count; i++) {
+        H265PipelineSlot *slot = &pipeline->slots[i];
+        slot->input = (uint8_t *)av_malloc(pipeline->frame_size);
+        slot->frame = av_frame_alloc();
+        if (!slot->input || !slot->frame) {
+            h265_write_pipeline_free(pipeline);
+            return NULL;
+        }
+        slot->frame->format = codec_ctx->pix_fmt;
+        slot->frame->width = width;
+        slot->frame->height = height;
+        if (av_frame_get_buffer(slot->frame, 0) < 0) {
+            h265_write_pipeline_free(pipeline);
+            return NULL;
+        }
+    }
+
+    /* Converters already run in parallel, so each swscale context uses one thread */
+    for (int i = 0; i < converter_count; i++) {
+        H265PipelineConverter *converter = &pipeline->converters[i];
+        converter->pipeline = pipeline;
+        if (is_color) {
+            converter->sws_ctx = h265_alloc_rgb_sws(width, height, bit_depth, 1);
+            converter->gbrp_frame = h265_alloc_gbrp_frame(width, height, bit_depth);
+            if (!converter->sws_ctx || !converter->gbrp_frame) {
+                h265_write_pipeline_free(pipeline);
+                return NULL;
+            }
+        }
+    }
+
+    for (int i = 0; i < converter_count; i++) {
+        H265PipelineConverter *converter = &pipeline->converters[i];
+        if (pthread_create(&converter->thread, NULL, converter_worker, converter) != 0) {
+            h265_write_pipeline_free(pipeline);
+            return NULL;
+        }
+        pipeline->started_converter_count++;
+    }
+    if (pthread_create(&pipeline->encoder_thread, NULL, encoder_worker, pipeline) != 0) {
+        h265_write_pipeline_free(pipeline);
+        return NULL;
+    }
+    pipeline->is_encoder_started = 1;
+
+    return pipeline;
+}
+
+int h265_write_pipeline_free(H265WritePipeline *pipeline)
+{
+    if (!pipeline) return 0;
+
+    /* The threads drain whatever is still queued before they exit */
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->is_stopping = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    for (int i = 0; i < pipeline->started_converter_count; i++) {
+        pthread_join(pipeline->converters[i].thread, NULL);
+    }
+    if (pipeline->is_encoder_started) {
+        pthread_join(pipeline->encoder_thread, NULL);
+    }
+    int error = pipeline->error;
+
+    for (int i = 0; i < pipeline->slot_count; i++) {
+        av_free(pipeline->slots[i].input);
+        av_frame_free(&pipeline->slots[i].frame);
+    }
+    for (int i = 0; i < pipeline->converter_count; i++) {
+        sws_freeContext(pipeline->converters[i].sws_ctx);
+        av_frame_free(&pipeline->converters[i].gbrp_frame);
+    }
+    av_free(pipeline->slots);
+    av_free(pipeline->converters);
+    pthread_cond_destroy(&pipeline->cond);
+    pthread_mutex_destroy(&pipeline->mutex);
+    av_free(pipeline);
+    return error;
+}
+
+int h265_write_pipeline_enqueue(H265WritePipeline *pipeline, const uint8_t *frame_data,
+                                int64_t pts)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    H265PipelineSlot *slot = &pipeline->slots[pipeline->enqueued_count % pipeline->slot_count];
+    while (slot->status != H265_SLOT_EMPTY && !pipeline->error) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    int error = pipeline->error;
+    pthread_mutex_unlock(&pipeline->mutex);
+    if (error) return error;
+
+    /* No thread touches an empty slot that has not been queued yet */
+    memcpy(slot->input, frame_data, pipeline->frame_size);
+    slot->pts = pts;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    slot->status = H265_SLOT_FILLED;
+    pipeline->enqueued_count++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return 0;
+}
+
+int h265_write_pipeline_wait(H265WritePipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->encoded_count < pipeline->enqueued_count) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    int error = pipeline->error;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return error;
+}
+
+void h265_write_pipeline_add_stats(H265WritePipeline *pipeline, H265WriteStats *total,
+                                   int do_reset)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    h265_write_stats_add(total, &pipeline->stats);
+    if (do_reset) {
+        memset(&pipeline->stats, 0, sizeof(pipeline->stats));
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+}
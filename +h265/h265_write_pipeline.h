@@ -0,0 +1,117 @@
+/*
+ * h265_write_pipeline.h
+ * Pipelined writing, used by write_h265_frames.c when the writer was opened
+ * with do_pipeline.
+ *
+ * write_h265_frames copies each frame into a slot of a fixed ring and returns
+ * as soon as the whole batch is queued. A pool of conversion threads turns
+ * queued frames into encoder frames (each thread has its own swscale context
+ * and staging frame), and one encoder thread sends them to x265 in order and
+ * muxes the packets. When every slot is in use, enqueueing blocks until the
+ * encoder frees one, which bounds memory and applies backpressure to the
+ * caller.
+ *
+ * While the pipeline runs, the encoder thread owns the codec and format
+ * contexts; h265_write_pipeline_free must be called before the encoder is
+ * flushed. The first error stops all further encoding and is reported by the
+ * next enqueue or wait.
+ *
+ * The pipeline hangs off WriterState.pipeline and is freed (after draining
+ * and joining the threads) by close_h265_write.
+ */
+
+#ifndef H265_WRITE_PIPELINE_H
+#define H265_WRITE_PIPELINE_H
+
+#include "h265_write_common.h"
+#include <pthread.h>
+
+#define H265_PIPELINE_DEFAULT_QUEUE_FRAME_COUNT 16
+#define H265_PIPELINE_DEFAULT_CONVERSION_THREAD_COUNT 2
+
+/* Slot states, in the order a frame moves through them */
+#define H265_SLOT_EMPTY 0
+#define H265_SLOT_FILLED 1      /* input copied, waiting for a converter */
+#define H265_SLOT_CONVERTED 2   /* frame ready for the encoder */
+
+typedef struct {
+    uint8_t *input;        /* One MATLAB column-major frame */
+    AVFrame *frame;        /* Encoder-format frame */
+    int64_t pts;
+    int status;            /* H265_SLOT_*, under mutex */
+} H265PipelineSlot;
+
+typedef struct H265PipelineConverter {
+    struct H265WritePipeline *pipeline;
+    struct SwsContext *sws_ctx;   /* NULL for grayscale */
+    AVFrame *gbrp_frame;          /* NULL for grayscale */
+    pthread_t thread;
+} H265PipelineConverter;
+
+typedef struct H265WritePipeline {
+    /* Fixed at creation */
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;
+    int stream_idx;
+    int width;
+    int height;
+    int is_color;
+    int bit_depth;
+    size_t frame_size;
+    H265PipelineSlot *slots;
+    int slot_count;
+    H265PipelineConverter *converters;
+    int converter_count;
+    int started_converter_count;  /* Threads that must be joined */
+    pthread_t encoder_thread;
+    int is_encoder_started;
+    int do_collect_stats;         /* Set before the first enqueue */
+
+    /* Frame n lives in slots[n % slot_count]. All under mutex. */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;          /* Broadcast on every change below */
+    int64_t enqueued_count;       /* Frames queued by the MATLAB thread */
+    int64_t claimed_count;        /* Frames claimed by converters */
+    int64_t encoded_count;        /* Frames retired by the encoder thread */
+    int is_stopping;
+    int error;                    /* First error, 0 if none */
+    char error_message[256];
+    H265WriteStats stats;         /* Summed over the threads, if do_collect_stats */
+} H265WritePipeline;
+
+/*
+ * Start the threads of a pipeline for an opened encoder. slot_count frames
+ * are buffered at most; converter_count threads convert them.
+ * Returns NULL on failure.
+ */
+H265WritePipeline *h265_write_pipeline_alloc(AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                             int stream_idx, int width, int height, int is_color,
+                                             int bit_depth, int slot_count, int converter_count);
+
+/*
+ * Drain every queued frame, join the threads, and free the pipeline.
+ * Returns the pipeline's error, 0 if none.
+ */
+int h265_write_pipeline_free(H265WritePipeline *pipeline);
+
+/*
+ * Copy one column-major frame into the queue with the given pts, waiting for
+ * a free slot if the queue is full. Returns the pipeline's error, 0 if none;
+ * nothing is queued once an error has occurred.
+ */
+int h265_write_pipeline_enqueue(H265WritePipeline *pipeline, const uint8_t *frame_data,
+                                int64_t pts);
+
+/*
+ * Wait until every queued frame has been encoded and muxed.
+ * Returns the pipeline's error, 0 if none.
+ */
+int h265_write_pipeline_wait(H265WritePipeline *pipeline);
+
+/*
+ * Add the threads' stats so far into total, and zero them if do_reset.
+ */
+void h265_write_pipeline_add_stats(H265WritePipeline *pipeline, H265WriteStats *total,
+                                   int do_reset);
+
+#endif /* H265_WRITE_PIPELINE_H */
@@ -4,32 +4,87 @@
  * the decoder open for fast subsequent frame reads.
  *
  * Usage: video_info = open_h265_video(filename)
+ *        video_info = open_h265_video(filename, options)
+ *
+ * options is an optional struct; all fields are optional:
+ *   thread_count - decoder threads, 0 for one per core (default 1)
+ *   thread_type  - 'frame', 'slice', or 'both' (default 'both')
+ *   do_read_index  - load the frame index from <filename>.h265idx when it
+ *                    exists and matches the video's size and mtime (default 1)
+ *   do_write_index - after building the frame index, save it to
+ *                    <filename>.h265idx for faster opens next time (default 0)
+ *   do_use_sample_table - build the index from the container's sample table,
+ *                    reading only keyframe packets; falls back to a full
+ *                    packet scan if the table is missing or inconsistent
+ *                    (default 1)
+ *   cache_mb     - byte budget of the decoded-GOP cache in MiB; least
+ *                  recently used GOPs are evicted beyond it, but the most
+ *                  recently decoded GOP is always kept (default 256)
+ *   forward_frame_limit - a read starting at most this many frames after the
+ *                  frame the decoder outputs next decodes on, skipping the
+ *                  frames in between, instead of seeking; -1 to always seek
+ *                  (default 16, see H265DecodePosition in h265_decode_common.h)
+ *   hwaccel      - 'none' (default), 'auto', 'cuda', 'vaapi', or
+ *                  'videotoolbox': decode on that device and download the
+ *                  frames. Without such a device decoding stays in software,
+ *                  with a warning unless hwaccel is 'auto'.
+ *   io_mode      - 'default' (FFmpeg's file I/O), 'mmap' (map the file), or
+ *                  'cached' (large aligned reads through a block cache shared
+ *                  by every reader of the file); see h265_io.h
+ *   io_block_kb  - read size of io_mode 'cached' in KiB, a multiple of 4
+ *                  (default 1024)
+ *   io_cache_mb  - block cache budget of io_mode 'cached' in MiB, set by the
+ *                  first reader of the file (default 64)
+ *   do_share     - share the frame index with other do_share readers of the
+ *                  file, and pool the demuxer and decoder for reuse once
+ *                  closed; see h265_registry.h (default 0)
+ *   do_collect_stats - time and count the stages of every read, for
+ *                  get_h265_read_stats; see h265_stats.h (default 0)
  *
  * Returns a struct with fields:
  *   filename   - the video file path
  *   num_frames - total number of frames
  *   width      - frame width
  *   height     - frame height
- *   dts        - array of DTS values indexed by frame number (1 x num_frames)
+ *   dts        - array of seek timestamps indexed by frame number (1 x num_frames):
+ *                the frame's own DTS, or (index_source 'sample_table') the DTS
+ *                of its GOP's keyframe. Both seek backward to the same keyframe.
  *   fmt_ctx_ptr    - pointer to AVFormatContext (for read_ffmpeg_frame)
  *   codec_ctx_ptr  - pointer to AVCodecContext (for read_ffmpeg_frame)
  *   video_stream_idx - video stream index
  *   cache_ptr  - pointer to GOP frame cache (initially empty)
+ *   thread_count - decoder thread count requested (0 means one per core)
+ *   thread_type  - decoder threading mode ('frame', 'slice', or 'both')
+ *   keyframes  - 1-based frame numbers of keyframes (int32, 1 x num_keyframes)
+ *   index_source - where the frame index came from: 'shared' (another
+ *                do_share reader), 'index_file', 'sample_table', or 'scan'
+ *   bit_depth  - bits per coded sample (8, or 10/12 for Main10/Main12);
+ *                frames are read as uint16 above 8
+ *   hwaccel    - device the decoder runs on ('cuda', ...), or 'none'
+ *   io_mode    - the io_mode option
+ *   registry_ptr - pointer to the reader's registry lease, 0 unless do_share
  *
  * IMPORTANT: Call close_h265_video(video_info) when done to free resources.
  *
  * Compile with:
- *   mex open_h265_video.c -lavformat -lavcodec -lavutil
+ *   mex open_h265_video.c h265_index.c h265_frame_cache.c h265_hwaccel.c h265_io.c h265_registry.c -lavformat -lavcodec -lavutil -lpthread
  */
 
 #include "mex.h"
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include "h265_frame_cache.h"
+#include "h265_hwaccel.h"
+#include "h265_index.h"
+#include "h265_io.h"
+#include "h265_registry.h"
 
 /* HEVC NAL unit types that indicate open GOP */
 #define HEVC_NAL_BLA_W_LP    16
@@ -41,6 +96,13 @@
 #define HEVC_NAL_RASL_N      8
 #define HEVC_NAL_RASL_R      9
 
+/* Error message for open GOP videos; arguments are NAL unit type and name */
+#define OPEN_GOP_ERROR_FORMAT \
+    "Video uses open GOP encoding (found NAL unit type %d: %s). " \
+    "Open GOP videos have frames that cannot be decoded after seeking. " \
+    "Please re-encode with closed GOP (e.g., -x265-params no-open-gop=1) " \
+    "or without B-frames (e.g., -x265-params bframes=0)."
+
 /*
  * Check HEVC packet for open GOP NAL unit types.
  * Returns the problematic NAL unit type if found, or -1 if OK.
@@ -82,158 +144,39 @@ static int check_hevc_packet_for_open_gop(const uint8_t *data, int size, int len
 }
 
 /*
- * Allocate an empty frame cache. Frame data will be allocated on first read.
- * Uses mxMalloc + mexMakeMemoryPersistent for proper MEX memory management.
+ * Name of an open-GOP NAL unit type, for error messages.
  */
-static H265FrameCache *alloc_frame_cache(void)
+static const char *open_gop_nal_name(int nal_unit_type)
 {
-    H265FrameCache *cache = (H265FrameCache *)mxMalloc(sizeof(H265FrameCache));
-    if (!cache) return NULL;
-    mexMakeMemoryPersistent(cache);
-
-    cache->frames = NULL;          /* mxArray allocated on first read */
-    cache->num_frames = 0;
-    cache->start_frame = -1;
-    cache->width = 0;
-    cache->height = 0;
-    cache->is_grayscale = 0;
-    cache->frame_size = 0;
-
-    return cache;
+    switch (nal_unit_type) {
+        case HEVC_NAL_CRA_NUT:    return "CRA (Clean Random Access)";
+        case HEVC_NAL_BLA_W_LP:   return "BLA_W_LP (Broken Link Access)";
+        case HEVC_NAL_BLA_W_RADL: return "BLA_W_RADL (Broken Link Access)";
+        case HEVC_NAL_BLA_N_LP:   return "BLA_N_LP (Broken Link Access)";
+        case HEVC_NAL_RASL_N:     return "RASL_N (Random Access Skipped Leading)";
+        case HEVC_NAL_RASL_R:     return "RASL_R (Random Access Skipped Leading)";
+        default:                  return "unknown";
+    }
 }
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+/*
+ * Build the frame index by reading every packet of the video stream.
+ * First pass: count frames and check for open GOP (HEVC only).
+ * Second pass: map each frame number (derived from PTS) to its DTS, and
+ * record which frames are keyframes.
+ * Leaves the demuxer at end of file. On failure, returns 0 with error_id and
+ * error_message set; index is left empty.
+ */
+static int scan_packets_for_index(AVFormatContext *fmt_ctx, AVStream *video_stream,
+                                  int video_stream_idx, int64_t pts_increment,
+                                  H265Index *index, const char **error_id,
+                                  char *error_message, size_t error_message_size)
 {
-    char *filename;
-
-    /* Suppress FFmpeg info messages (only show warnings and errors) */
-    av_log_set_level(AV_LOG_WARNING);
-
-    AVFormatContext *fmt_ctx = NULL;
-    AVCodecContext *codec_ctx = NULL;
-    const AVCodec *codec = NULL;
-    AVStream *video_stream = NULL;
-    AVPacket *pkt = NULL;
-    int video_stream_idx = -1;
-
-    /* Check arguments */
-    if (nrhs != 1) {
-        mexErrMsgIdAndTxt("open_h265_video:nrhs", "One input required: filename");
-    }
-    if (!mxIsChar(prhs[0])) {
-        mexErrMsgIdAndTxt("open_h265_video:notString", "Filename must be a string");
-    }
-
-    filename = mxArrayToString(prhs[0]);
-
-    /* Open input file */
-    if (avformat_open_input(&fmt_ctx, filename, NULL, NULL) < 0) {
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:openFailed", "Could not open input file");
-    }
-
-    /* Find stream info */
-    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:streamInfo", "Could not find stream info");
-    }
-
-    /* Find video stream */
-    for (int i = 0; i < fmt_ctx->nb_streams; i++) {
-        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_stream_idx = i;
-            video_stream = fmt_ctx->streams[i];
-            break;
-        }
-    }
-
-    if (video_stream_idx == -1) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:noVideo", "No video stream found");
-    }
-
-    /* Get dimensions */
-    int width = video_stream->codecpar->width;
-    int height = video_stream->codecpar->height;
-
-    /* Get frame rate to compute pts_increment */
-    AVRational frame_rate = av_guess_frame_rate(fmt_ctx, video_stream, NULL);
-    if (frame_rate.num == 0 || frame_rate.den == 0) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:noFrameRate", "Could not determine frame rate");
-    }
-
-    /* pts_increment = time_base / frame_rate (in time_base units per frame)
-     * = (time_base.den * frame_rate.den) / (time_base.num * frame_rate.num)
-     * For exact integer result, the division must have no remainder. */
-    AVRational time_base = video_stream->time_base;
-    int64_t numerator = (int64_t)time_base.den * frame_rate.den;
-    int64_t denominator = (int64_t)time_base.num * frame_rate.num;
-
-    if (numerator % denominator != 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:badFrameRate",
-            "Frame rate (%d/%d) and time base (%d/%d) are incompatible. "
-            "PTS increment would be non-integer: %lld/%lld. "
-            "Re-encode with a compatible frame rate.",
-            frame_rate.num, frame_rate.den, time_base.num, time_base.den,
-            (long long)numerator, (long long)denominator);
-    }
-
-    int64_t pts_increment = numerator / denominator;
-
-    /* Find software decoder (explicitly avoid hardware decoders) */
-    codec = avcodec_find_decoder(video_stream->codecpar->codec_id);
-    if (!codec) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:noCodec", "Could not find decoder");
-    }
-
-    /* Verify this is a software decoder, not hardware */
-    if (codec->capabilities & AV_CODEC_CAP_HARDWARE) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:hwDecoder",
-            "Got hardware decoder '%s', but software decoding is required", codec->name);
-    }
-
-    /* Allocate codec context */
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:allocCodec", "Could not allocate codec context");
-    }
-
-    /* Copy codec parameters */
-    if (avcodec_parameters_to_context(codec_ctx, video_stream->codecpar) < 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:codecParams", "Could not copy codec parameters");
-    }
-
-    /* Open codec */
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:openCodec", "Could not open codec");
-    }
-
-    /* Allocate packet */
-    pkt = av_packet_alloc();
+    AVPacket *pkt = av_packet_alloc();
     if (!pkt) {
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:allocPkt", "Could not allocate packet");
+        *error_id = "open_h265_video:allocPkt";
+        snprintf(error_message, error_message_size, "Could not allocate packet");
+        return 0;
     }
 
     /* Check if this is HEVC and get NAL length size for open GOP detection */
@@ -253,27 +196,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             if (is_hevc && pkt->data && pkt->size > 0) {
                 int bad_nal = check_hevc_packet_for_open_gop(pkt->data, pkt->size, nal_length_size);
                 if (bad_nal >= 0) {
-                    const char *nal_name;
-                    switch (bad_nal) {
-                        case HEVC_NAL_CRA_NUT:   nal_name = "CRA (Clean Random Access)"; break;
-                        case HEVC_NAL_BLA_W_LP:  nal_name = "BLA_W_LP (Broken Link Access)"; break;
-                        case HEVC_NAL_BLA_W_RADL: nal_name = "BLA_W_RADL (Broken Link Access)"; break;
-                        case HEVC_NAL_BLA_N_LP:  nal_name = "BLA_N_LP (Broken Link Access)"; break;
-                        case HEVC_NAL_RASL_N:    nal_name = "RASL_N (Random Access Skipped Leading)"; break;
-                        case HEVC_NAL_RASL_R:    nal_name = "RASL_R (Random Access Skipped Leading)"; break;
-                        default:                 nal_name = "unknown"; break;
-                    }
                     av_packet_unref(pkt);
                     av_packet_free(&pkt);
-                    avcodec_free_context(&codec_ctx);
-                    avformat_close_input(&fmt_ctx);
-                    mxFree(filename);
-                    mexErrMsgIdAndTxt("open_h265_video:openGOP",
-                        "Video uses open GOP encoding (found NAL unit type %d: %s). "
-                        "Open GOP videos have frames that cannot be decoded after seeking. "
-                        "Please re-encode with closed GOP (e.g., -x265-params no-open-gop=1) "
-                        "or without B-frames (e.g., -x265-params bframes=0).",
-                        bad_nal, nal_name);
+                    *error_id = "open_h265_video:openGOP";
+                    snprintf(error_message, error_message_size,
+                        OPEN_GOP_ERROR_FORMAT,
+                        bad_nal, open_gop_nal_name(bad_nal));
+                    return 0;
                 }
             }
             num_frames++;
@@ -283,23 +212,23 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
     if (num_frames == 0) {
         av_packet_free(&pkt);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:noFrames", "No frames found in video");
+        *error_id = "open_h265_video:noFrames";
+        snprintf(error_message, error_message_size, "No frames found in video");
+        return 0;
     }
 
-    /* Allocate DTS array and frame count array */
+    /* Allocate DTS array, packet count array, and keyframe flags */
     int64_t *dts_array = (int64_t *)mxMalloc(num_frames * sizeof(int64_t));
     int *frame_count = (int *)mxCalloc(num_frames, sizeof(int));  /* initialized to 0 */
-    if (!dts_array || !frame_count) {
+    uint8_t *is_keyframe = (uint8_t *)mxCalloc(num_frames, sizeof(uint8_t));
+    if (!dts_array || !frame_count || !is_keyframe) {
         if (dts_array) mxFree(dts_array);
         if (frame_count) mxFree(frame_count);
+        if (is_keyframe) mxFree(is_keyframe);
         av_packet_free(&pkt);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:allocArrays", "Could not allocate arrays");
+        *error_id = "open_h265_video:allocArrays";
+        snprintf(error_message, error_message_size, "Could not allocate arrays");
+        return 0;
     }
 
     /* Seek back to beginning */
@@ -315,15 +244,15 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             if (pts % pts_increment != 0) {
                 av_packet_unref(pkt);
                 av_packet_free(&pkt);
+                mxFree(is_keyframe);
                 mxFree(frame_count);
                 mxFree(dts_array);
-                avcodec_free_context(&codec_ctx);
-                avformat_close_input(&fmt_ctx);
-                mxFree(filename);
-                mexErrMsgIdAndTxt("open_h265_video:misalignedPTS",
+                *error_id = "open_h265_video:misalignedPTS";
+                snprintf(error_message, error_message_size,
                     "PTS %lld is not a multiple of pts_increment %lld. "
                     "Frame timing is inconsistent.",
                     (long long)pts, (long long)pts_increment);
+                return 0;
             }
 
             int frame_num = (int)(pts / pts_increment);
@@ -331,6 +260,9 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             if (frame_num >= 0 && frame_num < num_frames) {
                 dts_array[frame_num] = pkt->dts;
                 frame_count[frame_num]++;
+                if (pkt->flags & AV_PKT_FLAG_KEY) {
+                    is_keyframe[frame_num] = 1;
+                }
             }
         }
         av_packet_unref(pkt);
@@ -350,26 +282,527 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
     mxFree(frame_count);
 
-    if (pts_missing_count > 0) {
+    if (pts_missing_count > 0 || pts_duplicate_count > 0) {
+        mxFree(is_keyframe);
+        mxFree(dts_array);
+        if (pts_missing_count > 0) {
+            *error_id = "open_h265_video:missingPTS";
+            snprintf(error_message, error_message_size,
+                "%d of %d frames have no PTS mapping", pts_missing_count, num_frames);
+        } else {
+            *error_id = "open_h265_video:duplicatePTS";
+            snprintf(error_message, error_message_size,
+                "%d frames have duplicate PTS mappings", pts_duplicate_count);
+        }
+        return 0;
+    }
+
+    /* Collect keyframe list. The first frame must be a keyframe, or frames
+     * before the first keyframe could never be decoded. */
+    if (!is_keyframe[0]) {
+        mxFree(is_keyframe);
+        mxFree(dts_array);
+        *error_id = "open_h265_video:noKeyframe";
+        snprintf(error_message, error_message_size, "First frame is not a keyframe");
+        return 0;
+    }
+    int keyframe_count = 0;
+    for (int i = 0; i < num_frames; i++) {
+        keyframe_count += is_keyframe[i];
+    }
+    int32_t *keyframes = (int32_t *)mxMalloc(keyframe_count * sizeof(int32_t));
+    for (int i = 0, k = 0; i < num_frames; i++) {
+        if (is_keyframe[i]) keyframes[k++] = i;
+    }
+    mxFree(is_keyframe);
+
+    index->num_frames = num_frames;
+    index->keyframe_count = keyframe_count;
+    index->pts_increment = pts_increment;
+    index->dts = dts_array;
+    index->keyframes = keyframes;
+    return 1;
+}
+
+/*
+ * Build the frame index from the container's sample table without reading
+ * packet payloads. For MP4, libavformat exposes stts/stss/stsz as index entries:
+ * one entry per packet in decode order, with DTS and a keyframe flag.
+ *
+ * Since GOPs are closed, each GOP holds a contiguous run of frame numbers
+ * starting at its keyframe, so frame numbers follow from GOP sizes alone. The
+ * per-frame DTS (which needs ctts to map display order to decode order) is
+ * replaced by the DTS of the frame's keyframe: every use of dts is a backward
+ * seek, which lands on that same keyframe either way.
+ *
+ * Only keyframe packets are read, to confirm their PTS matches the frame
+ * number and to check them for open-GOP NAL units.
+ * Returns 1 on success, 0 if the sample table is missing or inconsistent (the
+ * caller then falls back to scanning). Sets *bad_nal if an open-GOP NAL unit
+ * was found, which is an error rather than a reason to fall back.
+ */
+static int build_index_from_sample_table(AVFormatContext *fmt_ctx, AVStream *video_stream,
+                                         int video_stream_idx, int64_t pts_increment,
+                                         H265Index *index, int *bad_nal)
+{
+    *bad_nal = -1;
+
+    int entry_count = avformat_index_get_entries_count(video_stream);
+    if (entry_count <= 0) return 0;
+    if (video_stream->nb_frames > 0 && video_stream->nb_frames != entry_count) return 0;
+
+    /* Entries must be in strictly increasing DTS order, start with a keyframe,
+     * and not be trimmed by an edit list */
+    int keyframe_count = 0;
+    for (int i = 0; i < entry_count; i++) {
+        const AVIndexEntry *entry = avformat_index_get_entry(video_stream, i);
+        if (!entry || (entry->flags & AVINDEX_DISCARD_FRAME) || entry->size <= 0) return 0;
+        if (i == 0 && !(entry->flags & AVINDEX_KEYFRAME)) return 0;
+        if (i > 0 && entry->timestamp <= avformat_index_get_entry(video_stream, i - 1)->timestamp) return 0;
+        if (entry->flags & AVINDEX_KEYFRAME) keyframe_count++;
+    }
+
+    int64_t *dts_array = (int64_t *)mxMalloc(entry_count * sizeof(int64_t));
+    int32_t *keyframes = (int32_t *)mxMalloc(keyframe_count * sizeof(int32_t));
+    int64_t *keyframe_dts = (int64_t *)mxMalloc(keyframe_count * sizeof(int64_t));
+
+    /* Frame numbering: a keyframe's frame number is the number of packets before it */
+    for (int i = 0, k = 0; i < entry_count; i++) {
+        const AVIndexEntry *entry = avformat_index_get_entry(video_stream, i);
+        if (entry->flags & AVINDEX_KEYFRAME) {
+            keyframes[k] = i;
+            keyframe_dts[k] = entry->timestamp;
+            k++;
+        }
+        dts_array[i] = keyframe_dts[k - 1];
+    }
+
+    int is_hevc = (video_stream->codecpar->codec_id == AV_CODEC_ID_HEVC);
+    int nal_length_size = 4;
+    if (is_hevc && video_stream->codecpar->extradata_size >= 22) {
+        nal_length_size = (video_stream->codecpar->extradata[21] & 0x03) + 1;
+    }
+
+    /* Read each keyframe packet to validate its PTS and NAL unit types */
+    AVPacket *pkt = av_packet_alloc();
+    int is_consistent = (pkt != NULL);
+    for (int k = 0; k < keyframe_count && is_consistent && *bad_nal < 0; k++) {
+        is_consistent = 0;
+        if (av_seek_frame(fmt_ctx, video_stream_idx, keyframe_dts[k], AVSEEK_FLAG_BACKWARD) < 0) break;
+        while (av_read_frame(fmt_ctx, pkt) >= 0) {
+            if (pkt->stream_index != video_stream_idx) {
+                av_packet_unref(pkt);
+                continue;
+            }
+            is_consistent = (pkt->flags & AV_PKT_FLAG_KEY) &&
+                            pkt->dts == keyframe_dts[k] &&
+                            pkt->pts == (int64_t)keyframes[k] * pts_increment;
+            if (is_consistent && is_hevc && pkt->data && pkt->size > 0) {
+                *bad_nal = check_hevc_packet_for_open_gop(pkt->data, pkt->size, nal_length_size);
+            }
+            av_packet_unref(pkt);
+            break;
+        }
+    }
+    av_packet_free(&pkt);
+    mxFree(keyframe_dts);
+
+    if (!is_consistent || *bad_nal >= 0) {
+        mxFree(keyframes);
         mxFree(dts_array);
+        return 0;
+    }
+
+    index->num_frames = entry_count;
+    index->keyframe_count = keyframe_count;
+    index->pts_increment = pts_increment;
+    index->dts = dts_array;
+    index->keyframes = keyframes;
+    return 1;
+}
+
+/*
+ * Read an optional scalar field from the options struct.
+ * Returns default_value if options is NULL or the field is absent or empty.
+ */
+static double get_option_scalar(const mxArray *options, const char *name, double default_value)
+{
+    if (!options) return default_value;
+    mxArray *field = mxGetField(options, 0, name);
+    if (!field || mxIsEmpty(field)) return default_value;
+    if (!mxIsNumeric(field) && !mxIsLogical(field)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption", "Option '%s' must be numeric", name);
+    }
+    return mxGetScalar(field);
+}
+
+/*
+ * Parse the thread_type option into FFmpeg's FF_THREAD_* flags.
+ */
+static int get_thread_type_option(const mxArray *options, const char **thread_type_name)
+{
+    mxArray *field = options ? mxGetField(options, 0, "thread_type") : NULL;
+    if (!field || mxIsEmpty(field)) {
+        *thread_type_name = "both";
+        return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+    if (!mxIsChar(field)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption", "Option 'thread_type' must be a string");
+    }
+
+    char *value = mxArrayToString(field);
+    int thread_type;
+    if (strcmp(value, "frame") == 0) {
+        *thread_type_name = "frame";
+        thread_type = FF_THREAD_FRAME;
+    } else if (strcmp(value, "slice") == 0) {
+        *thread_type_name = "slice";
+        thread_type = FF_THREAD_SLICE;
+    } else if (strcmp(value, "both") == 0) {
+        *thread_type_name = "both";
+        thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    } else {
+        mxFree(value);
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'thread_type' must be 'frame', 'slice', or 'both'");
+    }
+    mxFree(value);
+    return thread_type;
+}
+
+/*
+ * Parse the io_mode option.
+ */
+static H265IoMode get_io_mode_option(const mxArray *options)
+{
+    mxArray *field = options ? mxGetField(options, 0, "io_mode") : NULL;
+    if (!field || mxIsEmpty(field)) return H265_IO_DEFAULT;
+    if (!mxIsChar(field)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption", "Option 'io_mode' must be a string");
+    }
+
+    char *value = mxArrayToString(field);
+    for (int i = 0; h265_io_mode_names[i]; i++) {
+        if (strcmp(value, h265_io_mode_names[i]) == 0) {
+            mxFree(value);
+            return (H265IoMode)i;
+        }
+    }
+    mxFree(value);
+    mexErrMsgIdAndTxt("open_h265_video:badOption",
+        "Option 'io_mode' must be 'default', 'mmap', or 'cached'");
+    return H265_IO_DEFAULT;
+}
+
+/*
+ * Open filename for demuxing, through h265_io unless io_mode is
+ * H265_IO_DEFAULT. Returns 0 or a negative AVERROR.
+ */
+static int open_input(AVFormatContext **fmt_ctx, const char *filename, H265IoMode io_mode,
+                      size_t block_size, size_t byte_budget)
+{
+    if (io_mode == H265_IO_DEFAULT) return avformat_open_input(fmt_ctx, filename, NULL, NULL);
+
+    AVIOContext *pb = h265_io_open(filename, io_mode, block_size, byte_budget);
+    if (!pb) return AVERROR(EIO);
+
+    H265IoFile *file = ((H265IoStream *)pb->opaque)->file;
+    int ret = h265_io_open_input(fmt_ctx, filename, file);
+    file->close_context(&pb);
+    return ret;
+}
+
+/*
+ * Parse the hwaccel option into one of h265_hwaccel_names.
+ */
+static const char *get_hwaccel_option(const mxArray *options)
+{
+    mxArray *field = options ? mxGetField(options, 0, "hwaccel") : NULL;
+    if (!field || mxIsEmpty(field)) return "none";
+    if (!mxIsChar(field)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption", "Option 'hwaccel' must be a string");
+    }
+
+    char *value = mxArrayToString(field);
+    for (int i = 0; h265_hwaccel_names[i]; i++) {
+        if (strcmp(value, h265_hwaccel_names[i]) == 0) {
+            mxFree(value);
+            return h265_hwaccel_names[i];
+        }
+    }
+    mxFree(value);
+    mexErrMsgIdAndTxt("open_h265_video:badOption",
+        "Option 'hwaccel' must be 'none', 'auto', 'cuda', 'vaapi', or 'videotoolbox'");
+    return NULL;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    char *filename;
+    const mxArray *options = NULL;
+
+    /* close_h265_video dropping the lock taken for a Reader */
+    if (h265_mex_handle_unlock(nrhs, prhs)) return;
+
+    /* Idle decoders outlive their Readers; free them if this file is cleared */
+    mexAtExit(h265_registry_free_idle);
+
+    /* Suppress FFmpeg info messages (only show warnings and errors) */
+    av_log_set_level(AV_LOG_WARNING);
+
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    const AVCodec *codec = NULL;
+    AVStream *video_stream = NULL;
+    int video_stream_idx = -1;
+
+    /* Check arguments */
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgIdAndTxt("open_h265_video:nrhs", "Inputs must be filename and optional options struct");
+    }
+    if (!mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("open_h265_video:notString", "Filename must be a string");
+    }
+    if (nrhs == 2 && !mxIsEmpty(prhs[1])) {
+        if (!mxIsStruct(prhs[1])) {
+            mexErrMsgIdAndTxt("open_h265_video:notStruct", "Options must be a struct");
+        }
+        options = prhs[1];
+    }
+
+    /* Parse options before acquiring any resources */
+    double thread_count_value = get_option_scalar(options, "thread_count", 1);
+    if (thread_count_value < 0 || thread_count_value != (int)thread_count_value) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'thread_count' must be a non-negative integer");
+    }
+    int thread_count = (int)thread_count_value;
+    const char *thread_type_name;
+    int thread_type = get_thread_type_option(options, &thread_type_name);
+    const char *hwaccel = get_hwaccel_option(options);
+    int do_read_index = get_option_scalar(options, "do_read_index", 1) != 0;
+    int do_write_index = get_option_scalar(options, "do_write_index", 0) != 0;
+    int do_use_sample_table = get_option_scalar(options, "do_use_sample_table", 1) != 0;
+    double cache_mb = get_option_scalar(options, "cache_mb", H265_CACHE_DEFAULT_MB);
+    if (!(cache_mb >= 0)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'cache_mb' must be a non-negative number");
+    }
+    double forward_frame_limit = get_option_scalar(options, "forward_frame_limit",
+                                                   H265_DEFAULT_FORWARD_FRAME_LIMIT);
+    if (!(forward_frame_limit >= -1 && forward_frame_limit <= INT_MAX) ||
+        forward_frame_limit != (int)forward_frame_limit) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'forward_frame_limit' must be an integer of at least -1");
+    }
+
+    H265IoMode io_mode = get_io_mode_option(options);
+    double io_block_kb = get_option_scalar(options, "io_block_kb", H265_IO_DEFAULT_BLOCK_KB);
+    if (!(io_block_kb >= 4 && io_block_kb <= 1024 * 1024) || io_block_kb != (int)io_block_kb ||
+        (int)io_block_kb % 4 != 0) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'io_block_kb' must be a multiple of 4 between 4 and 1048576");
+    }
+    double io_cache_mb = get_option_scalar(options, "io_cache_mb", H265_IO_DEFAULT_CACHE_MB);
+    if (!(io_cache_mb >= 0)) {
+        mexErrMsgIdAndTxt("open_h265_video:badOption",
+            "Option 'io_cache_mb' must be a non-negative number");
+    }
+
+    int do_share = get_option_scalar(options, "do_share", 0) != 0;
+    int do_collect_stats = get_option_scalar(options, "do_collect_stats", 0) != 0;
+
+    H265DecoderConfig decoder_config;
+    decoder_config.thread_count = thread_count;
+    decoder_config.thread_type = thread_type;
+    decoder_config.hwaccel = hwaccel;
+    decoder_config.io_mode = io_mode;
+    decoder_config.io_block_size = (size_t)io_block_kb * 1024;
+
+    filename = mxArrayToString(prhs[0]);
+
+    /* A do_share Reader takes over the demuxer and decoder a closed Reader
+     * of the file left in the registry, if there is one */
+    int is_pooled = do_share &&
+                    h265_registry_take_decoder(filename, &decoder_config, &fmt_ctx, &codec_ctx);
+
+    if (!is_pooled) {
+        /* Open input file */
+        if (open_input(&fmt_ctx, filename, io_mode, decoder_config.io_block_size,
+                       (size_t)(io_cache_mb * 1024 * 1024)) < 0) {
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:openFailed", "Could not open input file");
+        }
+
+        /* Find stream info */
+        if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:streamInfo", "Could not find stream info");
+        }
+    }
+
+    /* Find video stream */
+    for (int i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_stream_idx = i;
+            video_stream = fmt_ctx->streams[i];
+            break;
+        }
+    }
+
+    if (video_stream_idx == -1) {
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+        h265_io_close_input(&fmt_ctx);
         mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:missingPTS",
-            "%d of %d frames have no PTS mapping", pts_missing_count, num_frames);
+        mexErrMsgIdAndTxt("open_h265_video:noVideo", "No video stream found");
     }
-    if (pts_duplicate_count > 0) {
-        mxFree(dts_array);
+
+    /* Get dimensions */
+    int width = video_stream->codecpar->width;
+    int height = video_stream->codecpar->height;
+
+    /* Get frame rate to compute pts_increment */
+    AVRational frame_rate = av_guess_frame_rate(fmt_ctx, video_stream, NULL);
+    if (frame_rate.num == 0 || frame_rate.den == 0) {
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+        h265_io_close_input(&fmt_ctx);
         mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_video:duplicatePTS",
-            "%d frames have duplicate PTS mappings", pts_duplicate_count);
+        mexErrMsgIdAndTxt("open_h265_video:noFrameRate", "Could not determine frame rate");
     }
 
-    /* Seek back to beginning for subsequent reads */
-    avformat_seek_file(fmt_ctx, video_stream_idx, INT64_MIN, 0, 0, 0);
-    avcodec_flush_buffers(codec_ctx);
+    /* pts_increment = time_base / frame_rate (in time_base units per frame)
+     * = (time_base.den * frame_rate.den) / (time_base.num * frame_rate.num)
+     * For exact integer result, the division must have no remainder. */
+    AVRational time_base = video_stream->time_base;
+    int64_t numerator = (int64_t)time_base.den * frame_rate.den;
+    int64_t denominator = (int64_t)time_base.num * frame_rate.num;
+
+    if (numerator % denominator != 0) {
+        avcodec_free_context(&codec_ctx);
+        h265_io_close_input(&fmt_ctx);
+        mxFree(filename);
+        mexErrMsgIdAndTxt("open_h265_video:badFrameRate",
+            "Frame rate (%d/%d) and time base (%d/%d) are incompatible. "
+            "PTS increment would be non-integer: %lld/%lld. "
+            "Re-encode with a compatible frame rate.",
+            frame_rate.num, frame_rate.den, time_base.num, time_base.den,
+            (long long)numerator, (long long)denominator);
+    }
+
+    int64_t pts_increment = numerator / denominator;
+
+    if (!is_pooled) {
+        /* Find the software decoder (not a wrapper around a hardware one such as
+         * hevc_cuvid); hardware decoding goes through its hwaccel instead */
+        codec = avcodec_find_decoder(video_stream->codecpar->codec_id);
+        if (!codec) {
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:noCodec", "Could not find decoder");
+        }
+
+        /* Verify this is a software decoder, not hardware */
+        if (codec->capabilities & AV_CODEC_CAP_HARDWARE) {
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:hwDecoder",
+                "Got hardware decoder '%s', but software decoding is required", codec->name);
+        }
+
+        /* Allocate codec context */
+        codec_ctx = avcodec_alloc_context3(codec);
+        if (!codec_ctx) {
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:allocCodec", "Could not allocate codec context");
+        }
+
+        /* Copy codec parameters */
+        if (avcodec_parameters_to_context(codec_ctx, video_stream->codecpar) < 0) {
+            avcodec_free_context(&codec_ctx);
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:codecParams", "Could not copy codec parameters");
+        }
+
+        /* Decode on a hardware device if one was asked for and can be opened */
+        int is_hwaccel_attached = 0;
+        for (int attempt = 0; !is_hwaccel_attached; attempt++) {
+            enum AVHWDeviceType device_type = h265_hwaccel_device_type(hwaccel, attempt);
+            if (device_type == AV_HWDEVICE_TYPE_NONE) break;
+            is_hwaccel_attached = h265_hwaccel_attach_decoder(codec_ctx, device_type);
+        }
+        if (!is_hwaccel_attached && strcmp(hwaccel, "none") != 0 && strcmp(hwaccel, "auto") != 0) {
+            mexWarnMsgIdAndTxt("open_h265_video:hwaccelUnavailable",
+                "Could not decode on a '%s' device; decoding in software", hwaccel);
+        }
+
+        /* Configure decoder threading. Frames are matched to their index by PTS
+         * everywhere, so the extra output delay of frame threading is harmless. */
+        codec_ctx->thread_count = thread_count;
+        codec_ctx->thread_type = thread_type;
+
+        /* Open codec */
+        if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+            avcodec_free_context(&codec_ctx);
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:openCodec", "Could not open codec");
+        }
+    }
+
+    /* Build the frame index: from the registry for do_share Readers of an
+     * already open file, else from the sidecar file if it is present and
+     * current, else from the container's sample table, else by scanning
+     * every packet */
+    H265Index index;
+    h265_index_init(&index);
+    const char *index_source = NULL;
+
+    int bad_nal = -1;
+    if (do_share && h265_registry_read_index(filename, &index)) {
+        index_source = "shared";
+    } else if (do_read_index && h265_index_read(filename, pts_increment, &index)) {
+        index_source = "index_file";
+    } else if (do_use_sample_table &&
+               build_index_from_sample_table(fmt_ctx, video_stream, video_stream_idx,
+                                             pts_increment, &index, &bad_nal)) {
+        index_source = "sample_table";
+    } else {
+        if (bad_nal >= 0) {
+            avcodec_free_context(&codec_ctx);
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_video:openGOP",
+                OPEN_GOP_ERROR_FORMAT,
+                bad_nal, open_gop_nal_name(bad_nal));
+        }
+
+        const char *error_id = NULL;
+        char error_message[512];
+        if (!scan_packets_for_index(fmt_ctx, video_stream, video_stream_idx, pts_increment,
+                                    &index, &error_id, error_message, sizeof(error_message))) {
+            avcodec_free_context(&codec_ctx);
+            h265_io_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt(error_id, "%s", error_message);
+        }
+        index_source = "scan";
+    }
+
+    if (strcmp(index_source, "index_file") != 0 && strcmp(index_source, "shared") != 0) {
+        if (do_write_index && !h265_index_write(filename, &index)) {
+            mexWarnMsgIdAndTxt("open_h265_video:indexWrite",
+                "Could not write index file for %s", filename);
+        }
+
+        /* Seek back to beginning for subsequent reads */
+        avformat_seek_file(fmt_ctx, video_stream_idx, INT64_MIN, 0, 0, 0);
+        avcodec_flush_buffers(codec_ctx);
+    }
+
+    int num_frames = index.num_frames;
 
     /* Detect grayscale from pixel format */
     int is_grayscale = -1;  /* -1 means not specified (will be treated as color) */
@@ -381,21 +814,42 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
 
     /* Allocate empty GOP frame cache (will be populated on first read) */
-    H265FrameCache *frame_cache = alloc_frame_cache();
+    H265FrameCache *frame_cache = h265_cache_alloc((size_t)(cache_mb * 1024 * 1024));
     if (!frame_cache) {
-        mxFree(dts_array);
+        h265_index_free(&index);
         avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+        h265_io_close_input(&fmt_ctx);
         mxFree(filename);
         mexErrMsgIdAndTxt("open_h265_video:allocCache", "Could not allocate frame cache");
     }
+    frame_cache->position.forward_frame_limit = (int)forward_frame_limit;
+    frame_cache->do_collect_stats = do_collect_stats;
+
+    /* Custom I/O callbacks live in this MEX file, so it must stay loaded for
+     * as long as the Reader (or one of its workers) may read */
+    if (h265_io_file_of(fmt_ctx)) {
+        h265_mex_lock_for(&frame_cache->mex_locks, "h265.open_h265_video");
+    }
+
+    /* Share the index, and the decoder once this Reader is closed. The lease
+     * is released through a function pointer into this MEX file, so it must
+     * stay loaded until close_h265_video has released it. */
+    H265VideoLease *lease = NULL;
+    if (do_share) {
+        lease = h265_registry_register(filename, &index, &decoder_config);
+        if (lease) {
+            h265_mex_lock_for(&frame_cache->mex_locks, "h265.open_h265_video");
+        }
+    }
 
     /* Create output struct - keep fmt_ctx, codec_ctx, and cache open */
     const char *field_names[] = {"filename", "num_frames", "width", "height", "dts",
                                   "fmt_ctx_ptr", "codec_ctx_ptr", "video_stream_idx", "pts_increment",
                                   "time_base_num", "time_base_den", "frame_rate_num", "frame_rate_den",
-                                  "is_grayscale", "cache_ptr"};
-    plhs[0] = mxCreateStructMatrix(1, 1, 15, field_names);
+                                  "is_grayscale", "cache_ptr", "thread_count", "thread_type",
+                                  "keyframes", "index_source", "bit_depth", "hwaccel", "io_mode",
+                                  "registry_ptr"};
+    plhs[0] = mxCreateStructMatrix(1, 1, 23, field_names);
 
     /* Helper variables for typed arrays */
     mxArray *mx_int32;
@@ -413,11 +867,18 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     /* Set dts array (int64) */
     mxArray *dts_mx = mxCreateNumericMatrix(1, num_frames, mxINT64_CLASS, mxREAL);
     int64_t *dts_data = (int64_t *)mxGetData(dts_mx);
-    for (int i = 0; i < num_frames; i++) {
-        dts_data[i] = dts_array[i];
-    }
+    memcpy(dts_data, index.dts, num_frames * sizeof(int64_t));
     mxSetField(plhs[0], 0, "dts", dts_mx);
 
+    /* Set keyframes array (int32, 1-based frame numbers) */
+    mxArray *keyframes_mx = mxCreateNumericMatrix(1, index.keyframe_count, mxINT32_CLASS, mxREAL);
+    int32_t *keyframes_data = (int32_t *)mxGetData(keyframes_mx);
+    for (int i = 0; i < index.keyframe_count; i++) {
+        keyframes_data[i] = index.keyframes[i] + 1;
+    }
+    mxSetField(plhs[0], 0, "keyframes", keyframes_mx);
+    mxSetField(plhs[0], 0, "index_source", mxCreateString(index_source));
+
     /* Store pointers as uint64 */
     mx_uint64 = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
     *(uint64_t *)mxGetData(mx_uint64) = (uint64_t)(uintptr_t)fmt_ctx;
@@ -456,12 +917,30 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     /* Set is_grayscale (-1 if not in metadata, 0 or 1 otherwise) */
     mxSetField(plhs[0], 0, "is_grayscale", mxCreateDoubleScalar((double)is_grayscale));
 
+    /* Set bit_depth of the coded samples (frames are uint16 above 8) */
+    const AVPixFmtDescriptor *pix_fmt_desc = av_pix_fmt_desc_get(pix_fmt);
+    mxSetField(plhs[0], 0, "bit_depth",
+               mxCreateDoubleScalar(pix_fmt_desc ? (double)pix_fmt_desc->comp[0].depth : 8.0));
+
     /* Store cache pointer as uint64 */
     mx_uint64 = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
     *(uint64_t *)mxGetData(mx_uint64) = (uint64_t)(uintptr_t)frame_cache;
     mxSetField(plhs[0], 0, "cache_ptr", mx_uint64);
 
+    /* Store registry lease pointer as uint64 (0 unless do_share) */
+    mx_uint64 = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+    *(uint64_t *)mxGetData(mx_uint64) = (uint64_t)(uintptr_t)lease;
+    mxSetField(plhs[0], 0, "registry_ptr", mx_uint64);
+
+    /* Record threading configuration */
+    mxSetField(plhs[0], 0, "thread_count", mxCreateDoubleScalar((double)thread_count));
+    mxSetField(plhs[0], 0, "thread_type", mxCreateString(thread_type_name));
+
+    /* Record the decode device */
+    mxSetField(plhs[0], 0, "hwaccel", mxCreateString(h265_hwaccel_device_name(codec_ctx)));
+    mxSetField(plhs[0], 0, "io_mode", mxCreateString(h265_io_mode_names[io_mode]));
+
     /* Free temporary arrays (but NOT fmt_ctx, codec_ctx, or cache - they stay open) */
-    mxFree(dts_array);
+    h265_index_free(&index);
     mxFree(filename);
 }
@@ -3,6 +3,7 @@
  * MEX function to open a video file for writing h.265 with closed GOP.
  *
  * Usage: writer = open_h265_write(filename, width, height, frame_rate, is_color, gop_size, crf)
+ *        writer = open_h265_write(filename, width, height, frame_rate, is_color, gop_size, crf, options)
  *   filename   - output file path (must end in .mp4)
  *   width      - frame width
  *   height     - frame height
@@ -10,12 +11,47 @@
  *   is_color   - boolean: 0 for grayscale, 1 for RGB color
  *   gop_size   - keyframe interval in frames (e.g., 50)
  *   crf        - quality setting, 0-51 where lower is better (e.g., 18)
+ *   options    - optional struct with fields:
+ *                  do_pipeline             - if true, write_h265_frames queues frames and
+ *                                            returns; conversion and encoding run on
+ *                                            worker threads (default false)
+ *                  queue_frame_count       - frames the pipeline buffers before
+ *                                            write_h265_frames blocks (default 16)
+ *                  conversion_thread_count - pipeline conversion threads (default 2)
+ *                  segment_encoder_count   - if greater than 1, encode runs of whole GOPs
+ *                                            on this many x265 instances in parallel
+ *                                            and mux them in order (default 1)
+ *                  segment_gop_count       - GOPs per segment (default 1)
+ *                  preset                  - x265 preset, 'ultrafast' ... 'placebo'
+ *                                            (default: x265's, 'medium')
+ *                  tune                    - x265 tune, or 'none' (default 'fastdecode')
+ *                  pools                   - x265 thread pool list, e.g. '8', '+', '4,4'
+ *                  frame_thread_count      - x265 frame threads, 0 for auto (0-16)
+ *                  do_wpp                  - x265 wavefront parallel processing
+ *                  lookahead_slice_count   - x265 lookahead slices (0-16)
+ *                  b_frame_count           - x265 consecutive B-frames (0-16)
+ *                  bit_depth               - 8 (default), or 10 or 12 for Main10 or
+ *                                            Main12; frames are then uint16. Needs
+ *                                            a libx265 with high bit depth support.
+ *                  hwaccel                 - 'none' (default), 'auto', 'cuda' (NVENC),
+ *                                            or 'videotoolbox': encode on that
+ *                                            device's h.265 encoder, falling back to
+ *                                            libx265 (with a warning unless 'auto')
+ *                                            if it is missing, cannot take the
+ *                                            frame format, or fails to open
+ *                  do_collect_stats        - time and count conversion, encoding, and
+ *                                            muxing, for get_h265_write_stats; see
+ *                                            h265_stats.h (default false)
+ *                The x265 options default to x265's own choice. None of them
+ *                can change the closed GOP, keyframe interval, or crf.
  *
- * Returns a struct with encoder context pointers for write_h265_frame.
+ * Returns a struct with encoder context pointers for write_h265_frame, the
+ * x265-params string that was used (empty for a hardware encoder), and the
+ * hwaccel device the encoder runs on ('none' for libx265).
  * IMPORTANT: Call close_h265_write(writer) when done to flush and close.
  *
  * Compile with:
- *   mex open_h265_write.c -lavformat -lavcodec -lavutil -lswscale
+ *   mex open_h265_write.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c h265_hwaccel.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
@@ -28,6 +64,10 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include "h265_hwaccel.h"
+#include "h265_write_common.h"
+#include "h265_write_pipeline.h"
+#include "h265_segment_encoder.h"
 
 /*
  * Dynamically allocate and format a string using mxMalloc.
@@ -56,12 +96,148 @@ static char *mx_sprintf(const char *format, ...)
     return buf;
 }
 
-/* Mutable state that can be updated by write_ffmpeg_frame */
-typedef struct {
-    int64_t next_pts;
-    int64_t pts_increment;
-    int is_color;  /* 0 for grayscale, 1 for RGB */
-} WriterState;
+/*
+ * Read an optional scalar field from the options struct.
+ * Returns default_value if options is NULL or the field is absent or empty.
+ */
+static double get_option_scalar(const mxArray *options, const char *name, double default_value)
+{
+    if (!options) return default_value;
+    mxArray *field = mxGetField(options, 0, name);
+    if (!field || mxIsEmpty(field)) return default_value;
+    if (!mxIsNumeric(field) && !mxIsLogical(field)) {
+        mexErrMsgIdAndTxt("open_h265_write:badOption", "Option '%s' must be numeric", name);
+    }
+    return mxGetScalar(field);
+}
+
+/*
+ * Read an optional integer option that must lie in [min_value, max_value].
+ * Returns default_value if options is NULL or the field is absent or empty.
+ */
+static int get_option_int(const mxArray *options, const char *name,
+                          int min_value, int max_value, int default_value)
+{
+    mxArray *field = options ? mxGetField(options, 0, name) : NULL;
+    if (!field || mxIsEmpty(field)) return default_value;
+
+    double value = get_option_scalar(options, name, default_value);
+    if (value != (int)value || value < min_value || value > max_value) {
+        mexErrMsgIdAndTxt("open_h265_write:badOption",
+            "Option '%s' must be an integer from %d to %d", name, min_value, max_value);
+    }
+    return (int)value;
+}
+
+/* Values accepted by the preset and tune options */
+static const char *const preset_names[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast",
+    "medium", "slow", "slower", "veryslow", "placebo", NULL
+};
+static const char *const tune_names[] = {
+    "psnr", "ssim", "grain", "zerolatency", "fastdecode", "animation", "none", NULL
+};
+
+/*
+ * Read an optional string option that must be one of names (NULL-terminated).
+ * Returns the matching entry of names, or default_value if options is NULL or
+ * the field is absent or empty.
+ */
+static const char *get_option_name(const mxArray *options, const char *name,
+                                   const char *const *names, const char *default_value)
+{
+    mxArray *field = options ? mxGetField(options, 0, name) : NULL;
+    if (!field || mxIsEmpty(field)) return default_value;
+    if (!mxIsChar(field)) {
+        mexErrMsgIdAndTxt("open_h265_write:badOption", "Option '%s' must be a string", name);
+    }
+
+    char *value = mxArrayToString(field);
+    for (int i = 0; names[i]; i++) {
+        if (strcmp(value, names[i]) == 0) {
+            mxFree(value);
+            return names[i];
+        }
+    }
+    mexErrMsgIdAndTxt("open_h265_write:badOption", "Unknown %s '%s'", name, value);
+    return NULL;
+}
+
+/*
+ * Read the optional pools option into pools (empty if absent). Only x265's
+ * pool list syntax is accepted, so the value cannot smuggle in other params.
+ */
+static void get_pools_option(const mxArray *options, char *pools, size_t pools_size)
+{
+    pools[0] = '\0';
+    mxArray *field = options ? mxGetField(options, 0, "pools") : NULL;
+    if (!field || mxIsEmpty(field)) return;
+    if (!mxIsChar(field) || mxGetString(field, pools, pools_size) != 0 ||
+        strspn(pools, "0123456789,+-*") != strlen(pools)) {
+        mexErrMsgIdAndTxt("open_h265_write:badOption",
+            "Option 'pools' must be an x265 pool list such as '8', '+', '-', or '4,4'");
+    }
+}
+
+/*
+ * Open the h.265 encoder of a hardware device of device_type with the
+ * writer's settings. GOPs are closed, keyframes come every gop_size frames,
+ * and crf maps onto the encoder's constant-quality mode. The encoder takes
+ * the same system-memory frames as libx265 and uploads them itself.
+ * Returns NULL if the encoder is missing, cannot take pix_fmt, or fails to
+ * open (no device, or no free encoder session), so the caller can fall back.
+ */
+static AVCodecContext *open_hw_encoder(enum AVHWDeviceType device_type,
+                                       const AVFormatContext *fmt_ctx, int width, int height,
+                                       int frame_rate_num, int frame_rate_den,
+                                       enum AVPixelFormat pix_fmt, int gop_size, int crf,
+                                       int b_frame_count)
+{
+    const char *encoder_name = h265_hwaccel_encoder_name(device_type);
+    const AVCodec *codec = encoder_name ? avcodec_find_encoder_by_name(encoder_name) : NULL;
+    if (!codec || !h265_hwaccel_has_pix_fmt(codec, pix_fmt)) return NULL;
+
+    AVBufferRef *device = NULL;
+    if (av_hwdevice_ctx_create(&device, device_type, NULL, NULL, 0) < 0) return NULL;
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx) {
+        av_buffer_unref(&device);
+        return NULL;
+    }
+
+    codec_ctx->hw_device_ctx = device;
+    codec_ctx->width = width;
+    codec_ctx->height = height;
+    codec_ctx->time_base = (AVRational){frame_rate_den, frame_rate_num};
+    codec_ctx->framerate = (AVRational){frame_rate_num, frame_rate_den};
+    codec_ctx->pix_fmt = pix_fmt;
+    codec_ctx->gop_size = gop_size;
+    codec_ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    if (b_frame_count >= 0) {
+        codec_ctx->max_b_frames = b_frame_count;
+    }
+    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+        codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (device_type == AV_HWDEVICE_TYPE_CUDA) {
+        /* Every keyframe an IDR frame, constant quality at crf */
+        av_opt_set_int(codec_ctx->priv_data, "forced-idr", 1, 0);
+        av_opt_set(codec_ctx->priv_data, "rc", "vbr", 0);
+        av_opt_set_int(codec_ctx->priv_data, "cq", crf, 0);
+        codec_ctx->bit_rate = 0;
+    } else {
+        /* VideoToolbox quality runs from 0 (worst) to 100 (lossless) */
+        codec_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+        codec_ctx->global_quality = FF_QP2LAMBDA * (100 * (51 - crf) / 51);
+    }
+
+    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+        avcodec_free_context(&codec_ctx);
+        return NULL;
+    }
+    return codec_ctx;
+}
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
@@ -71,6 +247,24 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     int is_color;
     int gop_size;
     int crf;
+    int do_pipeline;
+    int do_collect_stats;
+    int queue_frame_count;
+    int conversion_thread_count;
+    int segment_encoder_count;
+    int segment_gop_count;
+    const char *preset;
+    const char *tune;
+    char pools[64];
+    int frame_thread_count;
+    int do_wpp;
+    int lookahead_slice_count;
+    int b_frame_count;
+    int bit_depth;
+    const char *hwaccel;
+
+    /* close_h265_write dropping the lock taken for a pipeline */
+    if (h265_mex_handle_unlock(nrhs, prhs)) return;
 
     /* Suppress FFmpeg info messages (only show warnings and errors) */
     av_log_set_level(AV_LOG_WARNING);
@@ -85,9 +279,30 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     int ret;
 
     /* Check arguments */
-    if (nrhs != 7) {
+    if (nrhs != 7 && nrhs != 8) {
         mexErrMsgIdAndTxt("open_h265_write:nrhs",
-            "Seven inputs required: filename, width, height, frame_rate, is_color, gop_size, crf");
+            "Seven or eight inputs required: filename, width, height, frame_rate, is_color, gop_size, crf[, options]");
+    }
+    const mxArray *options = NULL;
+    if (nrhs == 8 && !mxIsEmpty(prhs[7])) {
+        if (!mxIsStruct(prhs[7])) {
+            mexErrMsgIdAndTxt("open_h265_write:notStruct", "Options must be a struct");
+        }
+        options = prhs[7];
+    }
+
+    /* Parse x265 options before acquiring any resources; -1 leaves x265's default */
+    preset = get_option_name(options, "preset", preset_names, NULL);
+    tune = get_option_name(options, "tune", tune_names, "fastdecode");
+    get_pools_option(options, pools, sizeof(pools));
+    frame_thread_count = get_option_int(options, "frame_thread_count", 0, 16, -1);
+    do_wpp = get_option_int(options, "do_wpp", 0, 1, -1);
+    lookahead_slice_count = get_option_int(options, "lookahead_slice_count", 0, 16, -1);
+    b_frame_count = get_option_int(options, "b_frame_count", 0, 16, -1);
+    bit_depth = get_option_int(options, "bit_depth", 8, 12, 8);
+    hwaccel = get_option_name(options, "hwaccel", h265_hwaccel_names, "none");
+    if (bit_depth != 8 && bit_depth != 10 && bit_depth != 12) {
+        mexErrMsgIdAndTxt("open_h265_write:badOption", "Option 'bit_depth' must be 8, 10, or 12");
     }
     if (!mxIsChar(prhs[0])) {
         mexErrMsgIdAndTxt("open_h265_write:notString", "Filename must be a string");
@@ -122,6 +337,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     gop_size = (int)mxGetScalar(prhs[5]);
     crf = (int)mxGetScalar(prhs[6]);
 
+    /* Parse pipeline options */
+    do_pipeline = get_option_scalar(options, "do_pipeline", 0) != 0;
+    queue_frame_count = (int)get_option_scalar(options, "queue_frame_count",
+                                               H265_PIPELINE_DEFAULT_QUEUE_FRAME_COUNT);
+    conversion_thread_count = (int)get_option_scalar(options, "conversion_thread_count",
+                                                     H265_PIPELINE_DEFAULT_CONVERSION_THREAD_COUNT);
+    segment_encoder_count = (int)get_option_scalar(options, "segment_encoder_count", 1);
+    segment_gop_count = (int)get_option_scalar(options, "segment_gop_count",
+                                               H265_SEGMENT_DEFAULT_GOP_COUNT);
+    do_collect_stats = get_option_scalar(options, "do_collect_stats", 0) != 0;
+
     /* Validate encoding parameters */
     if (gop_size < 1) {
         mxFree(filename);
@@ -133,6 +359,21 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         mexErrMsgIdAndTxt("open_h265_write:badCrf",
             "crf must be between 0 and 51");
     }
+    if (queue_frame_count < 1 || conversion_thread_count < 1) {
+        mxFree(filename);
+        mexErrMsgIdAndTxt("open_h265_write:badOption",
+            "queue_frame_count and conversion_thread_count must be at least 1");
+    }
+    if (segment_encoder_count < 1 || segment_gop_count < 1) {
+        mxFree(filename);
+        mexErrMsgIdAndTxt("open_h265_write:badOption",
+            "segment_encoder_count and segment_gop_count must be at least 1");
+    }
+    if (do_pipeline && segment_encoder_count > 1) {
+        mxFree(filename);
+        mexErrMsgIdAndTxt("open_h265_write:badOption",
+            "do_pipeline cannot be combined with segment_encoder_count > 1");
+    }
 
     /* Validate dimensions */
     if (width <= 0 || height <= 0) {
@@ -149,15 +390,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Could not allocate output format context");
     }
 
-    /* Find h.265 encoder */
-    codec = avcodec_find_encoder(AV_CODEC_ID_HEVC);
-    if (!codec) {
-        avformat_free_context(fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_write:noCodec",
-            "Could not find h.265 encoder. Is libx265 installed?");
-    }
-
     /* Create video stream */
     video_stream = avformat_new_stream(fmt_ctx, NULL);
     if (!video_stream) {
@@ -167,59 +399,123 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Could not create video stream");
     }
 
-    /* Allocate codec context */
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        avformat_free_context(fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_write:allocCodec",
-            "Could not allocate codec context");
+    /* Encode on a hardware device if one was asked for and its encoder opens
+     * with these settings */
+    for (int attempt = 0; !codec_ctx; attempt++) {
+        enum AVHWDeviceType device_type = h265_hwaccel_device_type(hwaccel, attempt);
+        if (device_type == AV_HWDEVICE_TYPE_NONE) break;
+        codec_ctx = open_hw_encoder(device_type, fmt_ctx, width, height,
+                                    frame_rate_num, frame_rate_den,
+                                    h265_encoder_pix_fmt(is_color, bit_depth),
+                                    gop_size, crf, b_frame_count);
+    }
+    if (!codec_ctx && strcmp(hwaccel, "none") != 0 && strcmp(hwaccel, "auto") != 0) {
+        mexWarnMsgIdAndTxt("open_h265_write:hwaccelUnavailable",
+            "Could not encode on a '%s' device; encoding with libx265", hwaccel);
     }
 
-    /* Set codec parameters */
-    codec_ctx->codec_id = AV_CODEC_ID_HEVC;
-    codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
-    codec_ctx->width = width;
-    codec_ctx->height = height;
-    codec_ctx->time_base = (AVRational){frame_rate_den, frame_rate_num};
-    codec_ctx->framerate = (AVRational){frame_rate_num, frame_rate_den};
-    codec_ctx->pix_fmt = is_color ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_GRAY8;
-    codec_ctx->gop_size = gop_size;
+    /* Otherwise (the default) encode with libx265 */
+    const char *x265_params = "";
+    if (!codec_ctx) {
+        /* Find h.265 encoder */
+        codec = avcodec_find_encoder(AV_CODEC_ID_HEVC);
+        if (!codec) {
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_write:noCodec",
+                "Could not find h.265 encoder. Is libx265 installed?");
+        }
 
-    /* Set tune for fast decoding */
-    ret = av_opt_set(codec_ctx->priv_data, "tune", "fastdecode", 0);
-    if (ret < 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_free_context(fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_write:tune",
-            "Could not set tune option");
-    }
+        /* Allocate codec context */
+        codec_ctx = avcodec_alloc_context3(codec);
+        if (!codec_ctx) {
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_write:allocCodec",
+                "Could not allocate codec context");
+        }
 
-    /* Set x265 params for closed GOP, quality, and suppress info messages */
-    char *x265_params = mx_sprintf("log-level=error:no-open-gop=1:keyint=%d:crf=%d", gop_size, crf);
-    ret = av_opt_set(codec_ctx->priv_data, "x265-params", x265_params, 0);
-    if (ret < 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_free_context(fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_write:x265Params",
-            "Could not set x265 params");
-    }
+        /* Set codec parameters */
+        codec_ctx->codec_id = AV_CODEC_ID_HEVC;
+        codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+        codec_ctx->width = width;
+        codec_ctx->height = height;
+        codec_ctx->time_base = (AVRational){frame_rate_den, frame_rate_num};
+        codec_ctx->framerate = (AVRational){frame_rate_num, frame_rate_den};
+        codec_ctx->pix_fmt = h265_encoder_pix_fmt(is_color, bit_depth);
+        codec_ctx->gop_size = gop_size;
+
+        /* Set preset and tune (fast decoding unless the caller chose otherwise) */
+        if (preset) {
+            ret = av_opt_set(codec_ctx->priv_data, "preset", preset, 0);
+            if (ret < 0) {
+                avcodec_free_context(&codec_ctx);
+                avformat_free_context(fmt_ctx);
+                mxFree(filename);
+                mexErrMsgIdAndTxt("open_h265_write:preset",
+                    "Could not set preset option");
+            }
+        }
+        if (strcmp(tune, "none") != 0) {
+            ret = av_opt_set(codec_ctx->priv_data, "tune", tune, 0);
+            if (ret < 0) {
+                avcodec_free_context(&codec_ctx);
+                avformat_free_context(fmt_ctx);
+                mxFree(filename);
+                mexErrMsgIdAndTxt("open_h265_write:tune",
+                    "Could not set tune option");
+            }
+        }
 
-    /* Some formats require global headers */
-    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
-        codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    }
+        /* Set x265 params: the caller's threading and B-frame choices, then closed
+         * GOP, keyframe interval, and quality. x265 applies params in order and
+         * after the preset and tune, so nothing can override the last three. */
+        x265_params = mx_sprintf("log-level=error");
+        if (pools[0]) {
+            x265_params = mx_sprintf("%s:pools=%s", x265_params, pools);
+        }
+        if (frame_thread_count >= 0) {
+            x265_params = mx_sprintf("%s:frame-threads=%d", x265_params, frame_thread_count);
+        }
+        if (do_wpp >= 0) {
+            x265_params = mx_sprintf("%s:%s", x265_params, do_wpp ? "wpp=1" : "no-wpp=1");
+        }
+        if (lookahead_slice_count >= 0) {
+            x265_params = mx_sprintf("%s:lookahead-slices=%d", x265_params, lookahead_slice_count);
+        }
+        if (b_frame_count >= 0) {
+            x265_params = mx_sprintf("%s:bframes=%d", x265_params, b_frame_count);
+        }
+        x265_params = mx_sprintf("%s:no-open-gop=1:keyint=%d:crf=%d", x265_params, gop_size, crf);
+        ret = av_opt_set(codec_ctx->priv_data, "x265-params", x265_params, 0);
+        if (ret < 0) {
+            avcodec_free_context(&codec_ctx);
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_write:x265Params",
+                "Could not set x265 params");
+        }
 
-    /* Open codec */
-    ret = avcodec_open2(codec_ctx, codec, NULL);
-    if (ret < 0) {
-        avcodec_free_context(&codec_ctx);
-        avformat_free_context(fmt_ctx);
-        mxFree(filename);
-        mexErrMsgIdAndTxt("open_h265_write:openCodec",
-            "Could not open codec: %s", av_err2str(ret));
+        /* Some formats require global headers */
+        if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+            codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+
+        /* Open codec. A libx265 built for 8 bits only rejects 10- and 12-bit
+         * formats here. */
+        ret = avcodec_open2(codec_ctx, codec, NULL);
+        if (ret < 0) {
+            avcodec_free_context(&codec_ctx);
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            if (bit_depth > 8) {
+                mexErrMsgIdAndTxt("open_h265_write:openCodec",
+                    "Could not open codec at %d bits: %s. Does libx265 support high bit depths?",
+                    bit_depth, av_err2str(ret));
+            }
+            mexErrMsgIdAndTxt("open_h265_write:openCodec",
+                "Could not open codec: %s", av_err2str(ret));
+        }
     }
 
     /* Copy codec parameters to stream */
@@ -285,11 +581,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Could not allocate frame buffer");
     }
 
-    /* Create swscale context for RGB->YUV420P conversion (only needed for color) */
+    /* Create swscale context for planar GBRP->YUV420P conversion (only needed
+     * for color), converting slices on one thread per core */
     if (is_color) {
-        sws_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
-                                 width, height, AV_PIX_FMT_YUV420P,
-                                 SWS_BILINEAR, NULL, NULL, NULL);
+        sws_ctx = h265_alloc_rgb_sws(width, height, bit_depth, 0);
         if (!sws_ctx) {
             av_frame_free(&frame);
             avio_closep(&fmt_ctx->pb);
@@ -300,7 +595,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                 "Could not create swscale context");
         }
     }
-    /* For grayscale, sws_ctx remains NULL - we copy directly to GRAY8 frame */
+    /* For grayscale, sws_ctx remains NULL - we copy directly to the GRAY frame */
 
     /* Allocate mutable state struct */
     state = (WriterState *)mxMalloc(sizeof(WriterState));
@@ -322,12 +617,60 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     state->next_pts = 0;
     state->pts_increment = 1;  /* With our time_base setup, each frame is 1 time unit */
     state->is_color = is_color;
+    state->bit_depth = bit_depth;
+    state->pipeline = NULL;
+    state->segments = NULL;
+    state->do_collect_stats = do_collect_stats;
+    memset(&state->stats, 0, sizeof(state->stats));
+    memset(&state->mex_locks, 0, sizeof(state->mex_locks));
+
+    /* Start the pipeline threads, which own the encoder until close_h265_write */
+    if (do_pipeline) {
+        state->pipeline = h265_write_pipeline_alloc(fmt_ctx, codec_ctx, 0, width, height, is_color,
+                                                    bit_depth, queue_frame_count, conversion_thread_count);
+        if (!state->pipeline) {
+            mxFree(state);
+            sws_freeContext(sws_ctx);
+            av_frame_free(&frame);
+            avio_closep(&fmt_ctx->pb);
+            avcodec_free_context(&codec_ctx);
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_write:pipeline",
+                "Could not start the writer pipeline");
+        }
+        state->pipeline->do_collect_stats = do_collect_stats;
+        /* The pipeline threads run code from this MEX file, so it must stay
+         * loaded until close_h265_write has joined them */
+        h265_mex_lock_for(&state->mex_locks, "h265.open_h265_write");
+    }
+
+    /* Segments are encoded by copies of codec_ctx; the writer's own encoder
+     * only provides the stream header and is flushed empty on close */
+    if (segment_encoder_count > 1) {
+        state->segments = h265_segment_encoder_alloc(fmt_ctx, codec_ctx, 0, width, height, is_color,
+                                                     bit_depth, gop_size * segment_gop_count,
+                                                     segment_encoder_count);
+        if (!state->segments) {
+            mxFree(state);
+            sws_freeContext(sws_ctx);
+            av_frame_free(&frame);
+            avio_closep(&fmt_ctx->pb);
+            avcodec_free_context(&codec_ctx);
+            avformat_free_context(fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("open_h265_write:segments",
+                "Could not allocate the segment encoder");
+        }
+        state->segments->do_collect_stats = do_collect_stats;
+    }
 
     /* Create output struct */
     const char *field_names[] = {"filename", "width", "height",
                                   "fmt_ctx_ptr", "codec_ctx_ptr", "frame_ptr",
-                                  "state_ptr", "stream_idx", "sws_ctx_ptr", "is_color"};
-    plhs[0] = mxCreateStructMatrix(1, 1, 10, field_names);
+                                  "state_ptr", "stream_idx", "sws_ctx_ptr", "is_color",
+                                  "bit_depth", "x265_params", "hwaccel"};
+    plhs[0] = mxCreateStructMatrix(1, 1, 13, field_names);
 
     mxArray *mx_uint64;
 
@@ -365,5 +708,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     /* Store is_color flag */
     mxSetField(plhs[0], 0, "is_color", mxCreateDoubleScalar((double)is_color));
 
+    /* Store the sample depth */
+    mxSetField(plhs[0], 0, "bit_depth", mxCreateDoubleScalar((double)bit_depth));
+
+    /* Store the x265 params, for reference */
+    mxSetField(plhs[0], 0, "x265_params", mxCreateString(x265_params));
+
+    /* Store the encode device */
+    mxSetField(plhs[0], 0, "hwaccel", mxCreateString(h265_hwaccel_device_name(codec_ctx)));
+
     mxFree(filename);
 }
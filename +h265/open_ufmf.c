@@ -0,0 +1,71 @@
+/*
+ * open_ufmf.c
+ * MEX function to open a UFMF file for native reading and transcoding.
+ * Reads the header, the frame and mean index, and the first mean, and
+ * assigns each frame its mean (see h265_ufmf.h).
+ *
+ * Usage: ufmf = open_ufmf(filename)
+ *   filename - path to a .ufmf file (version 2 to 4, MONO8 or RGB24)
+ *
+ * Returns struct with fields:
+ *   filename    - path to the file
+ *   version     - UFMF version
+ *   width       - frame width in pixels
+ *   height      - frame height in pixels
+ *   is_color    - 1 for RGB24, 0 for MONO8
+ *   frame_count - number of frames
+ *   timestamps  - timestamp of each frame in seconds (1 x frame_count)
+ *   ufmf_ptr    - native reader (internal)
+ *
+ * Frames come from read_ufmf_frame, or go straight into a writer with
+ * write_ufmf_frames. Call close_ufmf when done.
+ *
+ * Compile with:
+ *   mex open_ufmf.c h265_ufmf.c
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include <string.h>
+#include "h265_ufmf.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    /* Check arguments */
+    if (nrhs != 1) {
+        mexErrMsgIdAndTxt("open_ufmf:nrhs", "One input required: filename");
+    }
+    if (!mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("open_ufmf:notString", "Filename must be a string");
+    }
+
+    char *filename = mxArrayToString(prhs[0]);
+    const char *error_id = NULL;
+    char error_message[512];
+    H265Ufmf *ufmf = h265_ufmf_open(filename, &error_id, error_message, sizeof(error_message));
+    if (!ufmf) {
+        mxFree(filename);
+        mexErrMsgIdAndTxt(error_id, "%s", error_message);
+    }
+
+    /* Create output struct */
+    const char *field_names[] = {"filename", "version", "width", "height", "is_color",
+                                 "frame_count", "timestamps", "ufmf_ptr"};
+    plhs[0] = mxCreateStructMatrix(1, 1, 8, field_names);
+
+    mxSetField(plhs[0], 0, "filename", mxCreateString(filename));
+    mxFree(filename);
+    mxSetField(plhs[0], 0, "version", mxCreateDoubleScalar((double)ufmf->version));
+    mxSetField(plhs[0], 0, "width", mxCreateDoubleScalar((double)ufmf->width));
+    mxSetField(plhs[0], 0, "height", mxCreateDoubleScalar((double)ufmf->height));
+    mxSetField(plhs[0], 0, "is_color", mxCreateDoubleScalar(ufmf->color_count == 3 ? 1.0 : 0.0));
+    mxSetField(plhs[0], 0, "frame_count", mxCreateDoubleScalar((double)ufmf->frame_count));
+
+    mxArray *timestamps_mx = mxCreateDoubleMatrix(1, ufmf->frame_count, mxREAL);
+    memcpy(mxGetPr(timestamps_mx), ufmf->timestamps, ufmf->frame_count * sizeof(double));
+    mxSetField(plhs[0], 0, "timestamps", timestamps_mx);
+
+    mxArray *mx_uint64 = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+    *(uint64_t *)mxGetData(mx_uint64) = (uint64_t)(uintptr_t)ufmf;
+    mxSetField(plhs[0], 0, "ufmf_ptr", mx_uint64);
+}
@@ -0,0 +1,36 @@
+function info = probe(filename)
+% PROBE Read a video's size, frame count, and frame rate without opening it for reading
+%   info = h265.probe(filename)
+%   infos = h265.probe(filenames)
+%
+%   Parses only the container header (and the .h265idx sidecar, if any), with
+%   no decoder, frame index, or cache, so it takes a few milliseconds per
+%   file where h265.Reader builds its whole index.  info has fields
+%   filename, num_frames, width, height, frame_rate_num, frame_rate_den,
+%   frame_rate (frames per second), duration (seconds), keyframe_count,
+%   bit_depth, is_grayscale, codec_name, and num_frames_source; unknown
+%   counts and formats are -1.  See probe_h265_video.c for where each comes
+%   from.
+%
+%   filenames may be a cell array or string array, giving a struct array of
+%   the same size:
+%       listing = dir(fullfile(video_dir, '*.mp4'));
+%       infos = h265.probe(fullfile({listing.folder}, {listing.name}));
+%       total_frame_count = sum([infos.num_frames]);
+
+if ischar(filename) || (isstring(filename) && isscalar(filename))
+  info = h265.probe_h265_video(char(filename));
+  return
+end
+if isstring(filename)
+  filename = cellstr(filename);
+end
+if ~iscell(filename)
+  error('h265_probe:badFilename', 'filename must be a string or a cell array of strings');
+end
+if isempty(filename)
+  info = struct([]);
+  return
+end
+info = reshape(cellfun(@(name) h265.probe_h265_video(char(name)), filename), size(filename));
+end % function
@@ -0,0 +1,240 @@
+/*
+ * probe_h265_video.c
+ * MEX function to read a video's size, frame count, and frame rate without
+ * opening a decoder, building the frame index, or allocating a cache.
+ *
+ * Usage: info = probe_h265_video(filename)
+ *
+ * Only the container header is parsed. The frame count and keyframe count
+ * come from the first of these that has them:
+ *   'index_file'   - the <filename>.h265idx sidecar, if it is current
+ *   'sample_table' - the entries of the container's sample table (MP4/MOV)
+ *   'header'       - the stream's frame count in the header (keyframe_count
+ *                    is then unknown)
+ *   'scan'         - a pass over the packets, demuxing but not decoding them
+ * Bit depth and grayscale come from the stream's pixel format, or from the
+ * HEVC decoder configuration record when the header leaves the format unset.
+ * Only streams whose header lacks the frame size or rate (e.g. raw .h265)
+ * fall back to avformat_find_stream_info, which decodes a few frames.
+ *
+ * Returns a struct with fields:
+ *   filename       - the video file path
+ *   num_frames     - total number of frames
+ *   width, height  - frame size
+ *   frame_rate_num, frame_rate_den - frame rate as a fraction (int32)
+ *   frame_rate     - frames per second
+ *   duration       - num_frames / frame_rate, in seconds
+ *   keyframe_count - number of keyframes (GOPs), -1 if unknown
+ *   bit_depth      - bits per coded sample, -1 if unknown
+ *   is_grayscale   - -1 if unknown, 0 or 1 otherwise
+ *   codec_name     - e.g. 'hevc'
+ *   num_frames_source - which of the sources above gave num_frames
+ * num_frames and keyframe_count match an h265.Reader of the file except when
+ * the Reader rebuilds its index by scanning (say, a sample table whose
+ * entries disagree with the packets).
+ *
+ * Compile with:
+ *   mex probe_h265_video.c h265_index.c -lavformat -lavcodec -lavutil
+ */
+
+#include "mex.h"
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+#include <stdint.h>
+#include "h265_index.h"
+
+/*
+ * Read bit depth and grayscale from the stream's pixel format, or from the
+ * hvcC record (chromaFormat at byte 16, bitDepthLumaMinus8 at byte 17) when
+ * the format is unset. Leaves them at -1 if neither says.
+ */
+static void get_sample_format(const AVCodecParameters *codecpar, int *bit_depth, int *is_grayscale)
+{
+    *bit_depth = -1;
+    *is_grayscale = -1;
+
+    const AVPixFmtDescriptor *pix_fmt_desc = av_pix_fmt_desc_get((enum AVPixelFormat)codecpar->format);
+    if (pix_fmt_desc) {
+        *bit_depth = pix_fmt_desc->comp[0].depth;
+        *is_grayscale = pix_fmt_desc->nb_components <= 2 && !(pix_fmt_desc->flags & AV_PIX_FMT_FLAG_RGB);
+    } else if (codecpar->codec_id == AV_CODEC_ID_HEVC && codecpar->extradata_size >= 22 &&
+               codecpar->extradata[0] == 1) {
+        *bit_depth = (codecpar->extradata[17] & 0x07) + 8;
+        *is_grayscale = (codecpar->extradata[16] & 0x03) == 0;
+    }
+}
+
+/*
+ * Count the frames and keyframes of the sample table, leaving out entries
+ * an edit list discards. Returns 0 if the stream has no sample table.
+ */
+static int count_sample_table(AVStream *video_stream, int *num_frames, int *keyframe_count)
+{
+    int entry_count = avformat_index_get_entries_count(video_stream);
+    if (entry_count <= 0) return 0;
+
+    *num_frames = 0;
+    *keyframe_count = 0;
+    for (int i = 0; i < entry_count; i++) {
+        const AVIndexEntry *entry = avformat_index_get_entry(video_stream, i);
+        if (!entry || (entry->flags & AVINDEX_DISCARD_FRAME)) continue;
+        (*num_frames)++;
+        if (entry->flags & AVINDEX_KEYFRAME) (*keyframe_count)++;
+    }
+    return *num_frames > 0;
+}
+
+/*
+ * Count the video packets and keyframe packets by demuxing the whole file.
+ * Returns 0 if a packet could not be allocated.
+ */
+static int count_packets(AVFormatContext *fmt_ctx, int video_stream_idx,
+                         int *num_frames, int *keyframe_count)
+{
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt) return 0;
+
+    *num_frames = 0;
+    *keyframe_count = 0;
+    while (av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (pkt->stream_index == video_stream_idx) {
+            (*num_frames)++;
+            if (pkt->flags & AV_PKT_FLAG_KEY) (*keyframe_count)++;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    return 1;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVStream *video_stream = NULL;
+    int video_stream_idx = -1;
+
+    /* Suppress FFmpeg info messages (only show warnings and errors) */
+    av_log_set_level(AV_LOG_WARNING);
+
+    /* Check arguments */
+    if (nrhs != 1) {
+        mexErrMsgIdAndTxt("probe_h265_video:nrhs", "One input required: filename");
+    }
+    if (nlhs > 1) {
+        mexErrMsgIdAndTxt("probe_h265_video:nlhs", "One output allowed");
+    }
+    if (!mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("probe_h265_video:notString", "Filename must be a string");
+    }
+
+    char *filename = mxArrayToString(prhs[0]);
+
+    /* Open input file and read its header */
+    if (avformat_open_input(&fmt_ctx, filename, NULL, NULL) < 0) {
+        mxFree(filename);
+        mexErrMsgIdAndTxt("probe_h265_video:openFailed", "Could not open input file");
+    }
+
+    /* Find video stream */
+    for (int i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_stream_idx = i;
+            video_stream = fmt_ctx->streams[i];
+            break;
+        }
+    }
+    if (video_stream_idx == -1) {
+        avformat_close_input(&fmt_ctx);
+        mxFree(filename);
+        mexErrMsgIdAndTxt("probe_h265_video:noVideo", "No video stream found");
+    }
+
+    /* Headers without the frame size or rate need the streams probed */
+    AVRational frame_rate = av_guess_frame_rate(fmt_ctx, video_stream, NULL);
+    if (video_stream->codecpar->width <= 0 || video_stream->codecpar->height <= 0 ||
+        frame_rate.num <= 0 || frame_rate.den <= 0) {
+        if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+            avformat_close_input(&fmt_ctx);
+            mxFree(filename);
+            mexErrMsgIdAndTxt("probe_h265_video:streamInfo", "Could not find stream info");
+        }
+        frame_rate = av_guess_frame_rate(fmt_ctx, video_stream, NULL);
+    }
+    if (frame_rate.num <= 0 || frame_rate.den <= 0) {
+        avformat_close_input(&fmt_ctx);
+        mxFree(filename);
+        mexErrMsgIdAndTxt("probe_h265_video:noFrameRate", "Could not determine frame rate");
+    }
+
+    /* Frame and keyframe counts from the sidecar index, the sample table,
+     * the header, or a packet scan (see above) */
+    int num_frames = 0;
+    int keyframe_count = -1;
+    const char *num_frames_source = NULL;
+
+    AVRational time_base = video_stream->time_base;
+    int64_t numerator = (int64_t)time_base.den * frame_rate.den;
+    int64_t denominator = (int64_t)time_base.num * frame_rate.num;
+    H265Index index;
+    h265_index_init(&index);
+    if (denominator > 0 && numerator % denominator == 0 &&
+        h265_index_read(filename, numerator / denominator, &index)) {
+        num_frames = index.num_frames;
+        keyframe_count = index.keyframe_count;
+        num_frames_source = "index_file";
+        h265_index_free(&index);
+    } else if (count_sample_table(video_stream, &num_frames, &keyframe_count)) {
+        num_frames_source = "sample_table";
+    } else if (video_stream->nb_frames > 0 && video_stream->nb_frames <= INT32_MAX) {
+        num_frames = (int)video_stream->nb_frames;
+        keyframe_count = -1;
+        num_frames_source = "header";
+    } else if (count_packets(fmt_ctx, video_stream_idx, &num_frames, &keyframe_count)) {
+        num_frames_source = "scan";
+    } else {
+        avformat_close_input(&fmt_ctx);
+        mxFree(filename);
+        mexErrMsgIdAndTxt("probe_h265_video:alloc", "Could not allocate packet");
+    }
+
+    int bit_depth, is_grayscale;
+    get_sample_format(video_stream->codecpar, &bit_depth, &is_grayscale);
+    const AVCodecDescriptor *codec_desc = avcodec_descriptor_get(video_stream->codecpar->codec_id);
+
+    /* Create output struct */
+    const char *field_names[] = {"filename", "num_frames", "width", "height",
+                                  "frame_rate_num", "frame_rate_den", "frame_rate", "duration",
+                                  "keyframe_count", "bit_depth", "is_grayscale", "codec_name",
+                                  "num_frames_source"};
+    plhs[0] = mxCreateStructMatrix(1, 1, 13, field_names);
+    mxArray *mx_int32;
+
+    mxSetField(plhs[0], 0, "filename", mxCreateString(filename));
+    mxSetField(plhs[0], 0, "num_frames", mxCreateDoubleScalar((double)num_frames));
+    mxSetField(plhs[0], 0, "width", mxCreateDoubleScalar((double)video_stream->codecpar->width));
+    mxSetField(plhs[0], 0, "height", mxCreateDoubleScalar((double)video_stream->codecpar->height));
+
+    /* Set frame_rate (int32, and frames per second as a double) */
+    mx_int32 = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    *(int32_t *)mxGetData(mx_int32) = frame_rate.num;
+    mxSetField(plhs[0], 0, "frame_rate_num", mx_int32);
+
+    mx_int32 = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    *(int32_t *)mxGetData(mx_int32) = frame_rate.den;
+    mxSetField(plhs[0], 0, "frame_rate_den", mx_int32);
+
+    double frames_per_second = av_q2d(frame_rate);
+    mxSetField(plhs[0], 0, "frame_rate", mxCreateDoubleScalar(frames_per_second));
+    mxSetField(plhs[0], 0, "duration", mxCreateDoubleScalar((double)num_frames / frames_per_second));
+
+    mxSetField(plhs[0], 0, "keyframe_count", mxCreateDoubleScalar((double)keyframe_count));
+    mxSetField(plhs[0], 0, "bit_depth", mxCreateDoubleScalar((double)bit_depth));
+    mxSetField(plhs[0], 0, "is_grayscale", mxCreateDoubleScalar((double)is_grayscale));
+    mxSetField(plhs[0], 0, "codec_name", mxCreateString(codec_desc ? codec_desc->name : ""));
+    mxSetField(plhs[0], 0, "num_frames_source", mxCreateString(num_frames_source));
+
+    avformat_close_input(&fmt_ctx);
+    mxFree(filename);
+}
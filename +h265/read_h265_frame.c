@@ -4,19 +4,43 @@
  * Uses the persistent decoder context from open_h265_video for fast access.
  *
  * Optimization: Uses GOP frame cache stored in video_info. Subsequent requests
- * for frames in the same GOP are served from cache without re-decoding.
+ * for frames in any recently decoded GOP are served from cache without
+ * re-decoding; the cache keeps as many GOPs as fit in its byte budget.
  *
- * The cache stores frames in a MATLAB array (column-major). When decoding a GOP,
- * frames are decoded into a row-major buffer, then permuted all at once using
- * MATLAB's optimized permute function.
+ * If video_info.do_prefetch is true, the GOP after the one just read is
+ * decoded on a background thread so sequential reads do not stall at GOP
+ * boundaries (see h265_prefetch.h). The first such read locks this MEX file
+ * in memory, since the worker thread runs code from it, until
+ * close_h265_video frees the prefetcher (see h265_mex_lock.h).
+ * video_info.prefetch_direction picks that GOP: 'forward' the next one,
+ * 'backward' the previous one, for reverse playback, and 'auto' (the default)
+ * the next or previous one, whichever way the last read that moved went.
+ *
+ * A GOP that is decoded starting at most video_info's forward_frame_limit
+ * frames after the frame the reader's decoder outputs next, as when playing
+ * through GOP after GOP, is decoded on from there without a seek or a decoder
+ * flush (see H265DecodePosition in h265_decode_common.h).
+ *
+ * The cache stores frames in a MATLAB array (column-major). GOP boundaries come
+ * from video_info.keyframes, so the array is created at its final size and
+ * each frame is transposed straight into it as it is decoded.
  *
  * Usage: frame = read_h265_frame(video_info, frame_index)
+ *        [gop_frames, gop_start_index] = read_h265_frame(video_info, frame_index, true)
  *   video_info  - struct returned by open_h265_video
  *   frame_index - 1-based frame index
- *   frame       - grayscale (height x width) or RGB (height x width x 3) uint8
+ *   frame       - grayscale (height x width) or RGB (height x width x 3),
+ *                 uint8 for 8-bit video and uint16 for 10- and 12-bit video
+ *
+ * With a third argument of true, the whole GOP containing frame_index is
+ * returned instead (height x width x n or height x width x 3 x n), along with
+ * the 1-based index of its first frame. That costs one allocation per GOP
+ * rather than per frame: a GOP that is cached or prefetched is copied out in
+ * one block, and any other GOP is decoded straight into the returned array
+ * without passing through the cache.
  *
  * Compile with:
- *   mex read_h265_frame.c h265_decode_common.c -lavformat -lavcodec -lavutil -lswscale
+ *   mex read_h265_frame.c h265_frame_cache.c h265_decode_common.c h265_transpose.c h265_hwaccel.c h265_prefetch.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
@@ -26,226 +50,130 @@
 #include <string.h>
 #include "h265_frame_cache.h"
 #include "h265_decode_common.h"
-
-/* ============================================================================
- * Cache Helper Functions
- * ============================================================================ */
-
-/* O(1) cache lookup: frames in cache are consecutive starting at start_frame */
-static int find_in_cache(H265FrameCache *cache, int frame_index)
-{
-    if (!cache || cache->num_frames == 0 || !cache->frames) return -1;
-    if (frame_index >= cache->start_frame &&
-        frame_index < cache->start_frame + cache->num_frames) {
-        return frame_index - cache->start_frame;
-    }
-    return -1;
-}
-
-static void clear_cache(H265FrameCache *cache)
-{
-    if (!cache) return;
-    if (cache->frames) {
-        mxDestroyArray(cache->frames);
-        cache->frames = NULL;
-    }
-    cache->num_frames = 0;
-    cache->start_frame = -1;
-}
+#include "h265_index.h"
+#include "h265_prefetch.h"
 
 /* ============================================================================
  * GOP Decoding - decodes entire GOP and stores as transposed mxArray
  * ============================================================================ */
 
 /*
- * Decode GOP into cache. Frames are decoded in row-major order into a temporary
- * buffer, then permuted all at once and stored in the cache as column-major.
+ * Decode frames [gop_start, gop_end) into a new cache entry.
+ * Returns 0 on success, -1 on error.
  */
 static int decode_gop_to_cache(
     AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
-    int64_t *dts_array, int64_t pts_increment, int target_frame,
-    H265DecodeState *state, H265FrameCache *cache)
+    int64_t *dts_array, int64_t pts_increment, int gop_start, int gop_end,
+    H265DecodeState *state, H265FrameCache *cache, H265CachedGop **gop_out)
 {
-    int ret;
-    int found_target = 0;
-    int first_keyframe_seen = 0;
-
-    /* Track GOP boundaries */
-    int temp_capacity = 64;
-    int temp_count = 0;
-    int gop_start_frame = -1;
-
-    /* Temporary row-major buffer - will grow as needed */
-    size_t buffer_capacity = temp_capacity * cache->frame_size;
-    uint8_t *temp_buffer = (uint8_t *)mxMalloc(buffer_capacity);
-    if (!temp_buffer) {
-        return -1;
-    }
+    int frame_count = gop_end - gop_start;
 
-    /* Seek to target position */
-    ret = av_seek_frame(fmt_ctx, video_stream_idx, dts_array[target_frame], AVSEEK_FLAG_BACKWARD);
-    if (ret < 0) {
-        avformat_seek_file(fmt_ctx, video_stream_idx, INT64_MIN, 0, 0, 0);
-    }
-    avcodec_flush_buffers(codec_ctx);
-
-    /* Decode until we find target and hit next GOP boundary */
-    while (av_read_frame(fmt_ctx, state->pkt) >= 0) {
-        if (state->pkt->stream_index == video_stream_idx) {
-            int is_keyframe = (state->pkt->flags & AV_PKT_FLAG_KEY) != 0;
-
-            if (is_keyframe) {
-                if (first_keyframe_seen) {
-                    if (found_target) {
-                        /* Found target and hit next GOP - done */
-                        av_packet_unref(state->pkt);
-                        break;
-                    }
-                    /* Haven't found target - reset for new GOP */
-                    temp_count = 0;
-                    gop_start_frame = -1;
-                }
-                first_keyframe_seen = 1;
-            }
+    /* Uninitialized: every frame of the GOP is overwritten below */
+    mxArray *frames = create_frame_array(&state->geometry, state->is_grayscale, frame_count);
 
-            ret = avcodec_send_packet(codec_ctx, state->pkt);
-            if (ret < 0) {
-                av_packet_unref(state->pkt);
-                continue;
-            }
-
-            while (1) {
-                ret = avcodec_receive_frame(codec_ctx, state->frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
-                if (ret < 0) {
-                    mxFree(temp_buffer);
-                    return -1;
-                }
-
-                int frame_idx = (int)(state->frame->pts / pts_increment);
-
-                /* Track start of GOP */
-                if (gop_start_frame < 0) {
-                    gop_start_frame = frame_idx;
-                }
-
-                /* Grow buffer if needed */
-                if (temp_count >= temp_capacity) {
-                    temp_capacity *= 2;
-                    uint8_t *new_buffer = (uint8_t *)mxRealloc(temp_buffer, temp_capacity * cache->frame_size);
-                    if (!new_buffer) {
-                        mxFree(temp_buffer);
-                        return -1;
-                    }
-                    temp_buffer = new_buffer;
-                }
-
-                /* Color convert */
-                sws_scale(state->sws_ctx,
-                          (const uint8_t * const*)state->frame->data,
-                          state->frame->linesize, 0, state->height,
-                          state->out_frame->data, state->out_frame->linesize);
-
-                /* Copy frame in row-major order */
-                copy_frame_rowmajor(state->out_frame, state->width,
-                                    state->height, state->is_grayscale,
-                                    temp_buffer + temp_count * cache->frame_size);
-
-                temp_count++;
-
-                if (frame_idx == target_frame) {
-                    found_target = 1;
-                }
-
-                av_frame_unref(state->frame);
-            }
-        }
-        av_packet_unref(state->pkt);
+    int frames_captured = decode_frame_range_colmajor(
+        fmt_ctx, codec_ctx, video_stream_idx,
+        dts_array, pts_increment, gop_start, gop_end - 1,
+        state, &cache->position, (uint8_t *)mxGetData(frames), cache->frame_size);
+    if (frames_captured != frame_count) {
+        mxDestroyArray(frames);
+        return -1;
     }
 
-    /* Flush decoder */
-    if (!found_target) {
-        avcodec_send_packet(codec_ctx, NULL);
-        while (1) {
-            ret = avcodec_receive_frame(codec_ctx, state->frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
-            if (ret < 0) break;
-
-            int frame_idx = (int)(state->frame->pts / pts_increment);
-
-            if (gop_start_frame < 0) {
-                gop_start_frame = frame_idx;
-            }
-
-            if (temp_count >= temp_capacity) {
-                temp_capacity *= 2;
-                temp_buffer = (uint8_t *)mxRealloc(temp_buffer, temp_capacity * cache->frame_size);
-            }
-
-            sws_scale(state->sws_ctx,
-                      (const uint8_t * const*)state->frame->data,
-                      state->frame->linesize, 0, state->height,
-                      state->out_frame->data, state->out_frame->linesize);
-
-            copy_frame_rowmajor(state->out_frame, state->width,
-                                state->height, state->is_grayscale,
-                                temp_buffer + temp_count * cache->frame_size);
-
-            temp_count++;
-
-            if (frame_idx == target_frame) {
-                found_target = 1;
-            }
+    /* Store in cache, evicting older GOPs as needed */
+    mexMakeArrayPersistent(frames);
+    *gop_out = h265_cache_insert(cache, frames, gop_start, frame_count);
 
-            av_frame_unref(state->frame);
-        }
-    }
+    return *gop_out ? 0 : -1;
+}
 
-    avcodec_flush_buffers(codec_ctx);
+/* ============================================================================
+ * Read-ahead
+ * ============================================================================ */
 
-    if (!found_target || temp_count == 0) {
-        mxFree(temp_buffer);
-        return -1;
+/*
+ * Return the reader's prefetcher, creating it on first use, or NULL if it
+ * cannot be created (reads then proceed without read-ahead).
+ */
+static H265Prefetch *get_prefetch(const mxArray *video_info, H265FrameCache *cache,
+                                  AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx,
+                                  int video_stream_idx, int64_t *dts_array, int num_frames,
+                                  int64_t pts_increment, const H265OutputGeometry *geometry)
+{
+    /* A job decoded for another output format is useless */
+    if (cache->prefetch &&
+        (cache->prefetch->is_grayscale != cache->is_grayscale ||
+         memcmp(&cache->prefetch->geometry, geometry, sizeof(H265OutputGeometry)) != 0)) {
+        h265_prefetch_free(cache->prefetch);
+        cache->prefetch = NULL;
     }
+    if (cache->prefetch) return cache->prefetch;
 
-    /* Create row-major mxArray from temp buffer */
-    mxArray *rowmajor;
-    if (cache->is_grayscale) {
-        mwSize dims[3] = {cache->width, cache->height, temp_count};
-        rowmajor = mxCreateNumericArray(3, dims, mxUINT8_CLASS, mxREAL);
-    } else {
-        mwSize dims[4] = {3, cache->width, cache->height, temp_count};
-        rowmajor = mxCreateNumericArray(4, dims, mxUINT8_CLASS, mxREAL);
+    mxArray *filename_field = mxGetField(video_info, 0, "filename");
+    if (!filename_field || !mxIsChar(filename_field)) {
+        mexErrMsgIdAndTxt("read_h265_frame:badStruct",
+            "video_info must have a filename field when do_prefetch is set");
     }
-    memcpy(mxGetData(rowmajor), temp_buffer, temp_count * cache->frame_size);
-    mxFree(temp_buffer);
+    char *filename = mxArrayToString(filename_field);
+    cache->prefetch = h265_prefetch_alloc(filename, fmt_ctx, codec_ctx, video_stream_idx,
+                                          dts_array, num_frames, pts_increment,
+                                          geometry, cache->is_grayscale, cache->do_collect_stats);
+    mxFree(filename);
+
+    /* The worker thread runs code from this MEX file, so it must stay loaded
+     * until close_h265_video has freed the prefetcher */
+    if (cache->prefetch) h265_mex_lock_for(&cache->mex_locks, "h265.read_h265_frame");
+    return cache->prefetch;
+}
 
-    /* Permute to column-major */
-    mxArray *perm_args[2];
-    perm_args[0] = rowmajor;
+/*
+ * Parse video_info.prefetch_direction: 1 for 'forward', -1 for 'backward', and
+ * 0 for 'auto' or no such field.
+ */
+static int get_prefetch_direction(const mxArray *video_info)
+{
+    mxArray *direction_field = mxGetField(video_info, 0, "prefetch_direction");
+    if (!direction_field) return 0;
 
-    if (cache->is_grayscale) {
-        perm_args[1] = mxCreateDoubleMatrix(1, 3, mxREAL);
-        double *perm = mxGetPr(perm_args[1]);
-        perm[0] = 2; perm[1] = 1; perm[2] = 3;
-    } else {
-        perm_args[1] = mxCreateDoubleMatrix(1, 4, mxREAL);
-        double *perm = mxGetPr(perm_args[1]);
-        perm[0] = 3; perm[1] = 2; perm[2] = 1; perm[3] = 4;
+    char direction[16];
+    if (!mxIsChar(direction_field) || mxGetString(direction_field, direction, sizeof(direction)) != 0) {
+        direction[0] = '\0';
     }
+    if (strcmp(direction, "auto") == 0) return 0;
+    if (strcmp(direction, "forward") == 0) return 1;
+    if (strcmp(direction, "backward") == 0) return -1;
+    mexErrMsgIdAndTxt("read_h265_frame:badStruct",
+        "video_info.prefetch_direction must be 'auto', 'forward', or 'backward'");
+    return 0;
+}
 
-    mxArray *permuted;
-    mexCallMATLAB(1, &permuted, 2, perm_args, "permute");
-    mxDestroyArray(rowmajor);
-    mxDestroyArray(perm_args[1]);
+/*
+ * Start decoding the GOP after the one starting at gop_start_frame, or the one
+ * before it when reading backward, unless there is none or it is already
+ * cached. target_frame is the frame just read; with direction 0 (auto) the
+ * way from the previous read to it decides, and a read of the same frame
+ * keeps the last direction.
+ */
+static void prefetch_adjacent_gop(H265Prefetch *prefetch, H265FrameCache *cache,
+                                  const int32_t *keyframes, int keyframe_count,
+                                  int num_frames, int gop_start_frame, int target_frame,
+                                  int direction)
+{
+    if (direction != 0) {
+        prefetch->step = direction;
+    } else if (prefetch->last_frame >= 0 && target_frame != prefetch->last_frame) {
+        prefetch->step = target_frame < prefetch->last_frame ? -1 : 1;
+    }
+    prefetch->last_frame = target_frame;
 
-    /* Store in cache */
-    mexMakeArrayPersistent(permuted);
-    cache->frames = permuted;
-    cache->num_frames = temp_count;
-    cache->start_frame = gop_start_frame;
+    int adjacent_gop_index = h265_gop_for_frame(keyframes, keyframe_count, gop_start_frame) +
+                             prefetch->step;
+    if (adjacent_gop_index < 0 || adjacent_gop_index >= keyframe_count) return;
 
-    return 0;
+    int adjacent_start = h265_gop_start(keyframes, adjacent_gop_index);
+    if (h265_cache_has_frame(cache, adjacent_start)) return;
+    h265_prefetch_start(prefetch, adjacent_start,
+                        h265_gop_end(keyframes, keyframe_count, num_frames, adjacent_gop_index));
 }
 
 /* ============================================================================
@@ -262,12 +190,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     int is_grayscale;
     int video_stream_idx = -1;
 
+    /* close_h265_video dropping the lock taken for a prefetcher */
+    if (h265_mex_handle_unlock(nrhs, prhs)) return;
+
     /* Check arguments */
-    if (nrhs != 2) {
-        mexErrMsgIdAndTxt("read_h265_frame:nrhs", "Two inputs required: video_info and frame_index");
+    if (nrhs != 2 && nrhs != 3) {
+        mexErrMsgIdAndTxt("read_h265_frame:nrhs",
+            "Inputs must be video_info, frame_index, and optional do_return_gop");
     }
-    if (nlhs > 1) {
-        mexErrMsgIdAndTxt("read_h265_frame:nlhs", "One output allowed");
+    int do_return_gop = nrhs == 3 && mxGetNumberOfElements(prhs[2]) == 1 && mxGetScalar(prhs[2]) != 0;
+    if (nlhs > (do_return_gop ? 2 : 1)) {
+        mexErrMsgIdAndTxt("read_h265_frame:nlhs", "Too many outputs");
     }
     if (!mxIsStruct(prhs[0])) {
         mexErrMsgIdAndTxt("read_h265_frame:notStruct", "First argument must be video_info struct");
@@ -284,11 +217,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     mxArray *stream_idx_field = mxGetField(prhs[0], 0, "video_stream_idx");
     mxArray *pts_inc_field = mxGetField(prhs[0], 0, "pts_increment");
     mxArray *cache_ptr_field = mxGetField(prhs[0], 0, "cache_ptr");
+    mxArray *keyframes_field = mxGetField(prhs[0], 0, "keyframes");
 
     if (!dts_field || !num_frames_field || !fmt_ctx_field || !codec_ctx_field ||
-        !stream_idx_field || !pts_inc_field || !cache_ptr_field) {
+        !stream_idx_field || !pts_inc_field || !cache_ptr_field || !keyframes_field) {
         mexErrMsgIdAndTxt("read_h265_frame:badStruct", "video_info missing required fields");
     }
+    if (!mxIsInt32(keyframes_field) || mxGetNumberOfElements(keyframes_field) == 0) {
+        mexErrMsgIdAndTxt("read_h265_frame:badStruct", "video_info.keyframes must be a nonempty int32 array");
+    }
+    const int32_t *keyframes = (const int32_t *)mxGetData(keyframes_field);
+    int keyframe_count = (int)mxGetNumberOfElements(keyframes_field);
 
     int64_t *dts_array = (int64_t *)mxGetData(dts_field);
     int num_frames = (int)mxGetScalar(num_frames_field);
@@ -316,71 +255,108 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     } else if (is_gray_field && mxIsDouble(is_gray_field)) {
         is_grayscale = (int)mxGetScalar(is_gray_field) != 0;
     } else {
-        is_grayscale = (codec_ctx->pix_fmt == AV_PIX_FMT_GRAY8 ||
-                        codec_ctx->pix_fmt == AV_PIX_FMT_GRAY16BE ||
-                        codec_ctx->pix_fmt == AV_PIX_FMT_GRAY16LE);
+        enum AVPixelFormat pix_fmt = decoder_pix_fmt(codec_ctx);
+        is_grayscale = (pix_fmt == AV_PIX_FMT_GRAY8 ||
+                        pix_fmt == AV_PIX_FMT_GRAY16BE ||
+                        pix_fmt == AV_PIX_FMT_GRAY16LE);
     }
 
-    int width = codec_ctx->width;
-    int height = codec_ctx->height;
-
-    /* Check cache for frame */
-    int cache_idx = find_in_cache(cache, target_frame);
-    if (cache_idx >= 0 && cache->frames) {
-        /* Cache hit - extract frame from cached mxArray */
-        size_t frame_size = cache->frame_size;
-        uint8_t *cache_data = (uint8_t *)mxGetData(cache->frames);
-
-        if (is_grayscale) {
-            plhs[0] = mxCreateNumericMatrix(height, width, mxUINT8_CLASS, mxREAL);
+    H265OutputGeometry geometry;
+    if (!get_output_geometry(prhs[0], codec_ctx, &geometry)) {
+        mexErrMsgIdAndTxt("read_h265_frame:badGeometry",
+            "video_info.crop_rect or video_info.output_size is invalid");
+    }
+    int width = geometry.width;
+    int height = geometry.height;
+
+    /* Frames cached for another output format cannot be reused */
+    h265_cache_set_format(cache, width, height, is_grayscale, output_bytes_per_sample(&geometry));
+
+    /* Set up read-ahead if requested */
+    H265Prefetch *prefetch = NULL;
+    mxArray *do_prefetch_field = mxGetField(prhs[0], 0, "do_prefetch");
+    if (do_prefetch_field && mxGetNumberOfElements(do_prefetch_field) == 1 &&
+        mxGetScalar(do_prefetch_field) != 0) {
+        prefetch = get_prefetch(prhs[0], cache, fmt_ctx, codec_ctx, video_stream_idx,
+                                dts_array, num_frames, pts_increment, &geometry);
+    }
+    int prefetch_direction = prefetch ? get_prefetch_direction(prhs[0]) : 0;
+
+    /* Check cache for frame, then the read-ahead job; otherwise decode its GOP */
+    H265ReadStats *stats = h265_cache_stats(cache);
+    H265CachedGop *gop = h265_cache_find(cache, target_frame);
+    if (gop) {
+        if (stats) stats->cache_hit_count++;
+    } else if (prefetch) {
+        gop = h265_prefetch_take(prefetch, cache, target_frame);
+        if (gop && stats) stats->prefetch_hit_count++;
+    }
+    if (!gop && stats) stats->cache_miss_count++;
+
+    /* Whole-GOP read: copy a cached GOP out in one block, or decode the GOP
+     * straight into the output. (Cached arrays are persistent, so they cannot
+     * be handed to MATLAB themselves.) */
+    if (do_return_gop) {
+        int gop_index = h265_gop_for_frame(keyframes, keyframe_count, target_frame);
+        int gop_start = h265_gop_start(keyframes, gop_index);
+        int gop_end = h265_gop_end(keyframes, keyframe_count, num_frames, gop_index);
+        if (gop) {
+            plhs[0] = mxDuplicateArray(gop->frames);
         } else {
-            mwSize dims[3] = {height, width, 3};
-            plhs[0] = mxCreateNumericArray(3, dims, mxUINT8_CLASS, mxREAL);
+            if (!prepare_decode_state(&cache->decode_state, codec_ctx, &geometry, is_grayscale)) {
+                mexErrMsgIdAndTxt("read_h265_frame:allocDecode", "Could not initialize decoder");
+            }
+            cache->decode_state.stats = stats;
+            plhs[0] = create_frame_array(&geometry, is_grayscale, gop_end - gop_start);
+            int frames_captured = decode_frame_range_colmajor(
+                fmt_ctx, codec_ctx, video_stream_idx, dts_array, pts_increment,
+                gop_start, gop_end - 1, &cache->decode_state, &cache->position,
+                (uint8_t *)mxGetData(plhs[0]), cache->frame_size);
+            if (frames_captured != gop_end - gop_start) {
+                mexErrMsgIdAndTxt("read_h265_frame:decode", "Error decoding GOP");
+            }
+        }
+        if (prefetch) {
+            prefetch_adjacent_gop(prefetch, cache, keyframes, keyframe_count, num_frames, gop_start,
+                                  target_frame, prefetch_direction);
         }
-        memcpy(mxGetData(plhs[0]), cache_data + cache_idx * frame_size, frame_size);
+        if (nlhs > 1) {
+            plhs[1] = mxCreateDoubleScalar((double)gop_start + 1);
+        }
+        if (stats) stats->returned_frame_count += gop_end - gop_start;
         return;
     }
 
-    /* Cache miss - decode GOP */
-    clear_cache(cache);
+    if (!gop) {
+        /* The decode state is kept with the cache, so only the first read, or
+         * one for another output format, sets it up */
+        if (!prepare_decode_state(&cache->decode_state, codec_ctx, &geometry, is_grayscale)) {
+            mexErrMsgIdAndTxt("read_h265_frame:allocDecode", "Could not initialize decoder");
+        }
+        cache->decode_state.stats = stats;
 
-    /* Initialize cache format if needed */
-    cache->width = width;
-    cache->height = height;
-    cache->is_grayscale = is_grayscale;
-    cache->frame_size = is_grayscale ? (size_t)width * height : (size_t)width * height * 3;
+        int gop_index = h265_gop_for_frame(keyframes, keyframe_count, target_frame);
+        int result = decode_gop_to_cache(fmt_ctx, codec_ctx, video_stream_idx,
+                                         dts_array, pts_increment,
+                                         h265_gop_start(keyframes, gop_index),
+                                         h265_gop_end(keyframes, keyframe_count, num_frames, gop_index),
+                                         &cache->decode_state, cache, &gop);
 
-    /* Initialize decode state */
-    H265DecodeState state;
-    if (!init_decode_state(&state, codec_ctx, width, height, is_grayscale)) {
-        mexErrMsgIdAndTxt("read_h265_frame:allocDecode", "Could not initialize decoder");
+        if (result < 0) {
+            mexErrMsgIdAndTxt("read_h265_frame:decode", "Error decoding GOP");
+        }
     }
 
-    /* Decode GOP into cache */
-    int result = decode_gop_to_cache(fmt_ctx, codec_ctx, video_stream_idx,
-                                     dts_array, pts_increment, target_frame,
-                                     &state, cache);
-    free_decode_state(&state);
-
-    if (result < 0) {
-        mexErrMsgIdAndTxt("read_h265_frame:decode", "Error decoding GOP");
+    if (prefetch) {
+        prefetch_adjacent_gop(prefetch, cache, keyframes, keyframe_count, num_frames, gop->start_frame,
+                              target_frame, prefetch_direction);
     }
 
-    /* Return frame from cache */
-    cache_idx = find_in_cache(cache, target_frame);
-    if (cache_idx >= 0 && cache->frames) {
-        size_t frame_size = cache->frame_size;
-        uint8_t *cache_data = (uint8_t *)mxGetData(cache->frames);
-
-        if (is_grayscale) {
-            plhs[0] = mxCreateNumericMatrix(height, width, mxUINT8_CLASS, mxREAL);
-        } else {
-            mwSize dims[3] = {height, width, 3};
-            plhs[0] = mxCreateNumericArray(3, dims, mxUINT8_CLASS, mxREAL);
-        }
-        memcpy(mxGetData(plhs[0]), cache_data + cache_idx * frame_size, frame_size);
-        return;
-    }
+    /* Extract frame from cached mxArray */
+    size_t frame_size = cache->frame_size;
+    uint8_t *cache_data = (uint8_t *)mxGetData(gop->frames);
 
-    mexErrMsgIdAndTxt("read_h265_frame:notFound", "Frame %d not found", target_frame + 1);
+    plhs[0] = create_frame_array(&geometry, is_grayscale, 1);
+    memcpy(mxGetData(plhs[0]), cache_data + (size_t)(target_frame - gop->start_frame) * frame_size, frame_size);
+    if (stats) stats->returned_frame_count++;
 }
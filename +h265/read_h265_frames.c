@@ -1,27 +1,172 @@
 /*
  * read_h265_frames.c
  * MEX function to read a contiguous range of frames efficiently.
- * Seeks once to the start, then decodes sequentially through the range.
+ * Seeks once to the start, then decodes sequentially through the range. A
+ * range that starts at most video_info's forward_frame_limit frames after
+ * where the reader's decoder stopped, such as the next chunk of a sequential
+ * pass, is decoded on from there without seeking (see H265DecodePosition in
+ * h265_decode_common.h).
  *
- * Uses row-major decoding internally for cache efficiency, then calls
- * MATLAB's permute() to return properly oriented column-major data.
+ * Each frame is color converted to planar output and transposed straight into
+ * the column-major output array, with no intermediate buffer or permute().
+ *
+ * If video_info has a worker_count field greater than 1, large ranges are
+ * split at keyframes and the GOP-aligned segments are decoded in parallel,
+ * each on its own demuxer and decoder (see h265_parallel_decode.h). Those
+ * leave the reader's decoder where it was, so a sequential pass
+ * (h265.FrameIterator) sets worker_count to 1 to read each chunk on it.
  *
  * Usage: frames = read_h265_frames(video_info, start_frame, end_frame)
+ *        frames = read_h265_frames(video_info, frame_indices)
+ *        read_h265_frames(video_info, start_frame, end_frame, buffer)
  *   video_info  - struct returned by open_h265_video
  *   start_frame - 1-based starting frame index
  *   end_frame   - 1-based ending frame index (inclusive)
- *   frames      - grayscale: uint8 3D array (height x width x num_frames)
- *                 RGB: uint8 4D array (height x width x 3 x num_frames)
+ *   frame_indices - vector of 1-based frame indices, in any order, possibly
+ *                 with repeats
+ *   frames      - grayscale: 3D array (height x width x num_frames)
+ *                 RGB: 4D array (height x width x 3 x num_frames)
+ *                 uint8 for 8-bit video, uint16 for 10- and 12-bit video
+ *   buffer      - existing array of the class and frame size frames would
+ *                 have, holding at least end_frame - start_frame + 1 frames
+ *
+ * With buffer, the frames are decoded into its leading frames in place and
+ * nothing is returned, so a loop that reuses one buffer allocates no frame
+ * memory per read. This writes past MATLAB's copy-on-write: every variable
+ * sharing buffer's data sees the frames, so the buffer must not be a copy
+ * of an array in use elsewhere. If decoding fails, the buffer may hold part
+ * of the range.
+ *
+ * A frame list is sorted and split into runs of requested frames whose GOPs
+ * are adjacent. Each run is decoded in one pass from the keyframe of its
+ * first GOP to its last requested frame, and only requested frames are
+ * converted, each straight into its position in the output; repeats are then
+ * copied. A strided or sparse list therefore decodes each needed GOP once,
+ * whatever order the caller gave.
  *
  * Compile with:
- *   mex read_h265_frames.c -lavformat -lavcodec -lavutil -lswscale
+ *   mex read_h265_frames.c h265_decode_common.c h265_transpose.c h265_hwaccel.c h265_parallel_decode.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "h265_decode_common.h"
+#include "h265_frame_cache.h"
+#include "h265_index.h"
+#include "h265_parallel_decode.h"
+
+/* A requested frame and where it goes in the output */
+typedef struct {
+    int frame;      /* 0-based frame index */
+    int position;   /* 0-based position in the caller's list */
+} FrameRequest;
+
+static int compare_frame_requests(const void *a, const void *b)
+{
+    const FrameRequest *ra = (const FrameRequest *)a;
+    const FrameRequest *rb = (const FrameRequest *)b;
+    if (ra->frame != rb->frame) return ra->frame < rb->frame ? -1 : 1;
+    return (ra->position > rb->position) - (ra->position < rb->position);
+}
+
+/*
+ * Check that buffer can take frame_count frames of geometry in the layout
+ * read_h265_frames returns: same class, height x width (x 3), and at least
+ * frame_count frames. Raises an error otherwise.
+ */
+static void check_output_buffer(const mxArray *buffer, const H265OutputGeometry *geometry,
+                                int is_grayscale, int frame_count)
+{
+    int is_uint16 = output_bytes_per_sample(geometry) == 2;
+    if (mxGetClassID(buffer) != (is_uint16 ? mxUINT16_CLASS : mxUINT8_CLASS) || mxIsComplex(buffer)) {
+        mexErrMsgIdAndTxt("read_h265_frames:badBuffer", "buffer must be a real %s array",
+                          is_uint16 ? "uint16" : "uint8");
+    }
+
+    const mwSize *dims = mxGetDimensions(buffer);
+    mwSize dim_count = mxGetNumberOfDimensions(buffer);
+    mwSize frame_dim = is_grayscale ? 2 : 3;
+    if ((int)dims[0] != geometry->height || (int)dims[1] != geometry->width ||
+        (!is_grayscale && (dim_count < 3 || dims[2] != 3))) {
+        mexErrMsgIdAndTxt("read_h265_frames:badBuffer", "buffer frames must be %d x %d%s",
+                          geometry->height, geometry->width, is_grayscale ? "" : " x 3");
+    }
+    size_t frame_capacity = 1;
+    for (mwSize d = frame_dim; d < dim_count; d++) {
+        frame_capacity *= dims[d];
+    }
+    if (frame_capacity < (size_t)frame_count) {
+        mexErrMsgIdAndTxt("read_h265_frames:badBuffer", "buffer holds %d frames, %d needed",
+                          (int)frame_capacity, frame_count);
+    }
+}
+
+/*
+ * Decode requests[0..request_count), sorted by frame, into out_data in caller
+ * order. Returns 0 on success, -1 on a decode error, or the number of
+ * requested frames that were not found.
+ */
+static int decode_frame_requests(
+    AVFormatContext *fmt_ctx, AVCodecContext *codec_ctx, int video_stream_idx,
+    int64_t *dts_array, int64_t pts_increment,
+    const int32_t *keyframes, int keyframe_count,
+    const FrameRequest *requests, int request_count,
+    H265DecodeState *state, H265DecodePosition *position, uint8_t *out_data, size_t frame_size)
+{
+    int missing_count = 0;
+    int run_start = 0;
+    while (run_start < request_count) {
+        /* Extend the run while the next request is in the same or the next GOP */
+        int run_gop = h265_gop_for_frame(keyframes, keyframe_count, requests[run_start].frame);
+        int run_end = run_start + 1;
+        while (run_end < request_count) {
+            int gop = h265_gop_for_frame(keyframes, keyframe_count, requests[run_end].frame);
+            if (gop > run_gop + 1) break;
+            run_gop = gop;
+            run_end++;
+        }
+
+        /* The first request for each frame gets decoded into; repeats follow it */
+        int target_start = requests[run_start].frame;
+        int target_end = requests[run_end - 1].frame;
+        int *slot_for_frame = (int *)mxMalloc((size_t)(target_end - target_start + 1) * sizeof(int));
+        for (int i = 0; i <= target_end - target_start; i++) {
+            slot_for_frame[i] = -1;
+        }
+        int unique_count = 0;
+        for (int r = run_start; r < run_end; r++) {
+            int *slot = &slot_for_frame[requests[r].frame - target_start];
+            if (*slot < 0) {
+                *slot = requests[r].position;
+                unique_count++;
+            }
+        }
+
+        int frames_captured = decode_frame_list_colmajor(
+            fmt_ctx, codec_ctx, video_stream_idx, dts_array, pts_increment,
+            target_start, target_end, slot_for_frame, state, position, out_data, frame_size);
+        if (frames_captured < 0) {
+            mxFree(slot_for_frame);
+            return -1;
+        }
+        missing_count += unique_count - frames_captured;
+
+        for (int r = run_start; r < run_end; r++) {
+            int slot = slot_for_frame[requests[r].frame - target_start];
+            if (slot != requests[r].position) {
+                memcpy(out_data + (size_t)requests[r].position * frame_size,
+                       out_data + (size_t)slot * frame_size, frame_size);
+            }
+        }
+        mxFree(slot_for_frame);
+        run_start = run_end;
+    }
+    return missing_count;
+}
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
@@ -32,25 +177,30 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     AVCodecContext *codec_ctx = NULL;
 
     int video_stream_idx = -1;
-    int width, height;
     int is_grayscale;
 
     /* Check arguments */
-    if (nrhs != 3) {
+    if (nrhs < 2 || nrhs > 4) {
         mexErrMsgIdAndTxt("read_h265_frames:nrhs",
-            "Three inputs required: video_info, start_frame, end_frame");
+            "Inputs must be video_info, start_frame, end_frame (, buffer) or video_info, frame_indices");
     }
-    if (nlhs > 1) {
-        mexErrMsgIdAndTxt("read_h265_frames:nlhs", "One output allowed");
+    int is_frame_list = (nrhs == 2);
+    int is_into_buffer = (nrhs == 4);
+    if (nlhs > (is_into_buffer ? 0 : 1)) {
+        mexErrMsgIdAndTxt("read_h265_frames:nlhs",
+            is_into_buffer ? "No output allowed when reading into a buffer" : "One output allowed");
     }
     if (!mxIsStruct(prhs[0])) {
         mexErrMsgIdAndTxt("read_h265_frames:notStruct",
             "First argument must be video_info struct");
     }
-    if (!mxIsDouble(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+    if (is_frame_list && (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]))) {
+        mexErrMsgIdAndTxt("read_h265_frames:notVector", "frame_indices must be a real double array");
+    }
+    if (!is_frame_list && (!mxIsDouble(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1)) {
         mexErrMsgIdAndTxt("read_h265_frames:notScalar", "start_frame must be a scalar");
     }
-    if (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1) {
+    if (!is_frame_list && (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1)) {
         mexErrMsgIdAndTxt("read_h265_frames:notScalar", "end_frame must be a scalar");
     }
 
@@ -72,8 +222,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
     int64_t *dts_array = (int64_t *)mxGetData(dts_field);
     int total_frames = (int)mxGetScalar(num_frames_field);
-    width = (int)mxGetScalar(width_field);
-    height = (int)mxGetScalar(height_field);
     pts_increment = *(int64_t *)mxGetData(pts_inc_field);
 
     fmt_ctx = (AVFormatContext *)(uintptr_t)(*(uint64_t *)mxGetData(fmt_ctx_field));
@@ -85,6 +233,93 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Invalid video_info: null pointers");
     }
 
+    /* Check for is_gray field */
+    mxArray *is_gray_field = mxGetField(prhs[0], 0, "is_gray");
+    if (is_gray_field && mxIsLogical(is_gray_field)) {
+        is_grayscale = mxIsLogicalScalarTrue(is_gray_field);
+    } else if (is_gray_field && mxIsDouble(is_gray_field)) {
+        is_grayscale = (int)mxGetScalar(is_gray_field) != 0;
+    } else {
+        enum AVPixelFormat pix_fmt = decoder_pix_fmt(codec_ctx);
+        is_grayscale = (pix_fmt == AV_PIX_FMT_GRAY8 ||
+                        pix_fmt == AV_PIX_FMT_GRAY16BE ||
+                        pix_fmt == AV_PIX_FMT_GRAY16LE);
+    }
+
+    /* With the reader's cache, reads continue forward from where its decoder
+     * stopped when they can; without it, they always seek */
+    mxArray *cache_ptr_field = mxGetField(prhs[0], 0, "cache_ptr");
+    H265FrameCache *cache = cache_ptr_field
+        ? (H265FrameCache *)(uintptr_t)(*(uint64_t *)mxGetData(cache_ptr_field))
+        : NULL;
+    H265DecodePosition *position = cache ? &cache->position : NULL;
+
+    /* Decode on the decode state kept with the cache, set up by the first
+     * read; without the cache, on one for this call only */
+    H265DecodeState call_state;
+    memset(&call_state, 0, sizeof(call_state));
+    H265DecodeState *state = cache ? &cache->decode_state : &call_state;
+    H265ReadStats *stats = h265_cache_stats(cache);
+
+    /* Crop, output size, and sample depth */
+    H265OutputGeometry geometry;
+    if (!get_output_geometry(prhs[0], codec_ctx, &geometry)) {
+        mexErrMsgIdAndTxt("read_h265_frames:badGeometry",
+            "video_info.crop_rect or video_info.output_size is invalid");
+    }
+
+    if (is_frame_list) {
+        /* Frame list: validate, sort by frame, and decode GOP runs */
+        mxArray *keyframes_field = mxGetField(prhs[0], 0, "keyframes");
+        if (!keyframes_field || !mxIsInt32(keyframes_field) || mxIsEmpty(keyframes_field)) {
+            mexErrMsgIdAndTxt("read_h265_frames:badStruct",
+                "video_info must have a keyframes field to read a frame list");
+        }
+        const double *frame_indices = mxGetPr(prhs[1]);
+        int request_count = (int)mxGetNumberOfElements(prhs[1]);
+        FrameRequest *requests = (FrameRequest *)mxMalloc((size_t)(request_count > 0 ? request_count : 1) *
+                                                          sizeof(FrameRequest));
+        for (int r = 0; r < request_count; r++) {
+            double frame_index = frame_indices[r];
+            if (!(frame_index >= 1 && frame_index <= total_frames) || frame_index != (int)frame_index) {
+                mxFree(requests);
+                mexErrMsgIdAndTxt("read_h265_frames:invalidIndex",
+                    "frame_indices must be integers between 1 and %d", total_frames);
+            }
+            requests[r].frame = (int)frame_index - 1;
+            requests[r].position = r;
+        }
+        qsort(requests, request_count, sizeof(FrameRequest), compare_frame_requests);
+
+        mxArray *frames = create_frame_array(&geometry, is_grayscale, request_count);
+        size_t frame_size = output_frame_size(&geometry, is_grayscale);
+
+        if (!prepare_decode_state(state, codec_ctx, &geometry, is_grayscale)) {
+            mxFree(requests);
+            mxDestroyArray(frames);
+            mexErrMsgIdAndTxt("read_h265_frames:allocDecode", "Could not initialize decoder");
+        }
+        state->stats = stats;
+        int result = decode_frame_requests(
+            fmt_ctx, codec_ctx, video_stream_idx, dts_array, pts_increment,
+            (const int32_t *)mxGetData(keyframes_field), (int)mxGetNumberOfElements(keyframes_field),
+            requests, request_count, state, position, (uint8_t *)mxGetData(frames), frame_size);
+        if (!cache) free_decode_state(state);
+        mxFree(requests);
+
+        if (result < 0) {
+            mxDestroyArray(frames);
+            mexErrMsgIdAndTxt("read_h265_frames:decode", "Error during decoding");
+        }
+        if (result > 0) {
+            mxDestroyArray(frames);
+            mexErrMsgIdAndTxt("read_h265_frames:notFound", "%d requested frames were not found", result);
+        }
+        if (stats) stats->returned_frame_count += request_count;
+        plhs[0] = frames;
+        return;
+    }
+
     /* Get frame range (convert to 0-based) */
     start_frame = (int)mxGetScalar(prhs[1]) - 1;
     end_frame = (int)mxGetScalar(prhs[2]) - 1;
@@ -104,83 +339,74 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
     num_frames_to_read = end_frame - start_frame + 1;
 
-    /* Check for is_gray field */
-    mxArray *is_gray_field = mxGetField(prhs[0], 0, "is_gray");
-    if (is_gray_field && mxIsLogical(is_gray_field)) {
-        is_grayscale = mxIsLogicalScalarTrue(is_gray_field);
-    } else if (is_gray_field && mxIsDouble(is_gray_field)) {
-        is_grayscale = (int)mxGetScalar(is_gray_field) != 0;
+    /* Create output array, uninitialized since every frame is overwritten,
+     * or decode into the caller's buffer */
+    mxArray *frames = NULL;
+    uint8_t *out_data;
+    if (is_into_buffer) {
+        check_output_buffer(prhs[3], &geometry, is_grayscale, num_frames_to_read);
+        out_data = (uint8_t *)mxGetData(prhs[3]);
     } else {
-        is_grayscale = (codec_ctx->pix_fmt == AV_PIX_FMT_GRAY8 ||
-                        codec_ctx->pix_fmt == AV_PIX_FMT_GRAY16BE ||
-                        codec_ctx->pix_fmt == AV_PIX_FMT_GRAY16LE);
+        frames = create_frame_array(&geometry, is_grayscale, num_frames_to_read);
+        out_data = (uint8_t *)mxGetData(frames);
     }
+    size_t frame_size = output_frame_size(&geometry, is_grayscale);
 
-    /* Create temporary row-major array */
-    mxArray *rowmajor;
-    uint8_t *out_data;
-    size_t frame_size;
-    int perm_ndims;
-
-    if (is_grayscale) {
-        /* width x height x frames -> permute to height x width x frames */
-        mwSize dims[3] = {width, height, num_frames_to_read};
-        rowmajor = mxCreateNumericArray(3, dims, mxUINT8_CLASS, mxREAL);
-        frame_size = (size_t)height * width;
-        perm_ndims = 3;
-    } else {
-        /* 3 x width x height x frames -> permute to height x width x 3 x frames */
-        mwSize dims[4] = {3, width, height, num_frames_to_read};
-        rowmajor = mxCreateNumericArray(4, dims, mxUINT8_CLASS, mxREAL);
-        frame_size = (size_t)height * width * 3;
-        perm_ndims = 4;
-    }
-    out_data = (uint8_t *)mxGetData(rowmajor);
-
-    /* Initialize decode state */
-    H265DecodeState state;
-    if (!init_decode_state(&state, codec_ctx, width, height, is_grayscale)) {
-        mxDestroyArray(rowmajor);
-        mexErrMsgIdAndTxt("read_h265_frames:allocDecode", "Could not initialize decoder");
+    /* Check for optional worker_count field (parallel GOP decoding) */
+    int worker_count = 1;
+    mxArray *worker_count_field = mxGetField(prhs[0], 0, "worker_count");
+    if (worker_count_field && !mxIsEmpty(worker_count_field)) {
+        worker_count = (int)mxGetScalar(worker_count_field);
     }
 
-    /* Decode frames in row-major order (fast memcpy) */
-    int frames_captured = decode_frame_range_rowmajor(
-        fmt_ctx, codec_ctx, video_stream_idx,
-        dts_array, pts_increment,
-        start_frame, end_frame,
-        &state, out_data, frame_size);
+    if (!prepare_decode_state(state, codec_ctx, &geometry, is_grayscale)) {
+        if (frames) mxDestroyArray(frames);
+        mexErrMsgIdAndTxt("read_h265_frames:allocDecode", "Could not initialize decoder");
+    }
+    state->stats = stats;
 
-    free_decode_state(&state);
+    int frames_captured;
+    if (worker_count > 1) {
+        /* Decode GOP-aligned segments on parallel decoder contexts */
+        mxArray *filename_field = mxGetField(prhs[0], 0, "filename");
+        mxArray *keyframes_field = mxGetField(prhs[0], 0, "keyframes");
+        if (!filename_field || !keyframes_field || !mxIsInt32(keyframes_field)) {
+            if (!cache) free_decode_state(state);
+            if (frames) mxDestroyArray(frames);
+            mexErrMsgIdAndTxt("read_h265_frames:badStruct",
+                "video_info must have filename and keyframes fields for parallel decoding");
+        }
+        char *filename = mxArrayToString(filename_field);
+        frames_captured = decode_frame_range_parallel(
+            filename, fmt_ctx, codec_ctx, video_stream_idx,
+            dts_array, pts_increment,
+            (const int32_t *)mxGetData(keyframes_field),
+            (int)mxGetNumberOfElements(keyframes_field),
+            start_frame, end_frame,
+            worker_count, state, position, out_data, frame_size);
+        mxFree(filename);
+    } else {
+        /* Decode frames straight into the output array */
+        frames_captured = decode_frame_range_colmajor(
+            fmt_ctx, codec_ctx, video_stream_idx,
+            dts_array, pts_increment,
+            start_frame, end_frame,
+            state, position, out_data, frame_size);
+    }
+    if (!cache) free_decode_state(state);
 
     if (frames_captured < 0) {
-        mxDestroyArray(rowmajor);
+        if (frames) mxDestroyArray(frames);
         mexErrMsgIdAndTxt("read_h265_frames:decode", "Error during decoding");
     }
 
     if (frames_captured < num_frames_to_read) {
-        mxDestroyArray(rowmajor);
+        if (frames) mxDestroyArray(frames);
         mexErrMsgIdAndTxt("read_h265_frames:notFound",
             "Only captured %d of %d frames (%d missing)",
             frames_captured, num_frames_to_read, num_frames_to_read - frames_captured);
     }
 
-    /* Call MATLAB's permute to convert to column-major */
-    mxArray *perm_args[2];
-    perm_args[0] = rowmajor;
-    perm_args[1] = mxCreateDoubleMatrix(1, perm_ndims, mxREAL);
-    double *perm = mxGetPr(perm_args[1]);
-
-    if (is_grayscale) {
-        /* [2 1 3]: width x height x frames -> height x width x frames */
-        perm[0] = 2; perm[1] = 1; perm[2] = 3;
-    } else {
-        /* [3 2 1 4]: 3 x width x height x frames -> height x width x 3 x frames */
-        perm[0] = 3; perm[1] = 2; perm[2] = 1; perm[3] = 4;
-    }
-
-    mexCallMATLAB(1, &plhs[0], 2, perm_args, "permute");
-
-    mxDestroyArray(rowmajor);
-    mxDestroyArray(perm_args[1]);
+    if (stats) stats->returned_frame_count += num_frames_to_read;
+    if (frames) plhs[0] = frames;
 }
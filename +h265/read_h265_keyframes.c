@@ -0,0 +1,151 @@
+/*
+ * read_h265_keyframes.c
+ * MEX function to read keyframes only, for thumbnails and overviews.
+ *
+ * Each keyframe is reached with a seek and decoded from its own packet, with
+ * the decoder's skip_frame set to AVDISCARD_NONKEY, so a thumbnail costs one
+ * seek and one intra-frame decode however long the GOPs are, and the frames
+ * between keyframes are neither decoded nor demuxed. Set video_info's
+ * output_size to get the thumbnails scaled down in the color conversion.
+ * Keyframes bypass the frame cache, and the reader's decoder seeks again on
+ * its next read.
+ *
+ * Usage: frames = read_h265_keyframes(video_info, frame_indices)
+ *   video_info    - struct returned by open_h265_video
+ *   frame_indices - vector of 1-based frame indices, each one of
+ *                   video_info.keyframes
+ *   frames        - grayscale: 3D array (height x width x numel(frame_indices))
+ *                   RGB: 4D array (height x width x 3 x numel(frame_indices))
+ *                   uint8 for 8-bit video, uint16 for 10- and 12-bit video
+ *
+ * Compile with:
+ *   mex read_h265_keyframes.c h265_decode_common.c h265_transpose.c h265_hwaccel.c -lavformat -lavcodec -lavutil -lswscale
+ */
+
+#include "mex.h"
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <stdint.h>
+#include "h265_decode_common.h"
+#include "h265_frame_cache.h"
+#include "h265_index.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    int is_grayscale;
+
+    /* Check arguments */
+    if (nrhs != 2) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:nrhs",
+            "Two inputs required: video_info and frame_indices");
+    }
+    if (nlhs > 1) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:nlhs", "One output allowed");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:notStruct", "First argument must be video_info struct");
+    }
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1])) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:badIndex", "frame_indices must be a real double vector");
+    }
+
+    /* Extract fields from video_info struct */
+    mxArray *dts_field = mxGetField(prhs[0], 0, "dts");
+    mxArray *num_frames_field = mxGetField(prhs[0], 0, "num_frames");
+    mxArray *fmt_ctx_field = mxGetField(prhs[0], 0, "fmt_ctx_ptr");
+    mxArray *codec_ctx_field = mxGetField(prhs[0], 0, "codec_ctx_ptr");
+    mxArray *stream_idx_field = mxGetField(prhs[0], 0, "video_stream_idx");
+    mxArray *pts_inc_field = mxGetField(prhs[0], 0, "pts_increment");
+    mxArray *cache_ptr_field = mxGetField(prhs[0], 0, "cache_ptr");
+    mxArray *keyframes_field = mxGetField(prhs[0], 0, "keyframes");
+
+    if (!dts_field || !num_frames_field || !fmt_ctx_field || !codec_ctx_field ||
+        !stream_idx_field || !pts_inc_field || !cache_ptr_field || !keyframes_field) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:badStruct", "video_info missing required fields");
+    }
+    if (!mxIsInt32(keyframes_field) || mxGetNumberOfElements(keyframes_field) == 0) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:badStruct", "video_info.keyframes must be a nonempty int32 array");
+    }
+
+    int64_t *dts_array = (int64_t *)mxGetData(dts_field);
+    int num_frames = (int)mxGetScalar(num_frames_field);
+    int64_t pts_increment = *(int64_t *)mxGetData(pts_inc_field);
+    int video_stream_idx = (int)mxGetScalar(stream_idx_field);
+    const int32_t *keyframes = (const int32_t *)mxGetData(keyframes_field);
+    int keyframe_count = (int)mxGetNumberOfElements(keyframes_field);
+    fmt_ctx = (AVFormatContext *)(uintptr_t)(*(uint64_t *)mxGetData(fmt_ctx_field));
+    codec_ctx = (AVCodecContext *)(uintptr_t)(*(uint64_t *)mxGetData(codec_ctx_field));
+    H265FrameCache *cache = (H265FrameCache *)(uintptr_t)(*(uint64_t *)mxGetData(cache_ptr_field));
+
+    if (!fmt_ctx || !codec_ctx || !cache) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:nullPtr", "Invalid video_info: null pointers");
+    }
+
+    /* Requested keyframes, converted to 0-based */
+    int frame_count = (int)mxGetNumberOfElements(prhs[1]);
+    const double *index_data = mxGetPr(prhs[1]);
+    int *frame_indices = (int *)mxMalloc((size_t)(frame_count > 0 ? frame_count : 1) * sizeof(int));
+    for (int i = 0; i < frame_count; i++) {
+        double index = index_data[i];
+        if (!(index >= 1 && index <= num_frames) || index != (int)index) {
+            mexErrMsgIdAndTxt("read_h265_keyframes:invalidIndex",
+                "frame_indices must be integers between 1 and %d", num_frames);
+        }
+        int frame = (int)index - 1;
+        if (h265_gop_start(keyframes, h265_gop_for_frame(keyframes, keyframe_count, frame)) != frame) {
+            mexErrMsgIdAndTxt("read_h265_keyframes:notKeyframe",
+                "Frame %d is not a keyframe", frame + 1);
+        }
+        frame_indices[i] = frame;
+    }
+
+    /* Check for is_gray field */
+    mxArray *is_gray_field = mxGetField(prhs[0], 0, "is_gray");
+    if (is_gray_field && mxIsLogical(is_gray_field)) {
+        is_grayscale = mxIsLogicalScalarTrue(is_gray_field);
+    } else if (is_gray_field && mxIsDouble(is_gray_field)) {
+        is_grayscale = (int)mxGetScalar(is_gray_field) != 0;
+    } else {
+        enum AVPixelFormat pix_fmt = decoder_pix_fmt(codec_ctx);
+        is_grayscale = (pix_fmt == AV_PIX_FMT_GRAY8 ||
+                        pix_fmt == AV_PIX_FMT_GRAY16BE ||
+                        pix_fmt == AV_PIX_FMT_GRAY16LE);
+    }
+
+    /* Crop, output size, and sample depth */
+    H265OutputGeometry geometry;
+    if (!get_output_geometry(prhs[0], codec_ctx, &geometry)) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:badGeometry",
+            "video_info.crop_rect or video_info.output_size is invalid");
+    }
+
+    if (!prepare_decode_state(&cache->decode_state, codec_ctx, &geometry, is_grayscale)) {
+        mexErrMsgIdAndTxt("read_h265_keyframes:allocDecode", "Could not initialize decoder");
+    }
+    cache->decode_state.stats = h265_cache_stats(cache);
+    mxArray *frames = create_frame_array(&geometry, is_grayscale, frame_count);
+    size_t frame_size = output_frame_size(&geometry, is_grayscale);
+
+    /* The decoder stops drained, wherever the last keyframe was */
+    int frames_captured = decode_keyframes_colmajor(
+        fmt_ctx, codec_ctx, video_stream_idx, dts_array, pts_increment,
+        frame_indices, frame_count, &cache->decode_state,
+        (uint8_t *)mxGetData(frames), frame_size);
+    cache->position.next_frame = -1;
+
+    if (frames_captured < 0) {
+        mxDestroyArray(frames);
+        mexErrMsgIdAndTxt("read_h265_keyframes:decode", "Error during decoding");
+    }
+    if (frames_captured < frame_count) {
+        mxDestroyArray(frames);
+        mexErrMsgIdAndTxt("read_h265_keyframes:notFound",
+            "Could not decode keyframe %d", frame_indices[frames_captured] + 1);
+    }
+
+    mxFree(frame_indices);
+    if (cache->decode_state.stats) cache->decode_state.stats->returned_frame_count += frame_count;
+    plhs[0] = frames;
+}
@@ -0,0 +1,62 @@
+/*
+ * read_ufmf_frame.c
+ * MEX function to read one frame of a UFMF file opened with open_ufmf.
+ * The frame is the mean assigned to it with its foreground boxes pasted on,
+ * decoded natively (see h265_ufmf.h).
+ *
+ * Usage: [frame, timestamp] = read_ufmf_frame(ufmf, frame_index)
+ *   ufmf        - struct returned by open_ufmf
+ *   frame_index - 1-based frame index
+ *   frame       - uint8, grayscale (height x width) or RGB (height x width x 3)
+ *   timestamp   - timestamp of the frame in seconds
+ *
+ * Compile with:
+ *   mex read_ufmf_frame.c h265_ufmf.c
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include "h265_ufmf.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    /* Check arguments */
+    if (nrhs != 2) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:nrhs", "Two inputs required: ufmf and frame_index");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:notStruct", "First argument must be ufmf struct from open_ufmf");
+    }
+    if (!mxIsNumeric(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:badIndex", "frame_index must be a numeric scalar");
+    }
+
+    mxArray *ufmf_field = mxGetField(prhs[0], 0, "ufmf_ptr");
+    if (!ufmf_field) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:badStruct", "ufmf struct must have a ufmf_ptr field");
+    }
+    H265Ufmf *ufmf = (H265Ufmf *)(uintptr_t)(*(uint64_t *)mxGetData(ufmf_field));
+    if (!ufmf) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:nullPtr", "Invalid ufmf: null pointer");
+    }
+
+    int frame_index = (int)mxGetScalar(prhs[1]) - 1;
+    if (frame_index < 0 || frame_index >= ufmf->frame_count) {
+        mexErrMsgIdAndTxt("read_ufmf_frame:outOfRange",
+            "Frame index %d out of range [1, %d]", frame_index + 1, ufmf->frame_count);
+    }
+
+    mwSize dims[3] = {(mwSize)ufmf->height, (mwSize)ufmf->width, 3};
+    plhs[0] = mxCreateNumericArray(ufmf->color_count == 3 ? 3 : 2, dims, mxUINT8_CLASS, mxREAL);
+
+    const char *error_id = NULL;
+    char error_message[256];
+    if (!h265_ufmf_read_frame(ufmf, frame_index, (uint8_t *)mxGetData(plhs[0]),
+                              &error_id, error_message, sizeof(error_message))) {
+        mexErrMsgIdAndTxt(error_id, "%s", error_message);
+    }
+
+    if (nlhs > 1) {
+        plhs[1] = mxCreateDoubleScalar(ufmf->timestamps[frame_index]);
+    }
+}
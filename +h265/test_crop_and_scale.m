@@ -0,0 +1,130 @@
+function test_crop_and_scale()
+% TEST_CROP_AND_SCALE Test decode-time cropping and scaling
+%   Reads a cropped and a scaled view through every read path and checks
+%   them against cropping and resizing full frames in MATLAB: an unscaled
+%   grayscale crop must match exactly, and scaled or RGB views must be
+%   close.  Also checks that bad geometry is rejected.  Throws error on
+%   failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 128;
+height = 96;
+frame_count = 60;
+frame_rate = 30;  % Hz
+gop_size = 20;
+crop_rect = [33, 17, 64, 48];  % [x y width height]
+output_size = [24, 40];  % [height width]
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 4));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 4));
+    end
+  end
+  video_file_name = fullfile(temp_dir, sprintf('test_crop_and_scale_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  full_frames = reader.read(1, frame_count);
+  delete(reader);
+  rows = crop_rect(2):(crop_rect(2) + crop_rect(4) - 1);
+  columns = crop_rect(1):(crop_rect(1) + crop_rect(3) - 1);
+  if is_gray
+    cropped_frames = full_frames(rows, columns, :);
+  else
+    cropped_frames = full_frames(rows, columns, :, :);
+  end
+
+  view_options = {{'crop_rect', crop_rect}, ...
+                  {'crop_rect', crop_rect, 'output_size', output_size}, ...
+                  {'scale', 0.5}};
+  for view_index = 1:numel(view_options)
+    options = view_options{view_index};
+    reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_prefetch', true, ...
+                         'worker_count', 2, options{:});
+    switch view_index
+      case 1
+        expected_frames = cropped_frames;
+      case 2
+        expected_frames = imresize(cropped_frames, output_size);
+      case 3
+        expected_frames = imresize(full_frames, 0.5);
+    end
+    expected_size = size(expected_frames);
+    if is_gray
+      % Scaled views go through swscale, unscaled ones come straight from the
+      % Y plane; both must have the same levels
+      full_level = mean(double(full_frames(:)));
+      view_level = mean(double(reader.read(1, frame_count)), 'all');
+      assert(abs(view_level - full_level) < 1, 'Mean level of view %d differs from full frames: %.2f vs %.2f', ...
+        view_index, view_level, full_level);
+    end
+    assert(isequal(reader.output_size, expected_size(1:2)), 'output_size property mismatch');
+
+    batch_frames = reader.read(1, frame_count);
+    assert(isequal(size(batch_frames), size(expected_frames)), 'Wrong size for view %d', view_index);
+    gop_frames = reader.read_gop(2);
+    list_frames = reader.read_frames([gop_size + 1, 5]);
+    for frame_index = [1, 5, gop_size, gop_size + 1, frame_count]
+      if is_gray
+        batch_frame = batch_frames(:,:,frame_index);
+        expected_frame = expected_frames(:,:,frame_index);
+      else
+        batch_frame = batch_frames(:,:,:,frame_index);
+        expected_frame = expected_frames(:,:,:,frame_index);
+      end
+      assert(isequal(reader.read(frame_index), batch_frame), ...
+        'Single read of frame %d differs from batch read (view %d)', frame_index, view_index);
+      if is_gray && view_index == 1
+        assert(isequal(batch_frame, expected_frame), 'Grayscale crop of frame %d is not exact', frame_index);
+      else
+        frame_ssim = ssim(batch_frame, expected_frame);
+        assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low for view %d: %.4f (is_gray = %d)', ...
+          frame_index, view_index, frame_ssim, is_gray);
+      end
+    end
+    if is_gray
+      assert(isequal(gop_frames, batch_frames(:,:,gop_size + (1:gop_size))), 'GOP read mismatch');
+      assert(isequal(list_frames, batch_frames(:,:,[gop_size + 1, 5])), 'Frame list mismatch');
+    else
+      assert(isequal(gop_frames, batch_frames(:,:,:,gop_size + (1:gop_size))), 'GOP read mismatch');
+      assert(isequal(list_frames, batch_frames(:,:,:,[gop_size + 1, 5])), 'Frame list mismatch');
+    end
+    delete(reader);
+  end
+end
+
+% Bad geometry is rejected
+bad_option_sets = { ...
+  {'crop_rect', [0, 1, 10, 10]}, 'Reader:badCropRect'; ...
+  {'crop_rect', [width - 9, 1, 11, 10]}, 'Reader:badCropRect'; ...
+  {'crop_rect', [1, 1, 10]}, 'Reader:badCropRect'; ...
+  {'output_size', [16, 0]}, 'Reader:badOutputSize'; ...
+  {'scale', -1}, 'Reader:badOutputSize'; ...
+  {'output_size', [16, 16], 'scale', 0.5}, 'Reader:badOutputSize'};
+for option_set_index = 1:size(bad_option_sets, 1)
+  options = bad_option_sets{option_set_index, 1};
+  try
+    h265.Reader(video_file_name, options{:});
+    error('test_crop_and_scale:noError', 'Option set %d should be rejected', option_set_index);
+  catch err
+    assert(strcmp(err.identifier, bad_option_sets{option_set_index, 2}), 'Unexpected error: %s', err.message);
+  end
+end
+
+end
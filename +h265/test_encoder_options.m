@@ -0,0 +1,71 @@
+function test_encoder_options()
+% TEST_ENCODER_OPTIONS Test the x265 preset, tune, and threading options
+%   Writes with a live-capture setup and an archival setup, checks that the
+%   closed-GOP settings survive in both, and that bad values (including an
+%   attempt to sneak in x265 params) are rejected.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 60;
+frame_rate = 30;  % Hz
+gop_size = 15;
+crf = 20;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+
+frames = zeros(height, width, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+end
+
+option_sets = { ...
+  {'preset', 'ultrafast', 'tune', 'zerolatency', 'frame_thread_count', 1, 'do_wpp', false, 'b_frame_count', 0}, ...
+  {'preset', 'slow', 'tune', 'none', 'pools', '2', 'lookahead_slice_count', 0, 'b_frame_count', 4, 'do_wpp', true}};
+for option_set_index = 1:numel(option_sets)
+  options = option_sets{option_set_index};
+  video_file_name = fullfile(temp_dir, sprintf('test_encoder_options_%d.mp4', option_set_index));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', true, 'gop_size', gop_size, 'crf', crf, options{:});
+  assert(strcmp(writer.preset, options{2}), 'preset property mismatch');
+  expected_suffix = sprintf(':no-open-gop=1:keyint=%d:crf=%d', gop_size, crf);
+  assert(endsWith(writer.x265_params, expected_suffix), ...
+    'Closed-GOP settings must come last in x265_params: %s', writer.x265_params);
+  writer.write(frames);
+  delete(writer);
+
+  reader = h265.Reader(video_file_name);
+  assert(reader.num_frames == frame_count, 'Frame count mismatch with option set %d', option_set_index);
+  assert(all(diff([reader.keyframes(:); frame_count + 1]) <= gop_size), ...
+    'Keyframes should be at most gop_size frames apart with option set %d', option_set_index);
+  readback_frames = reader.read(1, frame_count);
+  delete(reader);
+  for frame_index = 1:frame_count
+    frame_ssim = ssim(readback_frames(:,:,frame_index), frames(:,:,frame_index));
+    assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low with option set %d: %.4f', ...
+      frame_index, option_set_index, frame_ssim);
+  end
+end
+
+% Bad values are rejected before anything is written
+bad_option_sets = { ...
+  {'preset', 'warpspeed'}, ...
+  {'tune', 'fastdecode:keyint=1000'}, ...
+  {'pools', '4:no-open-gop=0'}, ...
+  {'frame_thread_count', 17}, ...
+  {'b_frame_count', 1.5}};
+for option_set_index = 1:numel(bad_option_sets)
+  options = bad_option_sets{option_set_index};
+  try
+    h265.Writer(fullfile(temp_dir, 'bad.mp4'), width, height, frame_rate, 'is_gray', true, options{:});
+    error('test_encoder_options:noError', 'Option %s should be rejected', options{1});
+  catch err
+    assert(strcmp(err.identifier, 'open_h265_write:badOption'), 'Unexpected error: %s', err.message);
+  end
+end
+
+end
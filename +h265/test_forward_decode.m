@@ -0,0 +1,111 @@
+function test_forward_decode()
+% TEST_FORWARD_DECODE Test reads that continue decoding forward instead of seeking
+%   Writes a video, then checks that every forward_frame_limit setting returns
+%   the same frames as a batch read from a Reader that always seeks: for
+%   single-frame playback with no GOP cache, for chunked range reads, for
+%   reads that skip ahead within and beyond the limit, for frame lists, for
+%   whole-GOP reads, and for reads that go back.  Also checks that a bad
+%   forward_frame_limit is rejected.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 120;
+frame_rate = 30;  % Hz
+gop_size = 20;
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+
+  video_file_name = fullfile(temp_dir, sprintf('test_forward_decode_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reference_reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'forward_frame_limit', -1);
+  expected_frames = reference_reader.read(1, frame_count);
+  delete(reference_reader);
+
+  for forward_frame_limit = [-1, 0, 16, frame_count]
+    for thread_count = [1, 0]
+      reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'thread_count', thread_count, ...
+                           'forward_frame_limit', forward_frame_limit, 'cache_mb', 0);
+      assert(reader.forward_frame_limit == forward_frame_limit, 'forward_frame_limit property mismatch');
+      description = sprintf('is_gray = %d, forward_frame_limit = %d, thread_count = %d', ...
+                            is_gray, forward_frame_limit, thread_count);
+
+      % Single-frame playback: every GOP miss follows the previous GOP
+      for frame_index = 1:frame_count
+        check_frames(reader.read(frame_index), frame_index, expected_frames, is_gray, description);
+      end
+
+      % Chunked range reads that do not line up with the GOPs
+      chunk_frame_count = 13;
+      for first_frame_index = 1:chunk_frame_count:frame_count
+        last_frame_index = min(first_frame_index + chunk_frame_count - 1, frame_count);
+        check_frames(reader.read(first_frame_index, last_frame_index), first_frame_index:last_frame_index, ...
+                     expected_frames, is_gray, description);
+      end
+
+      % Skips ahead within a GOP, across a GOP boundary, past the limit, and back
+      ranges = [3 7; 12 15; 18 25; 30 31; 70 75; 76 76; 40 44; 1 2];
+      for range_index = 1:size(ranges, 1)
+        frame_indices = ranges(range_index, 1):ranges(range_index, 2);
+        check_frames(reader.read(frame_indices(1), frame_indices(end)), frame_indices, ...
+                     expected_frames, is_gray, description);
+      end
+
+      % Frame lists and whole GOPs after reads that leave the decoder mid-video
+      frame_indices = [50, 53, 53, 61, 100];
+      check_frames(reader.read_frames(frame_indices), frame_indices, expected_frames, is_gray, description);
+      for gop_index = [2, 3, 5]
+        [gop_frames, first_frame_index] = reader.read_gop(gop_index);
+        check_frames(gop_frames, first_frame_index + (0:size(gop_frames, ndims(expected_frames))-1), ...
+                     expected_frames, is_gray, description);
+      end
+      check_frames(reader.read(frame_count), frame_count, expected_frames, is_gray, description);
+      check_frames(reader.read(1), 1, expected_frames, is_gray, description);
+      delete(reader);
+    end
+  end
+end
+
+% Bad limits
+for forward_frame_limit = {-2, 2.5, [1, 2]}
+  try
+    h265.Reader(video_file_name, 'forward_frame_limit', forward_frame_limit{1});
+    error('test_forward_decode:noError', 'Bad forward_frame_limit should be rejected');
+  catch err
+    assert(strcmp(err.identifier, 'Reader:badForwardFrameLimit'), 'Unexpected error: %s', err.identifier);
+  end
+end
+
+end % function
+
+
+
+function check_frames(actual_frames, frame_indices, expected_frames, is_gray, description)
+% Compare frames read with the reference frames at frame_indices
+if is_gray
+  expected = expected_frames(:,:,frame_indices);
+else
+  expected = expected_frames(:,:,:,frame_indices);
+end
+assert(isequal(actual_frames, expected), 'Frames %d to %d do not match (%s)', ...
+  frame_indices(1), frame_indices(end), description);
+end % function
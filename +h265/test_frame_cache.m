@@ -0,0 +1,55 @@
+function test_frame_cache()
+% TEST_FRAME_CACHE Test single-frame reads served from the multi-GOP cache
+%   Reads frames that alternate between GOPs, with a cache large enough to
+%   hold all of them and with a zero budget (which keeps only the last GOP),
+%   and checks that both match a batch read.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 80;
+frame_rate = 30;  % Hz
+gop_size = 20;
+video_file_name = fullfile(temp_dir, 'test_frame_cache.mp4');
+
+frames = zeros(height, width, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+end
+writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+  'is_gray', true, 'gop_size', gop_size);
+writer.write(frames);
+delete(writer);
+
+reference_reader = h265.Reader(video_file_name);
+reference_frames = reference_reader.read(1, frame_count);
+delete(reference_reader);
+
+% Back and forth across GOP boundaries, then revisit earlier GOPs
+frame_indices = [gop_size, gop_size + 1, gop_size - 1, 2 * gop_size + 1, 2, ...
+                 frame_count, gop_size + 5, 1, 3 * gop_size, 3 * gop_size + 1];
+for cache_mb = [0, 64]
+  reader = h265.Reader(video_file_name, 'cache_mb', cache_mb);
+  assert(reader.cache_mb == cache_mb, 'cache_mb property mismatch');
+  for frame_index = [frame_indices, fliplr(frame_indices)]
+    frame = reader.read(frame_index);
+    assert(isequal(frame, reference_frames(:,:,frame_index)), ...
+      'Frame %d mismatch with cache_mb = %g', frame_index, cache_mb);
+  end
+  delete(reader);
+end
+
+% Bad budget is rejected
+try
+  h265.Reader(video_file_name, 'cache_mb', -1);
+  error('test_frame_cache:noError', 'Negative cache_mb should be rejected');
+catch err
+  assert(strcmp(err.identifier, 'Reader:badCacheSize'), 'Unexpected error: %s', err.message);
+end
+
+end
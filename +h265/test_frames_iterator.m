@@ -0,0 +1,122 @@
+function test_frames_iterator()
+% TEST_FRAMES_ITERATOR Test sequential chunked reads with frames_iterator
+%   Writes a video, then checks that iterating over it in chunks that do not
+%   line up with the GOPs returns the same frames as a batch read: over the
+%   whole video, over a range starting and ending mid-GOP, with frame
+%   threading, and with other reads between chunks (which make the next chunk
+%   seek again).  Also checks reset() and the errors for bad ranges and for
+%   reading past the end.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 95;
+frame_rate = 30;  % Hz
+gop_size = 10;
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+
+  video_file_name = fullfile(temp_dir, sprintf('test_frames_iterator_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  for thread_count = [1, 0]
+    reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'thread_count', thread_count);
+    expected_frames = reader.read(1, frame_count);
+
+    % Whole video, default range
+    iterator = reader.frames_iterator();
+    assert(iterator.start_frame == 1 && iterator.end_frame == frame_count, 'Default range mismatch');
+    check_iteration(iterator, expected_frames, is_gray);
+
+    % A range starting and ending mid-GOP, in chunks of 7
+    iterator = reader.frames_iterator(23, 71, 7);
+    check_iteration(iterator, expected_frames, is_gray);
+
+    % Other reads between chunks
+    iterator.reset();
+    assert(iterator.next_frame == 23, 'reset() should return to start_frame');
+    while iterator.has_next()
+      [chunk, first_frame_index] = iterator.next();
+      check_chunk(chunk, first_frame_index, expected_frames, is_gray);
+      reader.read(randi(frame_count));
+      reader.read(1, 3);
+    end
+
+    % Reading past the end
+    try
+      iterator.next();
+      error('test_frames_iterator:noError', 'Expected an error reading past the end');
+    catch err
+      assert(strcmp(err.identifier, 'FrameIterator:done'), 'Unexpected error: %s', err.identifier);
+    end
+    delete(reader);
+  end
+end
+
+% Bad ranges and chunk sizes
+reader = h265.Reader(video_file_name);
+bad_arguments = {{0, 10, 5}, {10, frame_count + 1, 5}, {20, 10, 5}, {1, 10, 0}, {1, 10, 2.5}};
+expected_identifiers = {'FrameIterator:badRange', 'FrameIterator:badRange', 'FrameIterator:badRange', ...
+  'FrameIterator:badChunkSize', 'FrameIterator:badChunkSize'};
+for argument_index = 1:length(bad_arguments)
+  arguments = bad_arguments{argument_index};
+  try
+    reader.frames_iterator(arguments{:});
+    error('test_frames_iterator:noError', 'Expected an error for bad arguments %d', argument_index);
+  catch err
+    assert(strcmp(err.identifier, expected_identifiers{argument_index}), 'Unexpected error: %s', err.identifier);
+  end
+end
+delete(reader);
+
+end % function
+
+
+
+function check_iteration(iterator, expected_frames, is_gray)
+% Iterate over the whole range and check that the chunks tile it exactly
+expected_first_frame_index = iterator.start_frame;
+while iterator.has_next()
+  [chunk, first_frame_index] = iterator.next();
+  assert(first_frame_index == expected_first_frame_index, 'Chunk starts at %d, expected %d', ...
+    first_frame_index, expected_first_frame_index);
+  chunk_frame_count = size(chunk, ndims(expected_frames));
+  assert(chunk_frame_count == min(iterator.chunk_frame_count, iterator.end_frame - first_frame_index + 1), ...
+    'Chunk at %d has %d frames', first_frame_index, chunk_frame_count);
+  check_chunk(chunk, first_frame_index, expected_frames, is_gray);
+  expected_first_frame_index = first_frame_index + chunk_frame_count;
+end
+assert(expected_first_frame_index == iterator.end_frame + 1, 'Chunks do not cover the range');
+end % function
+
+
+
+function check_chunk(chunk, first_frame_index, expected_frames, is_gray)
+% Compare a chunk with the frames of the batch read it covers
+frame_indices = first_frame_index + (0:size(chunk, ndims(expected_frames))-1);
+if is_gray
+  expected_chunk = expected_frames(:,:,frame_indices);
+else
+  expected_chunk = expected_frames(:,:,:,frame_indices);
+end
+assert(isequal(chunk, expected_chunk), 'Chunk at frame %d does not match batch read (is_gray = %d)', ...
+  first_frame_index, is_gray);
+end % function
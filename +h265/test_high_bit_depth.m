@@ -0,0 +1,90 @@
+function test_high_bit_depth()
+% TEST_HIGH_BIT_DEPTH Test writing and reading 10- and 12-bit video
+%   Writes uint16 grayscale and RGB frames at 10 and 12 bits, reads them back
+%   as uint16 through the single-frame and batch paths, and checks the values
+%   stay in range and close to the originals.  Also checks that frames of the
+%   wrong class and unsupported depths are rejected.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 30;
+frame_rate = 30;  % Hz
+gop_size = 10;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+
+for bit_depth = [10, 12]
+  max_value = 2^bit_depth - 1;
+  for is_gray = [true, false]
+    if is_gray
+      frames = zeros(height, width, frame_count, 'uint16');
+      for frame_index = 1:frame_count
+        frames(:,:,frame_index) = uint16(imgaussfilt(max_value * rand(height, width), 2));
+      end
+    else
+      frames = zeros(height, width, 3, frame_count, 'uint16');
+      for frame_index = 1:frame_count
+        frames(:,:,:,frame_index) = uint16(imgaussfilt(max_value * rand(height, width, 3), 2));
+      end
+    end
+    video_file_name = fullfile(temp_dir, sprintf('test_high_bit_depth_%d_%d.mp4', bit_depth, is_gray));
+    writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+      'is_gray', is_gray, 'gop_size', gop_size, 'bit_depth', bit_depth);
+    assert(writer.bit_depth == bit_depth, 'Writer bit_depth mismatch');
+    writer.write(frames);
+    delete(writer);
+
+    reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+    assert(reader.bit_depth == bit_depth, 'Reader bit_depth %d, expected %d', reader.bit_depth, bit_depth);
+    readback_frames = reader.read(1, frame_count);
+    single_frame = reader.read(frame_count);
+    delete(reader);
+
+    assert(isa(readback_frames, 'uint16') && isa(single_frame, 'uint16'), 'Frames should be uint16');
+    assert(isequal(size(readback_frames), size(frames)), 'Readback size mismatch');
+    assert(max(readback_frames(:)) <= max_value, 'Values exceed %d bits', bit_depth);
+    if is_gray
+      assert(isequal(single_frame, readback_frames(:,:,frame_count)), ...
+        'Single-frame and batch reads differ');
+    else
+      assert(isequal(single_frame, readback_frames(:,:,:,frame_count)), ...
+        'Single-frame and batch reads differ');
+    end
+    for frame_index = 1:frame_count
+      if is_gray
+        original_frame = double(frames(:,:,frame_index)) / max_value;
+        readback_frame = double(readback_frames(:,:,frame_index)) / max_value;
+      else
+        original_frame = double(frames(:,:,:,frame_index)) / max_value;
+        readback_frame = double(readback_frames(:,:,:,frame_index)) / max_value;
+      end
+      frame_ssim = ssim(readback_frame, original_frame);
+      assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low at %d bits (is_gray %d): %.4f', ...
+        frame_index, bit_depth, is_gray, frame_ssim);
+    end
+  end
+end
+
+% A high-bit-depth writer takes only uint16, and only 8, 10, and 12 bits exist
+writer = h265.Writer(fullfile(temp_dir, 'bad_type.mp4'), width, height, frame_rate, ...
+  'is_gray', true, 'bit_depth', 10);
+try
+  writer.write(zeros(height, width, 'uint8'));
+  error('test_high_bit_depth:noError', 'uint8 frames should be rejected by a 10-bit writer');
+catch err
+  assert(strcmp(err.identifier, 'Writer:badType'), 'Unexpected error: %s', err.message);
+end
+delete(writer);
+try
+  h265.Writer(fullfile(temp_dir, 'bad_depth.mp4'), width, height, frame_rate, 'bit_depth', 9);
+  error('test_high_bit_depth:noError', 'bit_depth 9 should be rejected');
+catch err
+  assert(strcmp(err.identifier, 'Writer:badBitDepth'), 'Unexpected error: %s', err.message);
+end
+
+end
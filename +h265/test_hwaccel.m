@@ -0,0 +1,104 @@
+function test_hwaccel()
+% TEST_HWACCEL Test the opt-in hardware decode and encode paths
+%   Writes and reads with hwaccel 'auto', which uses a GPU when there is one
+%   and the software path otherwise, and checks that the frames, keyframes,
+%   and frame-accurate reads match the software path.  Also checks that bad
+%   hwaccel names are rejected.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 256;
+height = 192;
+frame_count = 60;
+frame_rate = 30;  % Hz
+gop_size = 20;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+min_decoder_ssim = 0.99;  % Hardware and software decodes of the same file
+hwaccel_names = {'none', 'cuda', 'vaapi', 'videotoolbox'};
+
+frames = zeros(height, width, 3, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 4));
+end
+
+% Encode on whatever device is found, with closed GOPs either way
+video_file_name = fullfile(temp_dir, 'test_hwaccel.mp4');
+writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+  'gop_size', gop_size, 'hwaccel', 'auto');
+assert(ismember(writer.hwaccel, hwaccel_names), 'Unexpected writer hwaccel: %s', writer.hwaccel);
+writer.write(frames);
+delete(writer);
+
+software_reader = h265.Reader(video_file_name);
+assert(strcmp(software_reader.hwaccel, 'none'), 'The software path must stay the default');
+assert(software_reader.num_frames == frame_count, 'Frame count mismatch');
+assert(all(diff([software_reader.keyframes(:); frame_count + 1]) <= gop_size), ...
+  'Keyframes should be at most gop_size frames apart');
+software_frames = software_reader.read(1, frame_count);
+delete(software_reader);
+for frame_index = 1:frame_count
+  frame_ssim = ssim(software_frames(:,:,:,frame_index), frames(:,:,:,frame_index));
+  assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low: %.4f', frame_index, frame_ssim);
+end
+
+% Decode on whatever device is found, through every read path
+for is_gray = [false, true]
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'hwaccel', 'auto', ...
+                       'do_prefetch', true, 'worker_count', 2);
+  assert(ismember(reader.hwaccel, hwaccel_names), 'Unexpected reader hwaccel: %s', reader.hwaccel);
+  batch_frames = reader.read(1, frame_count);
+  list_indices = [frame_count, 1, 37, 37, 21];
+  list_frames = reader.read_frames(list_indices);
+  single_frames = cell(1, frame_count);
+  for frame_index = 1:frame_count
+    single_frames{frame_index} = reader.read(frame_index);
+  end
+  delete(reader);
+
+  software_reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  expected_frames = software_reader.read(1, frame_count);
+  delete(software_reader);
+  for frame_index = 1:frame_count
+    if is_gray
+      batch_frame = batch_frames(:,:,frame_index);
+      expected_frame = expected_frames(:,:,frame_index);
+    else
+      batch_frame = batch_frames(:,:,:,frame_index);
+      expected_frame = expected_frames(:,:,:,frame_index);
+    end
+    assert(isequal(single_frames{frame_index}, batch_frame), ...
+      'Single-frame and batch reads of frame %d differ (is_gray %d)', frame_index, is_gray);
+    frame_ssim = ssim(batch_frame, expected_frame);
+    assert(frame_ssim >= min_decoder_ssim, ...
+      'Frame %d differs from the software decode (is_gray %d): SSIM %.4f', frame_index, is_gray, frame_ssim);
+  end
+  for list_index = 1:numel(list_indices)
+    if is_gray
+      assert(isequal(list_frames(:,:,list_index), batch_frames(:,:,list_indices(list_index))), ...
+        'read_frames returned the wrong frame at position %d', list_index);
+    else
+      assert(isequal(list_frames(:,:,:,list_index), batch_frames(:,:,:,list_indices(list_index))), ...
+        'read_frames returned the wrong frame at position %d', list_index);
+    end
+  end
+end
+
+% Unknown devices are rejected rather than silently ignored
+try
+  h265.Reader(video_file_name, 'hwaccel', 'gpu');
+  error('test_hwaccel:noError', 'hwaccel ''gpu'' should be rejected by the Reader');
+catch err
+  assert(strcmp(err.identifier, 'open_h265_video:badOption'), 'Unexpected error: %s', err.message);
+end
+try
+  h265.Writer(fullfile(temp_dir, 'bad.mp4'), width, height, frame_rate, 'hwaccel', 'gpu');
+  error('test_hwaccel:noError', 'hwaccel ''gpu'' should be rejected by the Writer');
+catch err
+  assert(strcmp(err.identifier, 'open_h265_write:badOption'), 'Unexpected error: %s', err.message);
+end
+
+end
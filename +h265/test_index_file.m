@@ -0,0 +1,70 @@
+function test_index_file()
+% TEST_INDEX_FILE Test saving, loading, and invalidating the .h265idx sidecar
+%   Writes a video with an index sidecar, checks that the Reader loads the
+%   index from it and returns the same frames as a scanning Reader, and checks
+%   that stale or corrupt sidecars are ignored.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 64;
+frame_count = 90;
+frame_rate = 30;  % Hz
+gop_size = 20;
+video_file_name = fullfile(temp_dir, 'test_index.mp4');
+index_file_name = [video_file_name '.h265idx'];
+
+frames = uint8(randi([0 255], height, width, frame_count));
+writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+  'is_gray', true, 'gop_size', gop_size, 'do_write_index', true);
+writer.write(frames);
+delete(writer);
+assert(exist(index_file_name, 'file') == 2, 'Writer did not create index file');
+
+% Reader that scans, for reference
+scan_reader = h265.Reader(video_file_name, 'do_read_index', false);
+assert(strcmp(scan_reader.index_source, 'scan'), 'Reader should have scanned');
+assert(scan_reader.keyframes(1) == 1, 'First frame should be a keyframe');
+assert(all(diff(scan_reader.keyframes) <= gop_size), 'Keyframes should be at most gop_size frames apart');
+scan_frames = scan_reader.read(1, frame_count);
+
+% Reader that loads the sidecar
+index_reader = h265.Reader(video_file_name);
+assert(strcmp(index_reader.index_source, 'index_file'), 'Reader should have loaded the index file');
+assert(index_reader.num_frames == frame_count, 'Frame count from index file mismatch');
+assert(isequal(index_reader.keyframes, scan_reader.keyframes), 'Keyframes from index file mismatch');
+for frame_index = [1, gop_size, gop_size + 1, frame_count]
+  assert(isequal(index_reader.read(frame_index), scan_frames(:,:,frame_index)), ...
+    'Frame %d read via index file does not match', frame_index);
+end
+assert(isequal(index_reader.read(5, 45), scan_frames(:,:,5:45)), 'Range read via index file does not match');
+delete(index_reader);
+delete(scan_reader);
+
+% Corrupt sidecar: truncate it, and the Reader must fall back to scanning
+file_handle = fopen(index_file_name, 'w');
+fwrite(file_handle, uint8(1:10));
+fclose(file_handle);
+corrupt_reader = h265.Reader(video_file_name);
+assert(strcmp(corrupt_reader.index_source, 'scan'), 'Corrupt index file should be ignored');
+delete(corrupt_reader);
+
+% Stale sidecar: index a video, then overwrite the video with a shorter one
+writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+  'is_gray', true, 'gop_size', gop_size, 'do_write_index', true);
+writer.write(frames);
+delete(writer);
+short_frame_count = 30;
+writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', true, 'gop_size', gop_size);
+writer.write(frames(:,:,1:short_frame_count));
+delete(writer);
+stale_reader = h265.Reader(video_file_name);
+assert(strcmp(stale_reader.index_source, 'scan'), 'Stale index file should be ignored');
+assert(stale_reader.num_frames == short_frame_count, 'Frame count after stale index mismatch');
+delete(stale_reader);
+
+end
@@ -0,0 +1,93 @@
+function test_io_modes()
+% TEST_IO_MODES Test the custom I/O modes of the Reader
+%   Writes a video, then reads it with io_mode 'mmap' and 'cached' (with
+%   blocks much smaller than the file, and a cache smaller than it) through
+%   every read path, and checks the frames match io_mode 'default'.  Also
+%   checks that two Readers sharing a block cache read correctly when
+%   interleaved and after one is closed, and that bad options are rejected.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 256;
+height = 192;
+frame_count = 60;
+frame_rate = 30;  % Hz
+gop_size = 10;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+io_block_kb = 16;  % Several blocks per GOP
+io_cache_mb = 0.0625;  % Fewer blocks than the file has
+
+frames = zeros(height, width, 3, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 4));
+end
+
+video_file_name = fullfile(temp_dir, 'test_io_modes.mp4');
+writer = h265.Writer(video_file_name, width, height, frame_rate, 'gop_size', gop_size);
+writer.write(frames);
+delete(writer);
+
+reader = h265.Reader(video_file_name);
+assert(strcmp(reader.io_mode, 'default'), 'FFmpeg''s own I/O must stay the default');
+expected_frames = reader.read(1, frame_count);
+delete(reader);
+for frame_index = 1:frame_count
+  frame_ssim = ssim(expected_frames(:,:,:,frame_index), frames(:,:,:,frame_index));
+  assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low: %.4f', frame_index, frame_ssim);
+end
+
+% Every read path, including the prefetch and parallel workers, which open
+% their own contexts on the same file
+for io_mode = {'mmap', 'cached'}
+  reader = h265.Reader(video_file_name, 'io_mode', io_mode{1}, ...
+                       'io_block_kb', io_block_kb, 'io_cache_mb', io_cache_mb, ...
+                       'do_prefetch', true, 'worker_count', 2);
+  assert(strcmp(reader.io_mode, io_mode{1}), 'io_mode property mismatch');
+  assert(reader.num_frames == frame_count, 'Frame count mismatch (%s)', io_mode{1});
+  batch_frames = reader.read(1, frame_count);
+  assert(isequal(batch_frames, expected_frames), 'Batch read differs (%s)', io_mode{1});
+  for frame_index = [1:frame_count, frame_count:-7:1]
+    assert(isequal(reader.read(frame_index), expected_frames(:,:,:,frame_index)), ...
+      'Single-frame read of frame %d differs (%s)', frame_index, io_mode{1});
+  end
+  list_indices = [frame_count, 1, 37, 37, 21];
+  assert(isequal(reader.read_frames(list_indices), expected_frames(:,:,:,list_indices)), ...
+    'read_frames differs (%s)', io_mode{1});
+  delete(reader);
+end
+
+% Two Readers of the same file share one block cache
+first_reader = h265.Reader(video_file_name, 'io_mode', 'cached', ...
+                           'io_block_kb', io_block_kb, 'io_cache_mb', io_cache_mb, 'cache_mb', 0);
+second_reader = h265.Reader(video_file_name, 'io_mode', 'cached', ...
+                            'io_block_kb', io_block_kb, 'io_cache_mb', io_cache_mb, 'cache_mb', 0);
+for frame_index = 1:gop_size:frame_count
+  other_frame_index = frame_count + 1 - frame_index;
+  assert(isequal(first_reader.read(frame_index), expected_frames(:,:,:,frame_index)), ...
+    'Interleaved read of frame %d differs', frame_index);
+  assert(isequal(second_reader.read(other_frame_index), expected_frames(:,:,:,other_frame_index)), ...
+    'Interleaved read of frame %d differs', other_frame_index);
+end
+delete(first_reader);
+assert(isequal(second_reader.read(1, frame_count), expected_frames), ...
+  'Read after the other Reader of the file was closed differs');
+delete(second_reader);
+
+% Bad options are rejected
+bad_options = {{'io_mode', 'direct'}, {'io_mode', 'cached', 'io_block_kb', 6}, ...
+               {'io_mode', 'cached', 'io_cache_mb', -1}};
+for option_index = 1:numel(bad_options)
+  try
+    h265.Reader(video_file_name, bad_options{option_index}{:});
+    error('test_io_modes:noError', 'Bad option set %d should be rejected', option_index);
+  catch err
+    assert(strcmp(err.identifier, 'open_h265_video:badOption'), 'Unexpected error: %s', err.message);
+  end
+end
+
+end
@@ -5,6 +5,8 @@ function test_memory_leaks(varargin)
 %   1. Creates a test video with many GOPs
 %   2. Does a warmup to stabilize one-time allocations
 %   3. Runs many cycles with random frame reads (to trigger cache misses)
+%      and a batch read, each on a new Reader, so the decode state kept
+%      with each Reader's cache is set up and freed every cycle
 %   4. Computes memory growth per cycle and checks against threshold
 %
 % Optional parameters:
@@ -34,6 +36,8 @@ for warmup_cycle_index = 1:warmup_cycle_count
   for j = 1:20
     frame = reader.read(randi(num_frames)); %#ok<NASGU>
   end
+  first_frame_index = randi(num_frames - 2);
+  frames = reader.read(first_frame_index, first_frame_index + 2); %#ok<NASGU>
   reader = []; %#ok<NASGU>
   warmup_memory_samples(warmup_cycle_index) = get_memory_kb();
 end
@@ -51,6 +55,8 @@ for cycle_index = 1:cycle_count
   for j = 1:20
     frame = reader.read(randi(num_frames)); %#ok<NASGU>
   end
+  first_frame_index = randi(num_frames - 2);
+  frames = reader.read(first_frame_index, first_frame_index + 2); %#ok<NASGU>
   reader = [];  %#ok<NASGU> Release handle to trigger destructor
   memory_samples(cycle_index) = get_memory_kb();
 end
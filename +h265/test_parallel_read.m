@@ -0,0 +1,51 @@
+function test_parallel_read()
+% TEST_PARALLEL_READ Test GOP-parallel batch reads against sequential reads
+%   Writes a grayscale video with many GOPs, then reads ranges with several
+%   parallel decoder counts.  Every range must match the sequential read
+%   exactly, including ranges that start and end in the middle of a GOP.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 96;
+height = 64;
+frame_count = 400;
+frame_rate = 30;  % Hz
+gop_size = 20;
+output_file_name = fullfile(temp_dir, 'test_parallel.mp4');
+
+raw_frames = randi([0 255], height, width, frame_count);
+original_frames = uint8(imgaussfilt(double(raw_frames), 3));
+writer = h265.Writer(output_file_name, width, height, frame_rate, 'is_gray', true, 'gop_size', gop_size);
+writer.write(original_frames);
+delete(writer);
+
+% Reference: sequential decode on a single context
+reference_reader = h265.Reader(output_file_name);
+reference_frames = reference_reader.read(1, frame_count);
+delete(reference_reader);
+
+ranges = [1, frame_count; 7, 393; 41, 260; 100, 119];
+worker_counts = [2, 3, 8];
+for worker_index = 1:numel(worker_counts)
+  worker_count = worker_counts(worker_index);
+  reader = h265.Reader(output_file_name, 'worker_count', worker_count);
+  assert(reader.worker_count == worker_count, 'Reader worker_count mismatch');
+  for range_index = 1:size(ranges, 1)
+    start_frame = ranges(range_index, 1);
+    end_frame = ranges(range_index, 2);
+    frames = reader.read(start_frame, end_frame);
+    if ~isequal(frames, reference_frames(:,:,start_frame:end_frame))
+      error('test_parallel_read:mismatch', ...
+            'Parallel read of frames %d-%d with %d workers does not match sequential read', ...
+            start_frame, end_frame, worker_count);
+    end
+  end
+  delete(reader);
+end
+
+end
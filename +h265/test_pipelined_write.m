@@ -0,0 +1,88 @@
+function test_pipelined_write()
+% TEST_PIPELINED_WRITE Test writing through the conversion/encoding pipeline
+%   Writes the same frames with and without do_pipeline, in several small
+%   blocks through a short queue (so write has to wait for free slots), and
+%   checks that both files decode to the same frames.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 90;
+frame_rate = 30;  % Hz
+gop_size = 20;
+block_frame_count = 7;
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+
+  serial_file_name = fullfile(temp_dir, sprintf('test_serial_%d.mp4', is_gray));
+  serial_writer = h265.Writer(serial_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size);
+  serial_writer.write(frames);
+  delete(serial_writer);
+
+  pipelined_file_name = fullfile(temp_dir, sprintf('test_pipelined_%d.mp4', is_gray));
+  pipelined_writer = h265.Writer(pipelined_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size, ...
+    'do_pipeline', true, 'queue_frame_count', 4, 'conversion_thread_count', 3);
+  assert(pipelined_writer.do_pipeline, 'do_pipeline property mismatch');
+  for first_frame_index = 1:block_frame_count:frame_count
+    last_frame_index = min(first_frame_index + block_frame_count - 1, frame_count);
+    if is_gray
+      pipelined_writer.write(frames(:,:,first_frame_index:last_frame_index));
+    else
+      pipelined_writer.write(frames(:,:,:,first_frame_index:last_frame_index));
+    end
+    if first_frame_index == 1
+      pipelined_writer.wait();
+    end
+  end
+  assert(pipelined_writer.frames_written == frame_count, 'Pipelined frames_written mismatch');
+  pipelined_writer.wait();
+  delete(pipelined_writer);
+
+  serial_reader = h265.Reader(serial_file_name, 'is_gray', is_gray);
+  serial_frames = serial_reader.read(1, frame_count);
+  delete(serial_reader);
+  pipelined_reader = h265.Reader(pipelined_file_name, 'is_gray', is_gray);
+  assert(pipelined_reader.num_frames == frame_count, 'Pipelined file frame count mismatch');
+  pipelined_frames = pipelined_reader.read(1, frame_count);
+  delete(pipelined_reader);
+  assert(isequal(pipelined_frames, serial_frames), ...
+    'Pipelined file does not match serial file (is_gray = %d)', is_gray);
+end
+
+% Closing with frames still queued must finish them
+video_file_name = fullfile(temp_dir, 'test_pipelined_close.mp4');
+writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+  'is_gray', true, 'gop_size', gop_size, 'do_pipeline', true);
+writer.write(zeros(height, width, frame_count, 'uint8'));
+delete(writer);
+reader = h265.Reader(video_file_name);
+assert(reader.num_frames == frame_count, 'Frames queued at close were lost');
+delete(reader);
+
+% Bad queue length is rejected
+try
+  h265.Writer(fullfile(temp_dir, 'bad.mp4'), width, height, frame_rate, 'do_pipeline', true, 'queue_frame_count', 0);
+  error('test_pipelined_write:noError', 'queue_frame_count = 0 should be rejected');
+catch err
+  assert(strcmp(err.identifier, 'Writer:badQueueFrameCount'), 'Unexpected error: %s', err.message);
+end
+
+end
@@ -0,0 +1,101 @@
+function test_prefetch()
+% TEST_PREFETCH Test single-frame reads with background read-ahead
+%   Reads every frame in order with do_prefetch enabled, then jumps around,
+%   and checks that all frames match a batch read of the same video.  Then
+%   plays the video backward with each prefetch_direction and checks that
+%   'auto' and 'backward' get every earlier GOP from the read-ahead thread.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 100;
+frame_rate = 30;  % Hz
+gop_size = 20;
+
+for is_gray = [true, false]
+  video_file_name = fullfile(temp_dir, sprintf('test_prefetch_%d.mp4', is_gray));
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reference_reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  reference_frames = reference_reader.read(1, frame_count);
+  delete(reference_reader);
+
+  % Zero cache budget: only the read-ahead GOP carries reads across boundaries
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_prefetch', true, 'cache_mb', 0);
+  assert(reader.do_prefetch, 'do_prefetch property mismatch');
+  frame_indices = [1:frame_count, 3 * gop_size + 2, 5, frame_count, gop_size + 1, 2 * gop_size];
+  for frame_index = frame_indices
+    frame = reader.read(frame_index);
+    if is_gray
+      expected_frame = reference_frames(:,:,frame_index);
+    else
+      expected_frame = reference_frames(:,:,:,frame_index);
+    end
+    assert(isequal(frame, expected_frame), ...
+      'Frame %d mismatch with prefetch (is_gray = %d)', frame_index, is_gray);
+  end
+
+  % Closing with a read-ahead job in flight must be safe
+  reader.read(1);
+  delete(reader);
+
+  % Reverse playback: the read-ahead follows the reads back through the GOPs
+  gop_count = ceil(frame_count / gop_size);
+  prefetch_directions = {'auto', 'backward', 'forward'};
+  for direction_index = 1:length(prefetch_directions)
+    prefetch_direction = prefetch_directions{direction_index};
+    reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_prefetch', true, 'cache_mb', 0, ...
+                         'prefetch_direction', prefetch_direction, 'do_collect_stats', true);
+    assert(strcmp(reader.prefetch_direction, prefetch_direction), 'prefetch_direction property mismatch');
+    for frame_index = frame_count:-1:1
+      frame = reader.read(frame_index);
+      if is_gray
+        expected_frame = reference_frames(:,:,frame_index);
+      else
+        expected_frame = reference_frames(:,:,:,frame_index);
+      end
+      assert(isequal(frame, expected_frame), ...
+        'Frame %d mismatch in reverse with prefetch_direction %s (is_gray = %d)', ...
+        frame_index, prefetch_direction, is_gray);
+    end
+    stats = reader.stats();
+    if strcmp(prefetch_direction, 'forward')
+      assert(stats.prefetch_hit_count == 0, 'Forward read-ahead should not serve reverse reads');
+    else
+      assert(stats.prefetch_hit_count == gop_count - 1, ...
+        'Reverse playback with prefetch_direction %s got %d prefetch hits, expected %d', ...
+        prefetch_direction, stats.prefetch_hit_count, gop_count - 1);
+    end
+    delete(reader);
+  end
+end
+
+% Bad prefetch_direction
+try
+  h265.Reader(video_file_name, 'do_prefetch', true, 'prefetch_direction', 'sideways');
+  error('test_prefetch:noError', 'Bad prefetch_direction should have errored');
+catch err
+  assert(strcmp(err.identifier, 'Reader:badPrefetchDirection'), 'Unexpected error %s', err.identifier);
+end
+
+end
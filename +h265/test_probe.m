@@ -0,0 +1,85 @@
+function test_probe()
+% TEST_PROBE Test h265.probe
+%   Writes gray and RGB videos and checks that probe reports the frame
+%   count, size, frame rate, keyframe count, bit depth, and grayscale of an
+%   h265.Reader of each, with and without an index file, and for a list of
+%   files.  Also checks that a missing file is rejected.  Throws error on
+%   failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 45;
+frame_rate = 25;  % Hz
+gop_size = 10;
+
+video_file_names = cell(1, 2);
+is_gray_values = [true, false];
+for video_index = 1:2
+  is_gray = is_gray_values(video_index);
+  video_file_name = fullfile(temp_dir, sprintf('test_probe_%d.mp4', is_gray));
+  video_file_names{video_index} = video_file_name;
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  info = h265.probe(video_file_name);
+  assert(strcmp(info.num_frames_source, 'sample_table'), 'num_frames from %s', info.num_frames_source);
+  check_probe(info, video_file_name, is_gray);
+
+  % With an index file, probe reads the counts from it
+  delete(h265.Reader(video_file_name, 'do_write_index', true));
+  info = h265.probe(video_file_name);
+  assert(strcmp(info.num_frames_source, 'index_file'), 'num_frames from %s', info.num_frames_source);
+  check_probe(info, video_file_name, is_gray);
+end
+
+% A list of files gives a struct array of the same shape
+infos = h265.probe(video_file_names');
+assert(isequal(size(infos), [2, 1]), 'Struct array size mismatch');
+assert(strcmp(infos(2).filename, video_file_names{2}), 'Struct array order mismatch');
+assert(isempty(h265.probe({})), 'Empty list should give an empty struct');
+
+% Missing file
+try
+  h265.probe(fullfile(temp_dir, 'missing.mp4'));
+  error('test_probe:noError', 'Missing file should have errored');
+catch err
+  assert(strcmp(err.identifier, 'probe_h265_video:openFailed'), 'Unexpected error %s', err.identifier);
+end
+
+end % function
+
+
+
+function check_probe(info, video_file_name, is_gray)
+% Check the fields of a probe of video_file_name against a Reader of it
+reader = h265.Reader(video_file_name);
+assert(info.num_frames == reader.num_frames, 'num_frames %d, Reader %d', info.num_frames, reader.num_frames);
+assert(info.width == reader.width && info.height == reader.height, 'Frame size mismatch');
+assert(info.frame_rate_num == reader.frame_rate_num && info.frame_rate_den == reader.frame_rate_den, ...
+       'Frame rate mismatch');
+assert(abs(info.frame_rate * info.duration - info.num_frames) < 1e-6, 'duration mismatch');
+assert(info.keyframe_count == numel(reader.keyframes), 'keyframe_count %d, Reader %d', ...
+       info.keyframe_count, numel(reader.keyframes));
+assert(info.bit_depth == reader.bit_depth, 'bit_depth mismatch');
+assert(info.is_grayscale == is_gray, 'is_grayscale mismatch');
+assert(strcmp(info.codec_name, 'hevc'), 'codec_name is %s', info.codec_name);
+delete(reader);
+end % function
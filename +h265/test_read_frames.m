@@ -0,0 +1,83 @@
+function test_read_frames()
+% TEST_READ_FRAMES Test reading arbitrary lists of frames
+%   Reads strided, shuffled, repeated, and single-GOP frame lists and checks
+%   that each matches the corresponding frames of a batch read.  Throws error
+%   on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 95;  % Last GOP is short
+frame_rate = 30;  % Hz
+gop_size = 20;
+
+frame_lists = { ...
+  1:10:frame_count, ...
+  randperm(frame_count, 25), ...
+  [50, 3, 50, 94, 3, 3, 21], ...
+  [41, 45, 42], ...
+  frame_count, ...
+  [1, frame_count], ...
+  zeros(1, 0)};
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+  video_file_name = fullfile(temp_dir, sprintf('test_read_frames_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  reference_frames = reader.read(1, frame_count);
+  for list_index = 1:numel(frame_lists)
+    frame_indices = frame_lists{list_index};
+    list_frames = reader.read_frames(frame_indices);
+    if is_gray
+      expected_frames = reference_frames(:,:,frame_indices);
+    else
+      expected_frames = reference_frames(:,:,:,frame_indices);
+    end
+    assert(isequal(size(list_frames, ndims(reference_frames)), numel(frame_indices)), ...
+      'Wrong frame count for list %d (is_gray = %d)', list_index, is_gray);
+    assert(isequal(list_frames(:), expected_frames(:)), ...
+      'Frame list %d mismatch (is_gray = %d)', list_index, is_gray);
+  end
+
+  % Later single-frame reads are unaffected
+  if is_gray
+    assert(isequal(reader.read(gop_size + 1), reference_frames(:,:,gop_size + 1)), 'Single read mismatch');
+  else
+    assert(isequal(reader.read(gop_size + 1), reference_frames(:,:,:,gop_size + 1)), 'Single read mismatch');
+  end
+  delete(reader);
+end
+
+% Out-of-range and fractional indices are rejected
+reader = h265.Reader(video_file_name);
+for bad_indices = {[1, 0], [2, frame_count + 1], 1.5}
+  try
+    reader.read_frames(bad_indices{1});
+    error('test_read_frames:noError', 'Bad frame indices should be rejected');
+  catch err
+    assert(strcmp(err.identifier, 'read_h265_frames:invalidIndex'), 'Unexpected error: %s', err.message);
+  end
+end
+delete(reader);
+
+end
@@ -0,0 +1,99 @@
+function test_read_gop()
+% TEST_READ_GOP Test whole-GOP reads and the frame-to-GOP map
+%   Reads every GOP, both as fresh decodes and as cache and prefetch hits,
+%   checks that each block matches a batch read, and that gop_for_frame
+%   locates every frame within its block.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 70;  % Last GOP is short
+frame_rate = 30;  % Hz
+gop_size = 20;
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+  video_file_name = fullfile(temp_dir, sprintf('test_read_gop_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  for do_prefetch = [false, true]
+    reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_prefetch', do_prefetch);
+    reference_frames = reader.read(1, frame_count);
+    gop_count = numel(reader.keyframes);
+
+    % Second pass over each GOP comes from the cache (or the prefetcher)
+    for gop_index = [1:gop_count, gop_count:-1:1]
+      [gop_frames, first_frame_index] = reader.read_gop(gop_index);
+      assert(first_frame_index == reader.keyframes(gop_index), 'First frame index mismatch');
+      gop_frame_count = size(gop_frames, ndims(reference_frames));
+      frame_indices = first_frame_index:(first_frame_index + gop_frame_count - 1);
+      if is_gray
+        expected_frames = reference_frames(:,:,frame_indices);
+      else
+        expected_frames = reference_frames(:,:,:,frame_indices);
+      end
+      assert(isequal(gop_frames, expected_frames), ...
+        'GOP %d mismatch (is_gray = %d, do_prefetch = %d)', gop_index, is_gray, do_prefetch);
+    end
+
+    % A GOP read after a single-frame read in it, and vice versa
+    frame = reader.read(gop_size + 3);
+    gop_frames = reader.read_gop(2);
+    if is_gray
+      assert(isequal(gop_frames(:,:,3), frame), 'Cached GOP mismatch');
+    else
+      assert(isequal(gop_frames(:,:,:,3), frame), 'Cached GOP mismatch');
+    end
+    reader.read_gop(3);
+    if is_gray
+      assert(isequal(reader.read(2 * gop_size + 4), reference_frames(:,:,2 * gop_size + 4)), 'Read after GOP read mismatch');
+    else
+      assert(isequal(reader.read(2 * gop_size + 4), reference_frames(:,:,:,2 * gop_size + 4)), 'Read after GOP read mismatch');
+    end
+    delete(reader);
+  end
+end
+
+% Every frame maps to the GOP block that holds it
+reader = h265.Reader(video_file_name);
+[gop_indices, frame_offsets] = reader.gop_for_frame(1:frame_count);
+for frame_index = 1:frame_count
+  [gop_frames, first_frame_index] = reader.read_gop(gop_indices(frame_index));
+  assert(first_frame_index + frame_offsets(frame_index) - 1 == frame_index, ...
+    'gop_for_frame mismatch for frame %d', frame_index);
+  assert(frame_offsets(frame_index) <= size(gop_frames, 4), 'Frame offset %d out of range', frame_index);
+end
+
+% Out-of-range indices are rejected
+bad_calls = {@() reader.read_gop(0), @() reader.read_gop(numel(reader.keyframes) + 1), ...
+             @() reader.gop_for_frame(frame_count + 1)};
+bad_identifiers = {'Reader:badGopIndex', 'Reader:badGopIndex', 'Reader:badFrameIndex'};
+for call_index = 1:numel(bad_calls)
+  try
+    bad_calls{call_index}();
+    error('test_read_gop:noError', 'Bad index %d should be rejected', call_index);
+  catch err
+    assert(strcmp(err.identifier, bad_identifiers{call_index}), 'Unexpected error: %s', err.message);
+  end
+end
+delete(reader);
+
+end
@@ -0,0 +1,83 @@
+function test_read_into()
+% TEST_READ_INTO Test reading frames into a preallocated buffer
+%   Writes a video, then checks that read_into fills a buffer with the same
+%   frames as read: a single frame, ranges that fill the buffer exactly, and
+%   a short range into a larger buffer (whose other frames must be left
+%   alone), reusing one buffer across chunks of a sequential pass.  Also
+%   checks the errors for buffers of the wrong class, frame size, or length.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 60;
+frame_rate = 30;  % Hz
+gop_size = 10;
+chunk_frame_count = 8;
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+    frame_size = [height, width];
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+    frame_size = [height, width, 3];
+  end
+
+  video_file_name = fullfile(temp_dir, sprintf('test_read_into_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  expected_frames = reader.read(1, frame_count);
+
+  % Single frame
+  frame_buffer = zeros(frame_size, 'uint8');
+  reader.read_into(frame_buffer, 17);
+  assert(isequal(frame_buffer, reader.read(17)), 'Single frame mismatch (is_gray = %d)', is_gray);
+
+  % Sequential pass through one reused buffer; the last chunk is short
+  chunk_buffer = zeros([frame_size, chunk_frame_count], 'uint8');
+  for first_frame_index = 1:chunk_frame_count:frame_count
+    last_frame_index = min(first_frame_index + chunk_frame_count - 1, frame_count);
+    chunk_buffer(:) = 0;
+    reader.read_into(chunk_buffer, first_frame_index, last_frame_index);
+    read_frame_count = last_frame_index - first_frame_index + 1;
+    if is_gray
+      assert(isequal(chunk_buffer(:,:,1:read_frame_count), expected_frames(:,:,first_frame_index:last_frame_index)), ...
+        'Chunk at %d mismatch (is_gray = %d)', first_frame_index, is_gray);
+      assert(~any(chunk_buffer(:,:,read_frame_count+1:end), 'all'), 'Frames past the range were written');
+    else
+      assert(isequal(chunk_buffer(:,:,:,1:read_frame_count), expected_frames(:,:,:,first_frame_index:last_frame_index)), ...
+        'Chunk at %d mismatch (is_gray = %d)', first_frame_index, is_gray);
+      assert(~any(chunk_buffer(:,:,:,read_frame_count+1:end), 'all'), 'Frames past the range were written');
+    end
+  end
+
+  % Bad buffers
+  bad_buffers = {zeros([frame_size, 4], 'double'), zeros([frame_size(1) + 1, frame_size(2:end), 4], 'uint8'), ...
+                 zeros([frame_size, 2], 'uint8')};
+  for buffer_index = 1:length(bad_buffers)
+    try
+      reader.read_into(bad_buffers{buffer_index}, 1, 4);
+      error('test_read_into:noError', 'Expected an error for bad buffer %d', buffer_index);
+    catch err
+      assert(strcmp(err.identifier, 'read_h265_frames:badBuffer'), 'Unexpected error: %s', err.identifier);
+    end
+  end
+  delete(reader);
+end
+
+end % function
@@ -0,0 +1,89 @@
+function test_read_keyframes()
+% TEST_READ_KEYFRAMES Test h265.Reader/read_keyframes
+%   Writes gray and RGB videos, then checks that read_keyframes returns the
+%   keyframes a batch read returns, at every stride, that it decodes only
+%   the keyframes, and that output_size and scale shrink them.  Also checks
+%   that reads after it still match and that a bad stride is rejected.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 95;
+frame_rate = 30;  % Hz
+gop_size = 10;
+
+for is_gray = [true, false]
+  video_file_name = fullfile(temp_dir, sprintf('test_read_keyframes_%d.mp4', is_gray));
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'is_gray', is_gray, 'gop_size', gop_size);
+  writer.write(frames);
+  delete(writer);
+
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray, 'do_collect_stats', true);
+  reference_frames = reader.read(1, frame_count);
+  keyframe_count = numel(reader.keyframes);
+  assert(keyframe_count == ceil(frame_count / gop_size), 'Expected a keyframe every %d frames', gop_size);
+
+  % Every keyframe, and every third, decoding nothing else
+  for stride = [1, 3]
+    reader.reset_stats();
+    [thumbnails, frame_indices] = reader.read_keyframes(stride);
+    assert(isequal(frame_indices, reader.keyframes(1:stride:end)), 'frame_indices mismatch (stride %d)', stride);
+    if is_gray
+      expected_frames = reference_frames(:,:,frame_indices);
+    else
+      expected_frames = reference_frames(:,:,:,frame_indices);
+    end
+    assert(isequal(thumbnails, expected_frames), 'Keyframe mismatch (stride %d, is_gray = %d)', stride, is_gray);
+    stats = reader.stats();
+    assert(stats.decoded_frame_count == numel(frame_indices), ...
+           'Decoded %d frames for %d keyframes', stats.decoded_frame_count, numel(frame_indices));
+  end
+
+  % Smaller thumbnails, by size and by scale
+  thumbnails = reader.read_keyframes(2, 'output_size', [12, 16]);
+  assert(size(thumbnails, 1) == 12 && size(thumbnails, 2) == 16, 'output_size not applied');
+  assert(size(thumbnails, ndims(thumbnails)) == ceil(keyframe_count / 2), 'Wrong number of thumbnails');
+  thumbnails = reader.read_keyframes(1, 'scale', 0.5);
+  assert(size(thumbnails, 1) == height / 2 && size(thumbnails, 2) == width / 2, 'scale not applied');
+
+  % Reads afterwards are unaffected
+  for frame_index = [gop_size + 3, 1, frame_count]
+    frame = reader.read(frame_index);
+    if is_gray
+      expected_frame = reference_frames(:,:,frame_index);
+    else
+      expected_frame = reference_frames(:,:,:,frame_index);
+    end
+    assert(isequal(frame, expected_frame), 'Frame %d mismatch after read_keyframes', frame_index);
+  end
+  delete(reader);
+end
+
+% Bad stride
+reader = h265.Reader(video_file_name);
+try
+  reader.read_keyframes(0);
+  error('test_read_keyframes:noError', 'Bad stride should have errored');
+catch err
+  assert(strcmp(err.identifier, 'Reader:badStride'), 'Unexpected error %s', err.identifier);
+end
+delete(reader);
+
+end % function
@@ -0,0 +1,43 @@
+function test_sample_table_index()
+% TEST_SAMPLE_TABLE_INDEX Test building the frame index from the MP4 sample table
+%   Opens the same RGB video once from the sample table and once with a full
+%   packet scan, and checks that the indexes agree and that frames read
+%   through both are identical.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 80;
+height = 60;
+frame_count = 130;
+frame_rate = [30000, 1001];
+gop_size = 25;
+video_file_name = fullfile(temp_dir, 'test_sample_table.mp4');
+
+raw_frames = randi([0 255], height, width, 3, frame_count);
+frames = uint8(imgaussfilt(double(raw_frames), 3));
+writer = h265.Writer(video_file_name, width, height, frame_rate, 'gop_size', gop_size);
+writer.write(frames);
+delete(writer);
+
+table_reader = h265.Reader(video_file_name);
+scan_reader = h265.Reader(video_file_name, 'do_use_sample_table', false);
+assert(strcmp(table_reader.index_source, 'sample_table'), 'Reader should have used the sample table');
+assert(strcmp(scan_reader.index_source, 'scan'), 'Reader should have scanned');
+assert(table_reader.num_frames == scan_reader.num_frames, 'Frame count mismatch');
+assert(isequal(table_reader.keyframes, scan_reader.keyframes), 'Keyframe list mismatch');
+
+scan_frames = scan_reader.read(1, frame_count);
+assert(isequal(table_reader.read(1, frame_count), scan_frames), 'Batch read mismatch');
+assert(isequal(table_reader.read(gop_size + 2, 3 * gop_size), scan_frames(:,:,:,gop_size+2:3*gop_size)), ...
+  'Mid-GOP range read mismatch');
+for frame_index = randi(frame_count, 1, 30)
+  if ~isequal(table_reader.read(frame_index), scan_frames(:,:,:,frame_index))
+    error('test_sample_table_index:singleRead', 'Single read of frame %d mismatch', frame_index);
+  end
+end
+
+end
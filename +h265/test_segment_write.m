@@ -0,0 +1,85 @@
+function test_segment_write()
+% TEST_SEGMENT_WRITE Test encoding GOP-aligned segments on parallel encoders
+%   Writes frames with several segment encoders, in blocks that do not line up
+%   with the segments, then checks that the Reader accepts the file, that
+%   keyframes stay at most gop_size apart, that random reads match a batch
+%   read, and that every frame survives compression.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 130;
+frame_rate = 30;  % Hz
+gop_size = 10;
+block_frame_count = 17;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+
+for is_gray = [true, false]
+  if is_gray
+    frames = zeros(height, width, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width), 2));
+    end
+  else
+    frames = zeros(height, width, 3, frame_count, 'uint8');
+    for frame_index = 1:frame_count
+      frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+    end
+  end
+
+  video_file_name = fullfile(temp_dir, sprintf('test_segment_write_%d.mp4', is_gray));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, ...
+    'is_gray', is_gray, 'gop_size', gop_size, 'segment_encoder_count', 3, 'segment_gop_count', 2);
+  assert(writer.segment_encoder_count == 3, 'segment_encoder_count property mismatch');
+  for first_frame_index = 1:block_frame_count:frame_count
+    last_frame_index = min(first_frame_index + block_frame_count - 1, frame_count);
+    if is_gray
+      writer.write(frames(:,:,first_frame_index:last_frame_index));
+    else
+      writer.write(frames(:,:,:,first_frame_index:last_frame_index));
+    end
+  end
+  writer.wait();
+  delete(writer);
+
+  reader = h265.Reader(video_file_name, 'is_gray', is_gray);
+  assert(reader.num_frames == frame_count, 'Frame count mismatch (is_gray = %d)', is_gray);
+  assert(reader.keyframes(1) == 1, 'First frame should be a keyframe');
+  assert(all(diff([reader.keyframes(:); frame_count + 1]) <= gop_size), ...
+    'Keyframes should be at most gop_size frames apart');
+  readback_frames = reader.read(1, frame_count);
+  for frame_index = [1, gop_size, 2 * gop_size, 2 * gop_size + 1, frame_count, randi(frame_count, 1, 10)]
+    if is_gray
+      expected_frame = readback_frames(:,:,frame_index);
+    else
+      expected_frame = readback_frames(:,:,:,frame_index);
+    end
+    assert(isequal(reader.read(frame_index), expected_frame), ...
+      'Single read of frame %d does not match batch read (is_gray = %d)', frame_index, is_gray);
+  end
+  delete(reader);
+
+  for frame_index = 1:frame_count
+    if is_gray
+      frame_ssim = ssim(readback_frames(:,:,frame_index), frames(:,:,frame_index));
+    else
+      frame_ssim = ssim(readback_frames(:,:,:,frame_index), frames(:,:,:,frame_index));
+    end
+    assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low: %.4f (is_gray = %d)', frame_index, frame_ssim, is_gray);
+  end
+end
+
+% Segments and the pipeline are separate modes
+try
+  h265.Writer(fullfile(temp_dir, 'bad.mp4'), width, height, frame_rate, 'do_pipeline', true, 'segment_encoder_count', 2);
+  error('test_segment_write:noError', 'do_pipeline with segment_encoder_count > 1 should be rejected');
+catch err
+  assert(strcmp(err.identifier, 'Writer:badOption'), 'Unexpected error: %s', err.message);
+end
+
+end
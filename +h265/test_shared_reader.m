@@ -0,0 +1,85 @@
+function test_shared_reader()
+% TEST_SHARED_READER Test Readers sharing an index and pooled decoders
+%   Opens several do_share Readers of one video, checks that all but the
+%   first share the first one's index, that Readers opened after others were
+%   closed (reusing their decoders, with the same or different settings) read
+%   the same frames, and that a rewritten file is indexed again rather than
+%   reusing the stale entry.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 160;
+height = 128;
+frame_count = 50;
+short_frame_count = 20;
+frame_rate = 30;  % Hz
+gop_size = 10;
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+reader_count = 6;  % More than the registry keeps idle
+
+frames = zeros(height, width, 3, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 4));
+end
+
+video_file_name = fullfile(temp_dir, 'test_shared_reader.mp4');
+writer = h265.Writer(video_file_name, width, height, frame_rate, 'gop_size', gop_size);
+writer.write(frames);
+delete(writer);
+
+% The first do_share Reader builds the index, the others share it
+readers = cell(1, reader_count);
+for reader_index = 1:reader_count
+  readers{reader_index} = h265.Reader(video_file_name, 'do_share', true);
+  is_shared = strcmp(readers{reader_index}.index_source, 'shared');
+  assert(is_shared == (reader_index > 1), 'Reader %d index_source is %s', ...
+    reader_index, readers{reader_index}.index_source);
+end
+expected_frames = readers{1}.read(1, frame_count);
+for frame_index = 1:frame_count
+  frame_ssim = ssim(expected_frames(:,:,:,frame_index), frames(:,:,:,frame_index));
+  assert(frame_ssim >= min_ssim, 'SSIM of frame %d too low: %.4f', frame_index, frame_ssim);
+end
+for reader_index = 2:reader_count
+  reader = readers{reader_index};
+  assert(reader.num_frames == frame_count, 'Shared frame count mismatch');
+  assert(isequal(reader.keyframes, readers{1}.keyframes), 'Shared keyframes mismatch');
+  frame_index = 1 + mod(7 * reader_index, frame_count);
+  assert(isequal(reader.read(frame_index), expected_frames(:,:,:,frame_index)), ...
+    'Reader %d read frame %d wrong', reader_index, frame_index);
+end
+
+% Readers that do not ask to share are unaffected
+private_reader = h265.Reader(video_file_name);
+assert(~strcmp(private_reader.index_source, 'shared'), 'Reader without do_share must not share');
+delete(private_reader);
+
+% Closed Readers leave their decoders part way through the file; new Readers
+% that take them over must still read from the start
+for reader_index = 1:reader_count
+  delete(readers{reader_index});
+end
+for thread_count = [1, 2]
+  reused_reader = h265.Reader(video_file_name, 'do_share', true, 'thread_count', thread_count);
+  assert(strcmp(reused_reader.index_source, 'shared'), 'Index should outlive the closed Readers');
+  assert(isequal(reused_reader.read(1, frame_count), expected_frames), ...
+    'Reader reopened with thread_count %d read wrong frames', thread_count);
+  assert(isequal(reused_reader.read(gop_size + 3), expected_frames(:,:,:,gop_size + 3)), ...
+    'Reader reopened with thread_count %d read wrong single frame', thread_count);
+  delete(reused_reader);
+end
+
+% A rewritten file is indexed afresh
+writer = h265.Writer(video_file_name, width, height, frame_rate, 'gop_size', gop_size);
+writer.write(frames(:,:,:,1:short_frame_count));
+delete(writer);
+rewritten_reader = h265.Reader(video_file_name, 'do_share', true);
+assert(~strcmp(rewritten_reader.index_source, 'shared'), 'Stale registry entry was reused');
+assert(rewritten_reader.num_frames == short_frame_count, 'Frame count after rewrite mismatch');
+delete(rewritten_reader);
+
+end
@@ -0,0 +1,132 @@
+function test_stats()
+% TEST_STATS Test the timing and counters of h265.Reader/stats and h265.Writer/stats
+%   Writes a video with each kind of Writer (plain, pipelined, and
+%   segment-parallel) and checks the frame, packet, and byte counts of
+%   Writer.stats, then checks the counts of Reader.stats after cache misses
+%   and hits, prefetch hits, evictions, and batch and list reads, counting
+%   the decoding of the prefetch thread and of parallel read workers.  Also
+%   checks that reset_stats zeroes everything and that stats stay zero
+%   without do_collect_stats.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 64;
+height = 48;
+frame_count = 120;  % enough for two parallel read workers
+frame_rate = 30;  % Hz
+gop_size = 10;
+
+frames = zeros(height, width, 3, frame_count, 'uint8');
+for frame_index = 1:frame_count
+  frames(:,:,:,frame_index) = uint8(imgaussfilt(255 * rand(height, width, 3), 2));
+end
+
+% Writers: every frame converted, packets muxed once the frames are done
+writer_options = {{}, {'do_pipeline', true}, {'segment_encoder_count', 2}};
+for option_index = 1:length(writer_options)
+  video_file_name = fullfile(temp_dir, sprintf('test_stats_%d.mp4', option_index));
+  writer = h265.Writer(video_file_name, width, height, frame_rate, 'gop_size', gop_size, ...
+                       'do_collect_stats', true, writer_options{option_index}{:});
+  assert(writer.do_collect_stats, 'do_collect_stats property mismatch');
+  writer.write(frames);
+  writer.wait();
+  stats = writer.stats();
+  assert(stats.frame_count == frame_count, 'Writer %d converted %d of %d frames', ...
+         option_index, stats.frame_count, frame_count);
+  assert(stats.packet_count > 0 && stats.packet_bytes > 0, 'Writer %d muxed no packets', option_index);
+  assert(stats.convert_time > 0 && stats.send_frame_time > 0, 'Writer %d has no times', option_index);
+  writer.reset_stats();
+  check_all_zero(writer.stats(), sprintf('Writer %d after reset_stats', option_index));
+  delete(writer);
+end
+
+% Writer without do_collect_stats
+writer = h265.Writer(fullfile(temp_dir, 'test_stats_off.mp4'), width, height, frame_rate, 'gop_size', gop_size);
+writer.write(frames);
+check_all_zero(writer.stats(), 'Writer without do_collect_stats');
+delete(writer);
+
+video_file_name = fullfile(temp_dir, 'test_stats_1.mp4');
+
+% Reader: a cache miss decodes and converts the whole GOP
+reader = h265.Reader(video_file_name, 'do_collect_stats', true);
+assert(reader.do_collect_stats, 'do_collect_stats property mismatch');
+reader.read(1);
+stats = reader.stats();
+assert(stats.cache_miss_count == 1 && stats.cache_hit_count == 0, 'First read should be a cache miss');
+assert(stats.seek_count + stats.forward_count == 1, 'First read should seek once');
+assert(stats.converted_frame_count == gop_size, 'Cache miss converted %d frames', stats.converted_frame_count);
+assert(stats.decoded_frame_count >= stats.converted_frame_count, 'Fewer frames decoded than converted');
+assert(stats.packet_count >= stats.decoded_frame_count, 'Fewer packets read than frames decoded');
+assert(stats.returned_frame_count == 1, 'One frame should be returned');
+assert(stats.receive_frame_time > 0, 'Decoding was not timed');
+
+% A cache hit decodes nothing
+reader.read(5);
+stats = reader.stats();
+assert(stats.cache_hit_count == 1 && stats.converted_frame_count == gop_size, 'Second read should be a cache hit');
+
+% Batch and list reads count the frames they return
+reader.read(1, frame_count);
+reader.read_frames([33, 3, 33]);
+stats = reader.stats();
+assert(stats.returned_frame_count == 2 + frame_count + 3, 'Returned %d frames', stats.returned_frame_count);
+assert(stats.discarded_frame_count == stats.decoded_frame_count - stats.converted_frame_count, ...
+       'discarded_frame_count mismatch');
+
+reader.reset_stats();
+check_all_zero(reader.stats(), 'Reader after reset_stats');
+delete(reader);
+
+% Every new GOP evicts the last one when the cache holds only one
+reader = h265.Reader(video_file_name, 'do_collect_stats', true, 'cache_mb', 0);
+for frame_index = [1, 15, 25, 26]
+  reader.read(frame_index);
+end
+stats = reader.stats();
+assert(stats.cache_miss_count == 3 && stats.cache_hit_count == 1, 'Unexpected cache hits and misses');
+assert(stats.cache_evict_count == 2, 'Evicted %d GOPs', stats.cache_evict_count);
+delete(reader);
+
+% The GOP after a read is taken from the prefetch thread
+reader = h265.Reader(video_file_name, 'do_collect_stats', true, 'do_prefetch', true);
+reader.read(1);
+reader.read(gop_size + 1);
+stats = reader.stats();
+assert(stats.cache_miss_count == 1 && stats.prefetch_hit_count == 1, 'Second GOP should be a prefetch hit');
+assert(stats.converted_frame_count == 2 * gop_size, 'Prefetched GOP not counted: converted %d frames', ...
+       stats.converted_frame_count);
+delete(reader);
+
+% A parallel batch read counts the decoding of its workers
+reader = h265.Reader(video_file_name, 'do_collect_stats', true, 'worker_count', 2);
+reader.read(1, frame_count);
+stats = reader.stats();
+assert(stats.converted_frame_count == frame_count && stats.returned_frame_count == frame_count, ...
+       'Parallel read converted %d and returned %d of %d frames', ...
+       stats.converted_frame_count, stats.returned_frame_count, frame_count);
+delete(reader);
+
+% Reader without do_collect_stats
+reader = h265.Reader(video_file_name);
+reader.read(1);
+reader.read(1, 20);
+check_all_zero(reader.stats(), 'Reader without do_collect_stats');
+delete(reader);
+
+end % function
+
+
+
+function check_all_zero(stats, description)
+% Check that every count and time in stats is zero
+field_names = fieldnames(stats);
+for field_index = 1:length(field_names)
+  value = stats.(field_names{field_index});
+  assert(value == 0, '%s: %s is %g', description, field_names{field_index}, value);
+end
+end % function
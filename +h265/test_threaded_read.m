@@ -0,0 +1,68 @@
+function test_threaded_read()
+% TEST_THREADED_READ Test that multithreaded decoding returns the same frames
+%   Writes a multi-GOP video, then reads it back with a single-threaded reader
+%   and with frame- and slice-threaded readers.  Batch reads and random
+%   single-frame reads (which go through the GOP cache) must match exactly.
+%   Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 128;
+height = 96;
+frame_count = 120;
+frame_rate = 30;  % Hz
+gop_size = 25;
+output_file_name = fullfile(temp_dir, 'test_threaded.mp4');
+
+% Write an RGB video with several GOPs
+raw_frames = randi([0 255], height, width, 3, frame_count);
+original_frames = uint8(imgaussfilt(double(raw_frames), 3));
+writer = h265.Writer(output_file_name, width, height, frame_rate, 'gop_size', gop_size);
+writer.write(original_frames);
+delete(writer);
+
+% Reference: single-threaded decode
+reference_reader = h265.Reader(output_file_name, 'thread_count', 1);
+reference_frames = reference_reader.read(1, frame_count);
+delete(reference_reader);
+
+thread_types = {'frame', 'slice', 'both'};
+for type_index = 1:numel(thread_types)
+  thread_type = thread_types{type_index};
+  reader = h265.Reader(output_file_name, 'thread_count', 4, 'thread_type', thread_type);
+  assert(reader.thread_count == 4, 'Reader thread_count mismatch');
+  assert(strcmp(reader.thread_type, thread_type), 'Reader thread_type mismatch');
+
+  % Batch read across all GOPs
+  batch_frames = reader.read(1, frame_count);
+  if ~isequal(batch_frames, reference_frames)
+    error('test_threaded_read:batchRead', ...
+          'Batch read with %s threading does not match single-threaded read', thread_type);
+  end
+
+  % Range starting and ending mid-GOP
+  range_frames = reader.read(gop_size - 3, 2 * gop_size + 3);
+  if ~isequal(range_frames, reference_frames(:,:,:,gop_size-3:2*gop_size+3))
+    error('test_threaded_read:rangeRead', ...
+          'Mid-GOP range read with %s threading does not match', thread_type);
+  end
+
+  % Random single-frame reads exercise the GOP cache fill
+  random_indices = randi(frame_count, 40, 1);
+  for i = 1:numel(random_indices)
+    frame_index = random_indices(i);
+    frame = reader.read(frame_index);
+    if ~isequal(frame, reference_frames(:,:,:,frame_index))
+      error('test_threaded_read:randomRead', ...
+            'Single read of frame %d with %s threading does not match', frame_index, thread_type);
+    end
+  end
+
+  delete(reader);
+end
+
+end
@@ -0,0 +1,222 @@
+function test_ufmf_transcode()
+% TEST_UFMF_TRANSCODE Test native UFMF reading and transcoding to h.265
+%   Writes small non-square UFMF files (MONO8 with uint8 means, RGB24 with
+%   float means), each with two means and foreground boxes that run past the
+%   frame edge, then checks that read_ufmf_frame reproduces every frame
+%   exactly and matches toolbox/ufmf_read_frame.m (MONO8), that from_ufmf produces a
+%   video whose frames survive compression, and that mismatched writers and
+%   non-UFMF files are rejected.  Throws error on failure.
+
+% Create temp directory and ensure cleanup on exit (normal or error)
+temp_dir = tempname();
+mkdir(temp_dir);
+cleanup = onCleanup(@() rmdir(temp_dir, 's'));
+
+% Parameters
+width = 72;
+height = 40;
+frame_count = 60;
+frame_rate = 30;  % Hz
+min_ssim = 0.8;  % Threshold for filtered data with lossy compression
+
+for is_color = [false, true]
+  color_count = 1 + 2 * is_color;
+  ufmf_file_name = fullfile(temp_dir, sprintf('test_ufmf_transcode_%d.ufmf', is_color));
+  expected_frames = write_test_ufmf(ufmf_file_name, width, height, color_count, frame_count, frame_rate);
+
+  % Native reads match the frames that were written, and the MATLAB reader
+  ufmf = h265.open_ufmf(ufmf_file_name);
+  ufmf_cleanup = onCleanup(@() h265.close_ufmf(ufmf));
+  assert(ufmf.width == width && ufmf.height == height, 'Frame size mismatch (is_color = %d)', is_color);
+  assert(ufmf.is_color == is_color, 'is_color mismatch');
+  assert(ufmf.frame_count == frame_count, 'Frame count mismatch (is_color = %d)', is_color);
+  for frame_index = [1:frame_count, frame_count:-1:1]
+    [frame, timestamp] = h265.read_ufmf_frame(ufmf, frame_index);
+    assert(isequal(frame, expected_frames{frame_index}), ...
+      'Frame %d does not match the written frame (is_color = %d)', frame_index, is_color);
+    assert(timestamp == (frame_index - 1) / frame_rate, 'Timestamp mismatch at frame %d', frame_index);
+  end
+
+  % ufmf_read_mean.m only reads MONO8, and ufmf_read_frame.m grows the frame
+  % to fit boxes past its edge rather than clipping them
+  if ~is_color
+    header = ufmf_read_header(ufmf_file_name);
+    header_cleanup = onCleanup(@() fclose(header.fid));
+    for frame_index = 1:frame_count
+      matlab_frame = ufmf_read_frame(header, frame_index);
+      assert(isequal(h265.read_ufmf_frame(ufmf, frame_index), matlab_frame(1:height, 1:width)), ...
+        'Frame %d does not match ufmf_read_frame', frame_index);
+    end
+    clear header_cleanup;
+  end
+
+  % A writer of the wrong color mode is rejected
+  wrong_file_name = fullfile(temp_dir, 'test_ufmf_transcode_wrong.mp4');
+  wrong_writer = h265.Writer(wrong_file_name, width, height, frame_rate, 'is_gray', is_color);
+  try
+    wrong_writer.write_ufmf(ufmf, 1, 1);
+    error('test_ufmf_transcode:noError', 'Expected an error for a writer of the wrong color mode');
+  catch err
+    assert(strcmp(err.identifier, 'Writer:badColor'), 'Unexpected error: %s', err.identifier);
+  end
+  delete(wrong_writer);
+  clear ufmf_cleanup;
+
+  % Transcode, in blocks that do not line up with the GOPs
+  video_file_name = fullfile(temp_dir, sprintf('test_ufmf_transcode_%d.mp4', is_color));
+  h265.from_ufmf(video_file_name, ufmf_file_name, 'block_size', 23);
+  reader = h265.Reader(video_file_name, 'is_gray', ~is_color);
+  assert(reader.num_frames == frame_count, 'Transcoded frame count mismatch (is_color = %d)', is_color);
+  assert(reader.width == width && reader.height == height, 'Transcoded frame size mismatch');
+  readback_frames = reader.read(1, frame_count);
+  delete(reader);
+  for frame_index = 1:frame_count
+    if is_color
+      frame_ssim = ssim(readback_frames(:,:,:,frame_index), expected_frames{frame_index});
+    else
+      frame_ssim = ssim(readback_frames(:,:,frame_index), expected_frames{frame_index});
+    end
+    assert(frame_ssim > min_ssim, 'Transcoded frame %d SSIM %.3f below %.3f (is_color = %d)', ...
+      frame_index, frame_ssim, min_ssim, is_color);
+  end
+end
+
+% A file that is not UFMF is rejected
+not_ufmf_file_name = fullfile(temp_dir, 'not_ufmf.ufmf');
+file_id = fopen(not_ufmf_file_name, 'w');
+fwrite(file_id, 'this is not a ufmf file', 'char');
+fclose(file_id);
+try
+  h265.open_ufmf(not_ufmf_file_name);
+  error('test_ufmf_transcode:noError', 'Expected an error for a non-UFMF file');
+catch err
+  assert(strcmp(err.identifier, 'h265_ufmf:badHeader'), 'Unexpected error: %s', err.identifier);
+end
+
+end % function
+
+
+
+function frames = write_test_ufmf(file_name, width, height, color_count, frame_count, frame_rate)
+% Write a version 4 UFMF file with two means, the second one for the second
+% half of the frames, and return its frames (height x width [x 3] uint8).
+% MONO8 files get uint8 means and RGB24 files float ones.  Each frame pastes
+% two smooth boxes onto its mean, the second one running past the bottom
+% right corner of the frame.
+
+file_id = fopen(file_name, 'w', 'ieee-le');
+file_cleanup = onCleanup(@() fclose(file_id));
+
+if color_count == 3
+  coding = 'RGB24';
+else
+  coding = 'MONO8';
+end
+fwrite(file_id, 'ufmf', 'char');
+fwrite(file_id, 4, 'uint32');
+index_location_location = ftell(file_id);
+fwrite(file_id, 0, 'uint64');
+fwrite(file_id, [8, 8], 'uint16');  % max box size
+fwrite(file_id, 0, 'uint8');  % not fixed-size boxes
+fwrite(file_id, length(coding), 'uint8');
+fwrite(file_id, coding, 'char');
+
+timestamps = (0:frame_count-1) / frame_rate;
+mean_timestamps = timestamps([1, floor(frame_count / 2) + 1]);
+mean_count = length(mean_timestamps);
+means = cell(1, mean_count);
+mean_locations = zeros(1, mean_count);
+for mean_index = 1:mean_count
+  mean_image = imgaussfilt(255 * rand(height, width, color_count), 3);
+  mean_locations(mean_index) = ftell(file_id);
+  fwrite(file_id, [0, 4], 'uint8');
+  fwrite(file_id, 'mean', 'char');
+  if color_count == 3
+    fwrite(file_id, 'f', 'char');
+  else
+    fwrite(file_id, 'B', 'char');
+    mean_image = uint8(mean_image);
+  end
+  fwrite(file_id, [width, height], 'uint16');
+  fwrite(file_id, mean_timestamps(mean_index), 'double');
+  % Color fastest, then x, then y
+  if color_count == 3
+    fwrite(file_id, permute(mean_image, [3, 2, 1]), 'single');
+  else
+    fwrite(file_id, permute(mean_image, [3, 2, 1]), 'uint8');
+  end
+  means{mean_index} = uint8(single(mean_image));
+end
+
+frames = cell(1, frame_count);
+frame_locations = zeros(1, frame_count);
+for frame_index = 1:frame_count
+  frame = means{1 + (timestamps(frame_index) >= mean_timestamps(2))};
+  box_x0 = [randi(width - 8) - 1, width - 3];
+  box_y0 = [randi(height - 8) - 1, height - 2];
+  box_width = [randi(8), 6];
+  box_height = [randi(8), 5];
+
+  frame_locations(frame_index) = ftell(file_id);
+  fwrite(file_id, 1, 'uint8');
+  fwrite(file_id, timestamps(frame_index), 'double');
+  fwrite(file_id, length(box_x0), 'uint32');
+  for box_index = 1:length(box_x0)
+    box = uint8(imgaussfilt(255 * rand(box_height(box_index), box_width(box_index), color_count), 1));
+    fwrite(file_id, [box_x0(box_index), box_y0(box_index), box_width(box_index), box_height(box_index)], 'uint16');
+    fwrite(file_id, permute(box, [3, 2, 1]), 'uint8');
+    rows = box_y0(box_index) + (1:box_height(box_index));
+    columns = box_x0(box_index) + (1:box_width(box_index));
+    is_row_inside = rows <= height;
+    is_column_inside = columns <= width;
+    frame(rows(is_row_inside), columns(is_column_inside), :) = box(is_row_inside, is_column_inside, :);
+  end
+  frames{frame_index} = frame;
+end
+
+% Index: {frame: {loc, timestamp}, keyframe: {mean: {loc, timestamp}}}
+index_location = ftell(file_id);
+fwrite(file_id, 'd', 'char');
+fwrite(file_id, 2, 'uint8');
+write_key(file_id, 'frame');
+fwrite(file_id, 'd', 'char');
+fwrite(file_id, 2, 'uint8');
+write_array(file_id, 'loc', 'Q', frame_locations);
+write_array(file_id, 'timestamp', 'd', timestamps);
+write_key(file_id, 'keyframe');
+fwrite(file_id, 'd', 'char');
+fwrite(file_id, 1, 'uint8');
+write_key(file_id, 'mean');
+fwrite(file_id, 'd', 'char');
+fwrite(file_id, 2, 'uint8');
+write_array(file_id, 'loc', 'Q', mean_locations);
+write_array(file_id, 'timestamp', 'd', mean_timestamps);
+
+fseek(file_id, index_location_location, 'bof');
+fwrite(file_id, index_location, 'uint64');
+end % function
+
+
+
+function write_key(file_id, key)
+fwrite(file_id, length(key), 'uint16');
+fwrite(file_id, key, 'char');
+end % function
+
+
+
+function write_array(file_id, key, dtype_char, values)
+write_key(file_id, key);
+fwrite(file_id, 'a', 'char');
+fwrite(file_id, dtype_char, 'char');
+switch dtype_char
+  case 'Q'
+    fwrite(file_id, 8 * numel(values), 'uint32');
+    fwrite(file_id, values, 'uint64');
+  case 'd'
+    fwrite(file_id, 8 * numel(values), 'uint32');
+    fwrite(file_id, values, 'double');
+  otherwise
+    error('write_array:badType', 'Unhandled dtype character %s', dtype_char);
+end
+end % function
@@ -0,0 +1,61 @@
+/*
+ * wait_h265_write.c
+ * MEX function to wait until a pipelined writer has encoded every frame
+ * passed to write_h265_frames so far.
+ *
+ * Usage: wait_h265_write(writer)
+ *   writer - struct returned by open_h265_write
+ *
+ * Afterwards every queued frame has been sent to the encoder and its packets
+ * muxed; the encoder may still hold frames internally until close_h265_write
+ * flushes it. For a segment-parallel writer, the partial segment is encoded
+ * now, which ends the current GOP early. Raises the first pipeline or segment
+ * error, if any. Returns immediately for other writers, since
+ * write_h265_frames then encodes before returning.
+ *
+ * Compile with:
+ *   mex wait_h265_write.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c -lavformat -lavcodec -lavutil -lswscale -lpthread
+ */
+
+#include "mex.h"
+#include <stdint.h>
+#include "h265_write_common.h"
+#include "h265_write_pipeline.h"
+#include "h265_segment_encoder.h"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    WriterState *state = NULL;
+
+    /* Check arguments */
+    if (nrhs != 1) {
+        mexErrMsgIdAndTxt("wait_h265_write:nrhs",
+            "One input required: writer struct");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("wait_h265_write:notStruct",
+            "Argument must be writer struct from open_h265_write");
+    }
+
+    mxArray *state_field = mxGetField(prhs[0], 0, "state_ptr");
+    if (!state_field) {
+        mexErrMsgIdAndTxt("wait_h265_write:badStruct",
+            "Writer struct is missing required fields");
+    }
+    state = (WriterState *)(uintptr_t)(*(uint64_t *)mxGetData(state_field));
+    if (!state) {
+        mexErrMsgIdAndTxt("wait_h265_write:nullPtr",
+            "Invalid writer: null pointers. Was close_h265_write already called?");
+    }
+
+    if (state->pipeline && h265_write_pipeline_wait(state->pipeline) != 0) {
+        mexErrMsgIdAndTxt("wait_h265_write:pipeline",
+            "%s", state->pipeline->error_message);
+    }
+    if (state->segments) {
+        if (h265_segment_encoder_flush(state->segments) != 0) {
+            mexErrMsgIdAndTxt("wait_h265_write:segment",
+                "%s", state->segments->error_message);
+        }
+    }
+}
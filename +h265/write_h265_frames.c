@@ -2,45 +2,62 @@
  * write_h265_frames.c
  * MEX function to write multiple frames to an h.265 video file.
  * Supports both grayscale (3D) and RGB (4D) input based on writer mode.
+ * Grayscale planes are transposed straight into the encoder frame; RGB planes
+ * are transposed into a planar GBRP frame that swscale converts to YUV420P.
  * Automatically increments PTS for each frame.
  *
+ * If the writer was opened with do_pipeline, the frames are copied into the
+ * writer's queue and conversion and encoding happen on worker threads; this
+ * returns once the last frame is queued, waiting only while the queue is full.
+ * If it was opened with segment_encoder_count > 1, the frames are collected
+ * into GOP-aligned segments that are encoded in parallel on worker threads.
+ *
  * Usage: write_h265_frames(writer, frames)
  *   writer - struct returned by open_h265_write
- *   frames - grayscale as uint8 (height x width x num_frames)
- *            or RGB as uint8 (height x width x 3 x num_frames)
+ *   frames - grayscale (height x width x num_frames)
+ *            or RGB (height x width x 3 x num_frames); uint8 for an 8-bit
+ *            writer, uint16 holding 0 to 2^bit_depth - 1 for a 10- or 12-bit one
  *
  * Compile with:
- *   mex write_h265_frames.c -lavformat -lavcodec -lavutil -lswscale
+ *   mex write_h265_frames.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c -lavformat -lavcodec -lavutil -lswscale -lpthread
  */
 
 #include "mex.h"
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
-#include <libavutil/imgutils.h>
 #include <stdint.h>
+#include "h265_write_common.h"
 
-/* Must match the struct in open_h265_write.c */
+/* The frames of the input array, back to back */
 typedef struct {
-    int64_t next_pts;
-    int64_t pts_increment;
-    int is_color;  /* 0 for grayscale, 1 for RGB */
-} WriterState;
+    const uint8_t *data;
+    size_t frame_size;
+} InputFrames;
+
+static const uint8_t *next_input_frame(void *source, int frame_index, const char **error_id,
+                                       char *error_message, size_t error_message_size)
+{
+    const InputFrames *input = (const InputFrames *)source;
+    return input->data + (size_t)frame_index * input->frame_size;
+}
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
     AVFormatContext *fmt_ctx = NULL;
     AVCodecContext *codec_ctx = NULL;
     AVFrame *frame = NULL;
-    AVPacket *pkt = NULL;
     WriterState *state = NULL;
     struct SwsContext *sws_ctx = NULL;
-    int ret;
     int width, height;
     int stream_idx;
     int is_color;
+    int bit_depth;
     int num_frames;
 
+    /* close_h265_write dropping the lock taken for a segment encoder */
+    if (h265_mex_handle_unlock(nrhs, prhs)) return;
+
     /* Check arguments */
     if (nrhs != 2) {
         mexErrMsgIdAndTxt("write_h265_frames:nrhs",
@@ -50,10 +67,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         mexErrMsgIdAndTxt("write_h265_frames:notStruct",
             "First argument must be writer struct from open_h265_write");
     }
-    if (!mxIsUint8(prhs[1])) {
-        mexErrMsgIdAndTxt("write_h265_frames:notUint8",
-            "Frames must be a uint8 array");
-    }
     mwSize ndims = mxGetNumberOfDimensions(prhs[1]);
     /* MATLAB drops trailing singleton dimensions, so:
      * - Grayscale single frame: 2D (height x width)
@@ -99,6 +112,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             "Invalid writer: null pointers. Was close_ffmpeg_write already called?");
     }
 
+    /* 8-bit writers take uint8, 10- and 12-bit writers uint16 */
+    bit_depth = state->bit_depth;
+    if (bit_depth > 8 ? !mxIsUint16(prhs[1]) : !mxIsUint8(prhs[1])) {
+        mexErrMsgIdAndTxt("write_h265_frames:badType",
+            "Frames must be a %s array for a %d-bit writer",
+            bit_depth > 8 ? "uint16" : "uint8", bit_depth);
+    }
+
     /* Check frame dimensions based on color mode */
     const mwSize *dims = mxGetDimensions(prhs[1]);
     if (is_color) {
@@ -147,115 +168,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
 
     /* Get input data */
-    uint8_t *in_data = (uint8_t *)mxGetData(prhs[1]);
-
-    /* Allocate packet once for all frames */
-    pkt = av_packet_alloc();
-    if (!pkt) {
-        mexErrMsgIdAndTxt("write_h265_frames:allocPacket",
-            "Could not allocate packet");
-    }
-
-    /* Allocate conversion buffer once */
-    uint8_t *conv_buffer = NULL;
-    if (is_color) {
-        conv_buffer = (uint8_t *)mxMalloc(height * width * 3);
-    } else {
-        conv_buffer = (uint8_t *)mxMalloc(height * width);
-    }
-    if (!conv_buffer) {
-        av_packet_free(&pkt);
-        mexErrMsgIdAndTxt("write_h265_frames:allocBuffer",
-            "Could not allocate conversion buffer");
-    }
-
-    /* Process each frame */
-    size_t frame_size = is_color ? (size_t)height * width * 3 : (size_t)height * width;
-    size_t plane_size = (size_t)height * width;
-
-    for (int f = 0; f < num_frames; f++) {
-        /* Make frame writable */
-        ret = av_frame_make_writable(frame);
-        if (ret < 0) {
-            mxFree(conv_buffer);
-            av_packet_free(&pkt);
-            mexErrMsgIdAndTxt("write_h265_frames:makeWritable",
-                "Could not make frame writable");
-        }
-
-        /* Get pointer to this frame's data */
-        uint8_t *frame_data = in_data + f * frame_size;
-
-        if (is_color) {
-            /* RGB mode: convert from MATLAB column-major RGB to row-major RGB24, then to YUV420P */
-            /* Convert from MATLAB (height x width x 3, column-major) to RGB24 (row-major, interleaved) */
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    int matlab_idx = x * height + y;  /* Column-major index for each plane */
-                    int rgb_idx = (y * width + x) * 3;  /* Row-major interleaved RGB */
-                    conv_buffer[rgb_idx + 0] = frame_data[matlab_idx];                  /* R */
-                    conv_buffer[rgb_idx + 1] = frame_data[matlab_idx + plane_size];     /* G */
-                    conv_buffer[rgb_idx + 2] = frame_data[matlab_idx + 2 * plane_size]; /* B */
-                }
-            }
-
-            /* Convert RGB24 to YUV420P using swscale */
-            uint8_t *src_data[1] = {conv_buffer};
-            int src_linesize[1] = {width * 3};
-            sws_scale(sws_ctx, (const uint8_t * const*)src_data, src_linesize,
-                      0, height, frame->data, frame->linesize);
-        } else {
-            /* Grayscale mode: convert from MATLAB column-major to row-major GRAY8 */
-            /* Copy directly to frame buffer, handling linesize padding */
-            for (int y = 0; y < height; y++) {
-                uint8_t *dst_row = frame->data[0] + y * frame->linesize[0];
-                for (int x = 0; x < width; x++) {
-                    dst_row[x] = frame_data[x * height + y];
-                }
-            }
-        }
-
-        /* Set PTS and increment for next frame */
-        frame->pts = state->next_pts;
-        state->next_pts += state->pts_increment;
-
-        /* Send frame to encoder */
-        ret = avcodec_send_frame(codec_ctx, frame);
-        if (ret < 0) {
-            mxFree(conv_buffer);
-            av_packet_free(&pkt);
-            mexErrMsgIdAndTxt("write_h265_frames:sendFrame",
-                "Error sending frame %d to encoder", f + 1);
-        }
-
-        /* Receive and write encoded packets */
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codec_ctx, pkt);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                mxFree(conv_buffer);
-                av_packet_free(&pkt);
-                mexErrMsgIdAndTxt("write_h265_frames:receivePacket",
-                    "Error receiving packet from encoder at frame %d", f + 1);
-            }
-
-            /* Rescale timestamps */
-            av_packet_rescale_ts(pkt, codec_ctx->time_base,
-                                 fmt_ctx->streams[stream_idx]->time_base);
-            pkt->stream_index = stream_idx;
-
-            /* Write packet */
-            ret = av_interleaved_write_frame(fmt_ctx, pkt);
-            if (ret < 0) {
-                mxFree(conv_buffer);
-                av_packet_free(&pkt);
-                mexErrMsgIdAndTxt("write_h265_frames:writeFrame",
-                    "Error writing packet to file at frame %d", f + 1);
-            }
-        }
-    }
+    InputFrames input;
+    input.data = (const uint8_t *)mxGetData(prhs[1]);
+    input.frame_size = (is_color ? (size_t)height * width * 3 : (size_t)height * width) *
+        h265_bytes_per_sample(bit_depth);
 
-    mxFree(conv_buffer);
-    av_packet_free(&pkt);
+    h265_writer_add_frames(state, fmt_ctx, codec_ctx, stream_idx, frame, sws_ctx, width, height,
+                           num_frames, next_input_frame, &input, "h265.write_h265_frames");
 }
@@ -0,0 +1,155 @@
+/*
+ * write_ufmf_frames.c
+ * MEX function to transcode frames of a UFMF file into an h.265 writer.
+ * Each frame is decoded natively (see h265_ufmf.h) into one reused buffer
+ * and handed straight to the writer, so no MATLAB arrays are built and the
+ * interpreted ufmf_read_frame is never called. Frames take the same path as
+ * in write_h265_frames: with do_pipeline they are queued for the converter
+ * and encoder threads, so decoding the next frame overlaps with encoding;
+ * with segment_encoder_count > 1 they are collected into GOP-aligned
+ * segments encoded in parallel; otherwise they are converted and encoded
+ * here. Automatically increments PTS for each frame.
+ *
+ * Usage: write_ufmf_frames(writer, ufmf, first_frame, last_frame)
+ *   writer      - struct returned by open_h265_write, 8-bit, grayscale for a
+ *                 MONO8 file or RGB for an RGB24 one, with the file's size
+ *   ufmf        - struct returned by open_ufmf
+ *   first_frame - 1-based index of the first frame to write
+ *   last_frame  - 1-based index of the last frame to write
+ *
+ * Compile with:
+ *   mex write_ufmf_frames.c h265_ufmf.c h265_write_common.c h265_write_pipeline.c h265_segment_encoder.c h265_transpose.c -lavformat -lavcodec -lavutil -lswscale -lpthread
+ */
+
+#include "mex.h"
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <stdint.h>
+#include "h265_ufmf.h"
+#include "h265_write_common.h"
+
+/* The frames of a UFMF file from first_frame on, each decoded into frame_data */
+typedef struct {
+    H265Ufmf *ufmf;
+    int first_frame;
+    uint8_t *frame_data;
+} UfmfFrames;
+
+static const uint8_t *next_ufmf_frame(void *source, int frame_index, const char **error_id,
+                                      char *error_message, size_t error_message_size)
+{
+    UfmfFrames *frames = (UfmfFrames *)source;
+    if (!h265_ufmf_read_frame(frames->ufmf, frames->first_frame + frame_index, frames->frame_data,
+                              error_id, error_message, error_message_size)) {
+        return NULL;
+    }
+    return frames->frame_data;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    AVFrame *frame = NULL;
+    WriterState *state = NULL;
+    struct SwsContext *sws_ctx = NULL;
+    int width, height;
+    int stream_idx;
+    int is_color;
+
+    /* close_h265_write dropping the lock taken for a segment encoder */
+    if (h265_mex_handle_unlock(nrhs, prhs)) return;
+
+    /* Check arguments */
+    if (nrhs != 4) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:nrhs",
+            "Four inputs required: writer, ufmf, first_frame, and last_frame");
+    }
+    if (!mxIsStruct(prhs[0])) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:notStruct",
+            "First argument must be writer struct from open_h265_write");
+    }
+    if (!mxIsStruct(prhs[1])) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:notStruct",
+            "Second argument must be ufmf struct from open_ufmf");
+    }
+
+    /* Extract fields from writer struct */
+    mxArray *width_field = mxGetField(prhs[0], 0, "width");
+    mxArray *height_field = mxGetField(prhs[0], 0, "height");
+    mxArray *fmt_ctx_field = mxGetField(prhs[0], 0, "fmt_ctx_ptr");
+    mxArray *codec_ctx_field = mxGetField(prhs[0], 0, "codec_ctx_ptr");
+    mxArray *frame_field = mxGetField(prhs[0], 0, "frame_ptr");
+    mxArray *state_field = mxGetField(prhs[0], 0, "state_ptr");
+    mxArray *stream_idx_field = mxGetField(prhs[0], 0, "stream_idx");
+    mxArray *sws_ctx_field = mxGetField(prhs[0], 0, "sws_ctx_ptr");
+    mxArray *is_color_field = mxGetField(prhs[0], 0, "is_color");
+    mxArray *ufmf_field = mxGetField(prhs[1], 0, "ufmf_ptr");
+
+    if (!width_field || !height_field || !fmt_ctx_field || !codec_ctx_field ||
+        !frame_field || !state_field || !stream_idx_field || !sws_ctx_field || !is_color_field) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:badStruct",
+            "Writer struct is missing required fields");
+    }
+    if (!ufmf_field) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:badStruct",
+            "ufmf struct must have a ufmf_ptr field");
+    }
+
+    width = (int)mxGetScalar(width_field);
+    height = (int)mxGetScalar(height_field);
+    fmt_ctx = (AVFormatContext *)(uintptr_t)(*(uint64_t *)mxGetData(fmt_ctx_field));
+    codec_ctx = (AVCodecContext *)(uintptr_t)(*(uint64_t *)mxGetData(codec_ctx_field));
+    frame = (AVFrame *)(uintptr_t)(*(uint64_t *)mxGetData(frame_field));
+    state = (WriterState *)(uintptr_t)(*(uint64_t *)mxGetData(state_field));
+    stream_idx = (int)mxGetScalar(stream_idx_field);
+    sws_ctx = (struct SwsContext *)(uintptr_t)(*(uint64_t *)mxGetData(sws_ctx_field));
+    is_color = (int)mxGetScalar(is_color_field);
+    H265Ufmf *ufmf = (H265Ufmf *)(uintptr_t)(*(uint64_t *)mxGetData(ufmf_field));
+
+    /* Validate pointers */
+    if (!fmt_ctx || !codec_ctx || !frame || !state) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:nullPtr",
+            "Invalid writer: null pointers. Was close_h265_write already called?");
+    }
+    if (!ufmf) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:nullPtr", "Invalid ufmf: null pointer");
+    }
+
+    /* UFMF frames are 8-bit and must match the writer */
+    if (state->bit_depth != 8) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:badType",
+            "UFMF frames are 8-bit, but the writer is %d-bit", state->bit_depth);
+    }
+    if ((ufmf->color_count == 3) != (is_color != 0)) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:badColor",
+            "The UFMF file is %s, but the writer is %s",
+            ufmf->color_count == 3 ? "RGB" : "grayscale", is_color ? "RGB" : "grayscale");
+    }
+    if (ufmf->width != width || ufmf->height != height) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:badDimensions",
+            "UFMF frame dimensions (%d x %d) don't match writer (%d x %d)",
+            ufmf->height, ufmf->width, height, width);
+    }
+
+    int first_frame = (int)mxGetScalar(prhs[2]) - 1;
+    int last_frame = (int)mxGetScalar(prhs[3]) - 1;
+    if (first_frame < 0 || last_frame >= ufmf->frame_count || first_frame > last_frame) {
+        mexErrMsgIdAndTxt("write_ufmf_frames:outOfRange",
+            "Frame range [%d, %d] is empty or outside [1, %d]",
+            first_frame + 1, last_frame + 1, ufmf->frame_count);
+    }
+
+    /* One frame, decoded into over and over; every path copies or converts
+     * it before the next frame is decoded */
+    UfmfFrames source;
+    source.ufmf = ufmf;
+    source.first_frame = first_frame;
+    source.frame_data = (uint8_t *)mxMalloc(h265_ufmf_frame_size(ufmf));
+
+    h265_writer_add_frames(state, fmt_ctx, codec_ctx, stream_idx, frame, sws_ctx, width, height,
+                           last_frame - first_frame + 1, next_ufmf_frame, &source,
+                           "h265.write_ufmf_frames");
+    mxFree(source.frame_data);
+}